@@ -133,7 +133,7 @@ void main()
     /* Ambient */
     float kD = 1.0 - material.metallic;
     vec3 sunColor; // ignored
-    vec3 irradiance = sampleSky(N);
+    vec3 irradiance = sampleIrradiance(N);
     vec3 diffuse = irradiance * albedo;
     
     //vec3 V = normalize(uCamera.position - fragpos);
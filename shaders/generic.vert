@@ -5,6 +5,7 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoords;
 layout (location = 2) in vec3 aNormal;
+layout (location = 3) in mat4 aModel; // Per instance
 
 out VS_OUT
 {
@@ -14,10 +15,11 @@ out VS_OUT
 } vs_out;
 
 uniform mat4 uModel;
+uniform bool uInstanced; // Model from aModel instead of uModel
 
 void main()
 {
-    mat4 modelView = uCamera.view * uModel;
+    mat4 modelView = uCamera.view * (uInstanced ? aModel : uModel);
     vec4 viewPos = modelView * vec4(aPos, 1.0);
 
     vs_out.FragPos = viewPos.xyz;
@@ -22,6 +22,10 @@ layout (std140) uniform Atmosphere
     vec3 fogColor;
 
     float g; // Mie scattering phase function
+
+    float eyeHeight; // Quantized camera height the sky cubemap is rendered from
+
+    vec4 irradianceSH[9]; // Diffuse irradiance, spherical harmonics
 } uAtmosphere;
 
 uniform samplerCube uSkybox;
@@ -79,3 +83,18 @@ vec3 sampleIrradiance(vec3 R)
 {
     return texture(uIrradiance, R).rgb;
 }
+
+// Evaluate the irradiance directly from the spherical harmonics
+vec3 evalIrradianceSH(vec3 N)
+{
+    vec3 E = uAtmosphere.irradianceSH[0].rgb * 0.282095;
+    E += uAtmosphere.irradianceSH[1].rgb * 0.488603 * N.y;
+    E += uAtmosphere.irradianceSH[2].rgb * 0.488603 * N.z;
+    E += uAtmosphere.irradianceSH[3].rgb * 0.488603 * N.x;
+    E += uAtmosphere.irradianceSH[4].rgb * 1.092548 * N.x * N.y;
+    E += uAtmosphere.irradianceSH[5].rgb * 1.092548 * N.y * N.z;
+    E += uAtmosphere.irradianceSH[6].rgb * 0.315392 * (3.0 * N.z * N.z - 1.0);
+    E += uAtmosphere.irradianceSH[7].rgb * 1.092548 * N.x * N.z;
+    E += uAtmosphere.irradianceSH[8].rgb * 0.546274 * (N.x * N.x - N.y * N.y);
+    return max(E, vec3(0.0));
+}
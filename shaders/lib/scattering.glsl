@@ -0,0 +1,50 @@
+// Precomputed atmosphere tables, see src/atmosphere.cpp
+
+uniform sampler2D uTransmittanceLUT;
+uniform sampler2D uMultiScatteringLUT;
+
+// Sea level scattering coefficients, must match src/atmosphere.cpp
+const vec3 kRayleighScattering = vec3(5.8e-6, 13.0e-6, 22.4e-6);
+const float kMieScattering = 21e-6;
+
+float rayleighPhase(float mu)
+{
+    return 3.0 / (16.0 * 3.141592) * (1.0 + mu * mu);
+}
+
+float miePhase(float mu, float g)
+{
+    float gg = g * g;
+    return 3.0 / (8.0 * 3.141592) * ((1.0 - gg) * (mu * mu + 1.0)) / (pow(1.0 + gg - 2.0 * mu * g, 1.5) * (2.0 + gg));
+}
+
+// Transmittance from radius r along view zenith cosine mu to space
+vec3 sampleTransmittance(float r, float mu)
+{
+    float Rg = uAtmosphere.planetRadius;
+    float Rt = uAtmosphere.atmosphereRadius;
+
+    float dg = r * r * (mu * mu - 1.0) + Rg * Rg;
+    if (mu < 0.0 && dg >= 0.0)
+        return vec3(0.0); // Ray hits the ground
+
+    float H = sqrt(Rt * Rt - Rg * Rg);
+    float rho = sqrt(max(r * r - Rg * Rg, 0.0));
+
+    float d = max(-r * mu + sqrt(max(r * r * (mu * mu - 1.0) + Rt * Rt, 0.0)), 0.0);
+    float dMin = Rt - r;
+    float dMax = rho + H;
+
+    vec2 uv = vec2((d - dMin) / (dMax - dMin), rho / H);
+    return texture(uTransmittanceLUT, uv).rgb;
+}
+
+// Multiple scattering transfer at radius r with sun zenith cosine muS
+vec3 sampleMultiScattering(float r, float muS)
+{
+    float Rg = uAtmosphere.planetRadius;
+    float Rt = uAtmosphere.atmosphereRadius;
+
+    vec2 uv = vec2(muS * 0.5 + 0.5, clamp((r - Rg) / (Rt - Rg), 0.0, 1.0));
+    return texture(uMultiScatteringLUT, uv).rgb;
+}
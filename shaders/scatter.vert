@@ -0,0 +1,56 @@
+#version 410 core
+
+@include "lib/camera.glsl"
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoords;
+layout (location = 2) in vec3 aNormal;
+
+/* Per instance, see ScatterInstance */
+layout (location = 3) in vec2 aOffset; // In the chunk, 0 to 1
+layout (location = 4) in float aHeight;
+layout (location = 5) in float aRotation; // Turns
+layout (location = 6) in float aScale; // 0 to 1 over uScaleRange
+
+out VS_OUT
+{
+    vec3 FragPos;
+    vec3 Normal;
+    vec2 TexCoords;
+} vs_out;
+
+uniform vec2 uChunkOrigin; // World (x, z) of the chunk's min corner
+uniform float uChunkSize;
+uniform vec2 uScaleRange;
+uniform vec2 uFadeRange; // Props thin out between these distances
+uniform float uKindCount; // Props of the kind in the chunk
+
+void main()
+{
+    vec3 origin = vec3(uChunkOrigin.x + aOffset.x * uChunkSize, aHeight, uChunkOrigin.y + aOffset.y * uChunkSize);
+
+    /* Props are in random order, the first ones are kept the longest */
+    float rank = (float(gl_InstanceID) + 0.5) / uKindCount;
+    float keep = 1.0 - smoothstep(uFadeRange.x, uFadeRange.y, distance(uCamera.position, origin));
+    if (rank >= keep)
+    {
+        /* Past the far plane, the whole prop is clipped */
+        vs_out.FragPos = vec3(0.0);
+        vs_out.Normal = vec3(0.0, 1.0, 0.0);
+        vs_out.TexCoords = vec2(0.0);
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+        return;
+    }
+
+    float angle = aRotation * 6.28318530718;
+    float c = cos(angle), s = sin(angle);
+    mat3 rotation = mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c);
+    float scale = mix(uScaleRange.x, uScaleRange.y, aScale);
+
+    vec4 viewPos = uCamera.view * vec4(origin + rotation * (aPos * scale), 1.0);
+
+    vs_out.FragPos = viewPos.xyz;
+    vs_out.Normal = normalize(mat3(uCamera.view) * (rotation * aNormal));
+    vs_out.TexCoords = aTexCoords;
+    gl_Position = uCamera.proj * viewPos;
+}
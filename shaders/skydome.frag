@@ -2,10 +2,9 @@
 
 @include "lib/atmosphere.glsl"
 @include "lib/camera.glsl"
+@include "lib/scattering.glsl"
 
-#define PI 3.141592
 #define iSteps 16
-#define jSteps 9
 
 layout (location = 0) out vec4 Color0;
 
@@ -35,95 +34,65 @@ vec2 rsi(vec3 r0, vec3 rd, float sr)
     return vec2((-b - sqrtd) / (2.0 * a), (-b + sqrtd) / (2.0 * a));
 }
 
-vec2 earthShadow(float y0, vec3 sunDir)
-{
-    return vec2(0.0);
-}
-
 vec3 calcAtmosphere(vec3 V, vec3 eye)
 {
-    //const vec3 kRlh = vec3(5.8e-6, 13.5e-6, 33.1e-6); // For lambda = (680, 550, 440 nm)
-    //const vec3 kMie = //vec3(0.00002);
-    
-    const vec3 kRlh = vec3(5.8e-6, 13.0e-6, 22.4e-6);
-    const float kMie = 21e-6;
-    const float shRlh = 8e3;
-    const float shMie = 1.2e3;
-    const float g = 0.76;
-    const float gg = g * g;
+    float Rg = uAtmosphere.planetRadius;
+    float Rt = uAtmosphere.atmosphereRadius;
 
-    vec3 pSun = -normalize(uAtmosphere.sunDirection);
-    vec3 r = normalize(V);
+    vec3 S = -normalize(uAtmosphere.sunDirection);
 
-    vec3 r0 = eye;
+    vec2 p = rsi(eye, V, Rt);
 
-    vec2 p = rsi(r0, r, uAtmosphere.atmosphereRadius);
-
-    if (p.x > p.y || p.y < 0)
+    if (p.x > p.y || p.y < 0.0)
         return vec3(0.0);
 
-    p.y = min(p.y, rsi(r0, r, uAtmosphere.planetRadius).x);
-
-    float iStepSize = (p.y - p.x) / float(iSteps);
+    p.x = max(p.x, 0.0);
 
-    float iTime = 0.0;
+    // Stop at the ground if the ray hits it in front of the eye
+    vec2 g = rsi(eye, V, Rg);
+    if (g.x <= g.y && g.x > 0.0)
+        p.y = min(p.y, g.x);
 
-    vec3 totalRlh = vec3(0.0);
-    vec3 totalMie = vec3(0.0);
+    float stepSize = (p.y - p.x) / float(iSteps);
 
-    float iOdRlh = 0.0;
-    float iOdMie = 0.0;
+    float mu = dot(V, S);
+    float pRlh = rayleighPhase(mu);
+    float pMie = miePhase(mu, uAtmosphere.g);
 
-    float mu = dot(r, pSun);
-    float mumu = mu * mu;
-    float pRlh = 3.0 / (16.0 * PI) * (1.0 + mumu);
-    float pMie = 3.0 / (8.0 * PI) * ((1.0 - gg) * (mumu + 1.0)) / (pow(1.0 + gg - 2.0 * mu * g, 1.5) * (2.0 + gg));
+    vec3 T = vec3(1.0);
+    vec3 L = vec3(0.0);
 
     for (int i = 0; i < iSteps; i++)
     {
-        vec3 iPos = r0 + r * (iTime + iStepSize * 0.5);
-
-        float iHeight = length(iPos) - uAtmosphere.planetRadius;
-
-        float odStepRlh = exp(-iHeight / shRlh) * iStepSize;
-        float odStepMie = exp(-iHeight / shMie) * iStepSize;
-
-        iOdRlh += odStepRlh;
-        iOdMie += odStepMie;
-
-        float jStepSize = rsi(iPos, pSun, uAtmosphere.atmosphereRadius).y / float(jSteps);
-
-        float jTime = 0.0;
-
-        float jOdRlh = 0.0;
-        float jOdMie = 0.0;
-
-        for (int j = 0; j < jSteps; j++)
-        {
-            vec3 jPos = iPos + pSun * (jTime + jStepSize * 0.5);
+        vec3 pos = eye + V * (p.x + (float(i) + 0.5) * stepSize);
 
-            float jHeight = length(jPos) - uAtmosphere.planetRadius;
+        float r = length(pos);
+        float h = r - Rg;
 
-            jOdRlh += exp(-jHeight / shRlh) * jStepSize;
-            jOdMie += exp(-jHeight / shMie) * jStepSize;
+        vec3 sigmaRlh = kRayleighScattering * exp(-h / uAtmosphere.Hr);
+        float sigmaMie = kMieScattering * exp(-h / uAtmosphere.Hm);
+        vec3 sigmaS = sigmaRlh + sigmaMie;
 
-            jTime += jStepSize;
-        }
+        // Integrate transmittance analytically over the step
+        vec3 sampleT = exp(-sigmaS * stepSize);
+        vec3 seg = (1.0 - sampleT) / max(sigmaS, vec3(1e-12));
 
-        vec3 attn = exp(-(kMie * (iOdMie + iOdMie) + kRlh * (iOdRlh + jOdRlh)));
+        float muS = dot(pos, S) / r;
 
-        totalRlh += odStepRlh * attn;
-        totalMie += odStepMie * attn;
+        // Light reaching the sample comes from the tables instead of a second march
+        vec3 inScatter = sampleTransmittance(r, muS) * (sigmaRlh * pRlh + sigmaMie * pMie);
+        inScatter += sampleMultiScattering(r, muS) * sigmaS;
 
-        iTime + iStepSize;
+        L += T * inScatter * seg;
+        T *= sampleT;
     }
 
-    return uAtmosphere.sunColor * uAtmosphere.sunIntensity * (pRlh * kRlh * totalRlh + pMie * kMie * totalMie);
+    return uAtmosphere.sunColor * uAtmosphere.sunIntensity * L;
 }
 
 void main()
 {
-    vec3 eye = vec3(0.0, uCamera.position.y + uAtmosphere.planetRadius, 0.0);
+    vec3 eye = vec3(0.0, uAtmosphere.eyeHeight + uAtmosphere.planetRadius, 0.0);
     vec3 V = normalize(fs_in.Position);
 
     vec3 color = calcAtmosphere(V, eye);
@@ -0,0 +1,282 @@
+#include "arena.h"
+
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Pools a thread caches blocks for
+#define BLOCK_CACHE_POOLS 4
+
+static inline size_t roundUp(size_t size, size_t granularity)
+{
+    return (size + granularity - 1) / granularity * granularity;
+}
+
+void *allocPages(size_t size)
+{
+    size = roundUp(size, ARENA_GRANULARITY);
+
+#ifdef _WIN32
+    /* Large pages need the lock memory privilege, usually missing */
+    const SIZE_T large = GetLargePageMinimum();
+    if (large && size % large == 0)
+    {
+        void *pages = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (pages)
+            return pages;
+    }
+
+    return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+#ifdef MAP_HUGETLB
+    /* Explicit huge pages only exist if the system reserved some */
+    void *huge = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (huge != MAP_FAILED)
+        return huge;
+#endif
+
+    /* Map one granule more and trim it so transparent huge pages can back
+     * the whole range */
+    uint8_t *mapped = (uint8_t *)mmap(nullptr, size + ARENA_GRANULARITY, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == (uint8_t *)MAP_FAILED)
+        return nullptr;
+
+    uint8_t *pages = (uint8_t *)roundUp((uintptr_t)mapped, ARENA_GRANULARITY);
+    if (pages > mapped)
+        munmap(mapped, pages - mapped);
+    munmap(pages + size, mapped + ARENA_GRANULARITY - pages);
+
+#ifdef MADV_HUGEPAGE
+    madvise(pages, size, MADV_HUGEPAGE);
+#endif
+
+    return pages;
+#endif
+}
+
+void freePages(void *pages, size_t size)
+{
+    if (!pages)
+        return;
+
+#ifdef _WIN32
+    (void)size;
+    VirtualFree(pages, 0, MEM_RELEASE);
+#else
+    munmap(pages, roundUp(size, ARENA_GRANULARITY));
+#endif
+}
+
+/* Blocks cached by one thread, handed back to their pools when it exits */
+struct BlockCache
+{
+    struct Slot
+    {
+        BlockPool *pool;
+        void *blocks[BLOCK_POOL_CACHE];
+        int count;
+    };
+
+    Slot slots[BLOCK_CACHE_POOLS];
+
+    Slot *find(const BlockPool *pool, bool create)
+    {
+        Slot *empty = nullptr;
+        for (Slot &slot : slots)
+        {
+            if (slot.pool == pool)
+                return &slot;
+            if (!slot.pool && !empty)
+                empty = &slot;
+        }
+
+        if (!create || !empty)
+            return nullptr;
+
+        empty->pool = const_cast<BlockPool *>(pool);
+        empty->count = 0;
+        return empty;
+    }
+
+    void flush(Slot &slot)
+    {
+        for (int i = 0; i < slot.count; i++)
+            slot.pool->freeShared(slot.blocks[i]);
+        slot.pool = nullptr;
+        slot.count = 0;
+    }
+
+    BlockCache() : slots() {}
+
+    ~BlockCache()
+    {
+        for (Slot &slot : slots)
+        {
+            if (slot.pool)
+                flush(slot);
+        }
+    }
+};
+
+static thread_local BlockCache _blockCache;
+
+void *BlockPool::alloc()
+{
+    BlockCache::Slot *slot = _blockCache.find(this, false);
+    if (slot && slot->count > 0)
+        return slot->blocks[--slot->count];
+
+    return allocShared();
+}
+
+void BlockPool::free(void *block)
+{
+    if (!block)
+        return;
+
+    BlockCache::Slot *slot = _blockCache.find(this, true);
+    if (slot && slot->count < BLOCK_POOL_CACHE)
+    {
+        slot->blocks[slot->count++] = block;
+        return;
+    }
+
+    freeShared(block);
+}
+
+size_t BlockPool::capacity() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _capacity;
+}
+
+void *BlockPool::allocShared()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (!_free)
+    {
+        /* Carve a new arena, the first block ends up on top */
+        const size_t size = _blockSize * _blocksPerArena;
+        uint8_t *pages = (uint8_t *)allocPages(size);
+        if (!pages)
+            return nullptr;
+
+        _arenas.push_back({ pages, size });
+        _capacity += _blocksPerArena;
+
+        for (size_t i = _blocksPerArena; i-- > 0;)
+        {
+            void *block = pages + i * _blockSize;
+            *(void **)block = _free;
+            _free = block;
+        }
+    }
+
+    void *block = _free;
+    _free = *(void **)block;
+    return block;
+}
+
+void BlockPool::freeShared(void *block)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    *(void **)block = _free;
+    _free = block;
+}
+
+BlockPool::BlockPool(size_t blockSize, size_t blocksPerArena) :
+    _blockSize(roundUp(blockSize < sizeof(void *) ? sizeof(void *) : blockSize, 64)),
+    _blocksPerArena(blocksPerArena ? blocksPerArena : 1),
+    _free(nullptr), _capacity(0)
+{
+}
+
+BlockPool::~BlockPool()
+{
+    /* Blocks cached by this thread point into the arenas */
+    BlockCache::Slot *slot = _blockCache.find(this, false);
+    if (slot)
+    {
+        slot->pool = nullptr;
+        slot->count = 0;
+    }
+
+    for (const Arena &arena : _arenas)
+        freePages(arena.pages, arena.size);
+}
+
+void *ScratchArena::alloc(size_t size)
+{
+    size = roundUp(size ? size : 1, 64);
+
+    /* Regions too small for this are skipped until the scope ends */
+    for (; _current < _regions.size(); _current++, _offset = 0)
+    {
+        Region &region = _regions[_current];
+        if (_offset + size <= region.size)
+        {
+            void *memory = region.pages + _offset;
+            _offset += size;
+            return memory;
+        }
+    }
+
+    /* Grow geometrically so a job settles on a few regions */
+    size_t regionSize = _regions.empty() ? ARENA_GRANULARITY : _regions.back().size * 2;
+    regionSize = roundUp(regionSize > size ? regionSize : size, ARENA_GRANULARITY);
+
+    uint8_t *pages = (uint8_t *)allocPages(regionSize);
+    if (!pages)
+        throw std::bad_alloc();
+
+    _regions.push_back({ pages, regionSize });
+    _current = _regions.size() - 1;
+    _offset = size;
+    return pages;
+}
+
+void ScratchArena::rewind(const Mark &mark)
+{
+    _current = mark.region;
+    _offset = mark.offset;
+
+    /* Once everything is released, merge the regions so the next job fits
+     * in one */
+    if (_current == 0 && _offset == 0 && _regions.size() > 1)
+    {
+        size_t total = 0;
+        for (const Region &region : _regions)
+        {
+            total += region.size;
+            freePages(region.pages, region.size);
+        }
+        _regions.clear();
+
+        uint8_t *pages = (uint8_t *)allocPages(total);
+        if (pages)
+            _regions.push_back({ pages, total });
+    }
+}
+
+ScratchArena::ScratchArena() : _current(0), _offset(0)
+{
+}
+
+ScratchArena::~ScratchArena()
+{
+    for (const Region &region : _regions)
+        freePages(region.pages, region.size);
+}
+
+ScratchArena &getScratch()
+{
+    static thread_local ScratchArena arena;
+    return arena;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+
+/* Page level memory for chunk generation and streaming */
+
+// Arenas are rounded to this, the size of a huge page on most systems
+#define ARENA_GRANULARITY (2u << 20)
+
+// Blocks a thread keeps per pool before returning them to the shared list
+#define BLOCK_POOL_CACHE 2
+
+// Pages for at least size bytes, backed by huge pages where available
+void *allocPages(size_t size);
+void freePages(void *pages, size_t size);
+
+/* Fixed size blocks carved from page arenas.
+ *
+ * A freed block is cached by the freeing thread and reused by its next
+ * alloc, cache overflow goes to a shared free list. Arenas are only released
+ * when the pool is destroyed, which must outlive every thread using it.
+ */
+class BlockPool final
+{
+public:
+    // nullptr if the system is out of memory
+    void *alloc();
+    void free(void *block);
+
+    inline size_t blockSize() const { return _blockSize; }
+
+    // Blocks carved so far, in use or free
+    size_t capacity() const;
+
+    BlockPool(size_t blockSize, size_t blocksPerArena);
+    ~BlockPool();
+
+    BlockPool(const BlockPool &) = delete;
+    BlockPool &operator=(const BlockPool &) = delete;
+
+private:
+    struct Arena
+    {
+        void *pages;
+        size_t size;
+    };
+
+    size_t _blockSize;
+    size_t _blocksPerArena;
+
+    mutable std::mutex _mutex;
+    std::vector<Arena> _arenas;
+    void *_free; // Free list, linked through the first word of each block
+    size_t _capacity;
+
+    void *allocShared();
+    void freeShared(void *block);
+
+    friend struct BlockCache;
+};
+
+/* Bump allocator for scratch that lives for one job, like generating a
+ * chunk. Memory is reused, not freed, when a scope ends. Scopes nest */
+class ScratchArena final
+{
+public:
+    // Aligned to 64 bytes, throws std::bad_alloc if the system is out of memory
+    void *alloc(size_t size);
+
+    template <typename T>
+    inline T *alloc(size_t count)
+    {
+        return (T *)alloc(count * sizeof(T));
+    }
+
+    // Everything allocated after a mark is released by rewinding to it
+    struct Mark
+    {
+        size_t region, offset;
+    };
+
+    inline Mark mark() const { return { _current, _offset }; }
+    void rewind(const Mark &mark);
+
+    ScratchArena();
+    ~ScratchArena();
+
+    ScratchArena(const ScratchArena &) = delete;
+    ScratchArena &operator=(const ScratchArena &) = delete;
+
+private:
+    struct Region
+    {
+        uint8_t *pages;
+        size_t size;
+    };
+
+    std::vector<Region> _regions;
+    size_t _current; // Region allocations come from
+    size_t _offset; // Into the current region
+};
+
+// Scratch arena of the calling thread
+ScratchArena &getScratch();
+
+// Rewinds the calling thread's scratch arena when it goes out of scope
+class ScratchScope final
+{
+public:
+    inline ScratchArena &arena() const { return _arena; }
+
+    inline ScratchScope() : _arena(getScratch()), _mark(_arena.mark()) {}
+    inline ~ScratchScope() { _arena.rewind(_mark); }
+
+    ScratchScope(const ScratchScope &) = delete;
+    ScratchScope &operator=(const ScratchScope &) = delete;
+
+private:
+    ScratchArena &_arena;
+    ScratchArena::Mark _mark;
+};
@@ -0,0 +1,679 @@
+#include "atmosphere.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#include <emmintrin.h>
+
+#include <lysys/lysys.hpp>
+
+#include "util.h"
+#include "threadpool.h"
+
+#define LUT_MAGIC 0x54554c41 // 'ALUT'
+#define LUT_VERSION 1
+
+// Sea level scattering coefficients, must match shaders/lib/scattering.glsl
+static constexpr Vector3 kRayleighScattering = Vector3(5.8e-6f, 13.0e-6f, 22.4e-6f);
+static constexpr float kMieScattering = 21e-6f;
+
+static constexpr int kTransmittanceSteps = 40;
+static constexpr int kMultiScatteringSteps = 20;
+static constexpr int kMultiScatteringDirs = 8; // Per axis
+static constexpr int kSunSteps = 32;
+static constexpr int kViewSteps = 16; // Must match iSteps in skydome.frag
+
+static constexpr size_t kEvaluateGrain = 256; // Rays per thread pool chunk
+
+struct LUTHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    AtmosphereParams params;
+};
+
+static inline Vector3 expv(const Vector3 &v)
+{
+    return Vector3(expf(v.x), expf(v.y), expf(v.z));
+}
+
+/* (1 - T) / sigma, the integral of transmittance over a homogeneous segment */
+static inline Vector3 segmentIntegral(const Vector3 &sigma, const Vector3 &T)
+{
+    return Vector3(
+        (1.0f - T.x) / max(sigma.x, 1e-12f),
+        (1.0f - T.y) / max(sigma.y, 1e-12f),
+        (1.0f - T.z) / max(sigma.z, 1e-12f));
+}
+
+static inline float distanceToTop(float r, float mu, float Rt)
+{
+    float d = r * r * (mu * mu - 1.0f) + Rt * Rt;
+    return max(-r * mu + sqrtf(max(d, 0.0f)), 0.0f);
+}
+
+static inline float distanceToGround(float r, float mu, float Rg)
+{
+    float d = r * r * (mu * mu - 1.0f) + Rg * Rg;
+    return max(-r * mu - sqrtf(max(d, 0.0f)), 0.0f);
+}
+
+static inline bool hitsGround(float r, float mu, float Rg)
+{
+    return mu < 0.0f && r * r * (mu * mu - 1.0f) + Rg * Rg >= 0.0f;
+}
+
+static inline float rayleighPhase(float mu)
+{
+    return 3.0f / (16.0f * MUTIL_PI) * (1.0f + mu * mu);
+}
+
+static inline float miePhase(float mu, float g)
+{
+    float gg = g * g;
+    return 3.0f / (8.0f * MUTIL_PI) * ((1.0f - gg) * (mu * mu + 1.0f)) / (powf(1.0f + gg - 2.0f * mu * g, 1.5f) * (2.0f + gg));
+}
+
+/* Bilinear lookup of a table stored row by row */
+static Vector3 sampleTable(const Vector3 *table, int width, int height, float u, float v)
+{
+    float x = clamp(u * width - 0.5f, 0.0f, (float)(width - 1));
+    float y = clamp(v * height - 0.5f, 0.0f, (float)(height - 1));
+
+    int x0 = (int)x;
+    int y0 = (int)y;
+    int x1 = min(x0 + 1, width - 1);
+    int y1 = min(y0 + 1, height - 1);
+
+    float fx = x - x0;
+    float fy = y - y0;
+
+    Vector3 a = table[y0 * width + x0] * (1.0f - fx) + table[y0 * width + x1] * fx;
+    Vector3 b = table[y1 * width + x0] * (1.0f - fx) + table[y1 * width + x1] * fx;
+    return a * (1.0f - fy) + b * fy;
+}
+
+/* Transmittance LUT parameterization (Bruneton 2017) */
+static void transmittanceUV(const AtmosphereParams &p, float r, float mu, float *u, float *v)
+{
+    const float Rg = p.planetRadius;
+    const float Rt = p.atmosphereRadius;
+
+    float H = sqrtf(Rt * Rt - Rg * Rg);
+    float rho = sqrtf(max(r * r - Rg * Rg, 0.0f));
+
+    float d = distanceToTop(r, mu, Rt);
+    float dMin = Rt - r;
+    float dMax = rho + H;
+
+    *u = (d - dMin) / (dMax - dMin);
+    *v = rho / H;
+}
+
+static void transmittanceRMu(const AtmosphereParams &p, float u, float v, float *r, float *mu)
+{
+    const float Rg = p.planetRadius;
+    const float Rt = p.atmosphereRadius;
+
+    float H = sqrtf(Rt * Rt - Rg * Rg);
+    float rho = H * v;
+
+    *r = sqrtf(rho * rho + Rg * Rg);
+
+    float dMin = Rt - *r;
+    float dMax = rho + H;
+    float d = dMin + u * (dMax - dMin);
+
+    *mu = d == 0.0f ? 1.0f : (H * H - rho * rho - d * d) / (2.0f * *r * d);
+    *mu = clamp(*mu, -1.0f, 1.0f);
+}
+
+void AtmosphereLUT::compute(const AtmosphereParams &params)
+{
+    _params = sanitizeAtmosphereParams(params);
+
+    /* Order matters, each table depends on the previous ones */
+    computeTransmittance();
+    computeMultiScattering();
+    computeSun();
+}
+
+bool AtmosphereLUT::read(const char *path, const AtmosphereParams &params)
+{
+    ls_handle file = ls_open(path, LS_FILE_READ, LS_SHARE_READ, LS_OPEN_EXISTING);
+    if (!file)
+        return false;
+
+    AtmosphereParams sanitized = sanitizeAtmosphereParams(params);
+
+    LUTHeader header;
+    bool ok = (size_t)ls_read(file, &header, sizeof(header)) == sizeof(header) &&
+        header.magic == LUT_MAGIC &&
+        header.version == LUT_VERSION &&
+        memcmp(&header.params, &sanitized, sizeof(AtmosphereParams)) == 0;
+
+    ok = ok && (size_t)ls_read(file, _transmittance, sizeof(_transmittance)) == sizeof(_transmittance);
+    ok = ok && (size_t)ls_read(file, _multiScattering, sizeof(_multiScattering)) == sizeof(_multiScattering);
+    ok = ok && (size_t)ls_read(file, _sun, sizeof(_sun)) == sizeof(_sun);
+
+    ls_close(file);
+
+    if (ok)
+        _params = sanitized;
+
+    return ok;
+}
+
+bool AtmosphereLUT::write(const char *path) const
+{
+    ls_handle file = ls_open(path, LS_FILE_WRITE, LS_SHARE_NONE, LS_CREATE_ALWAYS);
+    if (!file)
+    {
+        ls_perror("ls_open");
+        return false;
+    }
+
+    LUTHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = LUT_MAGIC;
+    header.version = LUT_VERSION;
+    header.params = _params;
+
+    ls_write(file, &header, sizeof(header));
+    ls_write(file, _transmittance, sizeof(_transmittance));
+    ls_write(file, _multiScattering, sizeof(_multiScattering));
+    ls_write(file, _sun, sizeof(_sun));
+
+    ls_close(file);
+    return true;
+}
+
+Vector3 AtmosphereLUT::transmittance(float r, float mu) const
+{
+    if (hitsGround(r, mu, _params.planetRadius))
+        return Vector3(0.0f);
+
+    float u, v;
+    transmittanceUV(_params, r, mu, &u, &v);
+    return sampleTable(_transmittance, TRANSMITTANCE_LUT_WIDTH, TRANSMITTANCE_LUT_HEIGHT, u, v);
+}
+
+Vector3 AtmosphereLUT::multiScattering(float r, float muS) const
+{
+    const float Rg = _params.planetRadius;
+    const float Rt = _params.atmosphereRadius;
+
+    float u = muS * 0.5f + 0.5f;
+    float v = clamp((r - Rg) / (Rt - Rg), 0.0f, 1.0f);
+    return sampleTable(_multiScattering, MULTISCATTERING_LUT_SIZE, MULTISCATTERING_LUT_SIZE, u, v);
+}
+
+Vector3 AtmosphereLUT::sunRadiance(float h, float muS) const
+{
+    const float Rg = _params.planetRadius;
+    const float Rt = _params.atmosphereRadius;
+
+    float u = muS * 0.5f + 0.5f;
+    float v = sqrtf(clamp(h / (Rt - Rg), 0.0f, 1.0f));
+    return sampleTable(_sun, SUN_LUT_WIDTH, SUN_LUT_HEIGHT, u, v);
+}
+
+AtmosphereLUT::AtmosphereLUT()
+{
+    memset(&_params, 0, sizeof(_params));
+}
+
+AtmosphereLUT::~AtmosphereLUT() {}
+
+void AtmosphereLUT::computeTransmittance()
+{
+    const float Rg = _params.planetRadius;
+    const float Rt = _params.atmosphereRadius;
+
+    for (int j = 0; j < TRANSMITTANCE_LUT_HEIGHT; j++)
+    {
+        for (int i = 0; i < TRANSMITTANCE_LUT_WIDTH; i++)
+        {
+            float r, mu;
+            transmittanceRMu(_params,
+                (i + 0.5f) / TRANSMITTANCE_LUT_WIDTH,
+                (j + 0.5f) / TRANSMITTANCE_LUT_HEIGHT,
+                &r, &mu);
+
+            /* Optical depth to the top of the atmosphere */
+            float dt = distanceToTop(r, mu, Rt) / kTransmittanceSteps;
+
+            float odRlh = 0.0f;
+            float odMie = 0.0f;
+
+            for (int k = 0; k < kTransmittanceSteps; k++)
+            {
+                float t = (k + 0.5f) * dt;
+                float h = sqrtf(t * t + 2.0f * r * mu * t + r * r) - Rg;
+
+                odRlh += expf(-h / _params.Hr);
+                odMie += expf(-h / _params.Hm);
+            }
+
+            odRlh *= dt;
+            odMie *= dt;
+
+            _transmittance[j * TRANSMITTANCE_LUT_WIDTH + i] = expv(-(kRayleighScattering * odRlh + Vector3(kMieScattering * odMie)));
+        }
+    }
+}
+
+void AtmosphereLUT::computeMultiScattering()
+{
+    constexpr int kDirs = kMultiScatteringDirs * kMultiScatteringDirs;
+    constexpr float kIsotropicPhase = 1.0f / (4.0f * MUTIL_PI);
+
+    const float Rg = _params.planetRadius;
+    const float Rt = _params.atmosphereRadius;
+
+    for (int j = 0; j < MULTISCATTERING_LUT_SIZE; j++)
+    {
+        float r = Rg + (j + 0.5f) / MULTISCATTERING_LUT_SIZE * (Rt - Rg);
+        const Vector3 x(0.0f, r, 0.0f);
+
+        for (int i = 0; i < MULTISCATTERING_LUT_SIZE; i++)
+        {
+            float muS = (i + 0.5f) / MULTISCATTERING_LUT_SIZE * 2.0f - 1.0f;
+            const Vector3 s(sqrtf(1.0f - muS * muS), muS, 0.0f);
+
+            Vector3 L2(0.0f); // Second order radiance
+            Vector3 fms(0.0f); // Transfer function
+
+            /* Integrate over the sphere of directions */
+            for (int a = 0; a < kMultiScatteringDirs; a++)
+            {
+                float cosTheta = 1.0f - 2.0f * (a + 0.5f) / kMultiScatteringDirs;
+                float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+
+                for (int b = 0; b < kMultiScatteringDirs; b++)
+                {
+                    float phi = 2.0f * MUTIL_PI * (b + 0.5f) / kMultiScatteringDirs;
+                    Vector3 v(sinTheta * cosf(phi), cosTheta, sinTheta * sinf(phi));
+
+                    float mu = v.y;
+                    float dist = hitsGround(r, mu, Rg) ? distanceToGround(r, mu, Rg) : distanceToTop(r, mu, Rt);
+                    float dt = dist / kMultiScatteringSteps;
+
+                    Vector3 T(1.0f);
+                    for (int k = 0; k < kMultiScatteringSteps; k++)
+                    {
+                        Vector3 p = x + v * ((k + 0.5f) * dt);
+                        float rp = length(p);
+                        float h = rp - Rg;
+
+                        Vector3 sigmaS = kRayleighScattering * expf(-h / _params.Hr) + Vector3(kMieScattering * expf(-h / _params.Hm));
+                        Vector3 sampleT = expv(-sigmaS * dt);
+
+                        /* Extinction equals scattering here */
+                        Vector3 seg = segmentIntegral(sigmaS, sampleT);
+
+                        float muSp = dot(p, s) / rp;
+                        Vector3 S = transmittance(rp, muSp) * sigmaS * kIsotropicPhase;
+
+                        L2 += T * S * seg;
+                        fms += T * sigmaS * seg;
+
+                        T = T * sampleT;
+                    }
+                }
+            }
+
+            L2 = L2 / (float)kDirs;
+            fms = fms / (float)kDirs;
+
+            /* Infinite series of scattering orders */
+            _multiScattering[j * MULTISCATTERING_LUT_SIZE + i] = Vector3(
+                L2.x / max(1.0f - fms.x, 1e-3f),
+                L2.y / max(1.0f - fms.y, 1e-3f),
+                L2.z / max(1.0f - fms.z, 1e-3f));
+        }
+    }
+}
+
+void AtmosphereLUT::computeSun()
+{
+    const float Rg = _params.planetRadius;
+    const float Rt = _params.atmosphereRadius;
+
+    /* View direction is the sun direction, the phase functions are constant */
+    const float pRlh = rayleighPhase(1.0f);
+    const float pMie = miePhase(1.0f, _params.g);
+
+    for (int j = 0; j < SUN_LUT_HEIGHT; j++)
+    {
+        float v = (j + 0.5f) / SUN_LUT_HEIGHT;
+        float r = Rg + v * v * (Rt - Rg);
+        const Vector3 x(0.0f, r, 0.0f);
+
+        for (int i = 0; i < SUN_LUT_WIDTH; i++)
+        {
+            float muS = (i + 0.5f) / SUN_LUT_WIDTH * 2.0f - 1.0f;
+            const Vector3 s(sqrtf(1.0f - muS * muS), muS, 0.0f);
+
+            float dist = hitsGround(r, muS, Rg) ? distanceToGround(r, muS, Rg) : distanceToTop(r, muS, Rt);
+            float dt = dist / kSunSteps;
+
+            Vector3 T(1.0f);
+            Vector3 L(0.0f);
+
+            for (int k = 0; k < kSunSteps; k++)
+            {
+                Vector3 p = x + s * ((k + 0.5f) * dt);
+                float rp = length(p);
+                float h = rp - Rg;
+
+                Vector3 sigmaRlh = kRayleighScattering * expf(-h / _params.Hr);
+                float sigmaMie = kMieScattering * expf(-h / _params.Hm);
+                Vector3 sigmaS = sigmaRlh + Vector3(sigmaMie);
+                Vector3 sampleT = expv(-sigmaS * dt);
+                Vector3 seg = segmentIntegral(sigmaS, sampleT);
+
+                float muSp = dot(p, s) / rp;
+                Vector3 S = transmittance(rp, muSp) * (sigmaRlh * pRlh + Vector3(sigmaMie * pMie));
+                S += multiScattering(rp, muSp) * sigmaS;
+
+                L += T * S * seg;
+                T = T * sampleT;
+            }
+
+            _sun[j * SUN_LUT_WIDTH + i] = L;
+        }
+    }
+}
+
+/* exp for four lanes, Cephes polynomial, relative error around 1e-7 */
+static inline __m128 exp4(__m128 x)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    x = _mm_min_ps(x, _mm_set1_ps(88.3762626647949f));
+    x = _mm_max_ps(x, _mm_set1_ps(-88.3762626647949f));
+
+    /* exp(x) = 2^n * exp(x - n ln 2) */
+    __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)), _mm_set1_ps(0.5f));
+    __m128 tmp = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+    fx = _mm_sub_ps(tmp, _mm_and_ps(_mm_cmpgt_ps(tmp, fx), one)); // floor
+
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(0.693359375f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(-2.12194440e-4f)));
+
+    __m128 y = _mm_set1_ps(1.9875691500e-4f);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507e-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073e-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894e-2f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201e-1f));
+    y = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(y, x), x), _mm_add_ps(x, one));
+
+    __m128i n = _mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(127));
+    return _mm_mul_ps(y, _mm_castsi128_ps(_mm_slli_epi32(n, 23)));
+}
+
+/* Three component vectors for four lanes */
+struct Vector3x4
+{
+    __m128 x, y, z;
+};
+
+/* Bilinear lookup for four lanes, coordinates are computed in parallel */
+static inline Vector3x4 sampleTable4(const Vector3 *table, int width, int height, __m128 u, __m128 v)
+{
+    const __m128 zero = _mm_setzero_ps();
+
+    __m128 x = _mm_sub_ps(_mm_mul_ps(u, _mm_set1_ps((float)width)), _mm_set1_ps(0.5f));
+    __m128 y = _mm_sub_ps(_mm_mul_ps(v, _mm_set1_ps((float)height)), _mm_set1_ps(0.5f));
+    x = _mm_min_ps(_mm_max_ps(x, zero), _mm_set1_ps((float)(width - 1)));
+    y = _mm_min_ps(_mm_max_ps(y, zero), _mm_set1_ps((float)(height - 1)));
+
+    __m128i x0 = _mm_cvttps_epi32(x);
+    __m128i y0 = _mm_cvttps_epi32(y);
+
+    alignas(16) float fx[4], fy[4];
+    alignas(16) int32_t ix[4], iy[4];
+    _mm_store_ps(fx, _mm_sub_ps(x, _mm_cvtepi32_ps(x0)));
+    _mm_store_ps(fy, _mm_sub_ps(y, _mm_cvtepi32_ps(y0)));
+    _mm_store_si128((__m128i *)ix, x0);
+    _mm_store_si128((__m128i *)iy, y0);
+
+    alignas(16) float ox[4], oy[4], oz[4];
+    for (int i = 0; i < 4; i++)
+    {
+        int dx = ix[i] < width - 1 ? 1 : 0;
+        int dy = iy[i] < height - 1 ? width : 0;
+
+        const Vector3 *p = table + iy[i] * width + ix[i];
+
+        Vector3 a = p[0] * (1.0f - fx[i]) + p[dx] * fx[i];
+        Vector3 b = p[dy] * (1.0f - fx[i]) + p[dy + dx] * fx[i];
+        Vector3 c = a * (1.0f - fy[i]) + b * fy[i];
+
+        ox[i] = c.x;
+        oy[i] = c.y;
+        oz[i] = c.z;
+    }
+
+    Vector3x4 out = { _mm_load_ps(ox), _mm_load_ps(oy), _mm_load_ps(oz) };
+    return out;
+}
+
+void AtmosphereLUT::evaluate(const Vector3 &toSun, float h, const Vector3 *directions, Vector3 *radiance, size_t count, ThreadPool *pool) const
+{
+    if (!pool)
+    {
+        evaluateRange(toSun, h, directions, radiance, count);
+        return;
+    }
+
+    pool->parallelFor(count, kEvaluateGrain, [&](size_t begin, size_t end)
+    {
+        evaluateRange(toSun, h, directions + begin, radiance + begin, end - begin);
+    });
+}
+
+void AtmosphereLUT::evaluateRange(const Vector3 &toSun, float h, const Vector3 *directions, Vector3 *radiance, size_t count) const
+{
+    const float Rg = _params.planetRadius;
+    const float Rt = _params.atmosphereRadius;
+    const float r0 = Rg + max(h, 0.0f);
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    const __m128 vr0 = _mm_set1_ps(r0);
+    const __m128 vRg = _mm_set1_ps(Rg);
+    const __m128 vRt = _mm_set1_ps(Rt);
+    const __m128 vRg2 = _mm_set1_ps(Rg * Rg);
+    const __m128 vRt2 = _mm_set1_ps(Rt * Rt);
+    const __m128 vH = _mm_set1_ps(sqrtf(Rt * Rt - Rg * Rg));
+    const __m128 invH = _mm_set1_ps(1.0f / sqrtf(Rt * Rt - Rg * Rg));
+    const __m128 invThickness = _mm_set1_ps(1.0f / (Rt - Rg));
+    const __m128 cTop = _mm_set1_ps(r0 * r0 - Rt * Rt);
+    const __m128 cGround = _mm_set1_ps(r0 * r0 - Rg * Rg);
+
+    const __m128 invHr = _mm_set1_ps(-1.0f / _params.Hr);
+    const __m128 invHm = _mm_set1_ps(-1.0f / _params.Hm);
+
+    const __m128 kRlhX = _mm_set1_ps(kRayleighScattering.x);
+    const __m128 kRlhY = _mm_set1_ps(kRayleighScattering.y);
+    const __m128 kRlhZ = _mm_set1_ps(kRayleighScattering.z);
+    const __m128 kMie = _mm_set1_ps(kMieScattering);
+    const __m128 kEpsilon = _mm_set1_ps(1e-12f);
+
+    const __m128 sx = _mm_set1_ps(toSun.x);
+    const __m128 sy = _mm_set1_ps(toSun.y);
+    const __m128 sz = _mm_set1_ps(toSun.z);
+
+    const float g = _params.g;
+    const float gg = g * g;
+
+    for (size_t base = 0; base < count; base += 4)
+    {
+        size_t lanes = min(count - base, (size_t)4);
+
+        /* Load four directions, repeating the last one to fill the group */
+        alignas(16) float dx[4], dy[4], dz[4];
+        for (size_t i = 0; i < 4; i++)
+        {
+            const Vector3 &d = directions[base + min(i, lanes - 1)];
+            float len = sqrtf(dot(d, d));
+            dx[i] = d.x / len;
+            dy[i] = d.y / len;
+            dz[i] = d.z / len;
+        }
+
+        Vector3x4 V = { _mm_load_ps(dx), _mm_load_ps(dy), _mm_load_ps(dz) };
+
+        /* Ray-sphere intersections from (0, r0, 0), half b form */
+        __m128 b = _mm_mul_ps(vr0, V.y);
+        __m128 bb = _mm_mul_ps(b, b);
+
+        __m128 dTop = _mm_sub_ps(bb, cTop);
+        __m128 sqTop = _mm_sqrt_ps(_mm_max_ps(dTop, zero));
+        __m128 start = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(zero, b), sqTop), zero);
+        __m128 end = _mm_add_ps(_mm_sub_ps(zero, b), sqTop);
+
+        __m128 valid = _mm_and_ps(_mm_cmpge_ps(dTop, zero), _mm_cmpgt_ps(end, start));
+
+        /* Stop at the ground if it is hit in front of the eye */
+        __m128 dGround = _mm_sub_ps(bb, cGround);
+        __m128 tGround = _mm_sub_ps(_mm_sub_ps(zero, b), _mm_sqrt_ps(_mm_max_ps(dGround, zero)));
+        __m128 hitGround = _mm_and_ps(_mm_cmpge_ps(dGround, zero), _mm_cmpgt_ps(tGround, zero));
+        end = _mm_or_ps(_mm_and_ps(hitGround, _mm_min_ps(end, tGround)), _mm_andnot_ps(hitGround, end));
+
+        __m128 dt = _mm_and_ps(valid, _mm_mul_ps(_mm_sub_ps(end, start), _mm_set1_ps(1.0f / kViewSteps)));
+
+        /* Phase functions */
+        __m128 mu = _mm_add_ps(_mm_add_ps(_mm_mul_ps(V.x, sx), _mm_mul_ps(V.y, sy)), _mm_mul_ps(V.z, sz));
+        __m128 mumu1 = _mm_add_ps(_mm_mul_ps(mu, mu), one);
+        __m128 pRlh = _mm_mul_ps(_mm_set1_ps(3.0f / (16.0f * MUTIL_PI)), mumu1);
+
+        __m128 denom = _mm_sub_ps(_mm_set1_ps(1.0f + gg), _mm_mul_ps(_mm_set1_ps(2.0f * g), mu));
+        denom = _mm_mul_ps(denom, _mm_sqrt_ps(denom)); // pow(x, 1.5)
+        __m128 pMie = _mm_div_ps(_mm_mul_ps(_mm_set1_ps(3.0f / (8.0f * MUTIL_PI) * (1.0f - gg) / (2.0f + gg)), mumu1), denom);
+
+        Vector3x4 T = { one, one, one };
+        Vector3x4 L = { zero, zero, zero };
+
+        for (int k = 0; k < kViewSteps; k++)
+        {
+            __m128 t = _mm_add_ps(start, _mm_mul_ps(dt, _mm_set1_ps(k + 0.5f)));
+
+            __m128 px = _mm_mul_ps(V.x, t);
+            __m128 py = _mm_add_ps(vr0, _mm_mul_ps(V.y, t));
+            __m128 pz = _mm_mul_ps(V.z, t);
+
+            __m128 r = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(py, py)), _mm_mul_ps(pz, pz)));
+            __m128 height = _mm_sub_ps(r, vRg);
+
+            __m128 densityRlh = exp4(_mm_mul_ps(height, invHr));
+            __m128 sigmaMie = _mm_mul_ps(kMie, exp4(_mm_mul_ps(height, invHm)));
+
+            Vector3x4 sigmaRlh = {
+                _mm_mul_ps(kRlhX, densityRlh),
+                _mm_mul_ps(kRlhY, densityRlh),
+                _mm_mul_ps(kRlhZ, densityRlh)
+            };
+
+            Vector3x4 sigmaS = {
+                _mm_add_ps(sigmaRlh.x, sigmaMie),
+                _mm_add_ps(sigmaRlh.y, sigmaMie),
+                _mm_add_ps(sigmaRlh.z, sigmaMie)
+            };
+
+            __m128 negDt = _mm_sub_ps(zero, dt);
+            Vector3x4 sampleT = {
+                exp4(_mm_mul_ps(sigmaS.x, negDt)),
+                exp4(_mm_mul_ps(sigmaS.y, negDt)),
+                exp4(_mm_mul_ps(sigmaS.z, negDt))
+            };
+
+            Vector3x4 seg = {
+                _mm_div_ps(_mm_sub_ps(one, sampleT.x), _mm_max_ps(sigmaS.x, kEpsilon)),
+                _mm_div_ps(_mm_sub_ps(one, sampleT.y), _mm_max_ps(sigmaS.y, kEpsilon)),
+                _mm_div_ps(_mm_sub_ps(one, sampleT.z), _mm_max_ps(sigmaS.z, kEpsilon))
+            };
+
+            __m128 muS = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, sx), _mm_mul_ps(py, sy)), _mm_mul_ps(pz, sz)), r);
+
+            /* Transmittance to the sun, zero if the ground is in the way */
+            __m128 rr = _mm_mul_ps(r, r);
+            __m128 muSmuS1 = _mm_sub_ps(_mm_mul_ps(muS, muS), one);
+            __m128 shadowed = _mm_and_ps(_mm_cmplt_ps(muS, zero), _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(rr, muSmuS1), vRg2), zero));
+
+            __m128 rho = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(rr, vRg2), zero));
+            __m128 dist = _mm_sqrt_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(rr, muSmuS1), vRt2), zero));
+            dist = _mm_max_ps(_mm_sub_ps(dist, _mm_mul_ps(r, muS)), zero);
+            __m128 dMin = _mm_sub_ps(vRt, r);
+            __m128 dMax = _mm_add_ps(rho, vH);
+
+            Vector3x4 trans = sampleTable4(_transmittance, TRANSMITTANCE_LUT_WIDTH, TRANSMITTANCE_LUT_HEIGHT,
+                _mm_div_ps(_mm_sub_ps(dist, dMin), _mm_sub_ps(dMax, dMin)),
+                _mm_mul_ps(rho, invH));
+
+            trans.x = _mm_andnot_ps(shadowed, trans.x);
+            trans.y = _mm_andnot_ps(shadowed, trans.y);
+            trans.z = _mm_andnot_ps(shadowed, trans.z);
+
+            Vector3x4 ms = sampleTable4(_multiScattering, MULTISCATTERING_LUT_SIZE, MULTISCATTERING_LUT_SIZE,
+                _mm_add_ps(_mm_mul_ps(muS, half), half),
+                _mm_mul_ps(height, invThickness));
+
+            __m128 mieTerm = _mm_mul_ps(sigmaMie, pMie);
+
+            Vector3x4 S = {
+                _mm_add_ps(_mm_mul_ps(trans.x, _mm_add_ps(_mm_mul_ps(sigmaRlh.x, pRlh), mieTerm)), _mm_mul_ps(ms.x, sigmaS.x)),
+                _mm_add_ps(_mm_mul_ps(trans.y, _mm_add_ps(_mm_mul_ps(sigmaRlh.y, pRlh), mieTerm)), _mm_mul_ps(ms.y, sigmaS.y)),
+                _mm_add_ps(_mm_mul_ps(trans.z, _mm_add_ps(_mm_mul_ps(sigmaRlh.z, pRlh), mieTerm)), _mm_mul_ps(ms.z, sigmaS.z))
+            };
+
+            L.x = _mm_add_ps(L.x, _mm_mul_ps(_mm_mul_ps(T.x, S.x), seg.x));
+            L.y = _mm_add_ps(L.y, _mm_mul_ps(_mm_mul_ps(T.y, S.y), seg.y));
+            L.z = _mm_add_ps(L.z, _mm_mul_ps(_mm_mul_ps(T.z, S.z), seg.z));
+
+            T.x = _mm_mul_ps(T.x, sampleT.x);
+            T.y = _mm_mul_ps(T.y, sampleT.y);
+            T.z = _mm_mul_ps(T.z, sampleT.z);
+        }
+
+        /* Zero rays that miss the atmosphere */
+        alignas(16) float lx[4], ly[4], lz[4];
+        _mm_store_ps(lx, _mm_and_ps(valid, L.x));
+        _mm_store_ps(ly, _mm_and_ps(valid, L.y));
+        _mm_store_ps(lz, _mm_and_ps(valid, L.z));
+
+        for (size_t i = 0; i < lanes; i++)
+            radiance[base + i] = Vector3(lx[i], ly[i], lz[i]);
+    }
+}
+
+AtmosphereParams sanitizeAtmosphereParams(const AtmosphereParams &params)
+{
+    AtmosphereParams p = params;
+    p.planetRadius = max(p.planetRadius, 1.0f);
+    p.atmosphereRadius = max(p.atmosphereRadius, p.planetRadius + 1.0f);
+    p.Hr = max(p.Hr, 1.0f);
+    p.Hm = max(p.Hm, 1.0f);
+    p.g = clamp(p.g, -0.999f, 0.999f);
+    return p;
+}
+
+uint64_t hashAtmosphereParams(const AtmosphereParams &params)
+{
+    AtmosphereParams p = sanitizeAtmosphereParams(params);
+
+    uint32_t version = LUT_VERSION;
+    uint64_t hash = hashBytes(&version, sizeof(version));
+    return hashBytes(&p, sizeof(p), hash);
+}
+
+void pathForAtmosphereLUT(char *path, size_t size, const AtmosphereParams &params)
+{
+    snprintf(path, size, ATMOSPHERE_CACHE_DIR "/%016llx.lut", (unsigned long long)hashAtmosphereParams(params));
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+
+#include <mutil/mutil.h>
+
+using namespace mutil;
+
+class ThreadPool;
+
+// Transmittance LUT dimensions (view zenith x height)
+#define TRANSMITTANCE_LUT_WIDTH 256
+#define TRANSMITTANCE_LUT_HEIGHT 64
+
+// Multiple scattering LUT dimensions (sun zenith x height)
+#define MULTISCATTERING_LUT_SIZE 32
+
+// Sun radiance LUT dimensions (sun zenith x height)
+#define SUN_LUT_WIDTH 64
+#define SUN_LUT_HEIGHT 64
+
+#define ATMOSPHERE_CACHE_DIR ".acache"
+
+// Parameters the precomputed tables depend on
+struct AtmosphereParams
+{
+    float planetRadius;
+    float atmosphereRadius;
+    float Hr; // Rayleigh scale height
+    float Hm; // Mie scale height
+    float g; // Mie phase asymmetry
+};
+
+/* Precomputed atmosphere lookup tables.
+ *
+ * Holds the transmittance to the top of the atmosphere, the multiple
+ * scattering contribution (Hillaire 2020) and the radiance seen when looking
+ * directly at the sun. The first two are uploaded for the sky shader, the last
+ * one replaces the CPU ray march for the sun color.
+ */
+class AtmosphereLUT final
+{
+public:
+    void compute(const AtmosphereParams &params);
+
+    bool read(const char *path, const AtmosphereParams &params);
+    bool write(const char *path) const;
+
+    // Transmittance from radius r along view zenith cosine mu to space
+    Vector3 transmittance(float r, float mu) const;
+
+    // Multiple scattering transfer at radius r with sun zenith cosine muS
+    Vector3 multiScattering(float r, float muS) const;
+
+    // In-scattered radiance looking at the sun from height h above ground
+    Vector3 sunRadiance(float h, float muS) const;
+
+    /* Sky radiance for a batch of view directions seen from height h above
+     * ground, per unit sun radiance. Same model as skydome.frag, four rays
+     * are integrated at once and the batch is split over pool if given.
+     */
+    void evaluate(const Vector3 &toSun, float h, const Vector3 *directions, Vector3 *radiance, size_t count, ThreadPool *pool = nullptr) const;
+
+    constexpr const AtmosphereParams &params() const { return _params; }
+
+    constexpr const Vector3 *transmittanceData() const { return _transmittance; }
+    constexpr const Vector3 *multiScatteringData() const { return _multiScattering; }
+
+    AtmosphereLUT();
+    ~AtmosphereLUT();
+
+private:
+    AtmosphereParams _params;
+
+    Vector3 _transmittance[TRANSMITTANCE_LUT_WIDTH * TRANSMITTANCE_LUT_HEIGHT];
+    Vector3 _multiScattering[MULTISCATTERING_LUT_SIZE * MULTISCATTERING_LUT_SIZE];
+    Vector3 _sun[SUN_LUT_WIDTH * SUN_LUT_HEIGHT];
+
+    void computeTransmittance();
+    void computeMultiScattering();
+    void computeSun();
+
+    void evaluateRange(const Vector3 &toSun, float h, const Vector3 *directions, Vector3 *radiance, size_t count) const;
+};
+
+// Clamp parameters to values the tables can be built from
+AtmosphereParams sanitizeAtmosphereParams(const AtmosphereParams &params);
+
+uint64_t hashAtmosphereParams(const AtmosphereParams &params);
+
+// Path of the cached tables for a parameter set
+void pathForAtmosphereLUT(char *path, size_t size, const AtmosphereParams &params);
@@ -0,0 +1,180 @@
+/* Headless world baker, fills a terrain cache without a window or GPU */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <atomic>
+
+#include <lysys/lysys.hpp>
+
+#include "worldgen.h"
+#include "scatter.h"
+#include "threadpool.h"
+
+static void usage(const char *argv0)
+{
+    printf("Usage: %s [options] <x0> <y0> <x1> <y1>\n", argv0);
+    printf("Bake chunks in the inclusive chunk rectangle (x0, y0) - (x1, y1)\n\n");
+    printf("Options:\n");
+    printf("  -j <threads>  Number of threads, 0 for all hardware threads (default 0)\n");
+    printf("  -o <dir>      Output cache directory (default " TERRAIN_CACHE_DIR ")\n");
+    printf("  -f            Regenerate chunks that are already cached\n");
+    printf("  -g <file>     World graph (default " WORLD_GRAPH_FILE ")\n");
+    printf("  -e <error>    Interpolate smooth tiles within this height error (default 0, off)\n");
+    printf("  -E <n>        Erode chunks for n iterations with the default settings (default 0, off)\n");
+}
+
+static bool parseInt(const char *str, int *out)
+{
+    char *end;
+    long value = strtol(str, &end, 10);
+    if (end == str || *end)
+        return false;
+
+    *out = (int)value;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = 0;
+    const char *outDir = TERRAIN_CACHE_DIR;
+    const char *graphPath = WORLD_GRAPH_FILE;
+    bool force = false;
+
+    int rect[4];
+    int nrect = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc)
+        {
+            if (!parseInt(argv[++i], &threads))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            outDir = argv[++i];
+        else if (!strcmp(argv[i], "-f"))
+            force = true;
+        else if (!strcmp(argv[i], "-g") && i + 1 < argc)
+            graphPath = argv[++i];
+        else if (!strcmp(argv[i], "-e") && i + 1 < argc)
+            setAdaptiveTolerance((float)atof(argv[++i]));
+        else if (!strcmp(argv[i], "-E") && i + 1 < argc)
+            setErosion(defaultErosion(max(atoi(argv[++i]), 0)));
+        else if (nrect < 4 && parseInt(argv[i], &rect[nrect]))
+            nrect++;
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (nrect != 4)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const int x0 = min(rect[0], rect[2]);
+    const int y0 = min(rect[1], rect[3]);
+    const int x1 = max(rect[0], rect[2]);
+    const int y1 = max(rect[1], rect[3]);
+
+    const int width = x1 - x0 + 1;
+    const int total = width * (y1 - y0 + 1);
+
+    if (!loadWorldGraph(graphPath))
+        return 1;
+
+    if (ls_createdir(outDir) == -1)
+        ls_perror("ls_createdir"); // Usually exists already
+
+    ThreadPool pool(threads);
+
+    printf("Baking %d chunks (%d, %d) - (%d, %d) into %s with %d threads\n",
+        total, x0, y0, x1, y1, outDir, pool.threadCount());
+    printf("World graph %s, seed %u, kernel %s, adaptive error %g, erosion %d, signature %016llx\n",
+        graphPath, getWorldGraph().seed(), getHeightKernel(), (double)getAdaptiveTolerance(),
+        getErosion().iterations, (unsigned long long)worldSignature());
+
+    std::mutex printLock;
+    std::atomic<int> done(0);
+    std::atomic<int> generated(0);
+    std::atomic<int> failed(0);
+
+    const double start = ls_time64();
+
+    pool.parallelFor(total, 1, [&](size_t begin, size_t end)
+    {
+        /* Pool blocks, each worker reuses the ones it freed last */
+        half_float::half *heights = allocChunkMaps();
+        HeightBounds *bounds = allocChunkBounds();
+        ChunkScatter *scatter = allocChunkScatter();
+        if (!heights || !bounds || !scatter)
+        {
+            fprintf(stderr, "Failed to allocate chunk buffers\n");
+            exit(1);
+        }
+
+        half_float::half *normals = TERRAIN_DERIVED_NORMALS ? nullptr : heights + CHUNK_MIP_SIZE;
+        float *errors = (float *)(bounds + CHUNK_BOUNDS_COUNT);
+
+        for (size_t i = begin; i < end; i++)
+        {
+            const int x = x0 + (int)i % width;
+            const int y = y0 + (int)i / width;
+
+            char path[256];
+            pathForChunk(path, sizeof(path), outDir, x, y);
+
+            const double chunkStart = ls_time64();
+
+            bool cached = !force && readChunk(path, x, y, heights, normals, bounds, errors, scatter);
+
+            bool ok = true;
+            if (!cached)
+            {
+                generateArea(x, y, heights, normals, bounds, errors, scatter);
+                ok = writeChunk(path, x, y, heights, normals, bounds, errors, scatter);
+                generated++;
+            }
+
+            if (!ok)
+                failed++;
+
+            const double elapsed = ls_time64() - chunkStart;
+            const int n = ++done;
+
+            std::lock_guard<std::mutex> lock(printLock);
+            printf("[%*d/%d] %5.1f%% chunk %d, %d: %s (%.1f ms)\n",
+                (int)snprintf(nullptr, 0, "%d", total), n, total,
+                100.0 * n / total, x, y,
+                !ok ? "write failed" : cached ? "cached" : "generated",
+                elapsed * 1000.0);
+        }
+
+        freeChunkScatter(scatter);
+        freeChunkBounds(bounds);
+        freeChunkMaps(heights);
+    });
+
+    const double elapsed = ls_time64() - start;
+    const double samples = (double)generated * CHUNK_SIZE_SQ;
+
+    printf("Done in %.2f s: %d generated, %d cached, %d failed\n",
+        elapsed, generated.load(), total - generated.load(), failed.load());
+
+    if (elapsed > 0.0)
+    {
+        printf("Throughput: %.2f chunks/s, %.2f Msamples/s\n",
+            generated / elapsed, samples / elapsed / 1e6);
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,503 @@
+/* Generation micro-benchmarks, results are printed and written as JSON */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BENCH_HAS_TSC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#else
+#define BENCH_HAS_TSC 0
+#endif
+
+#include "atmosphere.h"
+#include "worldgen.h"
+#include "heightpreset.h"
+#include "scatter.h"
+#include "terrainquery.h"
+#include "threadpool.h"
+
+#define BENCH_VERSION 1
+
+// Side of the sample grid used by the per-sample benchmarks
+#define GRID_SIZE 256
+#define GRID_COUNT (GRID_SIZE * GRID_SIZE)
+
+// Fixed grid origin so every run evaluates the same positions
+static constexpr Vector2 kGridOrigin = Vector2(-1536.0f, 2304.0f);
+
+struct BenchResult
+{
+    std::string name;
+    double samples; // Samples per run
+    double seconds; // Median run time
+    double cycles; // Median run TSC ticks, 0 if unavailable
+    int threads;
+};
+
+static volatile float _sink; // Keeps results alive
+
+static inline uint64_t readTSC()
+{
+#if BENCH_HAS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static inline double now()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+/* Run fn repeats times after one warmup run, keep the median */
+template <typename F>
+static BenchResult run(const char *name, double samples, int repeats, F fn)
+{
+    fn(); // Warmup
+
+    std::vector<double> times(repeats);
+    std::vector<double> ticks(repeats);
+
+    for (int i = 0; i < repeats; i++)
+    {
+        double t0 = now();
+        uint64_t c0 = readTSC();
+
+        fn();
+
+        uint64_t c1 = readTSC();
+        double t1 = now();
+
+        times[i] = t1 - t0;
+        ticks[i] = (double)(c1 - c0);
+    }
+
+    std::sort(times.begin(), times.end());
+    std::sort(ticks.begin(), ticks.end());
+
+    BenchResult result;
+    result.name = name;
+    result.samples = samples;
+    result.seconds = times[repeats / 2];
+    result.cycles = ticks[repeats / 2];
+    result.threads = 1;
+
+    printf("%-28s %10.2f ns/sample %10.3f Msamples/s", name,
+        result.seconds / samples * 1e9, samples / result.seconds / 1e6);
+    if (BENCH_HAS_TSC)
+        printf(" %10.1f cycles/sample", result.cycles / samples);
+    printf("\n");
+
+    return result;
+}
+
+static inline Vector2 gridPosition(int i)
+{
+    return kGridOrigin + Vector2((float)(i % GRID_SIZE), (float)(i / GRID_SIZE));
+}
+
+static void usage(const char *argv0)
+{
+    printf("Usage: %s [options]\n\n", argv0);
+    printf("Options:\n");
+    printf("  -o <file>     JSON output file (default terrain_bench.json)\n");
+    printf("  -r <repeats>  Timed runs per benchmark, median is reported (default 5)\n");
+    printf("  -t <threads>  Maximum thread count for the scaling curve (default all)\n");
+    printf("  -g <file>     World graph (default " WORLD_GRAPH_FILE ")\n");
+    printf("  -e <error>    Adaptive generation error for the chunk passes (default 0, off)\n");
+    printf("  -E <n>        Erode chunks for n iterations with the default settings (default 0, off)\n");
+}
+
+static void writeJSON(const char *path, const std::vector<BenchResult> &results, const std::vector<BenchResult> &scaling)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        perror("fopen");
+        return;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"version\": %d,\n", BENCH_VERSION);
+    fprintf(file, "  \"world_signature\": \"%016llx\",\n", (unsigned long long)worldSignature());
+    fprintf(file, "  \"chunk_size\": %d,\n", CHUNK_SIZE);
+    fprintf(file, "  \"height_kernel\": \"%s\",\n", getHeightKernel());
+    fprintf(file, "  \"tolerance\": %.9g,\n", (double)getWorldGraph().tolerance());
+    fprintf(file, "  \"adaptive_tolerance\": %.9g,\n", (double)getAdaptiveTolerance());
+    fprintf(file, "  \"has_tsc\": %s,\n", BENCH_HAS_TSC ? "true" : "false");
+
+    fprintf(file, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        fprintf(file, "    {\"name\": \"%s\", \"samples\": %.0f, \"seconds\": %.9f, \"ns_per_sample\": %.4f, \"samples_per_sec\": %.1f, \"cycles_per_sample\": %.2f}%s\n",
+            r.name.c_str(), r.samples, r.seconds,
+            r.seconds / r.samples * 1e9, r.samples / r.seconds, r.cycles / r.samples,
+            i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ],\n");
+
+    fprintf(file, "  \"scaling\": [\n");
+    for (size_t i = 0; i < scaling.size(); i++)
+    {
+        const BenchResult &r = scaling[i];
+        fprintf(file, "    {\"threads\": %d, \"samples\": %.0f, \"seconds\": %.9f, \"samples_per_sec\": %.1f, \"speedup\": %.3f}%s\n",
+            r.threads, r.samples, r.seconds, r.samples / r.seconds,
+            scaling[0].seconds / r.seconds,
+            i + 1 < scaling.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n");
+
+    fprintf(file, "}\n");
+    fclose(file);
+
+    printf("Results written to %s\n", path);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *outPath = "terrain_bench.json";
+    int repeats = 5;
+    int maxThreads = (int)std::thread::hardware_concurrency();
+    const char *graphPath = WORLD_GRAPH_FILE;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            outPath = argv[++i];
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            repeats = max(atoi(argv[++i]), 1);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            maxThreads = max(atoi(argv[++i]), 1);
+        else if (!strcmp(argv[i], "-g") && i + 1 < argc)
+            graphPath = argv[++i];
+        else if (!strcmp(argv[i], "-e") && i + 1 < argc)
+            setAdaptiveTolerance((float)atof(argv[++i]));
+        else if (!strcmp(argv[i], "-E") && i + 1 < argc)
+            setErosion(defaultErosion(max(atoi(argv[++i]), 0)));
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    maxThreads = max(maxThreads, 1);
+
+    if (!loadWorldGraph(graphPath))
+        return 1;
+
+    printf("World graph %s, %d instructions, kernel %s, tolerance %g, adaptive error %g, erosion %d\n\n", graphPath,
+        (int)getWorldGraph().instructionCount(), getHeightKernel(), (double)getWorldGraph().tolerance(),
+        (double)getAdaptiveTolerance(), getErosion().iterations);
+
+    std::vector<BenchResult> results;
+    char name[64];
+
+    /* Noise */
+    for (int octaves = 1; octaves <= 8; octaves++)
+    {
+        snprintf(name, sizeof(name), "snoise/octaves:%d", octaves);
+        results.push_back(run(name, GRID_COUNT, repeats, [octaves]()
+        {
+            float sum = 0.0f;
+            for (int i = 0; i < GRID_COUNT; i++)
+                sum += snoise(gridPosition(i) * (1.0f / 64.0f), 0.5f, octaves);
+            _sink = sum;
+        }));
+    }
+
+    /* Layers */
+    for (int l = 0; l < HEIGHT_LAYER_COUNT; l++)
+    {
+        HeightLayer layer = kHeightLayers[l];
+
+        snprintf(name, sizeof(name), "layer%d", l + 1);
+        results.push_back(run(name, GRID_COUNT, repeats, [layer]()
+        {
+            float sum = 0.0f;
+            for (int i = 0; i < GRID_COUNT; i++)
+                sum += layer(gridPosition(i));
+            _sink = sum;
+        }));
+    }
+
+    /* Transforms, each is fed the output of the previous stage */
+    std::vector<float> stages((HEIGHT_TRANSFORM_COUNT + 1) * GRID_COUNT);
+    for (int i = 0; i < GRID_COUNT; i++)
+    {
+        Vector2 pos = gridPosition(i);
+
+        float value = 0.0f;
+        for (int l = 0; l < HEIGHT_LAYER_COUNT; l++)
+            value += kHeightLayers[l](pos);
+
+        stages[i] = value;
+        for (int t = 0; t < HEIGHT_TRANSFORM_COUNT; t++)
+        {
+            value = kHeightTransforms[t](pos, value);
+            stages[(t + 1) * GRID_COUNT + i] = value;
+        }
+    }
+
+    for (int t = 0; t < HEIGHT_TRANSFORM_COUNT; t++)
+    {
+        HeightTransform transform = kHeightTransforms[t];
+        const float *in = stages.data() + t * GRID_COUNT;
+
+        snprintf(name, sizeof(name), "transform%d", t + 1);
+        results.push_back(run(name, GRID_COUNT, repeats, [transform, in]()
+        {
+            float sum = 0.0f;
+            for (int i = 0; i < GRID_COUNT; i++)
+                sum += transform(gridPosition(i), in[i]);
+            _sink = sum;
+        }));
+    }
+
+    results.push_back(run("graph", GRID_COUNT, repeats, []()
+    {
+        const NoiseProgram &graph = getWorldGraph();
+
+        float sum = 0.0f;
+        for (int i = 0; i < GRID_COUNT; i++)
+            sum += graph.evaluate(gridPosition(i));
+        _sink = sum;
+    }));
+
+    results.push_back(run("computeHeight", GRID_COUNT, repeats, []()
+    {
+        float sum = 0.0f;
+        for (int i = 0; i < GRID_COUNT; i++)
+            sum += computeHeight(gridPosition(i));
+        _sink = sum;
+    }));
+
+    /* Chunk passes */
+    std::vector<half_float::half> heightmap(CHUNK_MIP_SIZE);
+    std::vector<half_float::half> normalmap(CHUNK_MIP_SIZE * 3);
+    std::vector<HeightBounds> bounds(CHUNK_BOUNDS_COUNT);
+    std::vector<float> errors(CHUNK_PATCH_COUNT);
+    ChunkScatter *scatter = allocChunkScatter();
+    std::vector<float> padded(CHUNK_PADDED_SIZE_SQ);
+    std::vector<float> blurred(CHUNK_PADDED_SIZE_SQ);
+
+    generateHeights(0, 0, padded.data(), heightmap.data());
+
+    results.push_back(run("pass/heights", CHUNK_SIZE_SQ, repeats, [&]()
+    {
+        generateHeights(0, 0, padded.data(), heightmap.data());
+    }));
+
+    results.push_back(run("pass/blur", CHUNK_SIZE_SQ, repeats, [&]()
+    {
+        blurHeights(padded.data(), blurred.data());
+    }));
+
+    /* Erosion of the padded image alone, without its margin */
+    const ErosionSettings erosion = getErosion().iterations > 0 ? getErosion() : defaultErosion(32);
+    std::vector<float> eroded(CHUNK_PADDED_SIZE_SQ);
+
+    snprintf(name, sizeof(name), "pass/erosion:%d", erosion.iterations);
+    results.push_back(run(name, CHUNK_SIZE_SQ, repeats, [&]()
+    {
+        eroded = padded;
+        erodeHeights(eroded.data(), CHUNK_PADDED_SIZE, erosion);
+    }));
+
+    results.push_back(run("pass/normals", CHUNK_SIZE_SQ, repeats, [&]()
+    {
+        generateNormals(blurred.data(), normalmap.data());
+    }));
+
+    results.push_back(run("pass/levels", CHUNK_SIZE_SQ, repeats, [&]()
+    {
+        generateLevels(padded.data(), heightmap.data(), normalmap.data());
+    }));
+
+    results.push_back(run("pass/bounds", CHUNK_SIZE_SQ, repeats, [&]()
+    {
+        generateBounds(padded.data(), bounds.data());
+    }));
+
+    results.push_back(run("pass/patches", CHUNK_SIZE_SQ, repeats, [&]()
+    {
+        generatePatchErrors(padded.data(), errors.data());
+    }));
+
+    results.push_back(run("pass/scatter", CHUNK_SIZE_SQ, repeats, [&]()
+    {
+        generateScatter(0, 0, padded.data(), scatter);
+    }));
+
+    results.push_back(run("generateArea", CHUNK_SIZE_SQ, repeats, [&]()
+    {
+        generateArea(0, 0, heightmap.data(), normalmap.data(), bounds.data(), errors.data(), scatter);
+    }));
+
+    /* As built with TERRAIN_DERIVED_NORMALS */
+    results.push_back(run("generateArea/heights", CHUNK_SIZE_SQ, repeats, [&]()
+    {
+        generateArea(0, 0, heightmap.data(), nullptr, bounds.data(), errors.data(), scatter);
+    }));
+
+    freeChunkScatter(scatter);
+
+    /* Chunk buffers as the generator takes them, from the pools after the
+     * first round */
+    results.push_back(run("pool/chunk", 1000, repeats, []()
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            half_float::half *maps = allocChunkMaps();
+            HeightBounds *chunkBounds = allocChunkBounds();
+            maps[0] = 0.0f;
+            chunkBounds[0].min = 0.0f;
+            freeChunkBounds(chunkBounds);
+            freeChunkMaps(maps);
+        }
+    }));
+
+    /* Queries over the chunk just generated */
+    TerrainQuery query(false);
+    query.insert(0, 0, heightmap.data(), bounds.data());
+
+    std::vector<Vector2> points(GRID_COUNT);
+    for (int i = 0; i < GRID_COUNT; i++)
+    {
+        const float u = ((float)(i % GRID_SIZE) + 0.37f) / GRID_SIZE - 0.5f;
+        const float v = ((float)(i / GRID_SIZE) + 0.61f) / GRID_SIZE - 0.5f;
+        points[i] = Vector2(u, v) * (float)CHUNK_WORLD_SIZE;
+    }
+
+    std::vector<float> queried(GRID_COUNT);
+    std::vector<Vector3> queriedNormals(GRID_COUNT);
+
+    results.push_back(run("query/heights", GRID_COUNT, repeats, [&]()
+    {
+        query.heights(points.data(), GRID_COUNT, queried.data());
+    }));
+
+    results.push_back(run("query/normals", GRID_COUNT, repeats, [&]()
+    {
+        query.normals(points.data(), GRID_COUNT, queriedNormals.data());
+    }));
+
+    /* Rays from above the chunk, straight down and grazing across it */
+    const HeightBounds &root = bounds[CHUNK_BOUNDS_COUNT - 1];
+    std::vector<TerrainRay> downRays(GRID_COUNT), shallowRays(GRID_COUNT);
+    for (int i = 0; i < GRID_COUNT; i++)
+    {
+        downRays[i].origin = Vector3(points[i].x, root.max + 1.0f, points[i].y);
+        downRays[i].direction = Vector3(0.0f, -1.0f, 0.0f);
+        downRays[i].maxT = INFINITY;
+
+        const float angle = (float)i * 2.39996f;
+        shallowRays[i].origin = downRays[i].origin;
+        shallowRays[i].direction = Vector3(cosf(angle), -0.1f, sinf(angle));
+        shallowRays[i].maxT = INFINITY;
+    }
+
+    std::vector<TerrainHit> hits(GRID_COUNT);
+
+    results.push_back(run("raycast/down", GRID_COUNT, repeats, [&]()
+    {
+        query.raycast(downRays.data(), GRID_COUNT, hits.data());
+    }));
+
+    results.push_back(run("raycast/shallow", GRID_COUNT, repeats, [&]()
+    {
+        query.raycast(shallowRays.data(), GRID_COUNT, hits.data());
+    }));
+
+    /* Sky radiance over the sphere, one ray at a time and batched */
+    AtmosphereParams params;
+    params.planetRadius = 6371e3f;
+    params.atmosphereRadius = 6471e3f;
+    params.Hr = 7994.0f;
+    params.Hm = 1200.0f;
+    params.g = 0.76f;
+
+    AtmosphereLUT *lut = new AtmosphereLUT();
+    lut->compute(params);
+
+    const Vector3 toSun = normalize(Vector3(0.3f, 0.4f, 0.8f));
+    std::vector<Vector3> directions(GRID_COUNT);
+    for (int i = 0; i < GRID_COUNT; i++)
+    {
+        /* Fibonacci sphere */
+        const float y = 1.0f - 2.0f * (i + 0.5f) / GRID_COUNT;
+        const float r = sqrtf(max(1.0f - y * y, 0.0f));
+        const float angle = (float)i * 2.39996f;
+        directions[i] = Vector3(r * cosf(angle), y, r * sinf(angle));
+    }
+
+    std::vector<Vector3> single(GRID_COUNT), batched(GRID_COUNT);
+
+    results.push_back(run("sky/single", GRID_COUNT, repeats, [&]()
+    {
+        for (int i = 0; i < GRID_COUNT; i++)
+            lut->evaluate(toSun, 100.0f, &directions[i], &single[i], 1);
+    }));
+
+    results.push_back(run("sky/batched", GRID_COUNT, repeats, [&]()
+    {
+        lut->evaluate(toSun, 100.0f, directions.data(), batched.data(), GRID_COUNT);
+    }));
+
+    /* Lanes integrate exactly like a single ray */
+    float skyError = 0.0f;
+    for (int i = 0; i < GRID_COUNT; i++)
+        skyError = max(skyError, length(batched[i] - single[i]) / max(length(single[i]), 1e-6f));
+    if (skyError > 1e-5f)
+        printf("sky/batched differs from sky/single by up to %g relative\n", (double)skyError);
+
+    delete lut;
+
+    /* Thread scaling, one chunk per thread at the maximum thread count */
+    printf("\nScaling (%d chunks)\n", maxThreads);
+
+    std::vector<BenchResult> scaling;
+    const int chunks = maxThreads;
+
+    for (int threads = 1; threads <= maxThreads; threads = threads < maxThreads ? min(threads * 2, maxThreads) : threads + 1)
+    {
+        ThreadPool pool(threads);
+
+        snprintf(name, sizeof(name), "threads:%d", threads);
+        BenchResult result = run(name, (double)chunks * CHUNK_SIZE_SQ, max(repeats / 2, 1), [&]()
+        {
+            pool.parallelFor(chunks, 1, [](size_t begin, size_t end)
+            {
+                std::vector<half_float::half> h(CHUNK_MIP_SIZE);
+                std::vector<half_float::half> n(CHUNK_MIP_SIZE * 3);
+                std::vector<HeightBounds> b(CHUNK_BOUNDS_COUNT);
+                std::vector<float> e(CHUNK_PATCH_COUNT);
+                ChunkScatter *s = allocChunkScatter();
+                for (size_t i = begin; i < end; i++)
+                    generateArea((int32_t)i, 0, h.data(), n.data(), b.data(), e.data(), s);
+                freeChunkScatter(s);
+            });
+        });
+
+        result.threads = threads;
+        scaling.push_back(result);
+    }
+
+    writeJSON(outPath, results, scaling);
+
+    return 0;
+}
@@ -1,10 +1,16 @@
 #include "bloom.h"
 
 #include "engine.h"
+#include "glresource.h"
 #include "shader.h"
 
 static constexpr float kFilterRadius = 0.005f;
 
+static inline GLTextureDesc stageDesc(const BloomStage &stage)
+{
+    return {GL_TEXTURE_2D, GL_R11F_G11F_B10F, stage.size.x, stage.size.y, 1};
+}
+
 void Bloom::render(GLuint srcTexture) const
 {
     glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
@@ -31,9 +37,17 @@ void Bloom::resize(int width, int height)
         stage.size = size;
         stage.fsize = Vector2(size);
 
-        glGenTextures(1, &stage.texture);
-        glBindTexture(GL_TEXTURE_2D, stage.texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, size.x, size.y, 0, GL_RGB, GL_FLOAT, NULL);
+        /* Resizing back to an earlier size reuses its storage */
+        stage.texture = acquireGLTexture(stageDesc(stage));
+        if (stage.texture)
+            glBindTexture(GL_TEXTURE_2D, stage.texture);
+        else
+        {
+            glGenTextures(1, &stage.texture);
+            glBindTexture(GL_TEXTURE_2D, stage.texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, size.x, size.y, 0, GL_RGB, GL_FLOAT, NULL);
+        }
+
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -72,14 +86,14 @@ void Bloom::unload()
     {
         if (_stages[i].texture)
         {
-            glDeleteTextures(1, &_stages[i].texture);
+            recycleGLTexture(_stages[i].texture, stageDesc(_stages[i]));
             _stages[i].texture = 0;
         }
     }
 
     if (_fbo)
     {
-        glDeleteFramebuffers(1, &_fbo);
+        releaseGLFramebuffers(1, &_fbo);
         _fbo = 0;
     }
 }
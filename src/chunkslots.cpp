@@ -0,0 +1,217 @@
+#include "chunkslots.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "arena.h"
+#include "glresource.h"
+#include "shader.h"
+#include "staging.h"
+
+// Samples in a mip chain
+static size_t mipSamples(GLsizei width, GLsizei height, GLsizei levels)
+{
+    size_t samples = 0;
+    for (GLsizei level = 0; level < levels; level++)
+        samples += (size_t)std::max(width >> level, 1) * std::max(height >> level, 1);
+    return samples;
+}
+
+static GLuint createArray(GLenum internalformat, GLenum format, GLenum type, GLsizei width, GLsizei height, GLsizei levels, GLsizei count,
+                          GLint filter = GL_LINEAR)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+
+    /* Immutable storage where available, the context only asks for 4.1 */
+    if (GLAD_GL_VERSION_4_2)
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, internalformat, width, height, count);
+    else
+    {
+        for (GLsizei level = 0; level < levels; level++)
+        {
+            const GLsizei w = std::max(width >> level, 1), h = std::max(height >> level, 1);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, internalformat, w, h, count, 0, format, type, nullptr);
+        }
+    }
+
+    const GLint minFilter = levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : filter;
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, filter);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    return texture;
+}
+
+void ChunkSlots::load(GLsizei width, GLsizei height, GLsizei levels, GLsizei count, bool normals, GLsizei patches)
+{
+    unload();
+
+    _width = width;
+    _height = height;
+    _levels = levels;
+    _count = count;
+    _patchCount = patches;
+
+    _heights = createArray(GL_R16F, GL_RED, GL_HALF_FLOAT, width, height, levels, count);
+    if (normals)
+        _normals = createArray(GL_RG16_SNORM, GL_RG, GL_SHORT, width, height, levels, count);
+    if (patches > 0)
+        _patches = createArray(GL_RGBA32F, GL_RGBA, GL_FLOAT, patches, patches, 1, count, GL_NEAREST);
+
+    for (int32_t slot = 0; slot < count; slot++)
+        _free.push_back(slot);
+}
+
+int32_t ChunkSlots::alloc()
+{
+    if (_free.empty())
+        return -1;
+
+    const int32_t slot = _free.front();
+    _free.pop_front();
+    return slot;
+}
+
+void ChunkSlots::free(int32_t slot)
+{
+    if (slot >= 0 && slot < _count)
+        _free.push_back(slot);
+}
+
+static inline int16_t toSnorm16(float v)
+{
+    return (int16_t)lrintf(fminf(fmaxf(v, -1.0f), 1.0f) * 32767.0f);
+}
+
+// Hemi-octahedral encoding of upward normals, decoded by decodeHemiOct
+static void encodeNormals(const half_float::half *normals, int16_t *out, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const float x = normals[i * 3 + 0];
+        const float y = normals[i * 3 + 1];
+        const float z = normals[i * 3 + 2];
+
+        /* Project onto the octahedron, then rotate the upper half to fill the square */
+        const float sum = fabsf(x) + fabsf(y) + fabsf(z);
+        const float px = sum > 0.0f ? x / sum : 0.0f;
+        const float pz = sum > 0.0f ? z / sum : 0.0f;
+
+        out[i * 2 + 0] = toSnorm16(px + pz);
+        out[i * 2 + 1] = toSnorm16(px - pz);
+    }
+}
+
+static void uploadLevels(GLuint texture, int32_t slot, GLenum format, GLenum type, const uint8_t *pixels, size_t texelSize,
+                         GLsizei width, GLsizei height, GLsizei levels)
+{
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+
+    size_t offset = 0;
+    for (GLsizei level = 0; level < levels; level++)
+    {
+        const GLsizei w = std::max(width >> level, 1), h = std::max(height >> level, 1);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, slot, w, h, 1, format, type, pixels + offset);
+        offset += (size_t)w * h * texelSize;
+    }
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void ChunkSlots::upload(int32_t slot, const half_float::half *heights, const half_float::half *normals)
+{
+    if (slot < 0 || slot >= _count)
+        return;
+
+    const size_t samples = mipSamples(_width, _height, _levels);
+    const size_t heightBytes = samples * sizeof(half_float::half);
+    const size_t normalBytes = _normals ? samples * 2 * sizeof(int16_t) : 0;
+
+    /* Normals are encoded straight into the staging ring */
+    Staging staging;
+    if (beginStaging(heightBytes + normalBytes, &staging))
+    {
+        memcpy(staging.data, heights, heightBytes);
+        if (_normals)
+            encodeNormals(normals, (int16_t *)(staging.data + heightBytes), samples);
+        useStaging(staging);
+
+        const uint8_t *pixels = (const uint8_t *)stagingPixels(staging, 0);
+        uploadLevels(_heights, slot, GL_RED, GL_HALF_FLOAT, pixels, sizeof(half_float::half), _width, _height, _levels);
+        if (_normals)
+            uploadLevels(_normals, slot, GL_RG, GL_SHORT, pixels + heightBytes, 2 * sizeof(int16_t), _width, _height, _levels);
+
+        endStaging(staging);
+    }
+    else if (_normals)
+    {
+        ScratchScope scope;
+        int16_t *encoded = scope.arena().alloc<int16_t>(samples * 2);
+        encodeNormals(normals, encoded, samples);
+
+        uploadLevels(_heights, slot, GL_RED, GL_HALF_FLOAT, (const uint8_t *)heights, sizeof(half_float::half), _width, _height, _levels);
+        uploadLevels(_normals, slot, GL_RG, GL_SHORT, (const uint8_t *)encoded, 2 * sizeof(int16_t), _width, _height, _levels);
+    }
+    else
+        uploadLevels(_heights, slot, GL_RED, GL_HALF_FLOAT, (const uint8_t *)heights, sizeof(half_float::half), _width, _height, _levels);
+}
+
+void ChunkSlots::uploadPatches(int32_t slot, const float *patches)
+{
+    if (slot < 0 || slot >= _count || !_patches)
+        return;
+
+    /* A few KB, not worth a staging */
+    uploadLevels(_patches, slot, GL_RGBA, GL_FLOAT, (const uint8_t *)patches, 4 * sizeof(float), _patchCount, _patchCount, 1);
+}
+
+void ChunkSlots::bind(Shader *shader) const
+{
+    shader->setTextureArray("uHeightmap", _heights, CHUNK_HEIGHTS_UNIT);
+    shader->setTextureArray("uNormalmap", _normals, CHUNK_NORMALS_UNIT);
+    shader->setTextureArray("uPatches", _patches, CHUNK_PATCHES_UNIT);
+    shader->setBool("uDerivedNormals", _normals == 0);
+    shader->setBool("uHasPatches", _patches != 0);
+}
+
+ChunkSlots::ChunkSlots() : _heights(0), _normals(0), _patches(0),
+                           _width(0), _height(0), _levels(0), _count(0), _patchCount(0)
+{
+}
+
+ChunkSlots::~ChunkSlots()
+{
+    unload();
+}
+
+void ChunkSlots::unload()
+{
+    if (_heights)
+    {
+        releaseGLTextures(1, &_heights);
+        _heights = 0;
+    }
+
+    if (_normals)
+    {
+        releaseGLTextures(1, &_normals);
+        _normals = 0;
+    }
+
+    if (_patches)
+    {
+        releaseGLTextures(1, &_patches);
+        _patches = 0;
+    }
+
+    _free.clear();
+    _count = 0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+
+#include <glad/glad.h>
+#include <half.hpp>
+
+class Shader;
+
+// Texture units the slot arrays are bound to
+#define CHUNK_HEIGHTS_UNIT 30
+#define CHUNK_NORMALS_UNIT 31
+#define CHUNK_PATCHES_UNIT 29
+
+/* Height and normal maps of many chunks in two texture arrays, one layer per
+ * slot. Storage is allocated once, loading a chunk only uploads into a free
+ * slot.
+ *
+ * Heights are R16F. Normals point up, so they are stored hemi-octahedral in
+ * RG16_SNORM, half of an RGB16F texel once drivers pad it to RGBA. The
+ * encoding is continuous over the hemisphere and filters linearly.
+ *
+ * Patches hold one RGBA32F texel per tessellation patch, the height bounds
+ * and the error of the patch, for the control shader to cull and pick levels.
+ */
+class ChunkSlots final
+{
+public:
+    /* Storage for count slots of width x height maps with levels mips. Without
+     * normals the terrain shader derives them from the heights. patches x
+     * patches texels of patch data per slot, none if 0 */
+    void load(GLsizei width, GLsizei height, GLsizei levels, GLsizei count, bool normals = true, GLsizei patches = 0);
+
+    // A free slot, -1 if all are taken
+    int32_t alloc();
+    void free(int32_t slot);
+
+    /* Heights and RGB normals hold the mips of a slot, each half the size of
+     * the last. Normals are ignored if the slots have none */
+    void upload(int32_t slot, const half_float::half *heights, const half_float::half *normals);
+
+    // Row major min height, max height, error, unused per patch
+    void uploadPatches(int32_t slot, const float *patches);
+
+    /* Bind the arrays to uHeightmap, uNormalmap and uPatches, set
+     * uDerivedNormals and uHasPatches */
+    void bind(Shader *shader) const;
+
+    constexpr GLsizei count() const { return _count; }
+
+    ChunkSlots();
+    ~ChunkSlots();
+
+    ChunkSlots(const ChunkSlots &) = delete;
+    ChunkSlots &operator=(const ChunkSlots &) = delete;
+
+private:
+    GLuint _heights, _normals, _patches;
+    GLsizei _width, _height, _levels, _count, _patchCount;
+
+    // Oldest first, so a freed layer is reused as late as possible
+    std::deque<int32_t> _free;
+
+    void unload();
+};
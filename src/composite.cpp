@@ -5,27 +5,44 @@
 
 #include "engine.h"
 #include "gbuffer.h"
+#include "glresource.h"
 #include "shader.h"
 #include "util.h"
 
-static void setupAttachment(const OutputSpec &spec, GLsizei width, GLsizei height)
+static inline GLTextureDesc attachmentDesc(const OutputSpec &spec, GLsizei width, GLsizei height)
 {
-    glTexImage2D(
-        GL_TEXTURE_2D,
-        0,
-        spec.internalFormat,
-        width, height,
-        0,
-        spec.format,
-        spec.type,
-        NULL);
+    return {GL_TEXTURE_2D, spec.internalFormat, width, height, 1};
+}
+
+static GLuint createAttachment(const OutputSpec &spec, GLsizei width, GLsizei height)
+{
+    /* Resizing back to an earlier size reuses its storage */
+    GLuint tex = acquireGLTexture(attachmentDesc(spec, width, height));
+    if (tex)
+        glBindTexture(GL_TEXTURE_2D, tex);
+    else
+    {
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexImage2D(
+            GL_TEXTURE_2D,
+            0,
+            spec.internalFormat,
+            width, height,
+            0,
+            spec.format,
+            spec.type,
+            NULL);
+    }
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-    checkGLErrors("setupAttachment");
+    checkGLErrors("createAttachment");
+
+    return tex;
 }
 
 void Compositor::render(Shader *shader, const Gbuffer *gbuffer, const Compositor *last) const
@@ -82,17 +99,13 @@ void Compositor::resize(GLsizei width, GLsizei height)
         return; // Output to default framebuffer
     
     glGenFramebuffers(1, &_fbo);
-    glGenTextures(_nOutputs, _textures);
 
     glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
 
     for (GLsizei i = 0; i < _nOutputs; i++)
     {
-        GLuint tex = _textures[i];
-        const OutputSpec &spec = _outputs[i];
-
-        glBindTexture(GL_TEXTURE_2D, tex);
-        setupAttachment(spec, width, height);
+        GLuint tex = createAttachment(_outputs[i], width, height);
+        _textures[i] = tex;
 
         glFramebufferTexture2D(
             GL_FRAMEBUFFER,
@@ -132,9 +145,10 @@ void Compositor::unload()
     if (!_fbo)
         return;
 
-    glDeleteTextures(_nOutputs, _textures);
+    for (GLsizei i = 0; i < _nOutputs; i++)
+        recycleGLTexture(_textures[i], attachmentDesc(_outputs[i], _width, _height));
     memset(_textures, 0, sizeof(_textures));
 
-    glDeleteFramebuffers(1, &_fbo);
+    releaseGLFramebuffers(1, &_fbo);
     _fbo = 0;
 }
\ No newline at end of file
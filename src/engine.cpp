@@ -12,6 +12,7 @@
 #include <half.hpp>
 
 #include "mesh.h"
+#include "instancing.h"
 #include "shader.h"
 #include "skybox.h"
 #include "camera.h"
@@ -21,6 +22,9 @@
 #include "terrain.h"
 #include "bloom.h"
 #include "generator.h"
+#include "profiler.h"
+#include "glresource.h"
+#include "staging.h"
 
 static const Vector4 kQuadVertices[] = {
     Vector4(-1.0f, -1.0f, 0.0f, 0.0f),
@@ -220,6 +224,7 @@ static Bloom *_bloom;
 static Camera *_camera;
 
 static std::vector<RenderableMesh *> _meshes;
+static MeshBatches *_meshBatches; // Draws _meshes instanced
 static std::vector<Terrain *> _terrains;
 static Terrain *_water;
 static Skybox *_skybox;
@@ -369,6 +374,7 @@ namespace
 #include <shaders/final.frag.h>
 #include <shaders/generic.frag.h>
 #include <shaders/generic.vert.h>
+#include <shaders/scatter.vert.h>
 #include <shaders/screen.vert.h>
 #include <shaders/skybox.frag.h>
 #include <shaders/skybox.vert.h>
@@ -410,6 +416,9 @@ static void loadShaders()
     Shader *generic = getShader(SHADER_GENERIC);
     generic->load("generic", generic_vert_source, generic_frag_source);
 
+    Shader *scatter = getShader(SHADER_SCATTER);
+    scatter->load("scatter", scatter_vert_source, generic_frag_source);
+
     Shader *skybox = getShader(SHADER_SKYBOX);
     skybox->load("skybox", skybox_vert_source, skybox_frag_source);
 
@@ -538,6 +547,9 @@ void initAll(int argc, char *argv[])
     if (!gladLoadGLLoader((void *(*)(const char *))SDL_GL_GetProcAddress))
         fatal("gladLoadGLLoader failed\n");
 
+    /* Ring the texture uploads are staged in */
+    createStaging();
+
     /* Setup ImGui */
 
     IMGUI_CHECKVERSION();
@@ -555,6 +567,8 @@ void initAll(int argc, char *argv[])
 
     createNoiseTex();
 
+    profilerInit();
+
     /* Enable vsync */
     _vsync = true;
     SDL_GL_SetSwapInterval(_vsync ? 1 : 0);
@@ -587,6 +601,8 @@ void initAll(int argc, char *argv[])
     _skybox = new Skybox();
     _skybox->load();
 
+    _meshBatches = new MeshBatches();
+
     /* Create water */
     _water = new Terrain();
     _water->setUseMaterials(false);
@@ -609,6 +625,8 @@ void quitAll()
         terrain->release();
     _terrains.clear();
 
+    delete _meshBatches;
+
     for (RenderableMesh *mesh : _meshes)
         mesh->release();
     _meshes.clear();
@@ -634,6 +652,11 @@ void quitAll()
 
     destroyQuad();
 
+    profilerShutdown();
+
+    destroyStaging();
+    destroyGLReleases();
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplSDL3_Shutdown();
     ImGui::DestroyContext();
@@ -716,6 +739,8 @@ bool beginFrame()
     _deltaTime = time - _startFrameTime;
     _startFrameTime = time;
 
+    profilerBeginFrame();
+
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplSDL3_NewFrame();
     ImGui::NewFrame();
@@ -727,14 +752,20 @@ bool beginFrame()
 
 void renderAll()
 {
+    PROFILE_SCOPE("Render");
+
     /* Update camera */
     _camera->update();
 
     /* Re-render skybox if needed */
-    if (_skybox->update(_camera))
     {
-        _skybox->renderSkybox();
-        _skybox->renderIrradiance();
+        PROFILE_GPU_SCOPE("Sky update");
+        if (_skybox->update(_camera))
+        {
+            _skybox->renderSkybox();
+            _skybox->renderIrradiance();
+        }
+        _skybox->updateIrradiance();
     }
 
     /* Render to Gbuffer */
@@ -763,13 +794,10 @@ void renderAll()
     genericShader->setCubemap("uIrradiance", _skybox->irradiance(), IRRADIANCE_TEXTURE_UNIT);
 
     glDepthFunc(GL_LESS);
-    for (RenderableMesh *mesh : _meshes)
     {
-        if (mesh->enabled())
-        {
-            mesh->update();
-            mesh->render(genericShader);
-        }
+        PROFILE_GPU_SCOPE("Meshes");
+        _meshBatches->update(_meshes);
+        _meshBatches->render(genericShader);
     }
 
     /* Render terrains */
@@ -778,31 +806,59 @@ void renderAll()
     terrainShader->use();
 
     terrainShader->setBool("uWireframe", _wireframe);
+    terrainShader->setFloat("uViewportHeight", (float)_windowSize.y);
     terrainShader->setCubemap("uSkybox", _skybox->skybox(), SKYBOX_TEXTURE_UNIT);
     terrainShader->setCubemap("uIrradiance", _skybox->irradiance(), IRRADIANCE_TEXTURE_UNIT);
 
-    for (Terrain *terrain : _terrains)
     {
-        if (terrain->enabled())
+        PROFILE_GPU_SCOPE("Terrain");
+        for (Terrain *terrain : _terrains)
         {
-            terrain->update();
-            terrain->render(terrainShader);
+            if (terrain->enabled())
+            {
+                terrain->update();
+                terrain->render(terrainShader);
+            }
         }
     }
 
     /* Render generated terrain */
-    _generator->update();
-    _generator->render(terrainShader);
+    {
+        PROFILE_SCOPE("Generator update");
+        _generator->update();
+    }
+
+    {
+        PROFILE_GPU_SCOPE("Generated terrain");
+        _generator->render(terrainShader);
+    }
+
+    /* Props on the generated terrain */
+    {
+        PROFILE_GPU_SCOPE("Scatter");
+
+        Shader *scatterShader = getShader(SHADER_SCATTER);
+        scatterShader->use();
+
+        scatterShader->setBool("uWireframe", _wireframe);
+        scatterShader->setCubemap("uSkybox", _skybox->skybox(), SKYBOX_TEXTURE_UNIT);
+        scatterShader->setCubemap("uIrradiance", _skybox->irradiance(), IRRADIANCE_TEXTURE_UNIT);
+
+        _generator->renderScatter(scatterShader, _camera);
+    }
 
     /* Water */
     if (_water->enabled())
     {
+        PROFILE_GPU_SCOPE("Water");
+
         glDisable(GL_CULL_FACE); // Water is double-sided
 
         Shader *waterShader = getShader(SHADER_WATER);
         waterShader->use();
 
         waterShader->setBool("uWireframe", _wireframe);
+        waterShader->setFloat("uViewportHeight", (float)_windowSize.y);
         waterShader->setCubemap("uSkybox", _skybox->skybox(), SKYBOX_TEXTURE_UNIT);
         waterShader->setCubemap("uIrradiance", _skybox->irradiance(), IRRADIANCE_TEXTURE_UNIT);
 
@@ -824,7 +880,10 @@ void renderAll()
     skyboxShader->setTexture("uNoiseTex", _noiseTex, NOISE_TEXTURE_UNIT);
 
     glDepthFunc(GL_LEQUAL);
-    _skybox->render(skyboxShader);
+    {
+        PROFILE_GPU_SCOPE("Skybox");
+        _skybox->render(skyboxShader);
+    }
 
     /* Composite render */
 
@@ -833,9 +892,15 @@ void renderAll()
 
     if (_visualizeMode == VISUALIZE_NONE || _visualizeMode == VISUALIZE_COMPOSITOR)
     {
+        static const char *const kCompositeScopes[COMPOSITOR_COUNT] = {
+            "Composite 1", "Composite 2", "Composite 3", "Composite 4"
+        };
+
         Compositor *lastCompositor = nullptr;
         for (int i = 0; i < COMPOSITOR_COUNT; i++)
         {
+            PROFILE_GPU_SCOPE(kCompositeScopes[i]);
+
             ShaderID shaderID = (ShaderID)(SHADER_COMPOSITE1 + i);
             Shader *s = getShader(shaderID);
             s->use();
@@ -860,10 +925,15 @@ void renderAll()
         }
 
         /* Bloom */
-        _bloom->render(lastCompositor->getTexture(0));
+        {
+            PROFILE_GPU_SCOPE("Bloom");
+            _bloom->render(lastCompositor->getTexture(0));
+        }
 
         if (_visualizeMode == VISUALIZE_NONE)
         {
+            PROFILE_GPU_SCOPE("Final");
+
             /* Final composite render */
 
             Shader *s = getShader(SHADER_FINAL);
@@ -890,6 +960,8 @@ void renderAll()
         }
         else
         {
+            PROFILE_GPU_SCOPE("Visualize");
+
             Shader *visualizeShader = getShader(SHADER_VISUALIZE);
             visualizeShader->use();
             visualizeShader->setInt("uMode", _visualizeMode);
@@ -908,6 +980,8 @@ void renderAll()
     }
     else
     {
+        PROFILE_GPU_SCOPE("Visualize");
+
         Shader *visualizeShader = getShader(SHADER_VISUALIZE);
         visualizeShader->use();
         visualizeShader->setInt("uMode", _visualizeMode);
@@ -919,11 +993,19 @@ void renderAll()
 
 void endFrame()
 {
-    ImGui::Render();
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    {
+        PROFILE_GPU_SCOPE("ImGui");
+        ImGui::Render();
+        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    }
+
+    /* Swap is excluded, it mostly waits for vsync */
+    profilerEndFrame();
 
     SDL_GL_SwapWindow(_window);
 
+    flushGLReleases();
+
     _frame++;
 }
 
@@ -966,6 +1048,7 @@ void addMesh(RenderableMesh *mesh)
     {
         mesh->retain();
         _meshes.push_back(mesh);
+        _meshBatches->invalidate();
     }
 }
 
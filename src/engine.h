@@ -31,6 +31,7 @@ enum ShaderID
     SHADER_FINAL,
 
     SHADER_GENERIC,
+    SHADER_SCATTER,
     SHADER_SKYBOX,
     SHADER_SKYDOME,
     SHADER_TERRAIN,
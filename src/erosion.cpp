@@ -0,0 +1,335 @@
+#include "erosion.h"
+
+#include <cstring>
+#include <utility>
+
+#include <emmintrin.h>
+
+#include <mutil/mutil.h>
+
+#include "arena.h"
+#include "threadpool.h"
+
+using namespace mutil;
+
+/* The image is eroded in square tiles a few iterations at a time. A tile is
+ * copied to scratch with a halo wide enough for those iterations, stepped
+ * there while it stays in cache, and its interior written back. Tiles of a
+ * block are independent, the halos are refreshed from the shared image
+ * between blocks */
+
+// Samples a tile writes back per block
+#define EROSION_TILE 64
+
+// Iterations per block
+#define EROSION_BLOCK 4
+
+#define EROSION_HALO erosionMargin(EROSION_BLOCK)
+
+// Side of a tile with its halo
+#define EROSION_SIDE (EROSION_TILE + 2 * EROSION_HALO)
+
+// Scratch rows have room for the neighbours of the outermost vectors
+#define EROSION_PAD 4
+#define EROSION_STRIDE (EROSION_SIDE + 2 * EROSION_PAD)
+#define EROSION_FIELD (EROSION_STRIDE * EROSION_SIDE)
+
+// Keeps sediment ratios finite where there is no water
+#define EROSION_EPSILON 1e-6f
+
+static_assert(EROSION_SIDE % 4 == 0, "Tile rows must be whole vectors");
+
+ErosionSettings defaultErosion(int32_t iterations)
+{
+	ErosionSettings settings;
+	settings.iterations = iterations;
+	settings.rain = 0.02f;
+	settings.evaporation = 0.05f;
+	settings.capacity = 4.0f;
+	settings.erosion = 0.3f;
+	settings.deposition = 0.3f;
+	settings.talus = 1.2f;
+	settings.thermal = 0.5f;
+	return settings;
+}
+
+namespace
+{
+
+struct ErosionConstants
+{
+	__m128 rain, keep, capacity, erosion, deposition, talus, thermal;
+};
+
+/* Tile scratch, samples are at origin + row * EROSION_STRIDE + column. Heights,
+ * water and sediment are double buffered, scale and ratio are the flow scale
+ * and sediment per unit of water of each sample */
+struct TileScratch
+{
+	__m128 *memory;
+	float *height[2], *water[2], *sediment[2];
+	float *scale, *ratio;
+
+	TileScratch(ScratchArena &arena)
+	{
+		memory = arena.alloc<__m128>(8 * EROSION_FIELD / 4);
+		memset(memory, 0, 8 * EROSION_FIELD * sizeof(float));
+
+		float *base = (float *)memory + EROSION_PAD;
+		for (int i = 0; i < 2; i++)
+		{
+			height[i] = base + (3 * i + 0) * EROSION_FIELD;
+			water[i] = base + (3 * i + 1) * EROSION_FIELD;
+			sediment[i] = base + (3 * i + 2) * EROSION_FIELD;
+		}
+		scale = base + 6 * EROSION_FIELD;
+		ratio = base + 7 * EROSION_FIELD;
+	}
+};
+
+// Shared image fields
+struct ErosionFields
+{
+	float *height, *water, *sediment;
+};
+
+}
+
+static inline __m128 positive(__m128 v)
+{
+	return _mm_max_ps(v, _mm_setzero_ps());
+}
+
+/* Water leaving a sample is a quarter of its surface height over each lower
+ * neighbour, scaled down when that is more than the sample holds. Stores the
+ * scale including the quarter, and the sediment carried per unit of water */
+static void flowScale(const float *height, const float *water, const float *sediment, float *scale, float *ratio,
+	int32_t inset, const ErosionConstants &k)
+{
+	const __m128 quarter = _mm_set1_ps(0.25f);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 epsilon = _mm_set1_ps(EROSION_EPSILON);
+
+	const int32_t c0 = inset & ~3;
+	const int32_t c1 = (EROSION_SIDE - inset + 3) & ~3;
+
+	for (int32_t r = inset; r < EROSION_SIDE - inset; r++)
+	{
+		for (int32_t c = c0; c < c1; c += 4)
+		{
+			const int32_t i = r * EROSION_STRIDE + c;
+
+			const __m128 w = _mm_add_ps(_mm_load_ps(water + i), k.rain);
+			const __m128 s = _mm_add_ps(_mm_load_ps(height + i), w);
+
+			const __m128 sl = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(height + i - 1), _mm_loadu_ps(water + i - 1)), k.rain);
+			const __m128 sr = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(height + i + 1), _mm_loadu_ps(water + i + 1)), k.rain);
+			const __m128 su = _mm_add_ps(_mm_add_ps(_mm_load_ps(height + i - EROSION_STRIDE), _mm_load_ps(water + i - EROSION_STRIDE)), k.rain);
+			const __m128 sd = _mm_add_ps(_mm_add_ps(_mm_load_ps(height + i + EROSION_STRIDE), _mm_load_ps(water + i + EROSION_STRIDE)), k.rain);
+
+			const __m128 drop = _mm_add_ps(
+				_mm_add_ps(positive(_mm_sub_ps(s, sl)), positive(_mm_sub_ps(s, sr))),
+				_mm_add_ps(positive(_mm_sub_ps(s, su)), positive(_mm_sub_ps(s, sd))));
+
+			const __m128 wanted = _mm_max_ps(_mm_mul_ps(drop, quarter), epsilon);
+			const __m128 fraction = _mm_min_ps(_mm_div_ps(w, wanted), one);
+
+			_mm_store_ps(scale + i, _mm_mul_ps(fraction, quarter));
+			_mm_store_ps(ratio + i, _mm_div_ps(_mm_load_ps(sediment + i), _mm_max_ps(w, epsilon)));
+		}
+	}
+}
+
+/* Move water and sediment, erode or deposit against the capacity, then slump
+ * slopes over the talus and evaporate */
+static void erodeStep(const float *height, const float *water, const float *sediment, const float *scale,
+	const float *ratio, float *heightOut, float *waterOut, float *sedimentOut, int32_t inset, const ErosionConstants &k)
+{
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 quarter = _mm_set1_ps(0.25f);
+
+	const int32_t c0 = inset & ~3;
+	const int32_t c1 = (EROSION_SIDE - inset + 3) & ~3;
+
+	const int32_t offsets[4] = { -1, 1, -EROSION_STRIDE, EROSION_STRIDE };
+
+	for (int32_t r = inset; r < EROSION_SIDE - inset; r++)
+	{
+		for (int32_t c = c0; c < c1; c += 4)
+		{
+			const int32_t i = r * EROSION_STRIDE + c;
+
+			const __m128 h = _mm_load_ps(height + i);
+			const __m128 w = _mm_add_ps(_mm_load_ps(water + i), k.rain);
+			const __m128 sed = _mm_load_ps(sediment + i);
+			const __m128 s = _mm_add_ps(h, w);
+			const __m128 f = _mm_load_ps(scale + i);
+
+			__m128 outflow = _mm_setzero_ps();
+			__m128 inflow = _mm_setzero_ps();
+			__m128 carriedIn = _mm_setzero_ps();
+			__m128 slump = _mm_setzero_ps();
+			__m128 hn[4];
+
+			for (int n = 0; n < 4; n++)
+			{
+				const int32_t j = i + offsets[n];
+
+				hn[n] = _mm_loadu_ps(height + j);
+				const __m128 wn = _mm_add_ps(_mm_loadu_ps(water + j), k.rain);
+				const __m128 sn = _mm_add_ps(hn[n], wn);
+				const __m128 d = _mm_sub_ps(s, sn);
+
+				outflow = _mm_add_ps(outflow, positive(d));
+
+				// Water from the neighbour brings its share of the sediment
+				const __m128 in = _mm_mul_ps(_mm_loadu_ps(scale + j), positive(_mm_sub_ps(sn, s)));
+				inflow = _mm_add_ps(inflow, in);
+				carriedIn = _mm_add_ps(carriedIn, _mm_mul_ps(in, _mm_loadu_ps(ratio + j)));
+
+				// Pairs exchange the same amount in both directions
+				const __m128 dh = _mm_sub_ps(h, hn[n]);
+				slump = _mm_add_ps(slump, _mm_sub_ps(positive(_mm_sub_ps(dh, k.talus)), positive(_mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), dh), k.talus))));
+			}
+
+			outflow = _mm_mul_ps(outflow, f);
+			const __m128 carriedOut = _mm_mul_ps(outflow, _mm_load_ps(ratio + i));
+
+			const __m128 wNew = _mm_add_ps(_mm_sub_ps(w, outflow), inflow);
+			__m128 sNew = _mm_add_ps(_mm_sub_ps(sed, carriedOut), carriedIn);
+
+			// Capacity from the outflow and the terrain slope
+			const __m128 gx = _mm_sub_ps(hn[1], hn[0]);
+			const __m128 gy = _mm_sub_ps(hn[3], hn[2]);
+			const __m128 slope = _mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy))), half);
+			const __m128 capacity = _mm_mul_ps(_mm_mul_ps(k.capacity, outflow), slope);
+
+			// Positive picks up sediment, negative drops it
+			const __m128 missing = _mm_sub_ps(capacity, sNew);
+			const __m128 eroding = _mm_cmpgt_ps(missing, _mm_setzero_ps());
+			const __m128 rate = _mm_or_ps(_mm_and_ps(eroding, k.erosion), _mm_andnot_ps(eroding, k.deposition));
+			const __m128 amount = _mm_mul_ps(missing, rate);
+
+			sNew = _mm_add_ps(sNew, amount);
+
+			__m128 hNew = _mm_sub_ps(h, amount);
+			hNew = _mm_sub_ps(hNew, _mm_mul_ps(_mm_mul_ps(slump, k.thermal), quarter));
+
+			_mm_store_ps(heightOut + i, hNew);
+			_mm_store_ps(waterOut + i, _mm_mul_ps(wNew, k.keep));
+			_mm_store_ps(sedimentOut + i, sNew);
+		}
+	}
+}
+
+/* Copy the tile at (x0, y0) and its halo into scratch, clamping to the image */
+static void loadTile(const float *image, int32_t size, int32_t x0, int32_t y0, float *out)
+{
+	for (int32_t r = 0; r < EROSION_SIDE; r++)
+	{
+		const float *row = image + clamp(y0 - EROSION_HALO + r, 0, size - 1) * size;
+		float *dst = out + r * EROSION_STRIDE;
+
+		const int32_t left = x0 - EROSION_HALO;
+		if (left >= 0 && left + EROSION_SIDE <= size)
+			memcpy(dst, row + left, EROSION_SIDE * sizeof(float));
+		else
+		{
+			for (int32_t c = 0; c < EROSION_SIDE; c++)
+				dst[c] = row[clamp(left + c, 0, size - 1)];
+		}
+	}
+}
+
+static void storeTile(const float *tile, int32_t size, int32_t x0, int32_t y0, float *image)
+{
+	const int32_t width = min(EROSION_TILE, size - x0);
+	const int32_t height = min(EROSION_TILE, size - y0);
+
+	for (int32_t r = 0; r < height; r++)
+		memcpy(image + (y0 + r) * size + x0, tile + (EROSION_HALO + r) * EROSION_STRIDE + EROSION_HALO, width * sizeof(float));
+}
+
+static void erodeTile(const ErosionFields &in, const ErosionFields &out, int32_t size, int32_t x0, int32_t y0,
+	int32_t steps, const ErosionConstants &k, TileScratch &scratch)
+{
+	loadTile(in.height, size, x0, y0, scratch.height[0]);
+	loadTile(in.water, size, x0, y0, scratch.water[0]);
+	loadTile(in.sediment, size, x0, y0, scratch.sediment[0]);
+
+	/* After step n only samples erosionMargin(n) into the tile are exact,
+	 * the rest of it is skipped */
+	int cur = 0;
+	for (int32_t n = 0; n < steps; n++)
+	{
+		const int32_t inset = erosionMargin(n);
+
+		flowScale(scratch.height[cur], scratch.water[cur], scratch.sediment[cur], scratch.scale, scratch.ratio, inset + 1, k);
+		erodeStep(scratch.height[cur], scratch.water[cur], scratch.sediment[cur], scratch.scale, scratch.ratio,
+			scratch.height[cur ^ 1], scratch.water[cur ^ 1], scratch.sediment[cur ^ 1], inset + 2, k);
+
+		cur ^= 1;
+	}
+
+	storeTile(scratch.height[cur], size, x0, y0, out.height);
+	storeTile(scratch.water[cur], size, x0, y0, out.water);
+	storeTile(scratch.sediment[cur], size, x0, y0, out.sediment);
+}
+
+void erodeHeights(float *heights, int32_t size, const ErosionSettings &settings, ThreadPool *pool)
+{
+	if (settings.iterations <= 0 || size <= 0)
+		return;
+
+	ErosionConstants k;
+	k.rain = _mm_set1_ps(settings.rain);
+	k.keep = _mm_set1_ps(1.0f - settings.evaporation);
+	k.capacity = _mm_set1_ps(settings.capacity);
+	k.erosion = _mm_set1_ps(settings.erosion);
+	k.deposition = _mm_set1_ps(settings.deposition);
+	k.talus = _mm_set1_ps(settings.talus);
+	k.thermal = _mm_set1_ps(settings.thermal);
+
+	ScratchScope scope;
+
+	const size_t count = (size_t)size * size;
+	float *memory = scope.arena().alloc<float>(6 * count);
+
+	ErosionFields a = { memory, memory + count, memory + 2 * count };
+	ErosionFields b = { memory + 3 * count, memory + 4 * count, memory + 5 * count };
+
+	memcpy(a.height, heights, count * sizeof(float));
+	memset(a.water, 0, count * sizeof(float));
+	memset(a.sediment, 0, count * sizeof(float));
+
+	const int32_t tiles = (size + EROSION_TILE - 1) / EROSION_TILE;
+
+	for (int32_t done = 0; done < settings.iterations; done += EROSION_BLOCK)
+	{
+		const int32_t steps = min(EROSION_BLOCK, settings.iterations - done);
+
+		auto erodeTiles = [&](size_t begin, size_t end)
+		{
+			ScratchScope tileScope;
+			TileScratch scratch(tileScope.arena());
+			for (size_t t = begin; t < end; t++)
+			{
+				const int32_t x0 = (int32_t)(t % tiles) * EROSION_TILE;
+				const int32_t y0 = (int32_t)(t / tiles) * EROSION_TILE;
+				erodeTile(a, b, size, x0, y0, steps, k, scratch);
+			}
+		};
+
+		/* A few tasks per thread, each takes its scratch once */
+		const size_t total = (size_t)tiles * tiles;
+		if (pool && pool->threadCount() > 1)
+			pool->parallelFor(total, max(total / (4 * pool->threadCount()), (size_t)1), erodeTiles);
+		else
+			erodeTiles(0, total);
+
+		std::swap(a, b);
+	}
+
+	for (size_t i = 0; i < count; i++)
+		heights[i] = a.height[i] + a.sediment[i];
+}
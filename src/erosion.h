@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class ThreadPool;
+
+/* Grid based hydraulic and thermal erosion.
+ *
+ * Every iteration rain falls on each sample and water flows to the lower of
+ * its four neighbours, carrying sediment in proportion. Flowing water picks
+ * up sediment below a capacity set by its flow and the slope and drops it
+ * above. Thermal erosion moves material down slopes steeper than the talus.
+ *
+ * An iteration reads samples at most two away, so after n iterations a sample
+ * only depends on the heights within erosionMargin(n) of it. Chunks eroded
+ * with that margin around them agree exactly where they overlap.
+ */
+struct ErosionSettings
+{
+	int32_t iterations; // 0 disables erosion
+	float rain; // Water added to every sample per iteration
+	float evaporation; // Fraction of the water lost per iteration
+	float capacity; // Sediment carried per unit of outflow and slope
+	float erosion; // Fraction of the missing capacity picked up per iteration
+	float deposition; // Fraction of the excess sediment dropped per iteration
+	float talus; // Height difference between neighbours left by thermal erosion
+	float thermal; // Fraction of the difference above the talus moved per iteration
+};
+
+// Samples around an image that affect its eroded heights
+constexpr int32_t erosionMargin(int32_t iterations)
+{
+	return 2 * iterations;
+}
+
+// Default settings with the given number of iterations
+ErosionSettings defaultErosion(int32_t iterations);
+
+/* Erode a square image of size x size heights in place, samples closer than
+ * erosionMargin(iterations) to its edges are not exact. Sediment still in the
+ * water at the end is deposited. A pool splits the work across its threads */
+void erodeHeights(float *heights, int32_t size, const ErosionSettings &settings, ThreadPool *pool = nullptr);
@@ -4,20 +4,55 @@
 #include <cstdint>
 
 #include "engine.h"
+#include "glresource.h"
 #include "util.h"
 
 void Gbuffer::load()
 {
 }
 
-static void setupGbufferTexture(GLuint texture, GLenum internalformat, GLsizei width, GLsizei height, GLenum format, GLenum type)
+struct GbufferFormat
 {
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, internalformat, width, height, 0, format, type, NULL);
+    GLenum internalformat;
+    GLenum format;
+    GLenum type;
+};
+
+static constexpr GbufferFormat kGbufferFormats[GBUFFER_NUM_TEXTURES] = {
+    {GL_R11F_G11F_B10F, GL_RGB, GL_FLOAT}, // Albedo
+    {GL_R11F_G11F_B10F, GL_RGB, GL_FLOAT}, // Emissive
+    {GL_RGB32F, GL_RGB, GL_FLOAT}, // Position
+    {GL_R32F, GL_RED, GL_FLOAT}, // Depth
+    {GL_RGB16F, GL_RGB, GL_FLOAT}, // Normal
+    {GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT}, // Material
+};
+
+static inline GLTextureDesc gbufferDesc(int32_t texture, GLsizei width, GLsizei height)
+{
+    return {GL_TEXTURE_2D, kGbufferFormats[texture].internalformat, width, height, 1};
+}
+
+static GLuint createGbufferTexture(int32_t texture, GLsizei width, GLsizei height)
+{
+    const GbufferFormat &spec = kGbufferFormats[texture];
+
+    /* Resizing back to an earlier size reuses its storage */
+    GLuint tex = acquireGLTexture(gbufferDesc(texture, width, height));
+    if (tex)
+        glBindTexture(GL_TEXTURE_2D, tex);
+    else
+    {
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, spec.internalformat, width, height, 0, spec.format, spec.type, NULL);
+    }
+
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    return tex;
 }
 
 void Gbuffer::resize(GLsizei width, GLsizei height)
@@ -29,57 +64,11 @@ void Gbuffer::resize(GLsizei width, GLsizei height)
 
     glGenFramebuffers(1, &_fbo);
     glGenRenderbuffers(1, &_rbo);
-    glGenTextures(6, _textures);
 
     glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
 
-    /* Albedo */
-    setupGbufferTexture(
-        _textures[GBUFFER_ALBEDO],
-        GL_R11F_G11F_B10F,
-        width, height,
-        GL_RGB,
-        GL_FLOAT);
-
-    /* Emissive */
-    setupGbufferTexture(
-        _textures[GBUFFER_EMISSIVE],
-        GL_R11F_G11F_B10F,
-        width, height,
-        GL_RGB,
-        GL_FLOAT);
-
-    /* Position */
-    setupGbufferTexture(
-        _textures[GBUFFER_POSITION],
-        GL_RGB32F,
-        width, height,
-        GL_RGB,
-        GL_FLOAT);
-
-    /* Depth */
-    setupGbufferTexture(
-        _textures[GBUFFER_DEPTH],
-        GL_R32F,
-        width, height,
-        GL_RED,
-        GL_FLOAT);
-
-    /* Normal */
-    setupGbufferTexture(
-        _textures[GBUFFER_NORMAL],
-        GL_RGB16F,
-        width, height,
-        GL_RGB,
-        GL_FLOAT);
-
-    /* Material */
-    setupGbufferTexture(
-        _textures[GBUFFER_MATERIAL],
-        GL_R32UI,
-        width, height,
-        GL_RED_INTEGER,
-        GL_UNSIGNED_INT);
+    for (int32_t i = 0; i < GBUFFER_NUM_TEXTURES; i++)
+        _textures[i] = createGbufferTexture(i, width, height);
 
     /* Attach to framebuffer */
     for (int32_t i = 0; i < GBUFFER_NUM_TEXTURES; i++)
@@ -103,7 +92,8 @@ void Gbuffer::resize(GLsizei width, GLsizei height)
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-Gbuffer::Gbuffer() : _fbo(0), _rbo(0)
+Gbuffer::Gbuffer() : _fbo(0), _rbo(0),
+                     _width(0), _height(0)
 {
     memset(_textures, 0, sizeof(_textures));
 }
@@ -117,13 +107,14 @@ void Gbuffer::unload()
 {
     if (_fbo)
     {
-        glDeleteTextures(6, _textures);
+        for (int32_t i = 0; i < GBUFFER_NUM_TEXTURES; i++)
+            recycleGLTexture(_textures[i], gbufferDesc(i, _width, _height));
         memset(_textures, 0, sizeof(_textures));
 
-        glDeleteRenderbuffers(1, &_rbo);
+        releaseGLRenderbuffers(1, &_rbo);
         _rbo = 0;
 
-        glDeleteFramebuffers(1, &_fbo);
+        releaseGLFramebuffers(1, &_fbo);
         _fbo = 0;
     }
 }
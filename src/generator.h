@@ -5,13 +5,10 @@
 
 #include "material.h"
 #include "terrain.h"
-
-// Chunk size
-#define CHUNK_SIZE 512
-#define CHUNK_SIZE_SQ (CHUNK_SIZE * CHUNK_SIZE)
-
-// Chunk size in world units
-#define CHUNK_WORLD_SIZE 2048
+#include "chunkslots.h"
+#include "worldgen.h"
+#include "terrainquery.h"
+#include "scatterrender.h"
 
 // Number of chunks past the center chunk to load
 #define VIEW_DISTANCE 1
@@ -22,15 +19,21 @@
 // Number of chunks in view
 #define CHUNK_VIEW_SIZE (CHUNK_VIEW_EXTENT * CHUNK_VIEW_EXTENT)
 
-#define TERRAIN_CACHE_DIR ".tcache"
+// Number of chunk map slots, spares let freed slots rest before reuse
+#define CHUNK_SLOT_COUNT (CHUNK_VIEW_SIZE + CHUNK_VIEW_EXTENT)
 
 class Shader;
+class Camera;
 
 struct Chunk
 {
 	int32_t x, y; // Chunk coordinates
 	half_float::half *heights; // Heightmap
 	half_float::half *normals; // Normalmap
+	HeightBounds *bounds; // Min/max tree, kept after upload
+	float *errors; // Patch errors, after the tree in its block
+	ChunkScatter *scatter; // Props, freed after upload
+	int32_t slot; // Slot of the maps on the GPU
 	Terrain *terrain; // Terrain renderable
 };
 
@@ -39,8 +42,16 @@ class Generator
 public:
 	void render(Shader *shader) const;
 
+	// Props of the loaded chunks
+	void renderScatter(Shader *shader, const Camera *camera) const;
+
+	constexpr ScatterRenderer &getScatter() { return _scatter; }
+
 	constexpr TerrainMaterials &getMaterials() { return _materials; }
 
+	// Ground heights of the loaded chunks, safe from any thread
+	constexpr const TerrainQuery &getQuery() const { return _query; }
+
 	void update();
 
 	Generator();
@@ -48,4 +59,7 @@ public:
 private:
 	Chunk _chunks[CHUNK_VIEW_SIZE]; // Chunks in view
 	TerrainMaterials _materials; // Terrain materials
+	TerrainQuery _query; // CPU copy of the loaded chunks
+	ChunkSlots _slots; // GPU maps of the loaded chunks
+	ScatterRenderer _scatter; // Props of the loaded chunks
 };
@@ -0,0 +1,256 @@
+#include "glresource.h"
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+struct PooledTexture
+{
+    GLTextureDesc desc;
+    GLuint texture;
+    uint64_t frame; // Frame it was pooled in
+};
+
+struct PooledBuffer
+{
+    GLsizeiptr size;
+    GLenum usage;
+    GLuint buffer;
+    uint64_t frame;
+};
+
+/* Names released during one frame */
+struct ReleaseFrame
+{
+    GLsync fence;
+
+    std::vector<GLuint> textures;
+    std::vector<GLuint> buffers;
+    std::vector<GLuint> arrays;
+    std::vector<GLuint> framebuffers;
+    std::vector<GLuint> renderbuffers;
+
+    std::vector<PooledTexture> recycledTextures;
+    std::vector<PooledBuffer> recycledBuffers;
+
+    inline bool empty() const
+    {
+        return textures.empty() && buffers.empty() && arrays.empty() &&
+               framebuffers.empty() && renderbuffers.empty() &&
+               recycledTextures.empty() && recycledBuffers.empty();
+    }
+};
+
+/* Releases of the current frame, from any thread */
+static std::mutex _pendingMutex;
+static ReleaseFrame _pending;
+
+/* Context thread only */
+static std::deque<ReleaseFrame> _fenced; // Oldest first
+static std::vector<PooledTexture> _texturePool; // Oldest first
+static std::vector<PooledBuffer> _bufferPool;
+static uint64_t _frame;
+
+static void defer(std::vector<GLuint> &pending, GLsizei n, const GLuint *names)
+{
+    std::lock_guard<std::mutex> lock(_pendingMutex);
+    for (GLsizei i = 0; i < n; i++)
+    {
+        if (names[i])
+            pending.push_back(names[i]);
+    }
+}
+
+void releaseGLTextures(GLsizei n, const GLuint *textures)
+{
+    defer(_pending.textures, n, textures);
+}
+
+void releaseGLBuffers(GLsizei n, const GLuint *buffers)
+{
+    defer(_pending.buffers, n, buffers);
+}
+
+void releaseGLVertexArrays(GLsizei n, const GLuint *arrays)
+{
+    defer(_pending.arrays, n, arrays);
+}
+
+void releaseGLFramebuffers(GLsizei n, const GLuint *framebuffers)
+{
+    defer(_pending.framebuffers, n, framebuffers);
+}
+
+void releaseGLRenderbuffers(GLsizei n, const GLuint *renderbuffers)
+{
+    defer(_pending.renderbuffers, n, renderbuffers);
+}
+
+void recycleGLTexture(GLuint texture, const GLTextureDesc &desc)
+{
+    if (!texture)
+        return;
+
+    std::lock_guard<std::mutex> lock(_pendingMutex);
+    _pending.recycledTextures.push_back({ desc, texture, 0 });
+}
+
+void recycleGLBuffer(GLuint buffer, GLsizeiptr size, GLenum usage)
+{
+    if (!buffer)
+        return;
+
+    std::lock_guard<std::mutex> lock(_pendingMutex);
+    _pending.recycledBuffers.push_back({ size, usage, buffer, 0 });
+}
+
+static inline bool operator==(const GLTextureDesc &a, const GLTextureDesc &b)
+{
+    return a.target == b.target && a.internalformat == b.internalformat &&
+           a.width == b.width && a.height == b.height && a.levels == b.levels;
+}
+
+GLuint acquireGLTexture(const GLTextureDesc &desc)
+{
+    /* Newest first, its memory is most likely still resident */
+    for (size_t i = _texturePool.size(); i-- > 0;)
+    {
+        if (_texturePool[i].desc == desc)
+        {
+            GLuint texture = _texturePool[i].texture;
+            _texturePool.erase(_texturePool.begin() + i);
+            return texture;
+        }
+    }
+
+    return 0;
+}
+
+GLuint acquireGLBuffer(GLsizeiptr size, GLenum usage)
+{
+    for (size_t i = _bufferPool.size(); i-- > 0;)
+    {
+        if (_bufferPool[i].size == size && _bufferPool[i].usage == usage)
+        {
+            GLuint buffer = _bufferPool[i].buffer;
+            _bufferPool.erase(_bufferPool.begin() + i);
+            return buffer;
+        }
+    }
+
+    return 0;
+}
+
+// Any of the glDelete* entry points taking a count and names
+typedef void (APIENTRYP DeleteNamesProc)(GLsizei n, const GLuint *names);
+
+static void deleteNames(DeleteNamesProc del, const std::vector<GLuint> &names)
+{
+    if (!names.empty())
+        del((GLsizei)names.size(), names.data());
+}
+
+// Delete or pool the names of a frame the GPU is done with
+static void retire(ReleaseFrame &frame)
+{
+    if (frame.fence)
+        glDeleteSync(frame.fence);
+
+    /* Containers first, they reference the rest */
+    deleteNames(glDeleteVertexArrays, frame.arrays);
+    deleteNames(glDeleteFramebuffers, frame.framebuffers);
+    deleteNames(glDeleteRenderbuffers, frame.renderbuffers);
+    deleteNames(glDeleteBuffers, frame.buffers);
+    deleteNames(glDeleteTextures, frame.textures);
+
+    for (PooledTexture &pooled : frame.recycledTextures)
+    {
+        pooled.frame = _frame;
+        _texturePool.push_back(pooled);
+    }
+
+    for (PooledBuffer &pooled : frame.recycledBuffers)
+    {
+        pooled.frame = _frame;
+        _bufferPool.push_back(pooled);
+    }
+}
+
+// Delete pooled objects that are too old or too many
+template <typename T, typename Deleter>
+static void trim(std::vector<T> &pool, GLsizei keep, Deleter del)
+{
+    size_t expired = 0;
+    while (expired < pool.size() &&
+           (pool.size() - expired > (size_t)keep || _frame - pool[expired].frame > GL_POOL_MAX_AGE))
+        expired++;
+
+    if (expired == 0)
+        return;
+
+    for (size_t i = 0; i < expired; i++)
+        del(pool[i]);
+    pool.erase(pool.begin(), pool.begin() + expired);
+}
+
+static void deleteTexture(const PooledTexture &pooled)
+{
+    glDeleteTextures(1, &pooled.texture);
+}
+
+static void deleteBuffer(const PooledBuffer &pooled)
+{
+    glDeleteBuffers(1, &pooled.buffer);
+}
+
+void flushGLReleases()
+{
+    ReleaseFrame frame = {};
+    {
+        std::lock_guard<std::mutex> lock(_pendingMutex);
+        std::swap(frame, _pending);
+    }
+
+    /* The fence passes once every command issued so far has executed */
+    if (!frame.empty())
+    {
+        frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        _fenced.push_back(std::move(frame));
+    }
+
+    /* Fences pass in order, stop at the first pending one */
+    while (!_fenced.empty())
+    {
+        GLenum status = glClientWaitSync(_fenced.front().fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+            break;
+
+        retire(_fenced.front());
+        _fenced.pop_front();
+    }
+
+    _frame++;
+
+    trim(_texturePool, GL_POOL_MAX_OBJECTS, deleteTexture);
+    trim(_bufferPool, GL_POOL_MAX_OBJECTS, deleteBuffer);
+}
+
+void destroyGLReleases()
+{
+    {
+        std::lock_guard<std::mutex> lock(_pendingMutex);
+        _fenced.push_back(std::move(_pending));
+        _pending = {};
+    }
+
+    glFinish();
+
+    for (ReleaseFrame &frame : _fenced)
+        retire(frame);
+    _fenced.clear();
+
+    trim(_texturePool, 0, deleteTexture);
+    trim(_bufferPool, 0, deleteBuffer);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <glad/glad.h>
+
+/* GL names of objects released from any thread.
+ *
+ * GL calls are only valid on the thread owning the context, and the GPU may
+ * still use an object for a few frames after the last draw referencing it.
+ * Released names are collected per frame and fenced when the frame ends, they
+ * are deleted on the context thread once the GPU has passed the fence.
+ *
+ * Textures and buffers can be recycled instead, the storage then goes to a
+ * pool and is handed out again for the same format and size. Pooled objects
+ * left unused for a while are deleted.
+ */
+
+// Frames a recycled object stays pooled without being reused
+#define GL_POOL_MAX_AGE 120
+
+// Objects of each kind kept in the pools at most
+#define GL_POOL_MAX_OBJECTS 64
+
+// Storage of a texture, recycled textures are only reused for the same
+struct GLTextureDesc
+{
+    GLenum target;
+    GLenum internalformat;
+    GLsizei width, height;
+    GLsizei levels;
+};
+
+void releaseGLTextures(GLsizei n, const GLuint *textures);
+void releaseGLBuffers(GLsizei n, const GLuint *buffers);
+void releaseGLVertexArrays(GLsizei n, const GLuint *arrays);
+void releaseGLFramebuffers(GLsizei n, const GLuint *framebuffers);
+void releaseGLRenderbuffers(GLsizei n, const GLuint *renderbuffers);
+
+// Release a texture whose storage matches desc into the pool
+void recycleGLTexture(GLuint texture, const GLTextureDesc &desc);
+
+// Release a buffer created with glBufferData(size, usage) into the pool
+void recycleGLBuffer(GLuint buffer, GLsizeiptr size, GLenum usage);
+
+/* Pooled objects, 0 if there is none. Contents and parameters are left over
+ * from the last use. Call on the context thread */
+GLuint acquireGLTexture(const GLTextureDesc &desc);
+GLuint acquireGLBuffer(GLsizeiptr size, GLenum usage);
+
+/* Fence the names released this frame and delete or pool those of frames the
+ * GPU is done with, call on the context thread once per frame */
+void flushGLReleases();
+
+// Wait for the GPU and delete everything released or pooled, before the context goes away
+void destroyGLReleases();
@@ -0,0 +1,344 @@
+#include "heightpreset.h"
+
+#include <cstdio>
+
+#include "noise.h"
+
+// Fbm node descriptor
+#define PRESET_FBM(Name, Frequency, Octaves, Persistence, OffsetX, OffsetY, Rotation, Amplitude, Bias) \
+	struct Name \
+	{ \
+		static constexpr float frequency = Frequency; \
+		static constexpr int octaves = Octaves; \
+		static constexpr float persistence = Persistence; \
+		static constexpr float offsetX = OffsetX; \
+		static constexpr float offsetY = OffsetY; \
+		static constexpr float rotation = Rotation; \
+		static constexpr float amplitude = Amplitude; \
+		static constexpr float bias = Bias; \
+	}
+
+/* Presets, each has a matching graph in assets/worlds */
+
+struct DefaultWorld
+{
+	static constexpr float shiftX = 0.0f, shiftY = 0.0f, frequency = 1.0f;
+	static constexpr float tolerance = 1.0f / 64.0f;
+
+	PRESET_FBM(Layer1, 1.0f / 512.0f, 8, 1.0f / 4.0f, 0.0f, 0.0f, 0.0f, 112.0f, 64.0f);
+	PRESET_FBM(Layer2, 1.0f / 128.0f, 4, 1.0f / 4.0f, 447.7f, 104.43f, 13.77f, 24.0f, 8.0f);
+	PRESET_FBM(Layer3, 1.0f / 32.0f, 4, 1.0f / 4.0f, -22.0f, 204.1f, 174.3f, 2.0f, -16.0f);
+
+	static constexpr float liftScale = 1.0f, liftOffset = 8.0f;
+
+	PRESET_FBM(Hills, 1.0f / 64.0f, 8, 1.0f / 2.0f, 89.75f, -153.1f, 97.2f, 4.0f, 0.0f);
+	static constexpr float hillsK = 0.25f, hillsBias = -0.5f, hillsScale = 4.0f;
+
+	static constexpr float seaLevel = 0.0f, seaFloor = -64.0f, seaPower = 0.5f;
+
+	PRESET_FBM(Mountains, 1.0f / 96.0f, 8, 1.0f / 3.0f, -2.0f, 33.7f, 74.2f, 1.0f, 0.0f);
+	static constexpr float mountainBase = 96.0f, mountainPeak = 224.0f, mountainScale = 2.0f, mountainPower = 2.5f;
+	static constexpr float mountainNoisePower = 2.0f, mountainNoiseScale = 2.0f;
+
+	PRESET_FBM(Transition, 1.0f / 64.0f, 4, 1.0f / 4.0f, 54.0f, -111.2f, 174.3f, 1.0f, 0.0f);
+	static constexpr float transitionLow = 0.0f, transitionHigh = 96.0f, transitionScale = 0.0f;
+};
+
+struct IslandsWorld
+{
+	static constexpr float shiftX = 0.0f, shiftY = 0.0f, frequency = 1.0f;
+	static constexpr float tolerance = 1.0f / 64.0f;
+
+	PRESET_FBM(Layer1, 1.0f / 1024.0f, 8, 1.0f / 3.0f, 311.4f, -87.2f, 23.5f, 128.0f, -24.0f);
+	PRESET_FBM(Layer2, 1.0f / 160.0f, 5, 1.0f / 3.0f, -55.1f, 410.8f, 61.2f, 20.0f, 0.0f);
+	PRESET_FBM(Layer3, 1.0f / 40.0f, 3, 1.0f / 4.0f, 17.9f, -233.4f, 142.7f, 3.0f, 0.0f);
+
+	static constexpr float liftScale = 1.0f, liftOffset = 4.0f;
+
+	PRESET_FBM(Hills, 1.0f / 48.0f, 6, 1.0f / 2.0f, -140.3f, 66.6f, 12.4f, 3.0f, 0.0f);
+	static constexpr float hillsK = 0.5f, hillsBias = -0.5f, hillsScale = 6.0f;
+
+	static constexpr float seaLevel = 0.0f, seaFloor = -48.0f, seaPower = 0.75f;
+
+	PRESET_FBM(Mountains, 1.0f / 80.0f, 6, 1.0f / 3.0f, 9.1f, -71.3f, 201.4f, 1.0f, 0.0f);
+	static constexpr float mountainBase = 72.0f, mountainPeak = 180.0f, mountainScale = 1.5f, mountainPower = 2.0f;
+	static constexpr float mountainNoisePower = 2.0f, mountainNoiseScale = 4.0f;
+
+	PRESET_FBM(Transition, 1.0f / 48.0f, 4, 1.0f / 4.0f, 71.7f, 12.5f, 95.0f, 1.0f, 0.0f);
+	static constexpr float transitionLow = 0.0f, transitionHigh = 72.0f, transitionScale = 3.0f;
+};
+
+const char *const kPresetNoiseNames[PRESET_NOISE_COUNT] = {
+	"layer1", "layer2", "layer3", "hillsNoise", "mountainNoise", "transitionNoise"
+};
+
+/* Kernels, these mirror NoiseProgram::evaluate operation for operation */
+
+/* Fbm with its octaves bounded by budget, sets *below instead of finishing
+ * once the result is certain to end under limit */
+template <typename L>
+static inline float presetFBM(const Vector2 &pos, const Vector2 &seedOffset, float budget, float limit, bool *below)
+{
+	constexpr NoiseRotation rotation = noiseRotation(L::rotation);
+	static constexpr OctaveTable<L::octaves> kTable = makeOctaveTable<L::octaves>(L::persistence);
+
+	float x, y;
+	noiseDomain(pos, L::offsetX, L::offsetY, L::frequency, rotation, seedOffset, &x, &y);
+
+	/* Limit in units of the octave sum */
+	const float sumLimit = L::amplitude > 0.0f ? (limit - L::bias) / L::amplitude * kTable.total : -INFINITY;
+
+	const float sum = OctaveSum<0, L::octaves>::eval(x, y, kTable, budget, sumLimit, below, 0.0f);
+	return sum / kTable.total * L::amplitude + L::bias;
+}
+
+template <typename L>
+static inline float presetFBM(const Vector2 &pos, const Vector2 &seedOffset, float budget)
+{
+	bool below;
+	return presetFBM<L>(pos, seedOffset, budget, -INFINITY, &below);
+}
+
+// Unmasked fbm node of a world
+template <typename W, typename L>
+static inline float presetLayer(const Vector2 &pos, const Vector2 &seedOffset)
+{
+	return presetFBM<L>(pos, seedOffset, noiseBudget(W::tolerance, L::amplitude));
+}
+
+/* What the sea clamp lets a kernel skip, the same proof NOISE_OP_GUARD makes */
+struct PresetBounds
+{
+	NoiseRange layers[HEIGHT_LAYER_COUNT];
+	float seaLimit; // Sum of the layers below which the sea returns its floor
+};
+
+template <typename W>
+static PresetBounds presetBounds()
+{
+	PresetBounds bounds;
+	bounds.layers[0] = rangeFBM(W::Layer1::amplitude, W::Layer1::bias);
+	bounds.layers[1] = rangeFBM(W::Layer2::amplitude, W::Layer2::bias);
+	bounds.layers[2] = rangeFBM(W::Layer3::amplitude, W::Layer3::bias);
+
+	const NoiseRange hills = rangeMonotonic(rangeFBM(W::Hills::amplitude, W::Hills::bias), [](float x)
+	{
+		return shapeSmooth(x, W::hillsK, W::hillsBias, W::hillsScale);
+	});
+
+	/* Undo the hills and the lift */
+	const float limit = (W::seaLevel < W::seaFloor ? W::seaLevel : W::seaFloor) - NOISE_RANGE_SLACK - hills.hi;
+	bounds.seaLimit = W::liftScale > 0.0f ? (limit - W::liftOffset) / W::liftScale : -INFINITY;
+
+	return bounds;
+}
+
+// Sum of the layers, false once it certainly ends below the sea limit
+template <typename W>
+static inline bool presetLayers(const Vector2 &pos, const Vector2 *seedOffsets, const PresetBounds &bounds, float *out)
+{
+	const float limit = bounds.seaLimit;
+	bool below = false;
+
+	float h = presetFBM<typename W::Layer1>(pos, seedOffsets[PRESET_NOISE_LAYER1], noiseBudget(W::tolerance, W::Layer1::amplitude),
+		limit - bounds.layers[1].hi - bounds.layers[2].hi, &below);
+	if (below)
+		return false;
+
+	h = h + presetFBM<typename W::Layer2>(pos, seedOffsets[PRESET_NOISE_LAYER2], noiseBudget(W::tolerance, W::Layer2::amplitude),
+		limit - h - bounds.layers[2].hi, &below);
+	if (below)
+		return false;
+
+	h = h + presetFBM<typename W::Layer3>(pos, seedOffsets[PRESET_NOISE_LAYER3], noiseBudget(W::tolerance, W::Layer3::amplitude),
+		limit - h, &below);
+	if (below)
+		return false;
+
+	*out = h;
+	return true;
+}
+
+template <typename W>
+static inline float presetLift(float in)
+{
+	return in * W::liftScale + W::liftOffset;
+}
+
+template <typename W>
+static inline float presetHills(const Vector2 &pos, const Vector2 *seedOffsets, float in)
+{
+	const float noise = presetLayer<W, typename W::Hills>(pos, seedOffsets[PRESET_NOISE_HILLS]);
+	return in + shapeSmooth(noise, W::hillsK, W::hillsBias, W::hillsScale);
+}
+
+template <typename W>
+static inline float presetSea(float in)
+{
+	return shapeSea(in, W::seaLevel, W::seaFloor, W::seaPower);
+}
+
+template <typename W>
+static inline float presetMountains(const Vector2 &pos, const Vector2 *seedOffsets, float in)
+{
+	if (in < W::mountainBase)
+		return in; // Noise is not evaluated below the base
+
+	const float mask = mountainMask(in, W::mountainBase, W::mountainPeak, W::mountainNoisePower);
+
+	const float noise = W::mountainNoiseScale != 0.0f ?
+		presetFBM<typename W::Mountains>(pos, seedOffsets[PRESET_NOISE_MOUNTAINS],
+			noiseBudget(W::tolerance, W::Mountains::amplitude * mask * W::mountainNoiseScale)) : 0.0f;
+
+	return shapeMountain(in, W::mountainBase, W::mountainPeak, W::mountainScale, W::mountainPower,
+		noise, mask, W::mountainNoiseScale);
+}
+
+template <typename W>
+static inline float presetTransition(const Vector2 &pos, const Vector2 *seedOffsets, float in)
+{
+	/* Scale 0 is folded away like the graph compiler does */
+	if (W::transitionScale == 0.0f || in >= W::transitionHigh || in <= W::transitionLow)
+		return in;
+
+	const float mask = transitionMask(in, W::transitionLow, W::transitionHigh);
+	const float noise = presetFBM<typename W::Transition>(pos, seedOffsets[PRESET_NOISE_TRANSITION],
+		noiseBudget(W::tolerance, W::Transition::amplitude * mask * W::transitionScale));
+
+	return shapeTransition(in, noise, mask, W::transitionScale);
+}
+
+template <typename W>
+static inline float presetHeight(const Vector2 &p, const Vector2 *seedOffsets, const PresetBounds &bounds)
+{
+	const Vector2 pos((p.x + W::shiftX) * W::frequency, (p.y + W::shiftY) * W::frequency);
+
+	/* Deep sea skips the remaining layers and the hills */
+	float h;
+	if (presetLayers<W>(pos, seedOffsets, bounds, &h))
+	{
+		h = presetLift<W>(h);
+		h = presetHills<W>(pos, seedOffsets, h);
+		h = presetSea<W>(h);
+	}
+	else
+		h = W::seaFloor;
+
+	h = presetMountains<W>(pos, seedOffsets, h);
+	h = presetTransition<W>(pos, seedOffsets, h);
+	return h;
+}
+
+template <typename W>
+static void presetRows(const Vector2 &start, int count, const Vector2 *seedOffsets, float *out)
+{
+	static const PresetBounds kBounds = presetBounds<W>();
+
+	for (int i = 0; i < count; i++)
+		out[i] = presetHeight<W>(Vector2(start.x + (float)i, start.y), seedOffsets, kBounds);
+}
+
+/* Graph descriptions, %.9g round trips every float */
+
+template <typename L>
+static int describeFBM(char *source, size_t size, const char *name)
+{
+	return snprintf(source, size,
+		"%s = fbm frequency=%.9g octaves=%d persistence=%.9g offset=%.9g,%.9g rotation=%.9g amplitude=%.9g bias=%.9g\n",
+		name, (double)L::frequency, (int)L::octaves, (double)L::persistence,
+		(double)L::offsetX, (double)L::offsetY, (double)L::rotation,
+		(double)L::amplitude, (double)L::bias);
+}
+
+template <typename W>
+static void presetDescribe(char *source, size_t size, uint32_t seed)
+{
+	int n = 0;
+
+#define APPEND(expr) n += (expr); if (n < 0 || (size_t)n >= size) return
+
+	APPEND(snprintf(source + n, size - n, "seed %u\ntolerance %.9g\ndomain shift=%.9g,%.9g frequency=%.9g\n",
+		seed, (double)W::tolerance, (double)W::shiftX, (double)W::shiftY, (double)W::frequency));
+
+	APPEND(describeFBM<typename W::Layer1>(source + n, size - n, kPresetNoiseNames[PRESET_NOISE_LAYER1]));
+	APPEND(describeFBM<typename W::Layer2>(source + n, size - n, kPresetNoiseNames[PRESET_NOISE_LAYER2]));
+	APPEND(describeFBM<typename W::Layer3>(source + n, size - n, kPresetNoiseNames[PRESET_NOISE_LAYER3]));
+	APPEND(snprintf(source + n, size - n, "layers = add layer1 layer2 layer3\n"));
+
+	APPEND(snprintf(source + n, size - n, "lifted = offset layers scale=%.9g offset=%.9g\n",
+		(double)W::liftScale, (double)W::liftOffset));
+
+	APPEND(describeFBM<typename W::Hills>(source + n, size - n, kPresetNoiseNames[PRESET_NOISE_HILLS]));
+	APPEND(snprintf(source + n, size - n, "hillsShape = smooth hillsNoise k=%.9g bias=%.9g scale=%.9g\n",
+		(double)W::hillsK, (double)W::hillsBias, (double)W::hillsScale));
+	APPEND(snprintf(source + n, size - n, "hills = add lifted hillsShape\n"));
+
+	APPEND(snprintf(source + n, size - n, "sea = sea hills level=%.9g floor=%.9g power=%.9g\n",
+		(double)W::seaLevel, (double)W::seaFloor, (double)W::seaPower));
+
+	APPEND(describeFBM<typename W::Mountains>(source + n, size - n, kPresetNoiseNames[PRESET_NOISE_MOUNTAINS]));
+	APPEND(snprintf(source + n, size - n,
+		"mountains = mountain sea mountainNoise base=%.9g peak=%.9g scale=%.9g power=%.9g noise_power=%.9g noise_scale=%.9g\n",
+		(double)W::mountainBase, (double)W::mountainPeak, (double)W::mountainScale, (double)W::mountainPower,
+		(double)W::mountainNoisePower, (double)W::mountainNoiseScale));
+
+	APPEND(describeFBM<typename W::Transition>(source + n, size - n, kPresetNoiseNames[PRESET_NOISE_TRANSITION]));
+	APPEND(snprintf(source + n, size - n, "terrain = transition mountains transitionNoise low=%.9g high=%.9g scale=%.9g\n",
+		(double)W::transitionLow, (double)W::transitionHigh, (double)W::transitionScale));
+
+	APPEND(snprintf(source + n, size - n, "output terrain\n"));
+
+#undef APPEND
+}
+
+const HeightPreset kHeightPresets[HEIGHT_PRESET_COUNT] = {
+	{ "default", presetRows<DefaultWorld>, presetDescribe<DefaultWorld> },
+	{ "islands", presetRows<IslandsWorld>, presetDescribe<IslandsWorld> }
+};
+
+/* Stages of the default preset */
+
+static const Vector2 kNoSeed[PRESET_NOISE_COUNT] = {};
+
+static float layer1(const Vector2 &pos)
+{
+	return presetLayer<DefaultWorld, DefaultWorld::Layer1>(pos, kNoSeed[0]);
+}
+
+static float layer2(const Vector2 &pos)
+{
+	return presetLayer<DefaultWorld, DefaultWorld::Layer2>(pos, kNoSeed[0]);
+}
+
+static float layer3(const Vector2 &pos)
+{
+	return presetLayer<DefaultWorld, DefaultWorld::Layer3>(pos, kNoSeed[0]);
+}
+
+static float transform1(const Vector2 &pos, float in)
+{
+	return presetLift<DefaultWorld>(in);
+}
+
+static float transform2(const Vector2 &pos, float in)
+{
+	return presetHills<DefaultWorld>(pos, kNoSeed, in);
+}
+
+static float transform3(const Vector2 &pos, float in)
+{
+	return presetSea<DefaultWorld>(in);
+}
+
+static float transform4(const Vector2 &pos, float in)
+{
+	return presetMountains<DefaultWorld>(pos, kNoSeed, in);
+}
+
+static float transform5(const Vector2 &pos, float in)
+{
+	return presetTransition<DefaultWorld>(pos, kNoSeed, in);
+}
+
+const HeightLayer kHeightLayers[HEIGHT_LAYER_COUNT] = { layer1, layer2, layer3 };
+const HeightTransform kHeightTransforms[HEIGHT_TRANSFORM_COUNT] = { transform1, transform2, transform3, transform4, transform5 };
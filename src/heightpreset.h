@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <mutil/mutil.h>
+
+using namespace mutil;
+
+/* Height functions specialized at compile time.
+ *
+ * A preset describes a world built like assets/worlds/default.graph with
+ * constexpr members. Every preset is instantiated into its own kernel with
+ * the constants folded, the rotations precomputed and the octave loops
+ * unrolled. loadWorldGraph() picks the preset whose description compiles to
+ * the same program as the loaded graph, other graphs are interpreted. Kernels
+ * stop octaves on the same budgets as the interpreter, and give up on the
+ * base layers once the sea floor is certain, checked after every octave.
+ */
+
+// Fbm nodes of a preset, indexes the seed offsets
+enum PresetNoise
+{
+	PRESET_NOISE_LAYER1,
+	PRESET_NOISE_LAYER2,
+	PRESET_NOISE_LAYER3,
+	PRESET_NOISE_HILLS,
+	PRESET_NOISE_MOUNTAINS,
+	PRESET_NOISE_TRANSITION,
+
+	PRESET_NOISE_COUNT
+};
+
+// Graph node names of the preset fbm nodes
+extern const char *const kPresetNoiseNames[PRESET_NOISE_COUNT];
+
+// Heights of count samples along +x from start
+typedef void (*HeightRowFunction)(const Vector2 &start, int count, const Vector2 *seedOffsets, float *out);
+
+struct HeightPreset
+{
+	const char *name;
+	HeightRowFunction rows;
+
+	// Write the graph description of the preset
+	void (*describe)(char *source, size_t size, uint32_t seed);
+};
+
+#define HEIGHT_PRESET_COUNT 2
+
+extern const HeightPreset kHeightPresets[HEIGHT_PRESET_COUNT];
+
+/* Stages of the default preset without a seed, in evaluation order */
+
+#define HEIGHT_LAYER_COUNT 3
+#define HEIGHT_TRANSFORM_COUNT 5
+
+typedef float (*HeightLayer)(const Vector2 &pos);
+typedef float (*HeightTransform)(const Vector2 &pos, float in);
+
+extern const HeightLayer kHeightLayers[HEIGHT_LAYER_COUNT];
+extern const HeightTransform kHeightTransforms[HEIGHT_TRANSFORM_COUNT];
@@ -0,0 +1,276 @@
+#include "instancing.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "mesh.h"
+#include "shader.h"
+#include "glresource.h"
+
+// Longest wait for the GPU to release the buffer, in nanoseconds
+#define INSTANCE_WAIT_TIMEOUT 1000000000ull
+
+// Smallest buffer, in instances
+#define INSTANCE_MIN_CAPACITY 64
+
+void InstanceBuffer::reserve(GLsizei count)
+{
+    if (count <= _capacity)
+        return;
+
+    unload();
+
+    _capacity = std::max(count, INSTANCE_MIN_CAPACITY);
+    _capacity = std::max(_capacity, (GLsizei)(_capacity + _capacity / 2));
+
+    const GLsizeiptr size = (GLsizeiptr)_capacity * sizeof(Matrix4);
+
+    glGenBuffers(1, &_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+
+    _persistent = GLAD_GL_VERSION_4_4 != 0;
+    if (_persistent)
+    {
+        /* Coherent, writes are visible to later draws without a flush */
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags);
+        _mapped = (Matrix4 *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+    }
+    else
+    {
+        glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+        _mapped = new Matrix4[_capacity];
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    _dirtyBegin = _capacity;
+    _dirtyEnd = 0;
+}
+
+void InstanceBuffer::wait()
+{
+    if (!_fence)
+        return;
+
+    glClientWaitSync(_fence, GL_SYNC_FLUSH_COMMANDS_BIT, INSTANCE_WAIT_TIMEOUT);
+    glDeleteSync(_fence);
+    _fence = 0;
+}
+
+void InstanceBuffer::write(GLsizei i, const Matrix4 &model)
+{
+    /* The first write of a frame waits for the draws still reading the buffer,
+     * they are usually done by now */
+    if (_dirtyBegin >= _dirtyEnd && _persistent)
+        wait();
+
+    _mapped[i] = model;
+    _dirtyBegin = std::min(_dirtyBegin, i);
+    _dirtyEnd = std::max(_dirtyEnd, i + 1);
+}
+
+void InstanceBuffer::flush()
+{
+    if (_dirtyBegin >= _dirtyEnd)
+        return;
+
+    if (!_persistent)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)_dirtyBegin * sizeof(Matrix4),
+                        (GLsizeiptr)(_dirtyEnd - _dirtyBegin) * sizeof(Matrix4), _mapped + _dirtyBegin);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    _dirtyBegin = _capacity;
+    _dirtyEnd = 0;
+}
+
+void InstanceBuffer::fence()
+{
+    if (!_persistent || !_buffer)
+        return;
+
+    if (_fence)
+        glDeleteSync(_fence);
+    _fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+InstanceBuffer::InstanceBuffer() : _buffer(0), _capacity(0), _mapped(nullptr), _persistent(false),
+                                   _fence(0), _dirtyBegin(0), _dirtyEnd(0)
+{
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+    unload();
+}
+
+void InstanceBuffer::unload()
+{
+    if (_fence)
+    {
+        glDeleteSync(_fence);
+        _fence = 0;
+    }
+
+    if (_persistent && _mapped)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    else
+        delete[] _mapped;
+    _mapped = nullptr;
+
+    /* Draws may still read it, the release is fenced */
+    if (_buffer)
+    {
+        releaseGLBuffers(1, &_buffer);
+        _buffer = 0;
+    }
+
+    _capacity = 0;
+}
+
+static inline bool sameColor(const Vector3 &a, const Vector3 &b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static bool sameMaterial(const Material &a, const Material &b)
+{
+    return a.albedo.get() == b.albedo.get() && sameColor(a.albedoColor, b.albedoColor) &&
+           a.emissive.get() == b.emissive.get() && sameColor(a.emissiveColor, b.emissiveColor) &&
+           a.normal.get() == b.normal.get() &&
+           a.roughness.get() == b.roughness.get() && a.roughnessValue == b.roughnessValue &&
+           a.metallic.get() == b.metallic.get() && a.metallicValue == b.metallicValue &&
+           a.ao.get() == b.ao.get() && a.aoValue == b.aoValue;
+}
+
+void MeshBatches::rebuild(const std::vector<RenderableMesh *> &meshes)
+{
+    _batches.clear();
+    _instances.clear();
+
+    /* Group by mesh, then by material among the batches of a mesh */
+    std::unordered_map<const Mesh *, std::vector<size_t>> byMesh;
+    std::vector<size_t> batchOf;
+    batchOf.reserve(meshes.size());
+
+    for (RenderableMesh *mesh : meshes)
+    {
+        _instances.push_back({ mesh, -1 });
+        if (!mesh->enabled())
+        {
+            batchOf.push_back(SIZE_MAX);
+            continue;
+        }
+
+        std::vector<size_t> &candidates = byMesh[mesh->mesh()];
+
+        size_t batch = SIZE_MAX;
+        for (size_t candidate : candidates)
+        {
+            if (sameMaterial(*_batches[candidate].material, mesh->material()))
+            {
+                batch = candidate;
+                break;
+            }
+        }
+
+        if (batch == SIZE_MAX)
+        {
+            batch = _batches.size();
+            candidates.push_back(batch);
+            _batches.push_back({ mesh->mesh(), &mesh->material(), 0, 0 });
+        }
+
+        _batches[batch].count++;
+        batchOf.push_back(batch);
+    }
+
+    /* Contiguous ranges per batch */
+    GLsizei total = 0;
+    for (Batch &batch : _batches)
+    {
+        batch.first = total;
+        total += batch.count;
+        batch.count = 0;
+    }
+
+    _buffer.reserve(total);
+
+    for (size_t i = 0; i < _instances.size(); i++)
+    {
+        if (batchOf[i] == SIZE_MAX)
+            continue;
+
+        Batch &batch = _batches[batchOf[i]];
+        Instance &instance = _instances[i];
+        instance.index = batch.first + batch.count++;
+
+        instance.mesh->update();
+        _buffer.write(instance.index, instance.mesh->model());
+    }
+
+    _buffer.flush();
+    _stale = false;
+}
+
+void MeshBatches::update(const std::vector<RenderableMesh *> &meshes)
+{
+    if (!_stale && _instances.size() == meshes.size())
+    {
+        for (const Instance &instance : _instances)
+        {
+            if (instance.mesh->enabled() != (instance.index >= 0))
+            {
+                _stale = true;
+                break;
+            }
+        }
+    }
+    else
+        _stale = true;
+
+    if (_stale)
+    {
+        rebuild(meshes);
+        return;
+    }
+
+    /* Only meshes that moved are written */
+    for (const Instance &instance : _instances)
+    {
+        if (instance.index >= 0 && instance.mesh->update())
+            _buffer.write(instance.index, instance.mesh->model());
+    }
+
+    _buffer.flush();
+}
+
+void MeshBatches::render(Shader *shader) const
+{
+    shader->setBool("uInstanced", true);
+
+    for (const Batch &batch : _batches)
+    {
+        shader->setMaterial(*batch.material);
+        batch.mesh->renderInstanced(_buffer.buffer(), batch.first, batch.count);
+    }
+
+    shader->setBool("uInstanced", false);
+
+    _buffer.fence();
+}
+
+MeshBatches::MeshBatches() : _stale(true)
+{
+}
+
+MeshBatches::~MeshBatches()
+{
+}
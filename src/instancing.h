@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glad/glad.h>
+#include <mutil/mutil.h>
+
+using namespace mutil;
+
+class Mesh;
+class Material;
+class RenderableMesh;
+class Shader;
+
+// First vertex attribute of the per instance model matrix, one per column
+#define INSTANCE_MODEL_ATTRIB 3
+
+/* Per instance model matrices in one buffer, each batch a contiguous range.
+ * With buffer storage (GL 4.4) the buffer stays mapped and matrices are
+ * written in place, otherwise through a client copy uploaded per range.
+ * Writes wait for the GPU to finish the last frame drawn from the buffer.
+ */
+class InstanceBuffer final
+{
+public:
+    // Room for count instances, contents are lost when the buffer grows
+    void reserve(GLsizei count);
+
+    // Matrix of instance i, call flush once all are written
+    void write(GLsizei i, const Matrix4 &model);
+    void flush();
+
+    // Fence the draws issued from the buffer this frame
+    void fence();
+
+    constexpr GLuint buffer() const { return _buffer; }
+    constexpr GLsizei capacity() const { return _capacity; }
+
+    InstanceBuffer();
+    ~InstanceBuffer();
+
+    InstanceBuffer(const InstanceBuffer &) = delete;
+    InstanceBuffer &operator=(const InstanceBuffer &) = delete;
+
+private:
+    GLuint _buffer;
+    GLsizei _capacity;
+    Matrix4 *_mapped; // Persistent mapping or client copy
+    bool _persistent;
+    GLsync _fence; // After the last draws from the buffer
+    GLsizei _dirtyBegin, _dirtyEnd; // Range not yet uploaded
+
+    void wait();
+    void unload();
+};
+
+/* RenderableMeshes drawn instanced, one draw per mesh and material. Batches
+ * are rebuilt when meshes are added or enabled, otherwise only the matrices
+ * of moved meshes are rewritten. Materials are compared when grouping,
+ * invalidate after changing one.
+ */
+class MeshBatches final
+{
+public:
+    // Rebuild the batches before the next draw
+    constexpr void invalidate() { _stale = true; }
+
+    // Update the transforms of meshes, rebuilding the batches if needed
+    void update(const std::vector<RenderableMesh *> &meshes);
+
+    void render(Shader *shader) const;
+
+    inline size_t batchCount() const { return _batches.size(); }
+
+    MeshBatches();
+    ~MeshBatches();
+
+private:
+    struct Batch
+    {
+        const Mesh *mesh;
+        const Material *material; // Of the first instance
+        GLsizei first, count;
+    };
+
+    struct Instance
+    {
+        RenderableMesh *mesh;
+        GLsizei index; // In the instance buffer, -1 if disabled
+    };
+
+    std::vector<Batch> _batches;
+    std::vector<Instance> _instances;
+    mutable InstanceBuffer _buffer;
+    bool _stale;
+
+    void rebuild(const std::vector<RenderableMesh *> &meshes);
+};
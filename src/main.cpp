@@ -8,6 +8,8 @@
 #include "bloom.h"
 #include "shader.h"
 #include "generator.h"
+#include "model.h"
+#include "profiler.h"
 
 #include <imgui.h>
 
@@ -48,6 +50,7 @@ static constexpr int kTerrainSize = 4096;
 
 static void debugWindow();
 static void initTerrainMaterials();
+static void initScatter();
 static void initWater();
 
 int main(int argc, char *argv[])
@@ -64,6 +67,8 @@ int main(int argc, char *argv[])
 
     initTerrainMaterials();
 
+    initScatter();
+
     initWater();
 
     Camera *camera = getCamera();
@@ -375,6 +380,12 @@ static void debugWindow()
             ImGui::EndTabItem();
         }
 
+        if (ImGui::BeginTabItem("Profiler"))
+        {
+            profilerDrawUI();
+            ImGui::EndTabItem();
+        }
+
         ImGui::EndTabBar();
     }
 
@@ -422,6 +433,23 @@ static void initTerrainMaterials()
     sand = loadMaterial("assets/wavy-sand");
 }
 
+static void initScatter()
+{
+    ScatterRenderer &scatter = getTerrainGenerator()->getScatter();
+
+    /* Cubes stand in for props without a baked model, see model_bake */
+    const float cubeReach = 0.87f;
+
+    Model *tree = new Model();
+    if (tree->load(MODEL_CACHE_DIR "/tree1a.mcache", "assets/models/tree1a"))
+        scatter.setKind(SCATTER_TREE, tree);
+    else
+        scatter.setKind(SCATTER_TREE, getCubeMesh(), loadMaterial("assets/forest-floor").get(), cubeReach);
+    tree->release();
+
+    scatter.setKind(SCATTER_ROCK, getCubeMesh(), loadMaterial("assets/jagged-rocky-ground1").get(), cubeReach);
+}
+
 static void initWater()
 {
     Terrain *water = getWater();
@@ -2,29 +2,38 @@
 
 #include <cstdlib>
 #include <cassert>
+#include <atomic>
 
+/* Reference counted base, safe to retain and release from any thread. Objects
+ * owning GL names hand them to releaseGL*() so the last release may happen off
+ * the context thread */
 class Object
 {
 public:
-	constexpr void retain()
+	inline void retain()
 	{
-		_refs++;
+		// A new reference always comes from one already held, nothing to order
+		_refs.fetch_add(1, std::memory_order_relaxed);
 	}
 
 	inline void release()
 	{
-		if (--_refs == 0)
+		// The last release sees every write made through the other references
+		if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
 			delete this;
 	}
 
-	constexpr Object() : _refs(1) {}
+	inline Object() : _refs(1) {}
+
+	Object(const Object &) = delete;
+	Object &operator=(const Object &) = delete;
 
 	inline virtual ~Object()
 	{
-		assert(_refs == 0);
+		assert(_refs.load(std::memory_order_relaxed) == 0);
 	}
 private:
-	size_t _refs;
+	std::atomic<size_t> _refs;
 };
 
 template <typename T>
@@ -76,16 +85,19 @@ public:
 		return *this;
 	}
 
+	inline AutoRelease<T> &operator=(const AutoRelease<T> &o)
+	{
+		return operator=(o._object);
+	}
+
 	template <typename U>
 	inline AutoRelease<T> &operator=(const AutoRelease<U> &o)
 	{
-		if (this == &o)
-			return *this;
 		return operator=(o._object);
 	}
 
-	template <typename U>
-	inline AutoRelease<T> &operator=(AutoRelease<U> &&o) noexcept
+	// Moves take over the reference, no count traffic
+	inline AutoRelease<T> &operator=(AutoRelease<T> &&o) noexcept
 	{
 		if (this == &o)
 			return *this;
@@ -94,7 +106,18 @@ public:
 			_object->release();
 
 		_object = o._object;
+		o._object = nullptr;
+
+		return *this;
+	}
+
+	template <typename U>
+	inline AutoRelease<T> &operator=(AutoRelease<U> &&o) noexcept
+	{
+		if (_object)
+			_object->release();
 
+		_object = static_cast<T *>(o._object);
 		o._object = nullptr;
 
 		return *this;
@@ -119,9 +142,15 @@ public:
 			_object->retain();
 	}
 
+	constexpr AutoRelease(AutoRelease<T> &&o) noexcept :
+		_object(o._object)
+	{
+		o._object = nullptr;
+	}
+
 	template <typename U>
 	constexpr AutoRelease(AutoRelease<U> &&o) noexcept :
-		_object(o._object)
+		_object(static_cast<T *>(o._object))
 	{
 		o._object = nullptr;
 	}
@@ -132,5 +161,8 @@ public:
 			_object->release();
 	}
 private:
+	template <typename U>
+	friend class AutoRelease;
+
 	T *_object;
 };
@@ -4,6 +4,9 @@
 #include <cassert>
 
 #include "shader.h"
+#include "glresource.h"
+#include "instancing.h"
+#include "modelcache.h"
 
 void Mesh::load(const Vertex *vertex, GLsizei nVertices, const GLuint *index, GLsizei nIndices)
 {
@@ -39,43 +42,106 @@ void Mesh::load(const Vertex *vertex, GLsizei nVertices, const GLuint *index, GL
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     _nIndices = nIndices;
+    _indexType = GL_UNSIGNED_INT;
+}
+
+void Mesh::load(const ModelVertex *vertex, GLsizei nVertices, const void *index, GLsizei nIndices, GLenum indexType)
+{
+    const size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+
+    glGenVertexArrays(1, &_vao);
+    glBindVertexArray(_vao);
+
+    /* Upload vertices */
+
+    glGenBuffers(1, &_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+    glBufferData(GL_ARRAY_BUFFER, nVertices * sizeof(ModelVertex), vertex, GL_STATIC_DRAW);
+
+    /* Upload indices */
+
+    glGenBuffers(1, &_ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, nIndices * indexSize, index, GL_STATIC_DRAW);
+
+    /* Bind vertex attributes, same locations as Vertex */
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, sizeof(ModelVertex), (void *)offsetof(ModelVertex, position));
+
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(ModelVertex), (void *)offsetof(ModelVertex, texCoords));
+
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(ModelVertex), (void *)offsetof(ModelVertex, normal));
+
+    glBindVertexArray(0);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    _nIndices = nIndices;
+    _indexType = indexType;
 }
 
 void Mesh::render(Shader *shader) const
 {
     glBindVertexArray(_vao);
-    glDrawElements(GL_TRIANGLES, _nIndices, GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, _nIndices, _indexType, 0);
+}
+
+void Mesh::renderInstanced(GLuint instances, GLsizei first, GLsizei count) const
+{
+    if (count <= 0)
+        return;
+
+    bind();
+
+    /* Matrix columns, pointed at the range of this draw. The instance buffer
+     * is not part of the mesh, the arrays are disabled again after the draw */
+    glBindBuffer(GL_ARRAY_BUFFER, instances);
+    for (GLuint column = 0; column < 4; column++)
+    {
+        const GLuint attrib = INSTANCE_MODEL_ATTRIB + column;
+        const size_t offset = (size_t)first * sizeof(Matrix4) + column * sizeof(Vector4);
+
+        glEnableVertexAttribArray(attrib);
+        glVertexAttribPointer(attrib, 4, GL_FLOAT, GL_FALSE, sizeof(Matrix4), (void *)offset);
+        glVertexAttribDivisor(attrib, 1);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    drawInstanced(count);
+
+    for (GLuint column = 0; column < 4; column++)
+        glDisableVertexAttribArray(INSTANCE_MODEL_ATTRIB + column);
 }
 
-void Mesh::retain()
+void Mesh::bind() const
 {
-    _refs++;
+    glBindVertexArray(_vao);
 }
 
-void Mesh::release()
+void Mesh::drawInstanced(GLsizei count) const
 {
-    if (--_refs == 0)
-        delete this;
+    glDrawElementsInstanced(GL_TRIANGLES, _nIndices, _indexType, 0, count);
 }
 
 Mesh::Mesh() : _vao(0), _vbo(0), _ebo(0),
-               _nIndices(0),
-               _refs(1)
+               _nIndices(0), _indexType(GL_UNSIGNED_INT)
 {
 }
 
 Mesh::~Mesh()
 {
-    assert(_refs == 0);
-
     if (_ebo)
-        glDeleteBuffers(1, &_ebo);
+        releaseGLBuffers(1, &_ebo);
 
     if (_vbo)
-        glDeleteBuffers(1, &_vbo);
+        releaseGLBuffers(1, &_vbo);
 
     if (_vao)
-        glDeleteVertexArrays(1, &_vao);
+        releaseGLVertexArrays(1, &_vao);
 }
 
 void RenderableMesh::render(Shader *shader) const
@@ -87,10 +153,10 @@ void RenderableMesh::render(Shader *shader) const
     _mesh->render(shader);
 }
 
-void RenderableMesh::update()
+bool RenderableMesh::update()
 {
     if (!_dirty)
-        return;
+        return false;
 
     _model = Matrix4(1.0f);
     _model = mutil::translate(_model, _position);
@@ -100,13 +166,13 @@ void RenderableMesh::update()
     _invModel = mutil::inverse(_model);
 
     _dirty = false;
+    return true;
 }
 
 RenderableMesh::RenderableMesh(Mesh *mesh) : _mesh(mesh),
                                              _enabled(true),
                                              _position(0.0f), _rotation(), _scale(1.0f),
-                                             _dirty(true),
-                                             _refs(1)
+                                             _dirty(true)
 {
     assert(mesh != nullptr);
     mesh->retain();
@@ -114,17 +180,5 @@ RenderableMesh::RenderableMesh(Mesh *mesh) : _mesh(mesh),
 
 RenderableMesh::~RenderableMesh()
 {
-    assert(_refs == 0);
     _mesh->release();
 }
-
-void RenderableMesh::retain()
-{
-    _refs++;
-}
-
-void RenderableMesh::release()
-{
-    if (--_refs == 0)
-        delete this;
-}
@@ -5,12 +5,15 @@
 #include <glad/glad.h>
 #include <mutil/mutil.h>
 
+#include "mem.h"
 #include "material.h"
 
 using namespace mutil;
 
 class Shader;
 
+struct ModelVertex;
+
 struct Vertex
 {
     Vector3 position;
@@ -18,37 +21,50 @@ struct Vertex
     Vector3 normal;
 };
 
-class Mesh
+class Mesh final : public Object
 {
 public:
     void load(const Vertex *vertex, GLsizei nVertices, const GLuint *index, GLsizei nIndices);
 
+    /* Upload baked vertices as stored, the attributes are unpacked on fetch.
+     * Indices are GL_UNSIGNED_SHORT or GL_UNSIGNED_INT */
+    void load(const ModelVertex *vertex, GLsizei nVertices, const void *index, GLsizei nIndices, GLenum indexType);
+
     void render(Shader *shader) const;
 
-    void retain();
-    void release();
+    /* Draw count instances with the model matrices from first on in an
+     * instance buffer */
+    void renderInstanced(GLuint instances, GLsizei first, GLsizei count) const;
+
+    /* Bind the vertex array, instance attributes past the mesh's may be set
+     * up before drawInstanced and have to be disabled after */
+    void bind() const;
+    void drawInstanced(GLsizei count) const;
 
     Mesh();
-    ~Mesh();
+    virtual ~Mesh();
 
 private:
     GLuint _vao, _vbo, _ebo;
     GLsizei _nIndices;
-
-    size_t _refs;
+    GLenum _indexType;
 };
 
-class RenderableMesh
+class RenderableMesh final : public Object
 {
 public:
     void render(Shader *shader) const;
 
-    void update();
+    // Recompute the model matrix if the transform changed, true if it did
+    bool update();
 
     constexpr bool enabled() const { return _enabled; }
     constexpr void setEnabled(bool enabled) { _enabled = enabled; }
 
     constexpr Material *getMaterial() { return &_material; }
+    constexpr const Material &material() const { return _material; }
+
+    constexpr const Mesh *mesh() const { return _mesh; }
 
     constexpr const Vector3 &position() const { return _position; }
 
@@ -77,11 +93,8 @@ public:
     constexpr const Matrix4 &model() const { return _model; }
     constexpr const Matrix4 &invModel() const { return _invModel; }
 
-    void retain();
-    void release();
-
     RenderableMesh(Mesh *mesh);
-    ~RenderableMesh();
+    virtual ~RenderableMesh();
 
 private:
     Mesh *_mesh;
@@ -96,6 +109,4 @@ private:
     bool _dirty;
 
     Matrix4 _model, _invModel;
-
-    size_t _refs;
 };
@@ -0,0 +1,329 @@
+#include "meshopt.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// Cache the greedy ordering scores against, larger than the modeled one
+#define FORSYTH_CACHE_SIZE 32
+
+static inline uint32_t hashBytes(const uint8_t *bytes, size_t size)
+{
+	uint32_t h = 2166136261u; // FNV-1a
+	for (size_t i = 0; i < size; i++)
+		h = (h ^ bytes[i]) * 16777619u;
+	return h;
+}
+
+size_t weldVertices(void *vertices, size_t vertexSize, size_t vertexCount, uint32_t *indices, size_t indexCount)
+{
+	uint8_t *bytes = (uint8_t *)vertices;
+
+	size_t tableSize = 16;
+	while (tableSize < vertexCount * 2)
+		tableSize *= 2;
+	const size_t mask = tableSize - 1;
+
+	/* Open addressing over the compacted vertices, a unique vertex moves to
+	 * the front which only overwrites vertices already visited */
+	std::vector<uint32_t> table(tableSize, UINT32_MAX);
+	std::vector<uint32_t> remap(vertexCount);
+
+	size_t unique = 0;
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		const uint8_t *vertex = bytes + v * vertexSize;
+
+		size_t slot = hashBytes(vertex, vertexSize) & mask;
+		while (table[slot] != UINT32_MAX && memcmp(bytes + table[slot] * vertexSize, vertex, vertexSize) != 0)
+			slot = (slot + 1) & mask;
+
+		if (table[slot] == UINT32_MAX)
+		{
+			if (unique != v)
+				memcpy(bytes + unique * vertexSize, vertex, vertexSize);
+			table[slot] = (uint32_t)unique++;
+		}
+		remap[v] = table[slot];
+	}
+
+	for (size_t i = 0; i < indexCount; i++)
+		indices[i] = remap[indices[i]];
+
+	return unique;
+}
+
+static inline float forsythScore(int32_t cachePos, uint32_t valence)
+{
+	/* Vertices without triangles left never count */
+	if (valence == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cachePos >= 0)
+	{
+		/* The last triangle's vertices score flat, so the next one does not
+		 * simply turn back on them */
+		if (cachePos < 3)
+			score = 0.75f;
+		else
+			score = powf(1.0f - (float)(cachePos - 3) / (FORSYTH_CACHE_SIZE - 3), 1.5f);
+	}
+
+	/* Few triangles left, finish the vertex before it falls out */
+	return score + 2.0f / sqrtf((float)valence);
+}
+
+void optimizeVertexCache(uint32_t *indices, size_t indexCount, size_t vertexCount)
+{
+	const size_t triCount = indexCount / 3;
+	if (triCount == 0)
+		return;
+
+	const std::vector<uint32_t> source(indices, indices + triCount * 3);
+
+	/* Triangles of each vertex, the live ones first */
+	std::vector<uint32_t> valence(vertexCount, 0);
+	for (size_t i = 0; i < triCount * 3; i++)
+		valence[source[i]]++;
+
+	std::vector<uint32_t> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+		offsets[v + 1] = offsets[v] + valence[v];
+
+	std::vector<uint32_t> adjacency(triCount * 3);
+	{
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < triCount * 3; i++)
+			adjacency[fill[source[i]]++] = (uint32_t)(i / 3);
+	}
+
+	std::vector<int32_t> cachePos(vertexCount, -1);
+	std::vector<float> score(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		score[v] = forsythScore(-1, valence[v]);
+
+	std::vector<bool> emitted(triCount, false);
+
+	uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+	size_t cacheCount = 0;
+
+	int64_t best = -1;
+	size_t cursor = 0; // Fallback when no cached vertex has triangles left
+
+	for (size_t out = 0; out < triCount; out++)
+	{
+		if (best < 0)
+		{
+			while (emitted[cursor])
+				cursor++;
+			best = (int64_t)cursor;
+		}
+
+		const uint32_t *tri = &source[(size_t)best * 3];
+		indices[out * 3 + 0] = tri[0];
+		indices[out * 3 + 1] = tri[1];
+		indices[out * 3 + 2] = tri[2];
+		emitted[(size_t)best] = true;
+
+		for (int k = 0; k < 3; k++)
+		{
+			const uint32_t v = tri[k];
+			uint32_t *adj = &adjacency[offsets[v]];
+			for (uint32_t j = 0; j < valence[v]; j++)
+			{
+				if (adj[j] == (uint32_t)best)
+				{
+					adj[j] = adj[valence[v] - 1];
+					break;
+				}
+			}
+			valence[v]--;
+		}
+
+		/* The triangle's vertices move to the front */
+		uint32_t next[FORSYTH_CACHE_SIZE + 3];
+		size_t nextCount = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			if (std::find(next, next + nextCount, tri[k]) == next + nextCount)
+				next[nextCount++] = tri[k];
+		}
+		for (size_t i = 0; i < cacheCount; i++)
+		{
+			if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2])
+				next[nextCount++] = cache[i];
+		}
+
+		for (size_t i = 0; i < nextCount; i++)
+		{
+			const uint32_t v = next[i];
+			cachePos[v] = i < FORSYTH_CACHE_SIZE ? (int32_t)i : -1;
+			score[v] = forsythScore(cachePos[v], valence[v]);
+		}
+
+		cacheCount = std::min(nextCount, (size_t)FORSYTH_CACHE_SIZE);
+		std::copy(next, next + cacheCount, cache);
+
+		/* Only triangles of rescored vertices changed, the best is among them */
+		best = -1;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < nextCount; i++)
+		{
+			const uint32_t v = next[i];
+			for (uint32_t j = 0; j < valence[v]; j++)
+			{
+				const uint32_t t = adjacency[offsets[v] + j];
+				const float s = score[source[t * 3 + 0]] + score[source[t * 3 + 1]] + score[source[t * 3 + 2]];
+				if (s > bestScore)
+				{
+					bestScore = s;
+					best = t;
+				}
+			}
+		}
+	}
+}
+
+struct Cluster
+{
+	size_t first, count; // Triangles
+	float sort;
+};
+
+void optimizeOverdraw(uint32_t *indices, size_t indexCount, const float *positions, size_t positionStride,
+	size_t vertexCount)
+{
+	const size_t triCount = indexCount / 3;
+	if (triCount == 0)
+		return;
+
+	const size_t stride = positionStride / sizeof(float);
+
+	/* Split where the FIFO cache misses all of a triangle's vertices */
+	std::vector<uint32_t> timestamps(vertexCount, 0);
+	uint32_t time = MESHOPT_CACHE_SIZE + 1;
+
+	std::vector<Cluster> clusters;
+	for (size_t t = 0; t < triCount; t++)
+	{
+		int misses = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			const uint32_t v = indices[t * 3 + k];
+			if (time - timestamps[v] > MESHOPT_CACHE_SIZE)
+			{
+				timestamps[v] = time++;
+				misses++;
+			}
+		}
+
+		if (t == 0 || misses == 3)
+			clusters.push_back(Cluster{ t, 0, 0.0f });
+		clusters.back().count++;
+	}
+
+	/* Area weighted centroids and normals */
+	std::vector<float> centroids(clusters.size() * 3, 0.0f), normals(clusters.size() * 3, 0.0f), areas(clusters.size(), 0.0f);
+	float meshCentroid[3] = {};
+	float meshArea = 0.0f;
+
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		for (size_t t = clusters[c].first; t < clusters[c].first + clusters[c].count; t++)
+		{
+			const float *p0 = positions + indices[t * 3 + 0] * stride;
+			const float *p1 = positions + indices[t * 3 + 1] * stride;
+			const float *p2 = positions + indices[t * 3 + 2] * stride;
+
+			const float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			const float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			const float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			const float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			for (int k = 0; k < 3; k++)
+			{
+				centroids[c * 3 + k] += (p0[k] + p1[k] + p2[k]) * (area / 3.0f);
+				normals[c * 3 + k] += n[k];
+			}
+			areas[c] += area;
+		}
+
+		for (int k = 0; k < 3; k++)
+			meshCentroid[k] += centroids[c * 3 + k];
+		meshArea += areas[c];
+	}
+
+	for (int k = 0; k < 3; k++)
+		meshCentroid[k] = meshArea > 0.0f ? meshCentroid[k] / meshArea : 0.0f;
+
+	/* Clusters facing away from the center occlude the ones inside */
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		const float *n = &normals[c * 3];
+		const float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (areas[c] <= 0.0f || length <= 0.0f)
+			continue;
+
+		float sort = 0.0f;
+		for (int k = 0; k < 3; k++)
+			sort += (centroids[c * 3 + k] / areas[c] - meshCentroid[k]) * n[k];
+		clusters[c].sort = sort / length;
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b) { return a.sort > b.sort; });
+
+	const std::vector<uint32_t> source(indices, indices + triCount * 3);
+	size_t out = 0;
+	for (const Cluster &cluster : clusters)
+	{
+		std::copy(source.begin() + cluster.first * 3, source.begin() + (cluster.first + cluster.count) * 3, indices + out);
+		out += cluster.count * 3;
+	}
+}
+
+size_t optimizeVertexFetch(void *vertices, size_t vertexSize, size_t vertexCount, uint32_t *indices, size_t indexCount)
+{
+	std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+	uint32_t next = 0;
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		uint32_t &target = remap[indices[i]];
+		if (target == UINT32_MAX)
+			target = next++;
+		indices[i] = target;
+	}
+
+	uint8_t *bytes = (uint8_t *)vertices;
+	const std::vector<uint8_t> source(bytes, bytes + vertexCount * vertexSize);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		if (remap[v] != UINT32_MAX)
+			memcpy(bytes + remap[v] * vertexSize, &source[v * vertexSize], vertexSize);
+	}
+
+	return next;
+}
+
+float vertexCacheMissRatio(const uint32_t *indices, size_t indexCount, size_t vertexCount)
+{
+	const size_t triCount = indexCount / 3;
+	if (triCount == 0)
+		return 0.0f;
+
+	std::vector<uint32_t> timestamps(vertexCount, 0);
+	uint32_t time = MESHOPT_CACHE_SIZE + 1;
+
+	size_t misses = 0;
+	for (size_t i = 0; i < triCount * 3; i++)
+	{
+		if (time - timestamps[indices[i]] > MESHOPT_CACHE_SIZE)
+		{
+			timestamps[indices[i]] = time++;
+			misses++;
+		}
+	}
+
+	return (float)misses / (float)triCount;
+}
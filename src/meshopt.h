@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/* Offline triangle mesh optimization for the model baker. Indices are
+ * triangle lists, vertices are opaque blocks of vertexSize bytes */
+
+// Vertices the post transform cache is modeled with
+#define MESHOPT_CACHE_SIZE 16
+
+/* Merge bitwise equal vertices, quantize first so vertices that only differ
+ * below the stored precision merge too. Vertices are compacted in place and
+ * indices remapped, returns the new vertex count */
+size_t weldVertices(void *vertices, size_t vertexSize, size_t vertexCount, uint32_t *indices, size_t indexCount);
+
+/* Reorder triangles for the post transform vertex cache, greedily emitting
+ * the triangle whose vertices score best by cache position and remaining
+ * valence (Forsyth) */
+void optimizeVertexCache(uint32_t *indices, size_t indexCount, size_t vertexCount);
+
+/* Reorder triangles to draw outward facing parts first. The cache ordered
+ * list is split where a triangle misses the cache on all vertices, so moving
+ * the clusters keeps their cache efficiency. Clusters sort by how far their
+ * normal points away from the mesh center. Positions are 3 floats at the
+ * start of each stride */
+void optimizeOverdraw(uint32_t *indices, size_t indexCount, const float *positions, size_t positionStride,
+	size_t vertexCount);
+
+/* Reorder vertices by first use so fetches walk the buffer forward, drops
+ * unreferenced vertices. Returns the new vertex count */
+size_t optimizeVertexFetch(void *vertices, size_t vertexSize, size_t vertexCount, uint32_t *indices, size_t indexCount);
+
+// Transformed vertices per triangle with a FIFO cache of MESHOPT_CACHE_SIZE
+float vertexCacheMissRatio(const uint32_t *indices, size_t indexCount, size_t vertexCount);
@@ -0,0 +1,59 @@
+#include "model.h"
+
+#include <cstdio>
+
+#include "modelcache.h"
+
+bool Model::load(const char *path, const char *textureDir)
+{
+    printf("Model::load: %s\n", path);
+
+    ModelCache cache;
+    if (!readModelCache(path, &cache))
+    {
+        printf("Model::load: Missing or stale cache: %s\n", path);
+        return false;
+    }
+
+    _parts.clear();
+    _parts.reserve(cache.header->partCount);
+
+    for (uint32_t i = 0; i < cache.header->partCount; i++)
+    {
+        const ModelPart &data = cache.parts[i];
+
+        /* Blocks are GPU ready, upload them straight from the cache */
+        Mesh *mesh = new Mesh();
+        mesh->load(modelVertices(cache, data), (GLsizei)data.vertexCount, modelIndices(cache, data), (GLsizei)data.indexCount,
+                   data.indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
+
+        Material *material = new Material();
+        if (data.albedo[0])
+        {
+            char texturePath[256];
+            snprintf(texturePath, sizeof(texturePath), "%s/%s", textureDir, data.albedo);
+            material->albedo = loadTexture2D(texturePath, COLOR_SPACE_SRGB);
+        }
+
+        Part part;
+        part.mesh = AutoRelease<Mesh>(mesh);
+        part.material = AutoRelease<Material>(material);
+        part.name = data.name;
+        part.doubleSided = (data.flags & MODEL_PART_DOUBLE_SIDED) != 0;
+        _parts.push_back(std::move(part));
+    }
+
+    _boundsMin = Vector3(cache.header->boundsMin[0], cache.header->boundsMin[1], cache.header->boundsMin[2]);
+    _boundsMax = Vector3(cache.header->boundsMax[0], cache.header->boundsMax[1], cache.header->boundsMax[2]);
+
+    freeModelCache(&cache);
+    return true;
+}
+
+Model::Model() : _boundsMin(0.0f), _boundsMax(0.0f)
+{
+}
+
+Model::~Model()
+{
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <mutil/mutil.h>
+
+#include "mem.h"
+#include "mesh.h"
+#include "material.h"
+
+using namespace mutil;
+
+// Where the build bakes models, see TERRAIN_BAKE_MODELS
+#ifndef MODEL_CACHE_DIR
+#define MODEL_CACHE_DIR "models"
+#endif
+
+/* A baked model, a mesh and material per part. Models come from the caches
+ * model_bake writes, source formats are never read at run time */
+class Model final : public Object
+{
+public:
+    /* Load a cache, false if it is missing or stale. Textures are looked up
+     * in textureDir, the source model's directory */
+    bool load(const char *path, const char *textureDir);
+
+    inline size_t partCount() const { return _parts.size(); }
+
+    inline Mesh *partMesh(size_t i) const { return _parts[i].mesh.get(); }
+    inline Material *partMaterial(size_t i) const { return _parts[i].material.get(); }
+    inline const char *partName(size_t i) const { return _parts[i].name.c_str(); }
+    inline bool partDoubleSided(size_t i) const { return _parts[i].doubleSided; }
+
+    // Bounds of all parts in model space
+    constexpr const Vector3 &boundsMin() const { return _boundsMin; }
+    constexpr const Vector3 &boundsMax() const { return _boundsMax; }
+
+    Model();
+    virtual ~Model();
+
+private:
+    struct Part
+    {
+        AutoRelease<Mesh> mesh;
+        AutoRelease<Material> material;
+        std::string name;
+        bool doubleSided;
+    };
+
+    std::vector<Part> _parts;
+    Vector3 _boundsMin, _boundsMax;
+};
@@ -0,0 +1,256 @@
+/* Offline model baker, imports a source model once and writes the optimized
+ * cache the renderer loads */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "modelcache.h"
+#include "meshopt.h"
+
+static void usage(const char *argv0)
+{
+    printf("Usage: %s [options] <input> <output>\n", argv0);
+    printf("Bake a model any importer format reads into a model cache\n\n");
+    printf("Options:\n");
+    printf("  -t <material>=<texture>  Albedo texture of a material, relative to the input\n");
+    printf("  -d <material>            Draw a material double-sided, as if the source marked it\n");
+    printf("  -s <scale>               Uniform scale (default 1)\n");
+    printf("  -v                       Print optimization statistics\n");
+}
+
+struct TextureOverride
+{
+    std::string material, path;
+};
+
+// Triangles of one material, vertices per corner until welded
+struct BakePart
+{
+    std::string name, albedo;
+    bool doubleSided;
+    std::vector<ModelVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<uint16_t> shortIndices; // When the vertices fit
+};
+
+static void optimizePart(BakePart &part, bool verbose)
+{
+    const size_t corners = part.vertices.size();
+    const float acmrBefore = vertexCacheMissRatio(part.indices.data(), part.indices.size(), corners);
+
+    /* Vertices are quantized already, weld what the quantization merged */
+    size_t count = weldVertices(part.vertices.data(), sizeof(ModelVertex), corners, part.indices.data(), part.indices.size());
+
+    /* Drop triangles welding collapsed */
+    size_t kept = 0;
+    for (size_t i = 0; i + 2 < part.indices.size(); i += 3)
+    {
+        const uint32_t a = part.indices[i], b = part.indices[i + 1], c = part.indices[i + 2];
+        if (a == b || b == c || c == a)
+            continue;
+        part.indices[kept++] = a;
+        part.indices[kept++] = b;
+        part.indices[kept++] = c;
+    }
+    part.indices.resize(kept);
+
+    optimizeVertexCache(part.indices.data(), part.indices.size(), count);
+
+    std::vector<float> positions(count * 3);
+    for (size_t v = 0; v < count; v++)
+        unpackModelPosition(part.vertices[v], &positions[v * 3]);
+    optimizeOverdraw(part.indices.data(), part.indices.size(), positions.data(), 3 * sizeof(float), count);
+
+    count = optimizeVertexFetch(part.vertices.data(), sizeof(ModelVertex), count, part.indices.data(), part.indices.size());
+    part.vertices.resize(count);
+
+    if (count <= 65536)
+        part.shortIndices.assign(part.indices.begin(), part.indices.end());
+
+    if (verbose)
+    {
+        const size_t indexSize = part.shortIndices.empty() ? 4 : 2;
+        printf("  %-24s %7zu -> %7zu vertices, %7zu triangles, ACMR %.3f -> %.3f, %zu bytes\n", part.name.c_str(), corners,
+            count, part.indices.size() / 3, (double)acmrBefore,
+            (double)vertexCacheMissRatio(part.indices.data(), part.indices.size(), count),
+            count * sizeof(ModelVertex) + part.indices.size() * indexSize);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<TextureOverride> textures;
+    std::vector<std::string> doubleSided;
+    float scale = 1.0f;
+    bool verbose = false;
+
+    const char *paths[2];
+    int npaths = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc)
+        {
+            const char *arg = argv[++i];
+            const char *eq = strchr(arg, '=');
+            if (!eq)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            textures.push_back(TextureOverride{ std::string(arg, eq - arg), std::string(eq + 1) });
+        }
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+            doubleSided.push_back(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            scale = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "-v"))
+            verbose = true;
+        else if (npaths < 2 && argv[i][0] != '-')
+            paths[npaths++] = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (npaths != 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *input = paths[0];
+    const char *output = paths[1];
+
+    /* Node transforms are baked in, the model is one space */
+    Assimp::Importer importer;
+    const aiScene *scene = importer.ReadFile(input, aiProcess_Triangulate | aiProcess_PreTransformVertices |
+        aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_SortByPType);
+    if (!scene)
+    {
+        fprintf(stderr, "%s: %s\n", input, importer.GetErrorString());
+        return 1;
+    }
+
+    /* One part per material, meshes sharing one are merged */
+    std::vector<BakePart> parts(scene->mNumMaterials);
+    for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+    {
+        const aiMaterial *material = scene->mMaterials[i];
+        parts[i].name = material->GetName().C_Str();
+
+        aiString texture;
+        if (material->GetTexture(aiTextureType_DIFFUSE, 0, &texture) == AI_SUCCESS)
+            parts[i].albedo = texture.C_Str();
+
+        for (const TextureOverride &o : textures)
+        {
+            if (o.material == parts[i].name)
+                parts[i].albedo = o.path;
+        }
+
+        int twoSided = 0;
+        parts[i].doubleSided = (material->Get(AI_MATKEY_TWOSIDED, twoSided) == AI_SUCCESS && twoSided) ||
+            std::find(doubleSided.begin(), doubleSided.end(), parts[i].name) != doubleSided.end();
+    }
+
+    for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+    {
+        const aiMesh *mesh = scene->mMeshes[m];
+        if (!(mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) || mesh->mMaterialIndex >= parts.size())
+            continue;
+
+        BakePart &part = parts[mesh->mMaterialIndex];
+        const uint32_t base = (uint32_t)part.vertices.size();
+
+        for (unsigned int v = 0; v < mesh->mNumVertices; v++)
+        {
+            const aiVector3D &p = mesh->mVertices[v];
+            const float position[3] = { p.x * scale, p.y * scale, p.z * scale };
+
+            float texCoords[2] = { 0.0f, 0.0f };
+            if (mesh->HasTextureCoords(0))
+            {
+                texCoords[0] = mesh->mTextureCoords[0][v].x;
+                texCoords[1] = mesh->mTextureCoords[0][v].y;
+            }
+
+            float normal[3] = { 0.0f, 1.0f, 0.0f };
+            if (mesh->HasNormals())
+            {
+                aiVector3D n = mesh->mNormals[v];
+                n.Normalize();
+                normal[0] = n.x;
+                normal[1] = n.y;
+                normal[2] = n.z;
+            }
+
+            part.vertices.push_back(packModelVertex(position, texCoords, normal));
+        }
+
+        for (unsigned int f = 0; f < mesh->mNumFaces; f++)
+        {
+            const aiFace &face = mesh->mFaces[f];
+            if (face.mNumIndices != 3)
+                continue;
+            for (int k = 0; k < 3; k++)
+                part.indices.push_back(base + face.mIndices[k]);
+        }
+    }
+
+    if (verbose)
+        printf("%s: %u meshes, %u materials\n", input, scene->mNumMeshes, scene->mNumMaterials);
+
+    std::vector<ModelPartData> data;
+    for (BakePart &part : parts)
+    {
+        if (part.indices.empty())
+            continue;
+
+        if (part.name.size() >= MODEL_NAME_SIZE || part.albedo.size() >= MODEL_PATH_SIZE)
+        {
+            fprintf(stderr, "%s: Material name or texture path too long: %s\n", input, part.name.c_str());
+            return 1;
+        }
+
+        optimizePart(part, verbose);
+
+        ModelPartData d;
+        d.name = part.name.c_str();
+        d.albedo = part.albedo.c_str();
+        d.vertices = part.vertices.data();
+        d.vertexCount = (uint32_t)part.vertices.size();
+        d.indexCount = (uint32_t)part.indices.size();
+        d.flags = part.doubleSided ? MODEL_PART_DOUBLE_SIDED : 0;
+        if (part.shortIndices.empty())
+        {
+            d.indices = part.indices.data();
+            d.indexSize = sizeof(uint32_t);
+        }
+        else
+        {
+            d.indices = part.shortIndices.data();
+            d.indexSize = sizeof(uint16_t);
+        }
+        data.push_back(d);
+    }
+
+    if (!writeModelCache(output, data.data(), (uint32_t)data.size()))
+    {
+        fprintf(stderr, "Failed to write %s\n", output);
+        return 1;
+    }
+
+    printf("Baked %s into %s, %zu parts\n", input, output, data.size());
+    return 0;
+}
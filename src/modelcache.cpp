@@ -0,0 +1,219 @@
+#include "modelcache.h"
+
+#include <cmath>
+#include <cstring>
+
+#include <lysys/lysys.hpp>
+#include <half.hpp>
+
+static inline uint32_t alignBlock(uint32_t offset)
+{
+	return (offset + 15) & ~15u;
+}
+
+static inline uint16_t packHalf(float value)
+{
+	const half_float::half h(value);
+	uint16_t bits;
+	memcpy(&bits, static_cast<const void *>(&h), sizeof(bits));
+	return bits;
+}
+
+static inline float unpackHalf(uint16_t bits)
+{
+	half_float::half h;
+	memcpy(static_cast<void *>(&h), &bits, sizeof(bits));
+	return (float)h;
+}
+
+static inline uint32_t packSnorm10(float value)
+{
+	const float v = fminf(fmaxf(value, -1.0f), 1.0f);
+	return (uint32_t)(int32_t)lrintf(v * 511.0f) & 0x3ff;
+}
+
+ModelVertex packModelVertex(const float position[3], const float texCoords[2], const float normal[3])
+{
+	ModelVertex vertex;
+	vertex.position[0] = packHalf(position[0]);
+	vertex.position[1] = packHalf(position[1]);
+	vertex.position[2] = packHalf(position[2]);
+	vertex.position[3] = packHalf(1.0f);
+	vertex.texCoords[0] = packHalf(texCoords[0]);
+	vertex.texCoords[1] = packHalf(texCoords[1]);
+	vertex.normal = packSnorm10(normal[0]) | packSnorm10(normal[1]) << 10 | packSnorm10(normal[2]) << 20;
+	return vertex;
+}
+
+void unpackModelPosition(const ModelVertex &vertex, float positionOut[3])
+{
+	for (int i = 0; i < 3; i++)
+		positionOut[i] = unpackHalf(vertex.position[i]);
+}
+
+// Whether a part's ranges lie in the file and its indices in its vertices
+static bool validPart(const ModelCache *cache, const ModelPart &part)
+{
+	const uint64_t size = cache->header->size;
+
+	if (part.name[MODEL_NAME_SIZE - 1] || part.albedo[MODEL_PATH_SIZE - 1])
+		return false;
+	if (part.indexSize != 2 && part.indexSize != 4)
+		return false;
+	if (part.flags & ~MODEL_PART_DOUBLE_SIDED)
+		return false;
+	if (part.vertexOffset % 16 || part.indexOffset % 16)
+		return false;
+	if ((uint64_t)part.vertexOffset + (uint64_t)part.vertexCount * sizeof(ModelVertex) > size)
+		return false;
+	if ((uint64_t)part.indexOffset + (uint64_t)part.indexCount * part.indexSize > size)
+		return false;
+
+	const void *indices = modelIndices(*cache, part);
+	for (uint32_t i = 0; i < part.indexCount; i++)
+	{
+		const uint32_t index = part.indexSize == 2 ? ((const uint16_t *)indices)[i] : ((const uint32_t *)indices)[i];
+		if (index >= part.vertexCount)
+			return false;
+	}
+
+	return true;
+}
+
+bool readModelCache(const char *path, ModelCache *cache)
+{
+	memset(cache, 0, sizeof(*cache));
+
+	ls_handle file = ls_open(path, LS_FILE_READ, LS_SHARE_READ, LS_OPEN_EXISTING);
+	if (!file)
+		return false;
+
+	/* Reject caches from other baker versions */
+	ModelHeader header;
+	bool ok = (size_t)ls_read(file, &header, sizeof(header)) == sizeof(header) &&
+		header.magic == MODEL_CACHE_MAGIC &&
+		header.version == MODEL_CACHE_VERSION &&
+		header.size >= sizeof(header) &&
+		header.partCount <= (header.size - sizeof(header)) / sizeof(ModelPart);
+
+	if (ok)
+	{
+		/* The rest in one read, the blocks are uploaded from here */
+		cache->data = new uint8_t[header.size];
+		memcpy(cache->data, &header, sizeof(header));
+
+		const size_t rest = header.size - sizeof(header);
+		ok = (size_t)ls_read(file, cache->data + sizeof(header), rest) == rest;
+	}
+
+	ls_close(file);
+
+	if (ok)
+	{
+		cache->header = (const ModelHeader *)cache->data;
+		cache->parts = (const ModelPart *)(cache->data + sizeof(ModelHeader));
+		for (uint32_t i = 0; i < header.partCount && ok; i++)
+			ok = validPart(cache, cache->parts[i]);
+	}
+
+	if (!ok)
+		freeModelCache(cache);
+	return ok;
+}
+
+void freeModelCache(ModelCache *cache)
+{
+	delete[] cache->data;
+	memset(cache, 0, sizeof(*cache));
+}
+
+bool writeModelCache(const char *path, const ModelPartData *parts, uint32_t partCount)
+{
+	ModelHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MODEL_CACHE_MAGIC;
+	header.version = MODEL_CACHE_VERSION;
+	header.partCount = partCount;
+
+	for (int i = 0; i < 3; i++)
+	{
+		header.boundsMin[i] = INFINITY;
+		header.boundsMax[i] = -INFINITY;
+	}
+
+	/* Lay out the blocks after the part table */
+	ModelPart *table = new ModelPart[partCount];
+	memset(table, 0, partCount * sizeof(ModelPart));
+
+	uint32_t offset = alignBlock((uint32_t)(sizeof(ModelHeader) + partCount * sizeof(ModelPart)));
+	for (uint32_t i = 0; i < partCount; i++)
+	{
+		const ModelPartData &data = parts[i];
+		ModelPart &part = table[i];
+
+		strncpy(part.name, data.name ? data.name : "", MODEL_NAME_SIZE - 1);
+		strncpy(part.albedo, data.albedo ? data.albedo : "", MODEL_PATH_SIZE - 1);
+
+		part.vertexOffset = offset;
+		part.vertexCount = data.vertexCount;
+		offset = alignBlock(offset + data.vertexCount * (uint32_t)sizeof(ModelVertex));
+
+		part.indexOffset = offset;
+		part.indexCount = data.indexCount;
+		part.indexSize = data.indexSize;
+		part.flags = data.flags;
+		offset = alignBlock(offset + data.indexCount * data.indexSize);
+
+		for (uint32_t v = 0; v < data.vertexCount; v++)
+		{
+			float position[3];
+			unpackModelPosition(data.vertices[v], position);
+			for (int k = 0; k < 3; k++)
+			{
+				header.boundsMin[k] = fminf(header.boundsMin[k], position[k]);
+				header.boundsMax[k] = fmaxf(header.boundsMax[k], position[k]);
+			}
+		}
+	}
+	header.size = offset;
+
+	ls_handle file = ls_open(path, LS_FILE_WRITE, LS_SHARE_NONE, LS_CREATE_ALWAYS);
+	if (!file)
+	{
+		delete[] table;
+		return false;
+	}
+
+	static const uint8_t kPadding[16] = {};
+	uint32_t written = 0;
+
+	/* Zero fill up to the next block */
+	auto pad = [&](uint32_t to) {
+		const size_t n = to - written;
+		written = to;
+		return n == 0 || (size_t)ls_write(file, kPadding, n) == n;
+	};
+
+	bool ok = (size_t)ls_write(file, &header, sizeof(header)) == sizeof(header);
+	ok = ok && (size_t)ls_write(file, table, partCount * sizeof(ModelPart)) == partCount * sizeof(ModelPart);
+	written = (uint32_t)(sizeof(header) + partCount * sizeof(ModelPart));
+
+	for (uint32_t i = 0; i < partCount && ok; i++)
+	{
+		const size_t vertexBytes = parts[i].vertexCount * sizeof(ModelVertex);
+		const size_t indexBytes = (size_t)parts[i].indexCount * parts[i].indexSize;
+
+		ok = ok && pad(table[i].vertexOffset);
+		ok = ok && (size_t)ls_write(file, parts[i].vertices, vertexBytes) == vertexBytes;
+		written += (uint32_t)vertexBytes;
+
+		ok = ok && pad(table[i].indexOffset);
+		ok = ok && (size_t)ls_write(file, parts[i].indices, indexBytes) == indexBytes;
+		written += (uint32_t)indexBytes;
+	}
+	ok = ok && pad(header.size);
+
+	ls_close(file);
+	delete[] table;
+	return ok;
+}
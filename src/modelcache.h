@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/* Baked models, written offline by model_bake and uploaded by the renderer
+ * as stored. A cache is a header, the part table and then each part's
+ * vertices and indices, every block 16 byte aligned */
+
+#define MODEL_CACHE_MAGIC 0x4c444d54 // 'TMDL'
+#define MODEL_CACHE_VERSION 2
+
+#define MODEL_NAME_SIZE 32
+#define MODEL_PATH_SIZE 96
+
+// Part flags
+#define MODEL_PART_DOUBLE_SIDED 0x1 // Drawn without backface culling, like leaf cards
+
+// A quantized vertex, 16 bytes
+struct ModelVertex
+{
+	uint16_t position[4]; // Half floats, w is 1
+	uint16_t texCoords[2]; // Half floats
+	uint32_t normal; // Signed normalized 10:10:10:2, w is 0
+};
+
+static_assert(sizeof(ModelVertex) == 16, "ModelVertex is uploaded as is");
+
+struct ModelHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size; // File bytes
+	uint32_t partCount;
+	float boundsMin[3], boundsMax[3];
+};
+
+/* A range drawn with one material. Indices are 16 bit when the part has at
+ * most 65536 vertices */
+struct ModelPart
+{
+	char name[MODEL_NAME_SIZE]; // Material name in the source
+	char albedo[MODEL_PATH_SIZE]; // Texture, relative to the source model, empty if none
+	uint32_t vertexOffset, vertexCount; // Bytes from the file start, vertices
+	uint32_t indexOffset, indexCount;
+	uint32_t indexSize; // 2 or 4
+	uint32_t flags; // MODEL_PART_*
+};
+
+// A cache read into memory, parts point into data
+struct ModelCache
+{
+	uint8_t *data;
+	const ModelHeader *header;
+	const ModelPart *parts;
+};
+
+/* Read a cache with one read and validate its ranges. Returns false on a
+ * missing, stale or corrupt cache */
+bool readModelCache(const char *path, ModelCache *cache);
+void freeModelCache(ModelCache *cache);
+
+inline const ModelVertex *modelVertices(const ModelCache &cache, const ModelPart &part)
+{
+	return (const ModelVertex *)(cache.data + part.vertexOffset);
+}
+
+inline const void *modelIndices(const ModelCache &cache, const ModelPart &part)
+{
+	return cache.data + part.indexOffset;
+}
+
+// A part to write, indices are indexSize bytes each
+struct ModelPartData
+{
+	const char *name;
+	const char *albedo;
+	const ModelVertex *vertices;
+	uint32_t vertexCount;
+	const void *indices;
+	uint32_t indexCount;
+	uint32_t indexSize;
+	uint32_t flags;
+};
+
+bool writeModelCache(const char *path, const ModelPartData *parts, uint32_t partCount);
+
+ModelVertex packModelVertex(const float position[3], const float texCoords[2], const float normal[3]);
+void unpackModelPosition(const ModelVertex &vertex, float positionOut[3]);
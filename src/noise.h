@@ -0,0 +1,302 @@
+#pragma once
+
+#include <cmath>
+
+#include <mutil/mutil.h>
+
+using namespace mutil;
+
+/* Noise primitives shared by the graph interpreter and the compiled presets,
+ * both must round identically for a preset to stand in for its graph. */
+
+// Maximum octaves of a fractal noise layer
+#define NOISE_MAX_OCTAVES 16
+
+// Rotation of the noise domain
+struct NoiseRotation
+{
+	float c, s;
+};
+
+/* Evaluated at compile time for presets, so no libm */
+constexpr NoiseRotation noiseRotation(float degrees)
+{
+	constexpr double kPi = 3.14159265358979323846;
+
+	double x = degrees * (kPi / 180.0);
+	while (x > kPi)
+		x -= 2.0 * kPi;
+	while (x < -kPi)
+		x += 2.0 * kPi;
+
+	/* Taylor series, converges to double precision on [-pi, pi] */
+	double c = 0.0, s = 0.0;
+	double term = 1.0;
+	for (int n = 0; n < 40; n++)
+	{
+		if (n % 2 == 0)
+			c += (n % 4 == 0 ? term : -term);
+		else
+			s += (n % 4 == 1 ? term : -term);
+		term *= x / (n + 1);
+	}
+
+	return NoiseRotation{ (float)c, (float)s };
+}
+
+// Largest magnitude of snoise(), the range bounds below rely on it
+#define NOISE_MAX 1.0f
+
+// Margin for rounding when a range bound decides to skip work
+#define NOISE_RANGE_SLACK (1.0f / 256.0f)
+
+/* True once the octaves left, worth remaining of total, can move the
+ * normalized sum by at most budget. A budget of 0 evaluates every octave */
+inline bool octavesDone(float remaining, float total, float budget)
+{
+	return budget > 0.0f && remaining * NOISE_MAX <= budget * total;
+}
+
+/* Budget of an fbm whose normalized value reaches the output scaled by gain,
+ * a stack masked out entirely needs no octaves at all */
+inline float noiseBudget(float tolerance, float gain)
+{
+	gain = mutil::abs(gain);
+	return gain > 0.0f ? tolerance / gain : INFINITY;
+}
+
+/* Fractal sum of simplex noise, octave i has frequency 2^i and amplitude
+ * persistence^i, the sum is normalized by the total amplitude. Octaves stop
+ * once the rest are within budget, see octavesDone() */
+inline float fbm(float x, float y, float persistence, int octaves, float budget)
+{
+	float total = 0.0f, amplitude = 1.0f;
+	for (int i = 0; i < octaves; i++)
+	{
+		total += amplitude;
+		amplitude *= persistence;
+	}
+
+	float sum = 0.0f, remaining = total;
+	float frequency = 1.0f;
+	amplitude = 1.0f;
+
+	for (int i = 0; i < octaves && !octavesDone(remaining, total, budget); i++)
+	{
+		sum += amplitude * snoise(Vector2(x * frequency, y * frequency));
+		remaining -= amplitude;
+		frequency *= 2.0f;
+		amplitude *= persistence;
+	}
+
+	return sum / total;
+}
+
+// Octave amplitudes of fbm, for octave counts known at compile time
+template <int Octaves>
+struct OctaveTable
+{
+	float amplitude[Octaves];
+	float remaining[Octaves]; // Amplitude left before each octave
+	float total;
+};
+
+template <int Octaves>
+constexpr OctaveTable<Octaves> makeOctaveTable(float persistence)
+{
+	OctaveTable<Octaves> table = {};
+
+	float amplitude = 1.0f;
+	for (int i = 0; i < Octaves; i++)
+	{
+		table.amplitude[i] = amplitude;
+		table.total += amplitude;
+		amplitude *= persistence;
+	}
+
+	/* Same rounding as the running remainder in fbm() */
+	float remaining = table.total;
+	for (int i = 0; i < Octaves; i++)
+	{
+		table.remaining[i] = remaining;
+		remaining -= table.amplitude[i];
+	}
+
+	return table;
+}
+
+/* fbm with the octave loop unrolled, sums and stops in the same order. Also
+ * stops with *below set once the sum is certain to end under limit */
+template <int I, int Octaves>
+struct OctaveSum
+{
+	static inline float eval(float x, float y, const OctaveTable<Octaves> &table, float budget, float limit, bool *below, float sum)
+	{
+		if (sum + table.remaining[I] * NOISE_MAX < limit)
+		{
+			*below = true;
+			return sum;
+		}
+
+		if (octavesDone(table.remaining[I], table.total, budget))
+			return sum;
+
+		const float frequency = (float)(1 << I);
+		sum += table.amplitude[I] * snoise(Vector2(x * frequency, y * frequency));
+		return OctaveSum<I + 1, Octaves>::eval(x, y, table, budget, limit, below, sum);
+	}
+};
+
+template <int Octaves>
+struct OctaveSum<Octaves, Octaves>
+{
+	static inline float eval(float, float, const OctaveTable<Octaves> &, float, float limit, bool *below, float sum)
+	{
+		*below = sum < limit;
+		return sum;
+	}
+};
+
+/* Layer sampled at rotation * ((p + offset) * frequency) + seedOffset */
+inline void noiseDomain(const Vector2 &p, float offsetX, float offsetY, float frequency, const NoiseRotation &rotation, const Vector2 &seedOffset, float *x, float *y)
+{
+	const float qx = (p.x + offsetX) * frequency;
+	const float qy = (p.y + offsetY) * frequency;
+
+	*x = rotation.c * qx - rotation.s * qy + seedOffset.x;
+	*y = rotation.s * qx + rotation.c * qy + seedOffset.y;
+}
+
+/* Ranges, used to prove work cannot affect the result */
+
+// Interval a value is known to lie in
+struct NoiseRange
+{
+	float lo, hi;
+};
+
+inline NoiseRange rangeAdd(const NoiseRange &a, const NoiseRange &b)
+{
+	return NoiseRange{ a.lo + b.lo, a.hi + b.hi };
+}
+
+inline NoiseRange rangeScale(const NoiseRange &a, float k)
+{
+	return k >= 0.0f ? NoiseRange{ a.lo * k, a.hi * k } : NoiseRange{ a.hi * k, a.lo * k };
+}
+
+inline NoiseRange rangeMul(const NoiseRange &a, const NoiseRange &b)
+{
+	const float p[4] = { a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi };
+
+	NoiseRange r = { p[0], p[0] };
+	for (int i = 1; i < 4; i++)
+	{
+		r.lo = p[i] < r.lo ? p[i] : r.lo;
+		r.hi = p[i] > r.hi ? p[i] : r.hi;
+	}
+	return r;
+}
+
+// Range of fbm * amplitude + bias
+inline NoiseRange rangeFBM(float amplitude, float bias)
+{
+	const float a = mutil::abs(amplitude) * NOISE_MAX;
+	return NoiseRange{ bias - a, bias + a };
+}
+
+// Range of a monotonic function, either direction
+template <typename F>
+inline NoiseRange rangeMonotonic(const NoiseRange &a, F f)
+{
+	const float x = f(a.lo), y = f(a.hi);
+	return x <= y ? NoiseRange{ x, y } : NoiseRange{ y, x };
+}
+
+/* Shaping functions */
+
+/* Compilers rewrite powf(x, 2) as x * x when the exponent is a constant, so
+ * the interpreter does the same to round like the presets */
+inline float noisePow(float x, float exponent)
+{
+	if (exponent == 2.0f)
+		return x * x;
+	return powf(x, exponent);
+}
+
+inline float noiseSmootherstep(float x)
+{
+	return smootherstep(0.0f, 1.0f, x);
+}
+
+// Signed power, keeps the sign of in
+inline float shapePower(float in, float exponent)
+{
+	float r = noisePow(mutil::abs(in), exponent);
+	return in < 0.0f ? -r : r;
+}
+
+inline float shapeSmooth(float in, float k, float bias, float scale)
+{
+	return (logistic(k, in) + bias) * scale;
+}
+
+// Smooth clamp between the sea floor and sea level
+inline float shapeSea(float in, float level, float floor, float power)
+{
+	if (in > level)
+		return in;
+
+	if (in < floor)
+		return floor;
+
+	float t = (in - floor) / (level - floor);
+	t = t * noiseSmootherstep(noisePow(t, power));
+
+	return floor + t * (level - floor);
+}
+
+/* Weight of the noise shapeMountain adds, 0 at the base */
+inline float mountainMask(float in, float base, float peak, float noisePower)
+{
+	float t0 = (in - base) / (peak - base);
+	float v = noiseSmootherstep(t0);
+
+	/* More noise towards the peaks */
+	return noiseSmootherstep(noisePow(v, noisePower));
+}
+
+/* Intensify mountain peaks, only valid for in >= base. Twice-differentiable
+ * at the base with f(0) = 0, f'(0) = 1, f''(0) = 0 */
+inline float shapeMountain(float in, float base, float peak, float scale, float power, float noise, float mask, float noiseScale)
+{
+	float t0 = (in - base) / (peak - base);
+	float u = 1.0f - t0;
+	u = u * noiseSmootherstep(u);
+
+	float a = scale * (1.0f - noisePow(u, power));
+	float b = 1.0f - u;
+	float v = noiseSmootherstep(t0);
+	float w = v * a + (1.0f - v) * b; // [0, scale]
+
+	float out = base + w * (peak - base);
+
+	noise *= mask;
+
+	return out + noise * noiseScale;
+}
+
+/* Weight of the noise shapeTransition adds, only valid for low < in < high */
+inline float transitionMask(float in, float low, float high)
+{
+	float t = (in - low) / (high - low);
+
+	float mask = 1.0f - mutil::abs(2.0f * t - 1.0f); // [0, 1]
+	return noiseSmootherstep(mask); // Second derivative is 0 at the edges
+}
+
+/* Noise faded out towards low and high */
+inline float shapeTransition(float in, float noise, float mask, float scale)
+{
+	return in + noise * mask * scale;
+}
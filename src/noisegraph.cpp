@@ -0,0 +1,1091 @@
+#include "noisegraph.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "util.h"
+
+#define NOISE_MAX_NAME 32
+#define NOISE_MAX_LINE 512
+#define NOISE_MAX_TOKENS 32
+
+enum GraphNodeType
+{
+	GRAPH_CONST,
+	GRAPH_FBM,
+	GRAPH_ADD,
+	GRAPH_MUL,
+	GRAPH_OFFSET,
+	GRAPH_POWER,
+	GRAPH_SMOOTH,
+	GRAPH_SEA,
+	GRAPH_MOUNTAIN,
+	GRAPH_TRANSITION,
+
+	GRAPH_TYPE_COUNT
+};
+
+struct GraphParam
+{
+	const char *name;
+	int slot;
+	int components;
+	float value; // Default
+};
+
+struct GraphOpInfo
+{
+	const char *name;
+	int minInputs, maxInputs;
+	GraphParam params[NOISE_MAX_PARAMS];
+};
+
+static const GraphOpInfo kGraphOps[GRAPH_TYPE_COUNT] = {
+	{ "const", 0, 0, { { "value", 0, 1, 0.0f } } },
+	{ "fbm", 0, 0, {
+		{ "frequency", 0, 1, 1.0f },
+		{ "octaves", 1, 1, 1.0f },
+		{ "persistence", 2, 1, 0.5f },
+		{ "offset", 3, 2, 0.0f },
+		{ "rotation", 5, 1, 0.0f },
+		{ "amplitude", 6, 1, 1.0f },
+		{ "bias", 7, 1, 0.0f } } },
+	{ "add", 2, NOISE_MAX_INPUTS, {} },
+	{ "mul", 2, 2, {} },
+	{ "offset", 1, 1, { { "scale", 0, 1, 1.0f }, { "offset", 1, 1, 0.0f } } },
+	{ "power", 1, 1, { { "exponent", 0, 1, 1.0f } } },
+	{ "smooth", 1, 1, { { "k", 0, 1, 1.0f }, { "bias", 1, 1, 0.0f }, { "scale", 2, 1, 1.0f } } },
+	{ "sea", 1, 1, { { "level", 0, 1, 0.0f }, { "floor", 1, 1, -64.0f }, { "power", 2, 1, 0.5f } } },
+	{ "mountain", 1, 2, {
+		{ "base", 0, 1, 96.0f },
+		{ "peak", 1, 1, 224.0f },
+		{ "scale", 2, 1, 1.0f },
+		{ "power", 3, 1, 1.0f },
+		{ "noise_power", 4, 1, 1.0f },
+		{ "noise_scale", 5, 1, 0.0f } } },
+	{ "transition", 1, 2, { { "low", 0, 1, 0.0f }, { "high", 1, 1, 96.0f }, { "scale", 2, 1, 0.0f } } }
+};
+
+struct GraphNode
+{
+	char name[NOISE_MAX_NAME]; // Empty for literals
+	GraphNodeType type;
+	int inputs[NOISE_MAX_INPUTS];
+	int inputCount;
+	float params[NOISE_MAX_PARAMS];
+
+	int alias; // Node this one folded into, -1 if none
+	bool live;
+	bool fused; // Evaluated inside its only user
+	int uses;
+	int lastUse; // Index of the last node reading this one
+	int reg;
+};
+
+static inline float evalFBM(const NoiseFBM &layer, const Vector2 &pos, float budget)
+{
+	float x, y;
+	noiseDomain(pos, layer.offset.x, layer.offset.y, layer.frequency, layer.rotation, layer.seedOffset, &x, &y);
+	return fbm(x, y, layer.persistence, layer.octaves, budget) * layer.amplitude + layer.bias;
+}
+
+/* Range of the result of an instruction given the ranges of its inputs,
+ * false if the op is not monotonic */
+static bool instructionRange(const NoiseInstruction *ins, const NoiseRange &a, const NoiseRange &b, NoiseRange *out)
+{
+	switch (ins->op)
+	{
+	case NOISE_OP_CONST:
+		*out = NoiseRange{ ins->k[0], ins->k[0] };
+		return true;
+	case NOISE_OP_FBM:
+		*out = rangeFBM(ins->fbm.amplitude, ins->fbm.bias);
+		return true;
+	case NOISE_OP_ADD:
+		*out = rangeAdd(a, b);
+		return true;
+	case NOISE_OP_ADDK:
+		*out = rangeAdd(a, NoiseRange{ ins->k[0], ins->k[0] });
+		return true;
+	case NOISE_OP_MUL:
+		*out = rangeMul(a, b);
+		return true;
+	case NOISE_OP_MULK:
+		*out = rangeScale(a, ins->k[0]);
+		return true;
+	case NOISE_OP_OFFSET:
+		*out = rangeAdd(rangeScale(a, ins->k[0]), NoiseRange{ ins->k[1], ins->k[1] });
+		return true;
+	case NOISE_OP_POWER:
+		*out = rangeMonotonic(a, [ins](float x) { return shapePower(x, ins->k[0]); });
+		return true;
+	case NOISE_OP_SMOOTH:
+		*out = rangeMonotonic(a, [ins](float x) { return shapeSmooth(x, ins->k[0], ins->k[1], ins->k[2]); });
+		return true;
+	case NOISE_OP_SEA:
+		*out = rangeMonotonic(a, [ins](float x) { return shapeSea(x, ins->k[0], ins->k[1], ins->k[2]); });
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Whether the input of the sea op a guard protects is certainly below the
+ * floor. Instructions between them are evaluated over ranges, values not
+ * computed yet span everything they can produce */
+static bool belowSeaFloor(const NoiseInstruction *guard, const float *r)
+{
+	const NoiseInstruction *sea = guard + guard->skip;
+
+	NoiseRange ranges[NOISE_MAX_REGISTERS];
+	uint32_t known = 0; // Registers written since the guard
+	uint32_t fixed = 0; // Registers holding their precomputed range
+
+	for (const NoiseInstruction *ins = guard + 1; ins < sea; ins++)
+	{
+		if (ins->op == NOISE_OP_GUARD)
+			continue;
+
+		const uint32_t inputs = (ins->a != NOISE_NO_INPUT ? 1u << ins->a : 0) | (ins->b != NOISE_NO_INPUT ? 1u << ins->b : 0);
+		const uint32_t dst = 1u << ins->dst;
+
+		if (ins->bounded && (inputs & fixed) == inputs)
+		{
+			/* Only depends on noise evaluated after the guard */
+			ranges[ins->dst] = ins->range;
+			known |= dst;
+			fixed |= dst;
+			continue;
+		}
+
+		NoiseRange a = { 0.0f, 0.0f }, b = { 0.0f, 0.0f };
+		if (ins->a != NOISE_NO_INPUT)
+			a = known & (1u << ins->a) ? ranges[ins->a] : NoiseRange{ r[ins->a], r[ins->a] };
+		if (ins->b != NOISE_NO_INPUT)
+			b = known & (1u << ins->b) ? ranges[ins->b] : NoiseRange{ r[ins->b], r[ins->b] };
+
+		if (!instructionRange(ins, a, b, &ranges[ins->dst]))
+			return false; // Nothing to prove
+
+		known |= dst;
+		fixed &= ~dst;
+	}
+
+	/* Sea returns its floor for inputs below both the level and the floor */
+	const float limit = (sea->k[0] < sea->k[1] ? sea->k[0] : sea->k[1]) - NOISE_RANGE_SLACK;
+	const float hi = known & (1u << sea->a) ? ranges[sea->a].hi : r[sea->a];
+	return hi < limit;
+}
+
+float NoiseProgram::evaluate(const Vector2 &p) const
+{
+	const Vector2 pos((p.x + _shift.x) * _frequency, (p.y + _shift.y) * _frequency);
+
+	float r[NOISE_MAX_REGISTERS];
+
+	const NoiseInstruction *code = _code.data();
+	const NoiseInstruction *end = code + _code.size();
+
+	for (const NoiseInstruction *ins = code; ins < end; ins++)
+	{
+		switch (ins->op)
+		{
+		case NOISE_OP_CONST:
+			r[ins->dst] = ins->k[0];
+			break;
+		case NOISE_OP_FBM:
+			r[ins->dst] = evalFBM(ins->fbm, pos, ins->fbm.budget);
+			break;
+		case NOISE_OP_ADD:
+			r[ins->dst] = r[ins->a] + r[ins->b];
+			break;
+		case NOISE_OP_ADDK:
+			r[ins->dst] = r[ins->a] + ins->k[0];
+			break;
+		case NOISE_OP_MUL:
+			r[ins->dst] = r[ins->a] * r[ins->b];
+			break;
+		case NOISE_OP_MULK:
+			r[ins->dst] = r[ins->a] * ins->k[0];
+			break;
+		case NOISE_OP_OFFSET:
+			r[ins->dst] = r[ins->a] * ins->k[0] + ins->k[1];
+			break;
+		case NOISE_OP_POWER:
+			r[ins->dst] = shapePower(r[ins->a], ins->k[0]);
+			break;
+		case NOISE_OP_SMOOTH:
+			r[ins->dst] = shapeSmooth(r[ins->a], ins->k[0], ins->k[1], ins->k[2]);
+			break;
+		case NOISE_OP_SEA:
+			r[ins->dst] = shapeSea(r[ins->a], ins->k[0], ins->k[1], ins->k[2]);
+			break;
+		case NOISE_OP_MOUNTAIN:
+		{
+			const float in = r[ins->a];
+			if (in < ins->k[0])
+			{
+				r[ins->dst] = in; // Below the base, noise is not evaluated
+				break;
+			}
+
+			/* Octaves are bounded by how visible the noise is */
+			const float mask = mountainMask(in, ins->k[0], ins->k[1], ins->k[4]);
+
+			float noise = 0.0f;
+			if (ins->fused)
+				noise = evalFBM(ins->fbm, pos, noiseBudget(_tolerance, ins->fbm.amplitude * mask * ins->k[5]));
+			else if (ins->b != NOISE_NO_INPUT)
+				noise = r[ins->b];
+
+			r[ins->dst] = shapeMountain(in, ins->k[0], ins->k[1], ins->k[2], ins->k[3], noise, mask, ins->k[5]);
+			break;
+		}
+		case NOISE_OP_TRANSITION:
+		{
+			const float in = r[ins->a];
+			if (in >= ins->k[1] || in <= ins->k[0])
+			{
+				r[ins->dst] = in;
+				break;
+			}
+
+			const float mask = transitionMask(in, ins->k[0], ins->k[1]);
+
+			float noise = 0.0f;
+			if (ins->fused)
+				noise = evalFBM(ins->fbm, pos, noiseBudget(_tolerance, ins->fbm.amplitude * mask * ins->k[2]));
+			else if (ins->b != NOISE_NO_INPUT)
+				noise = r[ins->b];
+
+			r[ins->dst] = shapeTransition(in, noise, mask, ins->k[2]);
+			break;
+		}
+		case NOISE_OP_GUARD:
+			if (belowSeaFloor(ins, r))
+			{
+				const NoiseInstruction *sea = ins + ins->skip;
+				r[sea->dst] = sea->k[1];
+				ins = sea;
+			}
+			break;
+		}
+	}
+
+	return r[_output];
+}
+
+/* Graph compilation */
+
+struct GraphCompiler
+{
+	const char *name;
+	int line;
+
+	GraphNode nodes[NOISE_MAX_NODES];
+	int count;
+
+	int output;
+	uint32_t seed;
+	float tolerance;
+	Vector2 shift;
+	float frequency;
+
+	std::vector<int> owners; // Node of each emitted instruction
+
+	bool error(const char *format, ...);
+
+	int find(const char *nodeName) const;
+	int resolve(int node) const;
+	int literal(float value);
+
+	bool parseLine(char *text);
+	bool parseNode(char **tokens, int ntokens);
+
+	void fold();
+	void markLive();
+	bool emit(std::vector<NoiseInstruction> &code, uint8_t *outputReg);
+	void guardSeas(std::vector<NoiseInstruction> &code);
+};
+
+bool GraphCompiler::error(const char *format, ...)
+{
+	va_list ls;
+
+	fprintf(stderr, "%s:%d: ", name, line);
+
+	va_start(ls, format);
+	vfprintf(stderr, format, ls);
+	va_end(ls);
+
+	fprintf(stderr, "\n");
+	return false;
+}
+
+int GraphCompiler::find(const char *nodeName) const
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (!strcmp(nodes[i].name, nodeName))
+			return i;
+	}
+	return -1;
+}
+
+int GraphCompiler::resolve(int node) const
+{
+	while (nodes[node].alias >= 0)
+		node = nodes[node].alias;
+	return node;
+}
+
+int GraphCompiler::literal(float value)
+{
+	if (count >= NOISE_MAX_NODES)
+		return -1;
+
+	GraphNode &node = nodes[count];
+	memset(&node, 0, sizeof(node));
+	node.type = GRAPH_CONST;
+	node.params[0] = value;
+	node.alias = -1;
+	node.reg = -1;
+
+	return count++;
+}
+
+/* Number or fraction a/b, fractions round like the division they spell */
+static bool parseFloat(const char *str, float *out)
+{
+	char *end;
+	*out = strtof(str, &end);
+	if (end == str)
+		return false;
+
+	if (*end == '/')
+	{
+		const char *denominator = end + 1;
+		float d = strtof(denominator, &end);
+		if (end == denominator || d == 0.0f)
+			return false;
+
+		*out /= d;
+	}
+
+	return !*end;
+}
+
+static int tokenize(char *text, char **tokens)
+{
+	int n = 0;
+	char *c = text;
+
+	while (*c)
+	{
+		while (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n')
+			*c++ = 0;
+
+		if (!*c)
+			break;
+
+		if (n == NOISE_MAX_TOKENS)
+			return -1;
+
+		tokens[n++] = c;
+		while (*c && *c != ' ' && *c != '\t' && *c != '\r' && *c != '\n')
+			c++;
+	}
+
+	return n;
+}
+
+bool GraphCompiler::parseLine(char *text)
+{
+	char *comment = strchr(text, '#');
+	if (comment)
+		*comment = 0;
+
+	char *tokens[NOISE_MAX_TOKENS];
+	int ntokens = tokenize(text, tokens);
+	if (ntokens < 0)
+		return error("Too many tokens");
+	if (ntokens == 0)
+		return true;
+
+	if (!strcmp(tokens[0], "seed"))
+	{
+		char *end;
+		unsigned long value = ntokens == 2 ? strtoul(tokens[1], &end, 10) : 0;
+		if (ntokens != 2 || end == tokens[1] || *end)
+			return error("Expected seed <n>");
+
+		seed = (uint32_t)value;
+		return true;
+	}
+
+	if (!strcmp(tokens[0], "tolerance"))
+	{
+		if (ntokens != 2 || !parseFloat(tokens[1], &tolerance) || !(tolerance >= 0.0f))
+			return error("Expected tolerance <t>, t >= 0");
+		return true;
+	}
+
+	if (!strcmp(tokens[0], "domain"))
+	{
+		for (int i = 1; i < ntokens; i++)
+		{
+			char *value = strchr(tokens[i], '=');
+			if (!value)
+				return error("Expected key=value, got '%s'", tokens[i]);
+			*value++ = 0;
+
+			if (!strcmp(tokens[i], "frequency"))
+			{
+				if (!parseFloat(value, &frequency))
+					return error("Invalid frequency '%s'", value);
+			}
+			else if (!strcmp(tokens[i], "shift"))
+			{
+				char *y = strchr(value, ',');
+				if (!y)
+					return error("Expected shift=x,y");
+				*y++ = 0;
+
+				if (!parseFloat(value, &shift.x) || !parseFloat(y, &shift.y))
+					return error("Invalid shift");
+			}
+			else
+				return error("Unknown domain parameter '%s'", tokens[i]);
+		}
+		return true;
+	}
+
+	if (!strcmp(tokens[0], "output"))
+	{
+		if (ntokens != 2)
+			return error("Expected output <name>");
+
+		output = find(tokens[1]);
+		if (output < 0)
+			return error("Unknown node '%s'", tokens[1]);
+		return true;
+	}
+
+	if (ntokens < 3 || strcmp(tokens[1], "="))
+		return error("Expected <name> = <op> ...");
+
+	return parseNode(tokens, ntokens);
+}
+
+bool GraphCompiler::parseNode(char **tokens, int ntokens)
+{
+	const char *nodeName = tokens[0];
+	if (strlen(nodeName) >= NOISE_MAX_NAME)
+		return error("Node name '%s' is too long", nodeName);
+	if (find(nodeName) >= 0)
+		return error("Node '%s' is already defined", nodeName);
+
+	int type = 0;
+	while (type < GRAPH_TYPE_COUNT && strcmp(kGraphOps[type].name, tokens[2]))
+		type++;
+	if (type == GRAPH_TYPE_COUNT)
+		return error("Unknown op '%s'", tokens[2]);
+
+	const GraphOpInfo &info = kGraphOps[type];
+
+	GraphNode node;
+	memset(&node, 0, sizeof(node));
+	strcpy(node.name, nodeName);
+	node.type = (GraphNodeType)type;
+	node.alias = -1;
+	node.reg = -1;
+
+	for (const GraphParam *param = info.params; param < info.params + NOISE_MAX_PARAMS && param->name; param++)
+	{
+		for (int c = 0; c < param->components; c++)
+			node.params[param->slot + c] = param->value;
+	}
+
+	for (int i = 3; i < ntokens; i++)
+	{
+		char *value = strchr(tokens[i], '=');
+		if (!value)
+		{
+			/* Input, a node or a literal */
+			if (node.inputCount == info.maxInputs)
+				return error("Too many inputs for '%s'", info.name);
+
+			int input = find(tokens[i]);
+			if (input < 0)
+			{
+				float number;
+				if (!parseFloat(tokens[i], &number))
+					return error("Unknown node '%s'", tokens[i]);
+
+				input = literal(number);
+				if (input < 0)
+					return error("Too many nodes");
+			}
+
+			node.inputs[node.inputCount++] = input;
+			continue;
+		}
+
+		*value++ = 0;
+
+		const GraphParam *param = info.params;
+		while (param < info.params + NOISE_MAX_PARAMS && param->name && strcmp(param->name, tokens[i]))
+			param++;
+		if (param == info.params + NOISE_MAX_PARAMS || !param->name)
+			return error("Unknown parameter '%s' for '%s'", tokens[i], info.name);
+
+		char *component = value;
+		for (int c = 0; c < param->components; c++)
+		{
+			char *next = nullptr;
+			if (c + 1 < param->components)
+			{
+				next = strchr(component, ',');
+				if (!next)
+					return error("Expected %d components for '%s'", param->components, param->name);
+				*next++ = 0;
+			}
+
+			if (!parseFloat(component, &node.params[param->slot + c]))
+				return error("Invalid value '%s' for '%s'", component, param->name);
+
+			component = next;
+		}
+	}
+
+	if (node.inputCount < info.minInputs)
+		return error("'%s' takes at least %d inputs", info.name, info.minInputs);
+
+	if (node.type == GRAPH_FBM)
+	{
+		const float octaves = node.params[1];
+		if (octaves < 1.0f || octaves > NOISE_MAX_OCTAVES || octaves != (float)(int)octaves)
+			return error("Octaves must be an integer in [1, %d]", NOISE_MAX_OCTAVES);
+	}
+
+	if (count >= NOISE_MAX_NODES)
+		return error("Too many nodes");
+
+	nodes[count++] = node;
+	return true;
+}
+
+/* Fold constants and identities, nodes only read nodes defined before them */
+void GraphCompiler::fold()
+{
+	for (int i = 0; i < count; i++)
+	{
+		GraphNode &node = nodes[i];
+
+		bool constant = node.type != GRAPH_FBM && node.type != GRAPH_CONST;
+		for (int j = 0; j < node.inputCount; j++)
+		{
+			node.inputs[j] = resolve(node.inputs[j]);
+			constant = constant && nodes[node.inputs[j]].type == GRAPH_CONST;
+		}
+
+		const float *k = node.params;
+
+		/* Noise scaled by zero contributes nothing */
+		if ((node.type == GRAPH_MOUNTAIN && k[5] == 0.0f) || (node.type == GRAPH_TRANSITION && k[2] == 0.0f))
+			node.inputCount = 1;
+
+		if (constant)
+		{
+			float a = nodes[node.inputs[0]].params[0];
+			float b = node.inputCount > 1 ? nodes[node.inputs[1]].params[0] : 0.0f;
+			float value = 0.0f;
+
+			switch (node.type)
+			{
+			case GRAPH_ADD:
+				value = a;
+				for (int j = 1; j < node.inputCount; j++)
+					value += nodes[node.inputs[j]].params[0];
+				break;
+			case GRAPH_MUL:
+				value = a * b;
+				break;
+			case GRAPH_OFFSET:
+				value = a * k[0] + k[1];
+				break;
+			case GRAPH_POWER:
+				value = shapePower(a, k[0]);
+				break;
+			case GRAPH_SMOOTH:
+				value = shapeSmooth(a, k[0], k[1], k[2]);
+				break;
+			case GRAPH_SEA:
+				value = shapeSea(a, k[0], k[1], k[2]);
+				break;
+			case GRAPH_MOUNTAIN:
+				value = a < k[0] ? a : shapeMountain(a, k[0], k[1], k[2], k[3], b, mountainMask(a, k[0], k[1], k[4]), k[5]);
+				break;
+			case GRAPH_TRANSITION:
+				value = a >= k[1] || a <= k[0] ? a : shapeTransition(a, b, transitionMask(a, k[0], k[1]), k[2]);
+				break;
+			default:
+				break;
+			}
+
+			node.type = GRAPH_CONST;
+			node.inputCount = 0;
+			node.params[0] = value;
+			continue;
+		}
+
+		/* Identities */
+		bool identity =
+			(node.type == GRAPH_OFFSET && k[0] == 1.0f && k[1] == 0.0f) ||
+			(node.type == GRAPH_POWER && k[0] == 1.0f) ||
+			(node.type == GRAPH_TRANSITION && node.inputCount == 1);
+
+		if (node.type == GRAPH_MUL)
+		{
+			for (int j = 0; j < 2; j++)
+			{
+				const GraphNode &other = nodes[node.inputs[j]];
+				if (other.type == GRAPH_CONST && other.params[0] == 1.0f)
+				{
+					node.alias = node.inputs[1 - j];
+					break;
+				}
+			}
+		}
+
+		if (identity)
+			node.alias = node.inputs[0];
+	}
+
+	if (output >= 0)
+		output = resolve(output);
+}
+
+void GraphCompiler::markLive()
+{
+	nodes[output].live = true;
+
+	for (int i = output; i >= 0; i--)
+	{
+		GraphNode &node = nodes[i];
+		if (!node.live)
+			continue;
+
+		for (int j = 0; j < node.inputCount; j++)
+		{
+			GraphNode &input = nodes[node.inputs[j]];
+			input.live = true;
+			input.uses++;
+			input.lastUse = max(input.lastUse, i);
+		}
+	}
+
+	/* An fbm read only by mountain or transition is evaluated inside it, so
+	 * it is skipped wherever its contribution is masked out */
+	for (int i = 0; i <= output; i++)
+	{
+		GraphNode &node = nodes[i];
+		if (!node.live || node.inputCount < 2)
+			continue;
+
+		if (node.type != GRAPH_MOUNTAIN && node.type != GRAPH_TRANSITION)
+			continue;
+
+		GraphNode &noise = nodes[node.inputs[1]];
+		if (noise.type == GRAPH_FBM && noise.uses == 1)
+			noise.fused = true;
+	}
+}
+
+Vector2 noiseSeedOffset(uint32_t seed, const char *node)
+{
+	if (!seed)
+		return Vector2(0.0f, 0.0f);
+
+	/* Keyed on the node name so editing other nodes leaves it in place */
+	uint64_t hash = hashBytes(&seed, sizeof(seed));
+	hash = hashBytes(node, strlen(node), hash);
+
+	return Vector2(
+		((hash & 0xffffffff) / 4294967295.0f * 2.0f - 1.0f) * NOISE_SEED_RANGE,
+		((hash >> 32) / 4294967295.0f * 2.0f - 1.0f) * NOISE_SEED_RANGE);
+}
+
+static void setupFBM(NoiseFBM *fbm, const GraphNode &node, uint32_t seed, float tolerance)
+{
+	const float *k = node.params;
+
+	fbm->rotation = noiseRotation(k[5]);
+	fbm->offset = Vector2(k[3], k[4]);
+	fbm->frequency = k[0];
+	fbm->persistence = k[2];
+	fbm->octaves = (int32_t)k[1];
+	fbm->amplitude = k[6];
+	fbm->bias = k[7];
+
+	/* Fused fbm are bounded by their mask at evaluation */
+	fbm->budget = node.fused ? 0.0f : noiseBudget(tolerance, fbm->amplitude);
+
+	fbm->seedOffset = noiseSeedOffset(seed, node.name);
+}
+
+bool GraphCompiler::emit(std::vector<NoiseInstruction> &code, uint8_t *outputReg)
+{
+	bool used[NOISE_MAX_REGISTERS];
+	memset(used, 0, sizeof(used));
+
+	code.clear();
+	owners.clear();
+
+	for (int i = 0; i <= output; i++)
+	{
+		GraphNode &node = nodes[i];
+		if (!node.live || node.fused)
+			continue;
+
+		/* Literals are folded into their readers where possible */
+		if (node.type == GRAPH_CONST && i != output)
+		{
+			bool immediate = true;
+			for (int j = i + 1; j <= output && immediate; j++)
+			{
+				const GraphNode &user = nodes[j];
+				if (!user.live)
+					continue;
+
+				for (int k = 0; k < user.inputCount; k++)
+				{
+					if (user.inputs[k] == i && !((user.type == GRAPH_ADD || user.type == GRAPH_MUL) && user.inputCount == 2))
+						immediate = false;
+				}
+			}
+
+			if (immediate)
+				continue;
+		}
+
+		/* Destination is allocated before the inputs are released, chained
+		 * adds write it while still reading inputs */
+		int dst = 0;
+		while (dst < NOISE_MAX_REGISTERS && used[dst])
+			dst++;
+		if (dst == NOISE_MAX_REGISTERS)
+			return error("Graph needs more than %d registers", NOISE_MAX_REGISTERS);
+
+		used[dst] = true;
+		node.reg = dst;
+
+		NoiseInstruction ins;
+		memset((void *)&ins, 0, sizeof(ins)); // Hashed, padding must be zero
+		ins.dst = (uint8_t)dst;
+		ins.a = NOISE_NO_INPUT;
+		ins.b = NOISE_NO_INPUT;
+		memcpy(ins.k, node.params, sizeof(ins.k));
+
+		const int a = node.inputCount > 0 ? node.inputs[0] : -1;
+		const int b = node.inputCount > 1 ? node.inputs[1] : -1;
+
+		if (a >= 0 && nodes[a].reg >= 0)
+			ins.a = (uint8_t)nodes[a].reg;
+		if (b >= 0 && nodes[b].reg >= 0)
+			ins.b = (uint8_t)nodes[b].reg;
+
+		switch (node.type)
+		{
+		case GRAPH_CONST:
+			ins.op = NOISE_OP_CONST;
+			break;
+		case GRAPH_FBM:
+			ins.op = NOISE_OP_FBM;
+			memset(ins.k, 0, sizeof(ins.k));
+			setupFBM(&ins.fbm, node, seed, tolerance);
+			break;
+		case GRAPH_ADD:
+		case GRAPH_MUL:
+			ins.op = node.type == GRAPH_ADD ? NOISE_OP_ADD : NOISE_OP_MUL;
+			memset(ins.k, 0, sizeof(ins.k));
+
+			if (node.inputCount == 2 && (nodes[a].reg < 0 || nodes[b].reg < 0))
+			{
+				/* One side is an immediate, constants on both sides were folded */
+				ins.op = node.type == GRAPH_ADD ? NOISE_OP_ADDK : NOISE_OP_MULK;
+				ins.a = (uint8_t)(nodes[a].reg >= 0 ? nodes[a].reg : nodes[b].reg);
+				ins.b = NOISE_NO_INPUT;
+				ins.k[0] = nodes[a].reg >= 0 ? nodes[b].params[0] : nodes[a].params[0];
+			}
+			break;
+		case GRAPH_OFFSET:
+			ins.op = NOISE_OP_OFFSET;
+			break;
+		case GRAPH_POWER:
+			ins.op = NOISE_OP_POWER;
+			break;
+		case GRAPH_SMOOTH:
+			ins.op = NOISE_OP_SMOOTH;
+			break;
+		case GRAPH_SEA:
+			ins.op = NOISE_OP_SEA;
+			break;
+		case GRAPH_MOUNTAIN:
+		case GRAPH_TRANSITION:
+			ins.op = node.type == GRAPH_MOUNTAIN ? NOISE_OP_MOUNTAIN : NOISE_OP_TRANSITION;
+			if (b >= 0 && nodes[b].fused)
+			{
+				ins.fused = 1;
+				ins.b = NOISE_NO_INPUT;
+				setupFBM(&ins.fbm, nodes[b], seed, tolerance);
+			}
+			break;
+		default:
+			break;
+		}
+
+		code.push_back(ins);
+		owners.push_back(i);
+
+		/* Chain the remaining inputs of an add */
+		for (int j = 2; j < node.inputCount && node.type == GRAPH_ADD; j++)
+		{
+			NoiseInstruction add;
+			memset((void *)&add, 0, sizeof(add));
+			add.op = NOISE_OP_ADD;
+			add.dst = (uint8_t)dst;
+			add.a = (uint8_t)dst;
+			add.b = (uint8_t)nodes[node.inputs[j]].reg;
+			add.fused = 0;
+			code.push_back(add);
+			owners.push_back(i);
+		}
+
+		/* Release inputs read for the last time */
+		for (int j = 0; j < node.inputCount; j++)
+		{
+			const GraphNode &input = nodes[node.inputs[j]];
+			if (input.lastUse == i && input.reg >= 0)
+				used[input.reg] = false;
+		}
+	}
+
+	*outputReg = (uint8_t)nodes[output].reg;
+	guardSeas(code);
+	return true;
+}
+
+/* Guard the noise feeding each sea op. A guard follows an fbm when all code
+ * up to the sea only feeds the sea, and some of it evaluates noise */
+void GraphCompiler::guardSeas(std::vector<NoiseInstruction> &code)
+{
+	const int n = (int)code.size();
+
+	/* Precompute the ranges of values that only depend on noise */
+	NoiseRange ranges[NOISE_MAX_REGISTERS];
+	uint32_t fixed = 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		NoiseInstruction &ins = code[i];
+
+		const bool a = ins.a == NOISE_NO_INPUT || (fixed >> ins.a) & 1;
+		const bool b = ins.b == NOISE_NO_INPUT || (fixed >> ins.b) & 1;
+		const NoiseRange none = { 0.0f, 0.0f };
+
+		if (a && b && instructionRange(&ins,
+			ins.a != NOISE_NO_INPUT ? ranges[ins.a] : none,
+			ins.b != NOISE_NO_INPUT ? ranges[ins.b] : none, &ins.range))
+		{
+			ins.bounded = 1;
+			ranges[ins.dst] = ins.range;
+			fixed |= 1u << ins.dst;
+		}
+		else
+			fixed &= ~(1u << ins.dst);
+	}
+	std::vector<int> target(n, -1); // Sea guarded after each instruction
+
+	for (int s = 0; s < n; s++)
+	{
+		if (code[s].op != NOISE_OP_SEA)
+			continue;
+
+		/* Nodes read only by the sea, directly or through each other */
+		const int sea = owners[s];
+
+		bool exclusive[NOISE_MAX_NODES];
+		memset(exclusive, 0, sizeof(exclusive));
+		exclusive[sea] = true;
+
+		for (int i = sea - 1; i >= 0; i--)
+		{
+			bool only = nodes[i].live;
+			for (int j = i + 1; j <= output && only; j++)
+			{
+				const GraphNode &user = nodes[j];
+				if (!user.live || exclusive[j])
+					continue;
+
+				for (int k = 0; k < user.inputCount; k++)
+				{
+					if (user.inputs[k] == i)
+						only = false;
+				}
+			}
+			exclusive[i] = only;
+		}
+
+		/* Grow the skipped window backwards from the sea, the earliest fbm
+		 * skips the most. One guard per sea, each costs a range pass */
+		bool noise = false;
+		int first = -1;
+		for (int g = s - 1; g >= 0; g--)
+		{
+			if (code[g].op == NOISE_OP_FBM && noise && target[g] < 0)
+				first = g;
+
+			if (!exclusive[owners[g]])
+				break;
+
+			noise = noise || code[g].op == NOISE_OP_FBM || code[g].fused;
+		}
+
+		if (first >= 0)
+			target[first] = s;
+	}
+
+	std::vector<NoiseInstruction> guarded;
+	std::vector<int> index(n);
+
+	for (int i = 0; i < n; i++)
+	{
+		index[i] = (int)guarded.size();
+		guarded.push_back(code[i]);
+
+		if (target[i] >= 0)
+		{
+			NoiseInstruction guard;
+			memset((void *)&guard, 0, sizeof(guard));
+			guard.op = NOISE_OP_GUARD;
+			guard.a = NOISE_NO_INPUT;
+			guard.b = NOISE_NO_INPUT;
+			guard.skip = (uint16_t)target[i]; // Resolved below
+			guarded.push_back(guard);
+		}
+	}
+
+	for (int i = 0; i < (int)guarded.size(); i++)
+	{
+		if (guarded[i].op == NOISE_OP_GUARD)
+			guarded[i].skip = (uint16_t)(index[guarded[i].skip] - i);
+	}
+
+	code.swap(guarded);
+}
+
+NoiseProgram::NoiseProgram() :
+	_shift(0.0f, 0.0f), _frequency(1.0f), _output(0), _seed(0), _tolerance(0.0f), _signature(0)
+{
+	/* Empty program evaluates to zero */
+	NoiseInstruction ins;
+	memset((void *)&ins, 0, sizeof(ins));
+	ins.op = NOISE_OP_CONST;
+	_code.push_back(ins);
+}
+
+bool NoiseProgram::compile(const char *source, const char *name)
+{
+	GraphCompiler *compiler = new GraphCompiler;
+	compiler->name = name;
+	compiler->line = 0;
+	compiler->count = 0;
+	compiler->output = -1;
+	compiler->seed = 0;
+	compiler->tolerance = 0.0f;
+	compiler->shift = Vector2(0.0f, 0.0f);
+	compiler->frequency = 1.0f;
+
+	bool ok = true;
+
+	/* Parse line by line */
+	const char *c = source;
+	while (ok && *c)
+	{
+		compiler->line++;
+
+		const char *eol = strchr(c, '\n');
+		size_t length = eol ? (size_t)(eol - c) : strlen(c);
+
+		char text[NOISE_MAX_LINE];
+		if (length >= sizeof(text))
+			ok = compiler->error("Line is too long");
+		else
+		{
+			memcpy(text, c, length);
+			text[length] = 0;
+			ok = compiler->parseLine(text);
+		}
+
+		c += length;
+		if (*c)
+			c++;
+	}
+
+	if (ok && compiler->output < 0)
+		ok = compiler->error("No output node");
+
+	std::vector<NoiseInstruction> code;
+	uint8_t output = 0;
+
+	if (ok)
+	{
+		compiler->fold();
+		compiler->markLive();
+		ok = compiler->emit(code, &output);
+	}
+
+	if (ok)
+	{
+		_code = code;
+		_shift = compiler->shift;
+		_frequency = compiler->frequency;
+		_output = output;
+		_seed = compiler->seed;
+		_tolerance = compiler->tolerance;
+
+		uint64_t hash = hashBytes(_code.data(), _code.size() * sizeof(NoiseInstruction));
+		hash = hashBytes(&_shift, sizeof(_shift), hash);
+		hash = hashBytes(&_frequency, sizeof(_frequency), hash);
+		hash = hashBytes(&_tolerance, sizeof(_tolerance), hash);
+		_signature = hashBytes(&_output, sizeof(_output), hash);
+	}
+
+	delete compiler;
+	return ok;
+}
+
+bool NoiseProgram::load(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+	{
+		perror(path);
+		return false;
+	}
+
+	std::vector<char> source;
+
+	char buffer[4096];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		source.insert(source.end(), buffer, buffer + n);
+
+	fclose(file);
+
+	source.push_back(0);
+	return compile(source.data(), path);
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <mutil/mutil.h>
+
+#include "noise.h"
+
+using namespace mutil;
+
+// Maximum number of nodes in a graph description, literals included
+#define NOISE_MAX_NODES 256
+
+// Maximum number of values live at once during evaluation
+#define NOISE_MAX_REGISTERS 32
+
+// Maximum parameters of a node
+#define NOISE_MAX_PARAMS 8
+
+// Maximum inputs of a node
+#define NOISE_MAX_INPUTS 8
+
+// Range of the per-layer noise offset derived from the seed, in noise space
+#define NOISE_SEED_RANGE 256.0f
+
+// Register index of a missing optional input
+#define NOISE_NO_INPUT 0xff
+
+enum NoiseOp : uint8_t
+{
+	NOISE_OP_CONST, // dst = k0
+	NOISE_OP_FBM, // dst = fbm(pos)
+	NOISE_OP_ADD, // dst = a + b
+	NOISE_OP_ADDK, // dst = a + k0
+	NOISE_OP_MUL, // dst = a * b
+	NOISE_OP_MULK, // dst = a * k0
+	NOISE_OP_OFFSET, // dst = a * k0 + k1
+	NOISE_OP_POWER, // dst = sign(a) * |a|^k0
+	NOISE_OP_SMOOTH, // dst = (logistic(k0, a) + k1) * k2
+	NOISE_OP_SEA, // Sea floor clamp, k = level, floor, power
+	NOISE_OP_MOUNTAIN, // Mountain shaping of a with noise b, k = base, peak, scale, power, noise power, noise scale
+	NOISE_OP_TRANSITION, // Noise b faded in between k0 and k1, scaled by k2
+	NOISE_OP_GUARD // Skips to the sea op skip instructions ahead if its input is certainly below the floor
+};
+
+// Fractal noise at rotation * ((pos + offset) * frequency) + seedOffset
+struct NoiseFBM
+{
+	NoiseRotation rotation;
+	Vector2 offset;
+	Vector2 seedOffset;
+	float frequency;
+	float persistence;
+	int32_t octaves;
+	float amplitude;
+	float bias;
+	float budget; // Octave budget from the tolerance, fused fbm derive theirs from the mask
+};
+
+struct NoiseInstruction
+{
+	NoiseOp op;
+	uint8_t dst, a, b; // Registers
+	uint8_t fused; // Mountain and transition evaluate fbm as b only where it is visible
+	uint8_t bounded; // range holds every value dst can take when the inputs only depend on noise
+	uint16_t skip; // Distance from a guard to its sea op
+	float k[6];
+	NoiseRange range;
+	NoiseFBM fbm;
+};
+
+// Offset a seed adds to the fbm node of the given name
+Vector2 noiseSeedOffset(uint32_t seed, const char *node);
+
+/* Height function compiled from a noise graph description.
+ *
+ * A description is a list of lines, '#' starts a comment:
+ *
+ *   seed <n>                      Perturbs every fbm node, 0 keeps the authored offsets
+ *   tolerance <t>                 Octaves worth at most t in a stack's output are skipped,
+ *                                 0 evaluates every octave
+ *   domain shift=x,y frequency=f  Applied to the sample position before anything else
+ *   <name> = <op> <inputs> <key>=<value> ...
+ *   output <name>
+ *
+ * Inputs are node names defined above or numbers. Ops and their parameters:
+ *
+ *   const value
+ *   fbm frequency octaves persistence offset=x,y rotation (degrees) amplitude bias
+ *   add <a> <b> ...
+ *   mul <a> <b>
+ *   offset <a> scale offset
+ *   power <a> exponent
+ *   smooth <a> k bias scale
+ *   sea <a> level floor power
+ *   mountain <a> [noise] base peak scale power noise_power noise_scale
+ *   transition <a> [noise] low high scale
+ *
+ * Compilation folds constants, drops identities and nodes the output does not
+ * depend on, and emits a flat instruction list over a small register file.
+ * Noise feeding a sea op is guarded, once the sea input is certainly below the
+ * floor the rest of it is skipped.
+ */
+class NoiseProgram final
+{
+public:
+	// Compile a description, name is used in error messages
+	bool compile(const char *source, const char *name);
+
+	// Compile the description in a file
+	bool load(const char *path);
+
+	float evaluate(const Vector2 &p) const;
+
+	constexpr uint32_t seed() const { return _seed; }
+
+	constexpr float tolerance() const { return _tolerance; }
+
+	// Hash of the compiled program, equal programs produce equal terrain
+	constexpr uint64_t signature() const { return _signature; }
+
+	size_t instructionCount() const { return _code.size(); }
+
+	NoiseProgram();
+
+private:
+	std::vector<NoiseInstruction> _code;
+	Vector2 _shift;
+	float _frequency;
+	uint8_t _output;
+	uint32_t _seed;
+	float _tolerance;
+	uint64_t _signature;
+};
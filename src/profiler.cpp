@@ -0,0 +1,408 @@
+#include "profiler.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+
+#include <glad/glad.h>
+#include <imgui.h>
+#include <lysys/lysys.hpp>
+
+struct ProfileEvent
+{
+    const char *name; // Compared by pointer, must outlive the profiler
+    int depth;
+    double cpuBegin, cpuEnd; // Seconds since profilerInit
+    int query; // Index into the frame's queries, -1 if CPU only
+    double gpuTime; // Seconds, negative if not measured
+};
+
+struct ProfileFrame
+{
+    uint64_t index;
+    double begin, end;
+    int count;
+    int queryCount;
+    bool pending; // GPU results not read yet
+    ProfileEvent events[PROFILER_MAX_SCOPES];
+};
+
+static bool _initialized = false;
+static bool _enabled = true;
+static bool _enabledNext = true;
+
+static double _start;
+static uint64_t _frameIndex;
+
+/* Frames in flight, their queries are read PROFILER_LATENCY frames later */
+static ProfileFrame _inflight[PROFILER_LATENCY];
+static GLuint _queries[PROFILER_LATENCY][PROFILER_MAX_SCOPES];
+
+static ProfileFrame *_current;
+static int _depth;
+static bool _gpuActive;
+
+/* Resolved frames */
+static ProfileFrame _history[PROFILER_HISTORY];
+static int _historyHead; // Next slot to write
+static int _historyCount;
+
+static char _exportStatus[256];
+
+static inline double now()
+{
+    return ls_time64() - _start;
+}
+
+static void resolveFrame(ProfileFrame *frame, int slot)
+{
+    for (int i = 0; i < frame->count; i++)
+    {
+        ProfileEvent &e = frame->events[i];
+        if (e.query < 0)
+            continue;
+
+        /* Never wait for the GPU, drop the sample instead */
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(_queries[slot][e.query], GL_QUERY_RESULT_AVAILABLE, &available);
+
+        if (available)
+        {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(_queries[slot][e.query], GL_QUERY_RESULT, &elapsed);
+            e.gpuTime = elapsed * 1e-9;
+        }
+    }
+
+    frame->pending = false;
+
+    _history[_historyHead] = *frame;
+    _historyHead = (_historyHead + 1) % PROFILER_HISTORY;
+    if (_historyCount < PROFILER_HISTORY)
+        _historyCount++;
+}
+
+/* i-th most recent resolved frame, 0 is the latest */
+static const ProfileFrame *historyFrame(int i)
+{
+    if (i >= _historyCount)
+        return nullptr;
+    return &_history[(_historyHead - 1 - i + PROFILER_HISTORY) % PROFILER_HISTORY];
+}
+
+void profilerInit()
+{
+    glGenQueries(PROFILER_LATENCY * PROFILER_MAX_SCOPES, &_queries[0][0]);
+
+    _start = ls_time64();
+    _frameIndex = 0;
+    _current = nullptr;
+    _depth = 0;
+    _gpuActive = false;
+    _historyHead = 0;
+    _historyCount = 0;
+    _exportStatus[0] = 0;
+
+    memset(_inflight, 0, sizeof(_inflight));
+
+    _initialized = true;
+}
+
+void profilerShutdown()
+{
+    if (!_initialized)
+        return;
+
+    glDeleteQueries(PROFILER_LATENCY * PROFILER_MAX_SCOPES, &_queries[0][0]);
+    _initialized = false;
+}
+
+void profilerBeginFrame()
+{
+    if (!_initialized)
+        return;
+
+    _enabled = _enabledNext;
+
+    int slot = (int)(_frameIndex % PROFILER_LATENCY);
+    ProfileFrame *frame = &_inflight[slot];
+
+    /* Queries of this slot were issued PROFILER_LATENCY frames ago */
+    if (frame->pending)
+        resolveFrame(frame, slot);
+
+    if (!_enabled)
+    {
+        _current = nullptr;
+        return;
+    }
+
+    _current = frame;
+    _current->index = _frameIndex;
+    _current->begin = now();
+    _current->end = _current->begin;
+    _current->count = 0;
+    _current->queryCount = 0;
+    _current->pending = false;
+
+    _depth = 0;
+    _gpuActive = false;
+}
+
+void profilerEndFrame()
+{
+    if (!_initialized)
+        return;
+
+    if (_current)
+    {
+        _current->end = now();
+        _current->pending = true;
+        _current = nullptr;
+    }
+
+    _frameIndex++;
+}
+
+int profilerBeginScope(const char *name, bool gpu)
+{
+    if (!_current || _current->count >= PROFILER_MAX_SCOPES)
+        return -1;
+
+    int index = _current->count++;
+
+    ProfileEvent &e = _current->events[index];
+    e.name = name;
+    e.depth = _depth++;
+    e.query = -1;
+    e.gpuTime = -1.0;
+
+    if (gpu && !_gpuActive)
+    {
+        int slot = (int)(_frameIndex % PROFILER_LATENCY);
+        e.query = _current->queryCount++;
+        glBeginQuery(GL_TIME_ELAPSED, _queries[slot][e.query]);
+        _gpuActive = true;
+    }
+
+    e.cpuBegin = now();
+    e.cpuEnd = e.cpuBegin;
+
+    return index;
+}
+
+void profilerEndScope(int scope)
+{
+    if (!_current || scope < 0)
+        return;
+
+    ProfileEvent &e = _current->events[scope];
+    e.cpuEnd = now();
+    _depth--;
+
+    if (e.query >= 0)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        _gpuActive = false;
+    }
+}
+
+void profilerSetEnabled(bool enabled)
+{
+    _enabledNext = enabled; // Takes effect on the next frame
+}
+
+bool profilerEnabled()
+{
+    return _enabledNext;
+}
+
+/* Average CPU and GPU time of a scope over the history, in milliseconds */
+static void averageScope(const char *name, float *cpuMs, float *gpuMs)
+{
+    double cpu = 0.0, gpu = 0.0;
+    int cpuCount = 0, gpuCount = 0;
+
+    for (int i = 0; i < _historyCount; i++)
+    {
+        const ProfileFrame *frame = historyFrame(i);
+        for (int j = 0; j < frame->count; j++)
+        {
+            const ProfileEvent &e = frame->events[j];
+            if (e.name != name)
+                continue;
+
+            cpu += e.cpuEnd - e.cpuBegin;
+            cpuCount++;
+
+            if (e.gpuTime >= 0.0)
+            {
+                gpu += e.gpuTime;
+                gpuCount++;
+            }
+        }
+    }
+
+    *cpuMs = cpuCount ? (float)(cpu / cpuCount * 1000.0) : 0.0f;
+    *gpuMs = gpuCount ? (float)(gpu / gpuCount * 1000.0) : -1.0f;
+}
+
+void profilerDrawUI()
+{
+    bool enabled = _enabledNext;
+    if (ImGui::Checkbox("Enabled", &enabled))
+        profilerSetEnabled(enabled);
+
+    ImGui::SameLine();
+    if (ImGui::Button("Export Trace"))
+    {
+        const char *path = "profile_trace.json";
+        if (profilerExportTrace(path))
+            snprintf(_exportStatus, sizeof(_exportStatus), "Wrote %d frames to %s", _historyCount, path);
+        else
+            snprintf(_exportStatus, sizeof(_exportStatus), "Failed to write %s", path);
+    }
+
+    if (_exportStatus[0])
+    {
+        ImGui::SameLine();
+        ImGui::TextUnformatted(_exportStatus);
+    }
+
+    const ProfileFrame *latest = historyFrame(0);
+    if (!latest)
+        return;
+
+    /* Frame time history, oldest first */
+    static float cpuHistory[PROFILER_HISTORY];
+    static float gpuHistory[PROFILER_HISTORY];
+
+    int n = _historyCount;
+    for (int i = 0; i < n; i++)
+    {
+        const ProfileFrame *frame = historyFrame(n - 1 - i);
+
+        cpuHistory[i] = (float)((frame->end - frame->begin) * 1000.0);
+
+        double gpu = 0.0;
+        for (int j = 0; j < frame->count; j++)
+        {
+            if (frame->events[j].gpuTime > 0.0)
+                gpu += frame->events[j].gpuTime;
+        }
+        gpuHistory[i] = (float)(gpu * 1000.0);
+    }
+
+    char overlay[64];
+
+    snprintf(overlay, sizeof(overlay), "CPU %.2f ms", cpuHistory[n - 1]);
+    ImGui::PlotLines("CPU", cpuHistory, n, 0, overlay, 0.0f, FLT_MAX, ImVec2(0.0f, 60.0f));
+
+    snprintf(overlay, sizeof(overlay), "GPU %.2f ms", gpuHistory[n - 1]);
+    ImGui::PlotLines("GPU", gpuHistory, n, 0, overlay, 0.0f, FLT_MAX, ImVec2(0.0f, 60.0f));
+
+    /* Per scope breakdown of the latest resolved frame */
+    if (ImGui::BeginTable("Scopes", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV))
+    {
+        ImGui::TableSetupColumn("Scope");
+        ImGui::TableSetupColumn("CPU ms");
+        ImGui::TableSetupColumn("GPU ms");
+        ImGui::TableSetupColumn("CPU avg");
+        ImGui::TableSetupColumn("GPU avg");
+        ImGui::TableHeadersRow();
+
+        for (int i = 0; i < latest->count; i++)
+        {
+            const ProfileEvent &e = latest->events[i];
+
+            float cpuAvg, gpuAvg;
+            averageScope(e.name, &cpuAvg, &gpuAvg);
+
+            ImGui::TableNextRow();
+
+            ImGui::TableNextColumn();
+            ImGui::Indent(e.depth * 12.0f + 0.001f);
+            ImGui::TextUnformatted(e.name);
+            ImGui::Unindent(e.depth * 12.0f + 0.001f);
+
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", (e.cpuEnd - e.cpuBegin) * 1000.0);
+
+            ImGui::TableNextColumn();
+            if (e.gpuTime >= 0.0)
+                ImGui::Text("%.3f", e.gpuTime * 1000.0);
+            else
+                ImGui::TextUnformatted("-");
+
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", cpuAvg);
+
+            ImGui::TableNextColumn();
+            if (gpuAvg >= 0.0f)
+                ImGui::Text("%.3f", gpuAvg);
+            else
+                ImGui::TextUnformatted("-");
+        }
+
+        ImGui::EndTable();
+    }
+}
+
+static void writeJSONString(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for (; *str; str++)
+    {
+        if (*str == '"' || *str == '\\')
+            fputc('\\', file);
+        fputc(*str, file);
+    }
+    fputc('"', file);
+}
+
+bool profilerExportTrace(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        perror("fopen");
+        return false;
+    }
+
+    /* CPU scopes go on thread 1, GPU time on thread 2. GPU timings have no
+     * timestamps, they are placed at the start of the CPU scope that issued
+     * them. */
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"CPU\"}},\n");
+    fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"GPU\"}}");
+
+    for (int i = _historyCount - 1; i >= 0; i--)
+    {
+        const ProfileFrame *frame = historyFrame(i);
+
+        fprintf(file, ",\n{\"name\": \"Frame %llu\", \"cat\": \"frame\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.3f, \"dur\": %.3f}",
+            (unsigned long long)frame->index, frame->begin * 1e6, (frame->end - frame->begin) * 1e6);
+
+        for (int j = 0; j < frame->count; j++)
+        {
+            const ProfileEvent &e = frame->events[j];
+
+            fprintf(file, ",\n{\"name\": ");
+            writeJSONString(file, e.name);
+            fprintf(file, ", \"cat\": \"cpu\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.3f, \"dur\": %.3f}",
+                e.cpuBegin * 1e6, (e.cpuEnd - e.cpuBegin) * 1e6);
+
+            if (e.gpuTime >= 0.0)
+            {
+                fprintf(file, ",\n{\"name\": ");
+                writeJSONString(file, e.name);
+                fprintf(file, ", \"cat\": \"gpu\", \"ph\": \"X\", \"pid\": 1, \"tid\": 2, \"ts\": %.3f, \"dur\": %.3f}",
+                    e.cpuBegin * 1e6, e.gpuTime * 1e6);
+            }
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+}
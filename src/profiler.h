@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+// Frames of timings kept for the history graphs and trace export
+#define PROFILER_HISTORY 240
+
+// Frames a GL query is given to complete before it is read back
+#define PROFILER_LATENCY 3
+
+// Maximum scopes per frame, further scopes are dropped
+#define PROFILER_MAX_SCOPES 128
+
+void profilerInit();
+void profilerShutdown();
+
+void profilerBeginFrame();
+void profilerEndFrame();
+
+/* Scopes nest. A GPU scope also times the GL commands issued inside it with
+ * GL_TIME_ELAPSED, such queries cannot nest, so a GPU scope opened inside
+ * another GPU scope is only timed on the CPU.
+ */
+int profilerBeginScope(const char *name, bool gpu);
+void profilerEndScope(int scope);
+
+void profilerSetEnabled(bool enabled);
+bool profilerEnabled();
+
+// Draw the profiler contents into the current ImGui window
+void profilerDrawUI();
+
+// Write the recorded history as a Chrome trace (chrome://tracing, Perfetto)
+bool profilerExportTrace(const char *path);
+
+class ProfileScope final
+{
+public:
+    ProfileScope(const char *name, bool gpu = false) :
+        _scope(profilerBeginScope(name, gpu)) {}
+
+    ~ProfileScope() { profilerEndScope(_scope); }
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+    int _scope;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+// Time the rest of the enclosing block on the CPU
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(_profileScope, __LINE__)(name)
+
+// Time the rest of the enclosing block on the CPU and GPU
+#define PROFILE_GPU_SCOPE(name) ProfileScope PROFILE_CONCAT(_profileScope, __LINE__)(name, true)
@@ -0,0 +1,221 @@
+#include "scatter.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "arena.h"
+
+/* Layers follow the material bands of terrain.frag: trees on grass between
+ * the beach and the dirt, rocks on steep ground below the snow */
+static const ScatterLayer kLayers[SCATTER_KIND_COUNT] = {
+	/* spacing, density, minHeight, maxHeight, heightFade, minSlope, maxSlope, minScale, maxScale */
+	{ 12.0f, 0.8f, 16.0f, 100.0f, 12.0f, 0.0f, 0.45f, 0.8f, 1.4f }, // SCATTER_TREE
+	{ 32.0f, 0.6f, 0.0f, 200.0f, 24.0f, 0.3f, 2.0f, 0.5f, 2.0f }, // SCATTER_ROCK
+};
+
+// Scatter blocks per pool arena, about 3 MB
+#define CHUNK_SCATTER_PER_ARENA 8
+
+// World units between heightmap samples
+#define SCATTER_SAMPLE_SPACING ((float)CHUNK_WORLD_SIZE / (float)CHUNK_SIZE)
+
+const ScatterLayer &getScatterLayer(ScatterKind kind)
+{
+	return kLayers[kind];
+}
+
+// Hash of a cell for a stream of random values, salt picks the stream
+static inline uint32_t hashCell(int32_t i, int32_t j, uint32_t salt)
+{
+	uint32_t h = (uint32_t)i * 0x8da6b343u ^ (uint32_t)j * 0xd8163841u ^ salt * 0xcb1ab31fu;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+// [0, 1) from the top 24 bits
+static inline float unitFloat(uint32_t h)
+{
+	return (float)(h >> 8) * (1.0f / 16777216.0f);
+}
+
+struct Candidate
+{
+	float x, z; // World position
+	uint32_t priority;
+	bool live; // Kept by the density
+};
+
+// Whether a wins over b, ties go to the lower cell
+static inline bool outranks(const Candidate &a, int32_t ai, int32_t aj, const Candidate &b, int32_t bi, int32_t bj)
+{
+	if (a.priority != b.priority)
+		return a.priority > b.priority;
+	return aj != bj ? aj < bj : ai < bi;
+}
+
+// Bilinear height at padded coordinates, clamped to the padded image
+static float sampleHeight(const float *padded, float px, float py)
+{
+	px = clamp(px, 0.0f, (float)(CHUNK_PADDED_SIZE - 1));
+	py = clamp(py, 0.0f, (float)(CHUNK_PADDED_SIZE - 1));
+
+	const int32_t x0 = min((int32_t)px, CHUNK_PADDED_SIZE - 2);
+	const int32_t y0 = min((int32_t)py, CHUNK_PADDED_SIZE - 2);
+	const float fx = px - x0, fy = py - y0;
+
+	const float *row = padded + y0 * CHUNK_PADDED_SIZE + x0;
+	const float top = row[0] + (row[1] - row[0]) * fx;
+	const float bottom = row[CHUNK_PADDED_SIZE] + (row[CHUNK_PADDED_SIZE + 1] - row[CHUNK_PADDED_SIZE]) * fx;
+	return top + (bottom - top) * fy;
+}
+
+struct Placed
+{
+	uint32_t priority;
+	ScatterInstance instance;
+};
+
+// Place one layer, returns the props added after count
+static uint32_t scatterLayer(int32_t chunkX, int32_t chunkY, const float *padded, ScatterKind kind, uint32_t seed,
+	ScatterInstance *out, uint32_t room)
+{
+	const ScatterLayer &layer = kLayers[kind];
+	const uint32_t salt = seed + (uint32_t)kind * 8;
+
+	/* Chunk (x, y) is centered on (x, y) * CHUNK_WORLD_SIZE */
+	const float minX = ((float)chunkX - 0.5f) * CHUNK_WORLD_SIZE;
+	const float minZ = ((float)chunkY - 0.5f) * CHUNK_WORLD_SIZE;
+
+	/* Cells overlapping the chunk and a ring of neighbours */
+	const int32_t i0 = (int32_t)floorf(minX / layer.spacing) - 1;
+	const int32_t j0 = (int32_t)floorf(minZ / layer.spacing) - 1;
+	const int32_t i1 = (int32_t)floorf((minX + CHUNK_WORLD_SIZE) / layer.spacing) + 1;
+	const int32_t j1 = (int32_t)floorf((minZ + CHUNK_WORLD_SIZE) / layer.spacing) + 1;
+	const int32_t columns = i1 - i0 + 1, rows = j1 - j0 + 1;
+
+	ScratchScope scope;
+	Candidate *cells = scope.arena().alloc<Candidate>((size_t)columns * rows);
+	Placed *placed = scope.arena().alloc<Placed>(room);
+
+	for (int32_t j = j0; j <= j1; j++)
+	{
+		for (int32_t i = i0; i <= i1; i++)
+		{
+			Candidate &c = cells[(j - j0) * columns + (i - i0)];
+			c.x = ((float)i + unitFloat(hashCell(i, j, salt))) * layer.spacing;
+			c.z = ((float)j + unitFloat(hashCell(i, j, salt + 1))) * layer.spacing;
+			c.priority = hashCell(i, j, salt + 2);
+			c.live = unitFloat(hashCell(i, j, salt + 3)) < layer.density;
+		}
+	}
+
+	const float spacingSq = layer.spacing * layer.spacing;
+	const float sampleScale = 1.0f / SCATTER_SAMPLE_SPACING;
+
+	uint32_t count = 0;
+	for (int32_t j = j0 + 1; j < j1 && count < room; j++)
+	{
+		for (int32_t i = i0 + 1; i < i1 && count < room; i++)
+		{
+			const Candidate &c = cells[(j - j0) * columns + (i - i0)];
+			if (!c.live)
+				continue;
+
+			/* Chunks own the candidates inside them */
+			const float u = c.x - minX, v = c.z - minZ;
+			if (u < 0.0f || v < 0.0f || u >= CHUNK_WORLD_SIZE || v >= CHUNK_WORLD_SIZE)
+				continue;
+
+			/* Points of cells further apart are at least a spacing away */
+			bool survives = true;
+			for (int32_t nj = j - 1; nj <= j + 1 && survives; nj++)
+			{
+				for (int32_t ni = i - 1; ni <= i + 1; ni++)
+				{
+					const Candidate &n = cells[(nj - j0) * columns + (ni - i0)];
+					if ((ni == i && nj == j) || !n.live)
+						continue;
+
+					const float dx = n.x - c.x, dz = n.z - c.z;
+					if (dx * dx + dz * dz < spacingSq && outranks(n, ni, nj, c, i, j))
+					{
+						survives = false;
+						break;
+					}
+				}
+			}
+			if (!survives)
+				continue;
+
+			/* Masks, texel centers are half a sample in like the renderer's */
+			const float px = u * sampleScale + 0.5f;
+			const float py = v * sampleScale + 0.5f;
+
+			const float h = sampleHeight(padded, px, py);
+			const float gx = (sampleHeight(padded, px + 1.0f, py) - sampleHeight(padded, px - 1.0f, py)) * (0.5f * sampleScale);
+			const float gz = (sampleHeight(padded, px, py + 1.0f) - sampleHeight(padded, px, py - 1.0f)) * (0.5f * sampleScale);
+			const float slope = sqrtf(gx * gx + gz * gz);
+
+			if (slope < layer.minSlope || slope > layer.maxSlope)
+				continue;
+
+			const float fade = layer.heightFade > 0.0f ? 1.0f / layer.heightFade : INFINITY;
+			const float weight = clamp((h - layer.minHeight) * fade, 0.0f, 1.0f) * clamp((layer.maxHeight - h) * fade, 0.0f, 1.0f);
+			if (unitFloat(hashCell(i, j, salt + 4)) >= weight)
+				continue;
+
+			Placed &p = placed[count++];
+			p.priority = c.priority;
+			p.instance.x = (uint16_t)min((int32_t)(u * (65536.0f / CHUNK_WORLD_SIZE)), 65535);
+			p.instance.z = (uint16_t)min((int32_t)(v * (65536.0f / CHUNK_WORLD_SIZE)), 65535);
+			p.instance.y = h;
+			p.instance.rotation = (uint16_t)(hashCell(i, j, salt + 5) >> 16);
+			p.instance.scale = (uint8_t)(hashCell(i, j, salt + 6) >> 24);
+			p.instance.kind = (uint8_t)kind;
+		}
+	}
+
+	/* Random order, so a prefix is an even subset */
+	std::sort(placed, placed + count, [](const Placed &a, const Placed &b) { return a.priority > b.priority; });
+	for (uint32_t k = 0; k < count; k++)
+		out[k] = placed[k].instance;
+
+	return count;
+}
+
+void generateScatter(int32_t x, int32_t y, const float *padded, ChunkScatter *scatterOut)
+{
+	/* Props move with the world graph only, erosion and the adaptive
+	 * tolerance reshape the ground under them but keep them in place */
+	const uint32_t seed = (uint32_t)getWorldGraph().signature();
+
+	uint32_t count = 0;
+	for (int kind = 0; kind < SCATTER_KIND_COUNT; kind++)
+	{
+		scatterOut->first[kind] = count;
+		count += scatterLayer(x, y, padded, (ScatterKind)kind, seed, scatterOut->instances + count, CHUNK_SCATTER_MAX - count);
+	}
+
+	scatterOut->first[SCATTER_KIND_COUNT] = count;
+	scatterOut->count = count;
+}
+
+static BlockPool *scatterPool()
+{
+	static BlockPool *pool = new BlockPool(sizeof(ChunkScatter), CHUNK_SCATTER_PER_ARENA);
+	return pool;
+}
+
+ChunkScatter *allocChunkScatter()
+{
+	return (ChunkScatter *)scatterPool()->alloc();
+}
+
+void freeChunkScatter(ChunkScatter *scatter)
+{
+	scatterPool()->free(scatter);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "worldgen.h"
+
+// Kinds of scattered props, each is drawn with its own mesh
+enum ScatterKind
+{
+	SCATTER_TREE,
+	SCATTER_ROCK,
+
+	SCATTER_KIND_COUNT
+};
+
+// Most props in a chunk, generation stops once they are placed
+#define CHUNK_SCATTER_MAX 32768
+
+// Bump when placement changes to invalidate cached chunks
+#define SCATTER_VERSION 1
+
+/* Where and how densely a kind is placed. Heights are in world units like
+ * the heightmap, slopes rise over run */
+struct ScatterLayer
+{
+	float spacing; // Smallest distance between props of the kind
+	float density; // Fraction of candidates kept before masking
+	float minHeight, maxHeight;
+	float heightFade; // Density ramps to 0 over this much at the height limits
+	float minSlope, maxSlope;
+	float minScale, maxScale;
+};
+
+static_assert(sizeof(ScatterLayer) == 9 * sizeof(float), "ScatterLayer is hashed into the world signature");
+
+const ScatterLayer &getScatterLayer(ScatterKind kind);
+
+// A placed prop, 12 bytes
+struct ScatterInstance
+{
+	uint16_t x, z; // From the chunk's min corner, CHUNK_WORLD_SIZE / 65536 units
+	float y; // Ground height
+	uint16_t rotation; // Around the up axis, a full turn is 65536
+	uint8_t scale; // Between the layer's min and max scale
+	uint8_t kind;
+};
+
+static_assert(sizeof(ScatterInstance) == 12, "ScatterInstance is uploaded as is");
+
+/* Props of a chunk, grouped by kind in kind order. Within a kind they are in
+ * random order, so any prefix thins them out evenly */
+struct ChunkScatter
+{
+	uint32_t count;
+	uint32_t first[SCATTER_KIND_COUNT + 1]; // Range of each kind
+	ScatterInstance instances[CHUNK_SCATTER_MAX];
+};
+
+/* Place the props of chunk (x, y) on its padded heights.
+ *
+ * Candidates come from a world aligned grid of spacing sized cells, one
+ * jittered point per cell. A candidate is dropped if a neighbour cell's
+ * candidate with a higher random priority lies closer than the spacing,
+ * which leaves a Poisson disk set. Every decision hashes world cells only,
+ * so chunks agree across their borders. Height and slope masks then thin
+ * the survivors */
+void generateScatter(int32_t x, int32_t y, const float *padded, ChunkScatter *scatterOut);
+
+// Chunk scatter from a shared block pool, nullptr when out of memory
+ChunkScatter *allocChunkScatter();
+void freeChunkScatter(ChunkScatter *scatter);
+
+// Bytes of a scatter in the chunk cache
+constexpr size_t scatterBytes(uint32_t count)
+{
+	return sizeof(uint32_t) * (SCATTER_KIND_COUNT + 2) + count * sizeof(ScatterInstance);
+}
@@ -0,0 +1,252 @@
+#include "scatterrender.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "mesh.h"
+#include "shader.h"
+#include "camera.h"
+#include "glresource.h"
+#include "model.h"
+
+// First vertex attribute of the instance data, after the mesh's
+#define SCATTER_ATTRIB 3
+
+/* Distances over which a kind thins out, it is gone past the second */
+struct ScatterFade
+{
+    float start, end;
+};
+
+static const ScatterFade kFades[SCATTER_KIND_COUNT] = {
+    { 600.0f, 1500.0f }, // SCATTER_TREE
+    { 300.0f, 800.0f }, // SCATTER_ROCK
+};
+
+void ScatterRenderer::setKind(ScatterKind kind, Mesh *mesh, Material *material, float reach)
+{
+    Part part;
+    part.mesh = mesh;
+    part.material = material;
+    part.doubleSided = false;
+
+    _kinds[kind].parts.clear();
+    _kinds[kind].parts.push_back(std::move(part));
+    _kinds[kind].reach = reach;
+}
+
+void ScatterRenderer::setKind(ScatterKind kind, const Model *model)
+{
+    _kinds[kind].parts.clear();
+    for (size_t i = 0; i < model->partCount(); i++)
+    {
+        Part part;
+        part.mesh = model->partMesh(i);
+        part.material = model->partMaterial(i);
+        part.doubleSided = model->partDoubleSided(i);
+        _kinds[kind].parts.push_back(std::move(part));
+    }
+
+    /* Props turn about their origin, any corner may point anywhere */
+    const Vector3 &lo = model->boundsMin();
+    const Vector3 &hi = model->boundsMax();
+    const Vector3 far(std::max(-lo.x, hi.x), std::max(-lo.y, hi.y), std::max(-lo.z, hi.z));
+    _kinds[kind].reach = sqrtf(far.x * far.x + far.y * far.y + far.z * far.z);
+}
+
+void ScatterRenderer::insert(int32_t x, int32_t y, const ChunkScatter *scatter)
+{
+    remove(x, y);
+
+    Chunk chunk;
+    chunk.x = x;
+    chunk.y = y;
+    std::copy(scatter->first, scatter->first + SCATTER_KIND_COUNT + 1, chunk.first);
+
+    chunk.minY = INFINITY;
+    chunk.maxY = -INFINITY;
+    for (uint32_t i = 0; i < scatter->count; i++)
+    {
+        chunk.minY = std::min(chunk.minY, scatter->instances[i].y);
+        chunk.maxY = std::max(chunk.maxY, scatter->instances[i].y);
+    }
+
+    /* Buffers are sized for a full chunk, so any freed one fits */
+    const GLsizeiptr size = CHUNK_SCATTER_MAX * sizeof(ScatterInstance);
+    const GLsizeiptr used = scatter->count * sizeof(ScatterInstance);
+
+    chunk.buffer = acquireGLBuffer(size, GL_STATIC_DRAW);
+    if (chunk.buffer)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, chunk.buffer);
+        if (used > 0)
+            glBufferSubData(GL_ARRAY_BUFFER, 0, used, scatter->instances);
+    }
+    else
+    {
+        glGenBuffers(1, &chunk.buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, chunk.buffer);
+        glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STATIC_DRAW);
+        if (used > 0)
+            glBufferSubData(GL_ARRAY_BUFFER, 0, used, scatter->instances);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    _chunks.push_back(chunk);
+}
+
+void ScatterRenderer::remove(int32_t x, int32_t y)
+{
+    for (size_t i = 0; i < _chunks.size(); i++)
+    {
+        if (_chunks[i].x == x && _chunks[i].y == y)
+        {
+            recycleGLBuffer(_chunks[i].buffer, CHUNK_SCATTER_MAX * sizeof(ScatterInstance), GL_STATIC_DRAW);
+            _chunks[i] = _chunks.back();
+            _chunks.pop_back();
+            return;
+        }
+    }
+}
+
+// Whether the box lies outside one of the frustum planes
+static bool outsideFrustum(const Matrix4 &projView, const Vector3 &lo, const Vector3 &hi)
+{
+    int outsideLo[3] = {}, outsideHi[3] = {};
+    for (int i = 0; i < 8; i++)
+    {
+        const Vector3 corner((i & 1) ? hi.x : lo.x, (i & 2) ? hi.y : lo.y, (i & 4) ? hi.z : lo.z);
+        const Vector4 clip = projView * Vector4(corner, 1.0f);
+
+        outsideLo[0] += clip.x < -clip.w;
+        outsideLo[1] += clip.y < -clip.w;
+        outsideLo[2] += clip.z < -clip.w;
+        outsideHi[0] += clip.x > clip.w;
+        outsideHi[1] += clip.y > clip.w;
+        outsideHi[2] += clip.z > clip.w;
+    }
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (outsideLo[axis] == 8 || outsideHi[axis] == 8)
+            return true;
+    }
+    return false;
+}
+
+// Distance from p to the nearest point of the box
+static float boxDistance(const Vector3 &p, const Vector3 &lo, const Vector3 &hi)
+{
+    const float dx = std::max(std::max(lo.x - p.x, p.x - hi.x), 0.0f);
+    const float dy = std::max(std::max(lo.y - p.y, p.y - hi.y), 0.0f);
+    const float dz = std::max(std::max(lo.z - p.z, p.z - hi.z), 0.0f);
+    return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+static void bindInstances(GLuint buffer, uint32_t first)
+{
+    const size_t base = (size_t)first * sizeof(ScatterInstance);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+    glEnableVertexAttribArray(SCATTER_ATTRIB + 0);
+    glVertexAttribPointer(SCATTER_ATTRIB + 0, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(ScatterInstance),
+                          (void *)(base + offsetof(ScatterInstance, x)));
+
+    glEnableVertexAttribArray(SCATTER_ATTRIB + 1);
+    glVertexAttribPointer(SCATTER_ATTRIB + 1, 1, GL_FLOAT, GL_FALSE, sizeof(ScatterInstance),
+                          (void *)(base + offsetof(ScatterInstance, y)));
+
+    glEnableVertexAttribArray(SCATTER_ATTRIB + 2);
+    glVertexAttribPointer(SCATTER_ATTRIB + 2, 1, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(ScatterInstance),
+                          (void *)(base + offsetof(ScatterInstance, rotation)));
+
+    glEnableVertexAttribArray(SCATTER_ATTRIB + 3);
+    glVertexAttribPointer(SCATTER_ATTRIB + 3, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ScatterInstance),
+                          (void *)(base + offsetof(ScatterInstance, scale)));
+
+    for (GLuint attrib = SCATTER_ATTRIB; attrib < SCATTER_ATTRIB + 4; attrib++)
+        glVertexAttribDivisor(attrib, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ScatterRenderer::render(Shader *shader, const Camera *camera) const
+{
+    const Vector3 &eye = camera->position();
+    const float half = 0.5f * CHUNK_WORLD_SIZE;
+
+    shader->setFloat("uChunkSize", (float)CHUNK_WORLD_SIZE);
+
+    for (int k = 0; k < SCATTER_KIND_COUNT; k++)
+    {
+        const Kind &kind = _kinds[k];
+
+        const ScatterLayer &layer = getScatterLayer((ScatterKind)k);
+        const ScatterFade &fade = kFades[k];
+        const float reach = kind.reach * layer.maxScale;
+
+        shader->setVector2("uScaleRange", Vector2(layer.minScale, layer.maxScale));
+        shader->setVector2("uFadeRange", Vector2(fade.start, fade.end));
+
+        for (const Part &part : kind.parts)
+        {
+            shader->setMaterial(*part.material);
+            part.mesh->bind();
+
+            if (part.doubleSided)
+                glDisable(GL_CULL_FACE);
+
+            for (const Chunk &chunk : _chunks)
+            {
+                const uint32_t first = chunk.first[k];
+                const uint32_t count = chunk.first[k + 1] - first;
+                if (count == 0)
+                    continue;
+
+                /* Chunk (x, y) is centered on (x, y) * CHUNK_WORLD_SIZE, props
+                 * stick out of it by their reach */
+                const Vector3 lo(chunk.x * (float)CHUNK_WORLD_SIZE - half - reach, chunk.minY - reach,
+                                 chunk.y * (float)CHUNK_WORLD_SIZE - half - reach);
+                const Vector3 hi(chunk.x * (float)CHUNK_WORLD_SIZE + half + reach, chunk.maxY + reach,
+                                 chunk.y * (float)CHUNK_WORLD_SIZE + half + reach);
+
+                const float distance = boxDistance(eye, lo, hi);
+                if (distance >= fade.end || outsideFrustum(camera->projView(), lo, hi))
+                    continue;
+
+                /* Props further in the kind's random order are dropped even by
+                 * the nearest point of the chunk */
+                const float t = std::min(std::max((distance - fade.start) / (fade.end - fade.start), 0.0f), 1.0f);
+                const float keep = 1.0f - t * t * (3.0f - 2.0f * t);
+                const GLsizei drawn = std::min((GLsizei)ceilf(keep * count), (GLsizei)count);
+                if (drawn <= 0)
+                    continue;
+
+                shader->setVector2("uChunkOrigin", Vector2(chunk.x * (float)CHUNK_WORLD_SIZE - half, chunk.y * (float)CHUNK_WORLD_SIZE - half));
+                shader->setFloat("uKindCount", (float)count);
+
+                bindInstances(chunk.buffer, first);
+                part.mesh->drawInstanced(drawn);
+            }
+
+            for (GLuint attrib = SCATTER_ATTRIB; attrib < SCATTER_ATTRIB + 4; attrib++)
+                glDisableVertexAttribArray(attrib);
+
+            if (part.doubleSided)
+                glEnable(GL_CULL_FACE);
+        }
+    }
+}
+
+ScatterRenderer::ScatterRenderer()
+{
+    for (Kind &kind : _kinds)
+        kind.reach = 0.0f;
+}
+
+ScatterRenderer::~ScatterRenderer()
+{
+    for (const Chunk &chunk : _chunks)
+        releaseGLBuffers(1, &chunk.buffer);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "mem.h"
+#include "scatter.h"
+
+class Mesh;
+class Material;
+class Model;
+class Shader;
+class Camera;
+
+/* Scattered props of the loaded chunks, drawn instanced.
+ *
+ * Each chunk's props are uploaded once into a buffer of their own, one draw
+ * per chunk and kind. Chunks outside the frustum or past a kind's draw
+ * distance are skipped. With distance props thin out: the drawn prefix of a
+ * kind shrinks on the CPU per chunk, the vertex shader drops single props.
+ */
+class ScatterRenderer final
+{
+public:
+    /* Mesh and material a kind is drawn with, reach is the mesh's farthest
+     * point from its origin. Kinds without parts are skipped */
+    void setKind(ScatterKind kind, Mesh *mesh, Material *material, float reach);
+
+    // Draw a kind with every part of a model
+    void setKind(ScatterKind kind, const Model *model);
+
+    // Upload the props of chunk (x, y), replacing older ones
+    void insert(int32_t x, int32_t y, const ChunkScatter *scatter);
+    void remove(int32_t x, int32_t y);
+
+    // Culls back faces, double-sided parts turn culling off while drawn
+    void render(Shader *shader, const Camera *camera) const;
+
+    ScatterRenderer();
+    ~ScatterRenderer();
+
+    ScatterRenderer(const ScatterRenderer &) = delete;
+    ScatterRenderer &operator=(const ScatterRenderer &) = delete;
+
+private:
+    struct Part
+    {
+        AutoRelease<Mesh> mesh;
+        AutoRelease<Material> material;
+        bool doubleSided;
+    };
+
+    struct Kind
+    {
+        std::vector<Part> parts;
+        float reach; // At scale 1, for culling
+    };
+
+    struct Chunk
+    {
+        int32_t x, y;
+        GLuint buffer;
+        uint32_t first[SCATTER_KIND_COUNT + 1];
+        float minY, maxY; // Ground heights of the props
+    };
+
+    Kind _kinds[SCATTER_KIND_COUNT];
+    std::vector<Chunk> _chunks;
+};
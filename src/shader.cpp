@@ -436,6 +436,17 @@ void Shader::setCubemap(const char *name, GLuint texture, int unit)
     }
 }
 
+void Shader::setTextureArray(const char *name, GLuint texture, int unit)
+{
+    int loc = glGetUniformLocation(_program, name);
+    if (loc != -1)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glUniform1i(loc, unit);
+    }
+}
+
 void Shader::setMaterial(const Material &material)
 {
     /* Albedo */
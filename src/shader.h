@@ -31,6 +31,7 @@ public:
 
     void setTexture(const char *name, GLuint texture, int unit);
     void setCubemap(const char *name, GLuint texture, int unit);
+    void setTextureArray(const char *name, GLuint texture, int unit);
     void setMaterial(const Material &material);
     void setMaterial(int index, const Material &material);
     void setGbuffer(const Gbuffer *gbuffer);
@@ -1,6 +1,11 @@
 #include "skybox.h"
 
 #include <cstdio>
+#include <cstring>
+
+#include <xmmintrin.h>
+
+#include <lysys/lysys.hpp>
 
 #include "util.h"
 #include "camera.h"
@@ -44,6 +49,11 @@ struct SkyboxGPU
     Vector3 fogColor;
 
     float g;
+
+    float eyeHeight;
+    float _pad5[3];
+
+    Vector4 irradianceSH[9];
 };
 
 static const Vector3 kSkyboxVertices[] = {
@@ -89,19 +99,25 @@ const Vector3 kInvWavelength = Vector3(
 #define IRRADIANCE_RESOLUTION 32
 #define STARBOX_RESOLUTION 1024
 
-static void createCubemapRenderer(GLsizei res, GLuint *fbo, GLuint *tex)
-{
-    /* Initialize framebuffer */
-    glGenFramebuffers(1, fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
+// Sky mip level projected to spherical harmonics
+#define SH_SAMPLE_LEVEL 5
+#define SH_SAMPLE_RESOLUTION (SKYBOX_RESOLUTION >> SH_SAMPLE_LEVEL)
+#define SH_SAMPLE_COUNT (6 * SH_SAMPLE_RESOLUTION * SH_SAMPLE_RESOLUTION)
 
-    /* Initialize cubemap */
+/* SH basis times texel solid angle for every sample, SoA */
+alignas(16) static float _shWeights[9][SH_SAMPLE_COUNT];
+
+/* Sky samples read back from the cubemap, SoA */
+alignas(16) static float _shSamples[3][SH_SAMPLE_COUNT];
+
+static void createCubemap(GLsizei res, GLuint *tex)
+{
     glGenTextures(1, tex);
     glBindTexture(GL_TEXTURE_CUBE_MAP, *tex);
 
     for (int i = 0; i < 6; i++)
         glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, res, res, 0, GL_RGB, GL_HALF_FLOAT, NULL);
-    checkGLErrors("createCubemapRenderer: glTexImage2D");
+    checkGLErrors("createCubemap: glTexImage2D");
 
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -109,6 +125,18 @@ static void createCubemapRenderer(GLsizei res, GLuint *fbo, GLuint *tex)
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+static void createCubemapRenderer(GLsizei res, GLuint *fbo, GLuint *tex)
+{
+    /* Initialize cubemap */
+    createCubemap(res, tex);
+
+    /* Initialize framebuffer */
+    glGenFramebuffers(1, fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
+
     glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, *tex, 0);
     checkGLErrors("createCubemapRenderer: glFramebufferTexture");
 
@@ -118,10 +146,106 @@ static void createCubemapRenderer(GLsizei res, GLuint *fbo, GLuint *tex)
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         fatal("Skybox::setupSkybox: Framebuffer is not complete!\n");
 
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+static void createLUTTexture(GLsizei width, GLsizei height, GLuint *tex)
+{
+    glGenTextures(1, tex);
+    glBindTexture(GL_TEXTURE_2D, *tex);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
+    checkGLErrors("createLUTTexture: glTexImage2D");
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/* Read tables from the cache, building and caching them if missing */
+static void loadLUT(AtmosphereLUT *lut, const AtmosphereParams &params)
+{
+    char path[256];
+    pathForAtmosphereLUT(path, sizeof(path), params);
+
+    if (lut->read(path, params))
+        return;
+
+    lut->compute(params);
+    lut->write(path);
+}
+
+/* Direction through a cubemap texel, s and t in [-1, 1] */
+static inline Vector3 cubemapDirection(int face, float s, float t)
+{
+    switch (face)
+    {
+    case 0: return normalize(Vector3(1.0f, -t, -s));
+    case 1: return normalize(Vector3(-1.0f, -t, s));
+    case 2: return normalize(Vector3(s, 1.0f, t));
+    case 3: return normalize(Vector3(s, -1.0f, -t));
+    case 4: return normalize(Vector3(s, -t, 1.0f));
+    default: return normalize(Vector3(-s, -t, -1.0f));
+    }
+}
+
+/* Real spherical harmonics up to band 2 */
+static inline void shBasis(const Vector3 &d, float *Y)
+{
+    Y[0] = 0.282095f;
+    Y[1] = 0.488603f * d.y;
+    Y[2] = 0.488603f * d.z;
+    Y[3] = 0.488603f * d.x;
+    Y[4] = 1.092548f * d.x * d.y;
+    Y[5] = 1.092548f * d.y * d.z;
+    Y[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+    Y[7] = 1.092548f * d.x * d.z;
+    Y[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+}
+
+static void initSHWeights()
+{
+    constexpr int res = SH_SAMPLE_RESOLUTION;
+
+    float total = 0.0f;
+
+    for (int face = 0; face < 6; face++)
+    {
+        for (int y = 0; y < res; y++)
+        {
+            for (int x = 0; x < res; x++)
+            {
+                float s = 2.0f * (x + 0.5f) / res - 1.0f;
+                float t = 2.0f * (y + 0.5f) / res - 1.0f;
+
+                /* Solid angle subtended by the texel */
+                float d = 1.0f + s * s + t * t;
+                float dw = 4.0f / (res * res * d * sqrtf(d));
+
+                float Y[9];
+                shBasis(cubemapDirection(face, s, t), Y);
+
+                int i = (face * res + y) * res + x;
+                for (int k = 0; k < 9; k++)
+                    _shWeights[k][i] = Y[k] * dw;
+
+                total += dw;
+            }
+        }
+    }
+
+    /* Normalize so the weights integrate to exactly 4 pi */
+    float norm = 4.0f * MUTIL_PI / total;
+    for (int k = 0; k < 9; k++)
+    {
+        for (int i = 0; i < SH_SAMPLE_COUNT; i++)
+            _shWeights[k][i] *= norm;
+    }
+}
+
 static inline Matrix3 getSkyProjViewMatrix(int side)
 {
     float pitch, yaw;
@@ -193,30 +317,150 @@ void Skybox::renderSkybox() const
     shader->setMatrix3("uViews[4]", kSkyMatrices[4]);
     shader->setMatrix3("uViews[5]", kSkyMatrices[5]);
 
+    shader->setTexture("uTransmittanceLUT", _transmittanceTex, TRANSMITTANCE_TEXTURE_UNIT);
+    shader->setTexture("uMultiScatteringLUT", _multiScatteringTex, MULTISCATTERING_TEXTURE_UNIT);
+
     glBindVertexArray(_skyQuadVAO);
     glDrawArrays(GL_TRIANGLES, 0, 6);
 
     checkGLErrors("Skybox::renderSkybox");
 }
 
-void Skybox::renderIrradiance() const
+void Skybox::renderIrradiance()
 {
-    // TODO: Implement
+    constexpr int res = SH_SAMPLE_RESOLUTION;
+
+    /* A readback still in flight is of an older sky, drop it */
+    if (_shFence)
+        glDeleteSync(_shFence);
+
+    /* Copy a downsampled sky into the pack buffer, mapped a frame later so
+     * the copy does not wait for the cubemap render */
+    glBindTexture(GL_TEXTURE_CUBE_MAP, _cubemap);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _shPBO);
+    for (int i = 0; i < 6; i++)
+    {
+        const size_t offset = (size_t)i * res * res * sizeof(Vector3);
+        glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, SH_SAMPLE_LEVEL, GL_RGB, GL_FLOAT, (void *)offset);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    checkGLErrors("Skybox::renderIrradiance: glGetTexImage");
+
+    _shFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 }
 
-static Vector2 rsi(const Vector3 &r0, const Vector3 &rd, float sr)
+void Skybox::updateIrradiance()
 {
-    float a = dot(rd, rd);
-    float b = 2.0f * dot(rd, r0);
-    float c = dot(r0, r0) - (sr * sr);
-    float d = (b * b) - 4.0f * a * c;
+    constexpr int res = SH_SAMPLE_RESOLUTION;
+
+    if (!_shFence)
+        return;
+
+    /* Never block, try again next frame */
+    const GLenum status = glClientWaitSync(_shFence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+        return;
+
+    glDeleteSync(_shFence);
+    _shFence = 0;
+
+    if (status == GL_WAIT_FAILED)
+        return;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _shPBO);
+    const Vector3 *samples = (const Vector3 *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, SH_SAMPLE_COUNT * sizeof(Vector3), GL_MAP_READ_BIT);
+    if (!samples)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return;
+    }
+
+    for (int i = 0; i < 6; i++)
+    {
+        const Vector3 *face = samples + i * res * res;
+
+        float *r = _shSamples[0] + i * res * res;
+        float *g = _shSamples[1] + i * res * res;
+        float *b = _shSamples[2] + i * res * res;
+        for (int j = 0; j < res * res; j++)
+        {
+            r[j] = face[j].x;
+            g[j] = face[j].y;
+            b[j] = face[j].z;
+        }
+    }
+
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    /* Project onto the basis */
+    for (int k = 0; k < 9; k++)
+    {
+        __m128 sumR = _mm_setzero_ps();
+        __m128 sumG = _mm_setzero_ps();
+        __m128 sumB = _mm_setzero_ps();
+
+        const float *w = _shWeights[k];
+        for (int i = 0; i < SH_SAMPLE_COUNT; i += 4)
+        {
+            __m128 wi = _mm_load_ps(w + i);
+            sumR = _mm_add_ps(sumR, _mm_mul_ps(wi, _mm_load_ps(_shSamples[0] + i)));
+            sumG = _mm_add_ps(sumG, _mm_mul_ps(wi, _mm_load_ps(_shSamples[1] + i)));
+            sumB = _mm_add_ps(sumB, _mm_mul_ps(wi, _mm_load_ps(_shSamples[2] + i)));
+        }
+
+        alignas(16) float r[4], g[4], b[4];
+        _mm_store_ps(r, sumR);
+        _mm_store_ps(g, sumG);
+        _mm_store_ps(b, sumB);
+
+        _irradianceSH[k] = Vector3(r[0] + r[1] + r[2] + r[3], g[0] + g[1] + g[2] + g[3], b[0] + b[1] + b[2] + b[3]);
+    }
+
+    /* Convolve with the clamped cosine lobe, divided by pi, band 0 is unchanged */
+    for (int k = 1; k < 4; k++)
+        _irradianceSH[k] = _irradianceSH[k] * (2.0f / 3.0f);
+    for (int k = 4; k < 9; k++)
+        _irradianceSH[k] = _irradianceSH[k] * 0.25f;
+
+    /* Evaluate the irradiance cubemap */
+    constexpr int ires = IRRADIANCE_RESOLUTION;
+    static Vector3 irradiance[ires * ires];
+
+    glBindTexture(GL_TEXTURE_CUBE_MAP, _irradiance);
+
+    for (int i = 0; i < 6; i++)
+    {
+        for (int y = 0; y < ires; y++)
+        {
+            for (int x = 0; x < ires; x++)
+            {
+                float s = 2.0f * (x + 0.5f) / ires - 1.0f;
+                float t = 2.0f * (y + 0.5f) / ires - 1.0f;
+
+                float Y[9];
+                shBasis(cubemapDirection(i, s, t), Y);
+
+                Vector3 E(0.0f);
+                for (int k = 0; k < 9; k++)
+                    E += _irradianceSH[k] * Y[k];
+
+                irradiance[y * ires + x] = Vector3(max(E.x, 0.0f), max(E.y, 0.0f), max(E.z, 0.0f));
+            }
+        }
 
-    if (d < 0.0f)
-        return Vector2(1e5f, -1e5f);
+        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, ires, ires, GL_RGB, GL_FLOAT, irradiance);
+    }
+
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    checkGLErrors("Skybox::updateIrradiance: glTexSubImage2D");
 
-    float sqrtd = mutil::sqrt(d);
-    float twoa = 2.0f * a;
-    return Vector2((-b - sqrtd) / twoa, (-b + sqrtd) / twoa);
+    /* Coefficients are also available to shaders */
+    upload();
 }
 
 void Skybox::render(Shader *shader) const
@@ -280,24 +524,58 @@ void Skybox::load()
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     createCubemapRenderer(SKYBOX_RESOLUTION, &_cubemapFBO, &_cubemap);
-    createCubemapRenderer(IRRADIANCE_RESOLUTION, &_irradianceFBO, &_irradiance);
+    createCubemap(IRRADIANCE_RESOLUTION, &_irradiance); // Filled from the SH on the CPU
+
+    initSHWeights();
+
+    glGenBuffers(1, &_shPBO);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _shPBO);
+    glBufferData(GL_PIXEL_PACK_BUFFER, SH_SAMPLE_COUNT * sizeof(Vector3), NULL, GL_STREAM_READ);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    /* Atmosphere tables, built synchronously so the first frame is correct */
+    if (ls_createdir(ATMOSPHERE_CACHE_DIR) == -1)
+        ls_perror("ls_createdir");
+
+    createLUTTexture(TRANSMITTANCE_LUT_WIDTH, TRANSMITTANCE_LUT_HEIGHT, &_transmittanceTex);
+    createLUTTexture(MULTISCATTERING_LUT_SIZE, MULTISCATTERING_LUT_SIZE, &_multiScatteringTex);
+
+    AtmosphereParams params = atmosphereParams();
+
+    _lut = new AtmosphereLUT();
+    loadLUT(_lut, params);
+    _lutHash = hashAtmosphereParams(params);
+
+    uploadLUT();
 }
 
 bool Skybox::update(const Camera *camera)
 {
-    if (!_dirty)
-        return false;
+    updateLUT();
 
-    /* Update sun direction */
-    Quaternion q1 = mutil::rotateaxis(kWorldUp, mutil::radians(_azimuth));
-    Quaternion q2 = mutil::rotateaxis(kWorldRight, mutil::radians(_altitude));
-    Quaternion q = q1 * q2;
-    _sunDirection = mutil::rotatevector(q, kWorldFront);
+    /* The sky only changes noticeably over large height differences */
+    float eyeHeight = floorf(max(camera->position().y, 0.0f) / SKY_HEIGHT_QUANTUM) * SKY_HEIGHT_QUANTUM;
+    if (eyeHeight != _eyeHeight)
+    {
+        _eyeHeight = eyeHeight;
+        _dirty = true;
+    }
 
-    /* Compute sun position */
-    _sunPositionWorld = -_sunDirection * _atmosphereRadius * 1.1f + camera->position(); // Sun position in world space
+    if (_dirty)
+    {
+        /* Update sun direction */
+        Quaternion q1 = mutil::rotateaxis(kWorldUp, mutil::radians(_azimuth));
+        Quaternion q2 = mutil::rotateaxis(kWorldRight, mutil::radians(_altitude));
+        Quaternion q = q1 * q2;
+        _sunDirection = mutil::rotatevector(q, kWorldFront);
+
+        /* Compute sun color */
+        computeSunColor();
+    }
 
-    /* Compute screen-space sun position */
+    /* Camera dependent state changes every frame */
+
+    _sunPositionWorld = -_sunDirection * _atmosphereRadius * 1.1f + camera->position(); // Sun position in world space
 
     Vector4 sunPosView = camera->view() * Vector4(_sunPositionWorld, 1.0f);
     Vector4 sunPosNDC = camera->proj() * sunPosView;
@@ -307,14 +585,20 @@ bool Skybox::update(const Camera *camera)
     _sunPosition = Vector3(sunPosNDC.x / sunPosNDC.w, sunPosNDC.y / sunPosNDC.w, z);
     _sunPosition = (_sunPosition + Vector3(1.0f)) * 0.5f;
 
-    /* Compute sun color */
-    computeSunColor(camera);
-
     /* Upload to GPU */
     upload();
 
+    if (!_dirty)
+        return false;
+
     _dirty = false;
 
+    /* Only re-render the cubemap if something it depends on changed */
+    uint64_t hash = skyHash();
+    if (hash == _skyHash)
+        return false;
+
+    _skyHash = hash;
     return true;
 }
 
@@ -331,26 +615,48 @@ Skybox::Skybox() :
     _sunTemperature(5772.0f), _sunBlackbody(0.0f), _sunColorMask(1.0f),
     _dirty(true),
     _ubo(0),
+    _eyeHeight(0.0f), _skyHash(0),
     _cubemapFBO(0), _cubemap(0),
-    _irradianceFBO(0), _irradiance(0),
-    _starbox(0)
+    _irradiance(0),
+    _shPBO(0), _shFence(0),
+    _starbox(0),
+    _lut(nullptr), _pendingLUT(nullptr),
+    _lutReady(false), _lutHash(0),
+    _transmittanceTex(0), _multiScatteringTex(0)
 {
+    for (int i = 0; i < 9; i++)
+        _irradianceSH[i] = Vector3(0.0f);
 }
 
 Skybox::~Skybox()
 {
+    if (_lutWorker.joinable())
+        _lutWorker.join();
+
+    delete _pendingLUT;
+    delete _lut;
+
+    if (_multiScatteringTex)
+        glDeleteTextures(1, &_multiScatteringTex);
+
+    if (_transmittanceTex)
+        glDeleteTextures(1, &_transmittanceTex);
+
     if (_ubo)
         glDeleteBuffers(1, &_ubo);
 
     if (_starbox)
         glDeleteTextures(1, &_starbox);
 
+    if (_shFence)
+        glDeleteSync(_shFence);
+
+    if (_shPBO)
+        glDeleteBuffers(1, &_shPBO);
+
     if (_irradiance)
         glDeleteTextures(1, &_irradiance);
 
-    if (_irradianceFBO)
-        glDeleteFramebuffers(1, &_irradianceFBO);
-
     if (_cubemap)
 		glDeleteTextures(1, &_cubemap);
 
@@ -397,99 +703,71 @@ static Vector3 blackbody(float K)
     return out / 255.0f;
 }
 
-Vector3 Skybox::atmosphere(const Vector3 &V, const Vector3 &eye) const
+AtmosphereParams Skybox::atmosphereParams() const
 {
-    constexpr int iSteps = 16;
-    constexpr int jSteps = 9;
-
-    constexpr Vector3 kRlh(5.8e-6f, 13.0e-6f, 22.4e-6f);
-    constexpr float kMie = 21e-6f;
-    constexpr float shRlh = 8e3f;
-    constexpr float shMie = 1.2e3f;
-    constexpr float g = 0.76f;
-    constexpr float gg = g * g;
-
-    Vector3 pSun = -normalize(_sunDirection);
-    Vector3 r = normalize(V);
-
-    Vector3 r0 = eye;
-
-    Vector2 p = rsi(r0, r, _atmosphereRadius);
-
-    if (p.x > p.y || p.y < 0.0f)
-        return Vector3(0.0f);
-
-    p.y = min(p.y, rsi(r0, r, _planetRadius).x);
-
-    float iStepSize = (p.y - p.x) / iSteps;
-
-    float iTime = 0.0f;
-
-    Vector3 totalRlh(0.0f);
-    Vector3 totalMie(0.0f);
-
-    float iOdRlh = 0.0f;
-    float iOdMie = 0.0f;
-
-    float mu = dot(r, pSun);
-    float mumu = mu * mu;
-    float pRlh = 3.0f / (16.0f * MUTIL_PI) * (1.0f + mumu);
-    float pMie = 3.0f / (8.0f * MUTIL_PI) * ((1.0f - gg) * (mumu + 1.0f)) / (powf(1.0f + gg - 2.0f * mu * g, 1.5f) * (2.0f + gg));
+    AtmosphereParams params;
+    params.planetRadius = _planetRadius;
+    params.atmosphereRadius = _atmosphereRadius;
+    params.Hr = _Hr;
+    params.Hm = _Hm;
+    params.g = _miePhase;
+    return params;
+}
 
-    for (int i = 0; i < iSteps; i++)
+void Skybox::updateLUT()
+{
+    if (_lutWorker.joinable())
     {
-        Vector3 iPos = r0 + r * (iTime + iStepSize * 0.5f);
-
-        float iHeight = length(iPos) - _planetRadius;
-
-        float tmp = -iHeight / shRlh;
+        if (!_lutReady.load(std::memory_order_acquire))
+            return; // Still building
 
-        float odStepRlh = expf(-iHeight / shRlh) * iStepSize;
-        float odStepMie = expf(-iHeight / shMie) * iStepSize;
+        _lutWorker.join();
 
-        iOdRlh += odStepRlh;
-        iOdMie += odStepMie;
+        delete _lut;
+        _lut = _pendingLUT;
+        _pendingLUT = nullptr;
 
-        float jStepSize = rsi(iPos, pSun, _atmosphereRadius).y / jSteps;
+        uploadLUT();
 
-        float jTime = 0.0f;
-
-        float jOdRlh = 0.0f;
-        float jOdMie = 0.0f;
-
-        for (int j = 0; j < jSteps; j++)
-        {
-            Vector3 jPos = iPos + pSun * (jTime + jStepSize * 0.5f);
+        _dirty = true;
+    }
 
-            float jHeight = length(jPos) - _planetRadius;
+    AtmosphereParams params = atmosphereParams();
+    uint64_t hash = hashAtmosphereParams(params);
+    if (hash == _lutHash)
+        return;
 
-            jOdRlh += expf(-jHeight / shRlh) * jStepSize;
-            jOdMie += expf(-jHeight / shMie) * jStepSize;
+    /* Keep using the old tables until the new ones are ready */
+    _lutHash = hash;
+    _pendingLUT = new AtmosphereLUT();
+    _lutReady.store(false, std::memory_order_relaxed);
 
-            jTime += jStepSize;
-        }
+    AtmosphereLUT *lut = _pendingLUT;
+    _lutWorker = std::thread([this, lut, params]()
+    {
+        loadLUT(lut, params);
+        _lutReady.store(true, std::memory_order_release);
+    });
+}
 
-        Vector3 attn = -(Vector3(kMie * (iOdMie + iOdMie)) + kRlh * (iOdRlh + jOdRlh));
-        attn.x = expf(attn.x);
-        attn.y = expf(attn.y);
-        attn.z = expf(attn.z);
+void Skybox::uploadLUT() const
+{
+    glBindTexture(GL_TEXTURE_2D, _transmittanceTex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TRANSMITTANCE_LUT_WIDTH, TRANSMITTANCE_LUT_HEIGHT, GL_RGB, GL_FLOAT, _lut->transmittanceData());
 
-        totalRlh += odStepRlh * attn;
-        totalMie += odStepMie * attn;
+    glBindTexture(GL_TEXTURE_2D, _multiScatteringTex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, MULTISCATTERING_LUT_SIZE, MULTISCATTERING_LUT_SIZE, GL_RGB, GL_FLOAT, _lut->multiScatteringData());
 
-        iTime += iStepSize;
-    }
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-    return pRlh * kRlh * totalRlh + pMie * kMie * totalMie;
+    checkGLErrors("Skybox::uploadLUT");
 }
 
-void Skybox::computeSunColor(const Camera *camera)
+void Skybox::computeSunColor()
 {
-    const Vector3 eye(0.0f, camera->position().y + _planetRadius, 0.0f);
-
     _sunBlackbody = blackbody(_sunTemperature);
 
-    _sunColor = atmosphere(-_sunDirection, eye);
+    _sunColor = _lut->sunRadiance(_eyeHeight, -_sunDirection.y);
     if (isnan(_sunColor.x) || isnan(_sunColor.y) || isnan(_sunColor.z))
         _sunColor = Vector3(0.0f);
     _sunColor = _sunColor * _sunColorMask * _sunBlackbody;
@@ -501,6 +779,30 @@ void Skybox::computeSunColor(const Camera *camera)
     _fogColor = _sunColor * _sunIntensity;
 }
 
+uint64_t Skybox::skyHash() const
+{
+    /* Everything skydome.frag reads */
+    struct
+    {
+        Vector3 sunDirection;
+        Vector3 sunColor;
+        float sunIntensity;
+        float eyeHeight;
+        AtmosphereParams params; // Raw values used by the shader
+        AtmosphereParams lutParams; // Tables currently uploaded
+    } state;
+
+    memset(&state, 0, sizeof(state));
+    state.sunDirection = _sunDirection;
+    state.sunColor = _sunColor;
+    state.sunIntensity = _sunIntensity;
+    state.eyeHeight = _eyeHeight;
+    state.params = atmosphereParams();
+    state.lutParams = _lut->params();
+
+    return hashBytes(&state, sizeof(state));
+}
+
 void Skybox::genStarbox()
 {
 
@@ -529,6 +831,10 @@ void Skybox::upload() const
     sb->Hm = _Hm;
     sb->g = _miePhase;
     sb->fogColor = _fogColor;
+    sb->eyeHeight = _eyeHeight;
+
+    for (int i = 0; i < 9; i++)
+        sb->irradianceSH[i] = Vector4(_irradianceSH[i], 0.0f);
 
     glBindBuffer(GL_UNIFORM_BUFFER, _ubo);
     glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SkyboxGPU), buf);
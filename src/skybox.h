@@ -1,21 +1,37 @@
 #pragma once
 
+#include <thread>
+#include <atomic>
+
 #include <glad/glad.h>
 #include <mutil/mutil.h>
 
+#include "atmosphere.h"
+
 using namespace mutil;
 
 class Shader;
 class Camera;
 
+#define TRANSMITTANCE_TEXTURE_UNIT 23
+#define MULTISCATTERING_TEXTURE_UNIT 24
 #define SKYBOX_TEXTURE_UNIT 25
 #define IRRADIANCE_TEXTURE_UNIT 26
 
+// Eye height steps at which the sky cubemap is re-rendered, in meters
+#define SKY_HEIGHT_QUANTUM 16.0f
+
+static constexpr bool sameVector(const Vector3 &a, const Vector3 &b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
 class Skybox final
 {
 public:
     void renderSkybox() const;
-    void renderIrradiance() const;
+    void renderIrradiance(); // Starts reading the sky back
+    void updateIrradiance(); // Projects the sky once the readback finished
     void render(Shader *shader) const;
 
     void load();
@@ -26,64 +42,88 @@ public:
 
     constexpr void setSunAltitude(float altitude)
     {
-        _altitude = altitude;
-        _dirty = true;
+        if (_altitude != altitude)
+        {
+            _altitude = altitude;
+            _dirty = true;
+        }
     }
 
     constexpr float sunAzimuth() const { return _azimuth; }
 
     constexpr void setSunAzimuth(float azimuth)
     {
-        _azimuth = azimuth;
-        _dirty = true;
+        if (_azimuth != azimuth)
+        {
+            _azimuth = azimuth;
+            _dirty = true;
+        }
     }
 
     constexpr const Vector3 &sunColor() const { return _sunColor; }
 
    /* constexpr void setSunColor(const Vector3 &color)
     {
-        _sunColor = color;
-        _dirty = true;
+        if (!sameVector(_sunColor, color))
+        {
+            _sunColor = color;
+            _dirty = true;
+        }
     }*/
 
     constexpr float sunIntensity() const { return _sunIntensity; }
 
     constexpr void setSunIntensity(float intensity)
     {
-        _sunIntensity = intensity;
-        _dirty = true;
+        if (_sunIntensity != intensity)
+        {
+            _sunIntensity = intensity;
+            _dirty = true;
+        }
     }
 
     constexpr float sunTightness() const { return _sunTightness; }
 
     constexpr void setSunTightness(float tightness)
     {
-        _sunTightness = tightness;
-        _dirty = true;
+        if (_sunTightness != tightness)
+        {
+            _sunTightness = tightness;
+            _dirty = true;
+        }
     }
 
     constexpr const Vector3 &horizonColor() const { return _horizonColor; }
 
     constexpr void setHorizonColor(const Vector3 &color)
     {
-        _horizonColor = color;
-        _dirty = true;
+        if (!sameVector(_horizonColor, color))
+        {
+            _horizonColor = color;
+            _dirty = true;
+        }
     }
 
     constexpr const Vector3 &zenithColor() const { return _zenithColor; }
 
     constexpr void setZenithColor(const Vector3 &color)
     {
-        _zenithColor = color;
-        _dirty = true;
+        if (!sameVector(_zenithColor, color))
+        {
+            _zenithColor = color;
+            _dirty = true;
+        }
     }
 
     constexpr float fogDensity() const { return _fogDensity; }
 
     constexpr void setFogDensity(float density)
     {
-        _fogDensity = density;
-        _dirty = true;
+        if (_fogDensity != density)
+        {
+            _fogDensity = density;
+            _dirty = true;
+        }
     }
 
     constexpr const Vector3 &fogColor() const { return _fogColor; }
@@ -92,49 +132,67 @@ public:
 
     constexpr void setPlanetRadius(float radius)
     {
-		_planetRadius = radius;
-		_dirty = true;
-	}
+        if (_planetRadius != radius)
+        {
+            _planetRadius = radius;
+            _dirty = true;
+        }
+    }
 
     constexpr float atmosphereRadius() const { return _atmosphereRadius; }
 
     constexpr void setAtmosphereRadius(float radius)
     {
-        _atmosphereRadius = radius;
-        _dirty = true;
+        if (_atmosphereRadius != radius)
+        {
+            _atmosphereRadius = radius;
+            _dirty = true;
+        }
     }
 
     constexpr float Hr() const { return _Hr; }
 
     constexpr void setHr(float Hr)
     {
-		_Hr = Hr;
-		_dirty = true;
-	}
+        if (_Hr != Hr)
+        {
+            _Hr = Hr;
+            _dirty = true;
+        }
+    }
 
     constexpr float Hm() const { return _Hm; }
 
     constexpr void setHm(float Hm)
     {
-        _Hm = Hm;
-        _dirty = true;
+        if (_Hm != Hm)
+        {
+            _Hm = Hm;
+            _dirty = true;
+        }
     }
 
     constexpr float miePhase() const { return _miePhase; }
 
     constexpr void setMiePhase(float miePhase)
     {
-        _miePhase = miePhase;
-        _dirty = true;
+        if (_miePhase != miePhase)
+        {
+            _miePhase = miePhase;
+            _dirty = true;
+        }
     }
 
     constexpr float sunTemperature() const { return _sunTemperature; }
 
     constexpr void setSunTemperature(float temperature)
     {
-		_sunTemperature = temperature;
-		_dirty = true;
-	}
+        if (_sunTemperature != temperature)
+        {
+            _sunTemperature = temperature;
+            _dirty = true;
+        }
+    }
 
     constexpr const Vector3 &sunBlackbody() const { return _sunBlackbody; }
 
@@ -142,9 +200,12 @@ public:
 
     constexpr void setSunColorMask(const Vector3 &mask)
     {
-		_sunColorMask = mask;
-		_dirty = true;
-	}
+        if (!sameVector(_sunColorMask, mask))
+        {
+            _sunColorMask = mask;
+            _dirty = true;
+        }
+    }
 
     constexpr const Vector3 &sunDirection() const { return _sunDirection; }
     constexpr const Vector3 &sunPosition() const { return _sunPosition; }
@@ -152,6 +213,12 @@ public:
     constexpr GLuint skybox() const { return _cubemap; }
     constexpr GLuint irradiance() const { return _irradiance; }
 
+    // Irradiance as 3rd order spherical harmonics, 9 coefficients
+    constexpr const Vector3 *irradianceSH() const { return _irradianceSH; }
+
+    constexpr GLuint transmittanceLUT() const { return _transmittanceTex; }
+    constexpr GLuint multiScatteringLUT() const { return _multiScatteringTex; }
+
     Skybox();
     ~Skybox();
 
@@ -181,9 +248,12 @@ private:
     Vector3 _sunBlackbody;
     Vector3 _sunColorMask;
 
-    bool _dirty;
+    bool _dirty; // Parameters changed since the last update
     GLuint _ubo;
 
+    float _eyeHeight; // Quantized camera height the sky is rendered from
+    uint64_t _skyHash; // Hash of the state the cubemap was rendered with
+
     Vector3 _sunDirection;
 
     Vector3 _sunPosition;
@@ -194,13 +264,32 @@ private:
     GLuint _cubemapFBO;
     GLuint _cubemap; // Skybox cubemap
 
-    GLuint _irradianceFBO;
     GLuint _irradiance; // Irradiance cubemap
+    Vector3 _irradianceSH[9];
+
+    GLuint _shPBO; // Sky samples read back for the projection
+    GLsync _shFence; // Signals when _shPBO holds the newest sky, 0 if none pending
 
     GLuint _starbox; // Starbox cubemap
 
-    Vector3 atmosphere(const Vector3 &V, const Vector3 &eye) const;
-    void computeSunColor(const Camera *camera);
+    /* Precomputed atmosphere */
+    AtmosphereLUT *_lut; // Tables in use
+    AtmosphereLUT *_pendingLUT; // Tables being built by the worker
+    std::thread _lutWorker;
+    std::atomic<bool> _lutReady;
+    uint64_t _lutHash; // Hash of the parameters of the newest tables
+
+    GLuint _transmittanceTex;
+    GLuint _multiScatteringTex;
+
+    AtmosphereParams atmosphereParams() const;
+
+    void updateLUT();
+    void uploadLUT() const;
+
+    void computeSunColor();
+
+    uint64_t skyHash() const;
 
     void genStarbox();
 
@@ -0,0 +1,149 @@
+#include "staging.h"
+
+#include <deque>
+
+// Longest wait for a fence before uploading from client memory, in nanoseconds
+#define STAGING_WAIT_TIMEOUT 1000000000ull
+
+/* Range of the ring uploads may still be reading */
+struct StagingRange
+{
+    GLsync fence;
+    size_t begin, end;
+};
+
+static GLuint _buffer;
+static uint8_t *_mapped; // Whole ring, null if it is mapped per staging
+static size_t _head;
+static std::deque<StagingRange> _inFlight; // Oldest first
+
+void createStaging()
+{
+    glGenBuffers(1, &_buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffer);
+
+    if (GLAD_GL_VERSION_4_4)
+    {
+        /* Coherent, writes are visible to later commands without a flush */
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, STAGING_RING_SIZE, nullptr, flags);
+        _mapped = (uint8_t *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, STAGING_RING_SIZE, flags);
+    }
+    else
+    {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, STAGING_RING_SIZE, nullptr, GL_STREAM_DRAW);
+        _mapped = nullptr;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    _head = 0;
+}
+
+void destroyStaging()
+{
+    for (const StagingRange &range : _inFlight)
+        glDeleteSync(range.fence);
+    _inFlight.clear();
+
+    if (_buffer)
+    {
+        if (_mapped)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            _mapped = nullptr;
+        }
+
+        glDeleteBuffers(1, &_buffer);
+        _buffer = 0;
+    }
+}
+
+// Retire the oldest range once the GPU passed its fence, false if it did not in time
+static bool retireOldest(GLbitfield flags, GLuint64 timeout)
+{
+    const StagingRange &range = _inFlight.front();
+
+    const GLenum status = glClientWaitSync(range.fence, flags, timeout);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return false;
+
+    glDeleteSync(range.fence);
+    _inFlight.pop_front();
+    return true;
+}
+
+static bool overlapsInFlight(size_t begin, size_t end)
+{
+    for (const StagingRange &range : _inFlight)
+    {
+        if (range.begin < end && begin < range.end)
+            return true;
+    }
+    return false;
+}
+
+bool beginStaging(size_t size, Staging *staging)
+{
+    if (!_buffer || size == 0 || size > STAGING_RING_SIZE)
+        return false;
+
+    /* Drop ranges the GPU is done with */
+    while (!_inFlight.empty() && retireOldest(0, 0))
+        ;
+
+    size_t begin = (_head + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+    if (begin + size > STAGING_RING_SIZE)
+        begin = 0; // Wrap
+
+    /* Ranges complete in order, wait for the oldest until the new one is free.
+     * A range is never handed out before its fence, on a timeout or a failed
+     * wait the caller uploads from client memory */
+    while (overlapsInFlight(begin, begin + size))
+    {
+        if (!retireOldest(GL_SYNC_FLUSH_COMMANDS_BIT, STAGING_WAIT_TIMEOUT))
+            return false;
+    }
+
+    uint8_t *data;
+    if (_mapped)
+        data = _mapped + begin;
+    else
+    {
+        /* The fences already keep the range out of the GPU's way */
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffer);
+        data = (uint8_t *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, begin, size,
+                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        if (!data)
+            return false;
+    }
+
+    _head = begin + size;
+
+    staging->data = data;
+    staging->size = size;
+    staging->offset = (GLintptr)begin;
+    return true;
+}
+
+void useStaging(const Staging &staging)
+{
+    (void)staging;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffer);
+
+    if (!_mapped)
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+}
+
+void endStaging(const Staging &staging)
+{
+    const size_t begin = (size_t)staging.offset;
+    _inFlight.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), begin, begin + staging.size });
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glad/glad.h>
+
+/* Ring buffer of pixel unpack memory for texture uploads.
+ *
+ * Pixels are written once into buffer memory and the upload commands read
+ * them from there without blocking, the driver copies them while the GPU
+ * renders. With buffer storage (GL 4.4) the ring stays mapped, otherwise each
+ * staging maps its range unsynchronized. Every staging is fenced and its range
+ * is only handed out again once the GPU has passed the fence.
+ */
+
+// Size of the ring, larger uploads come from client memory
+#define STAGING_RING_SIZE (64u << 20)
+
+// Alignment of staging offsets
+#define STAGING_ALIGNMENT 256
+
+struct Staging
+{
+    uint8_t *data; // Write size bytes here before useStaging
+    size_t size;
+    GLintptr offset; // Of data in the ring buffer
+};
+
+// Create the ring, call on the context thread once the context is current
+void createStaging();
+void destroyStaging();
+
+/* Reserve size bytes, waiting for the GPU if the ring is full. false if
+ * there is no ring, size does not fit or the GPU did not free the space in
+ * time, upload from client memory then.
+ * Call on the context thread, one staging at a time */
+bool beginStaging(size_t size, Staging *staging);
+
+// Done writing, binds the ring as the pixel unpack buffer
+void useStaging(const Staging &staging);
+
+// Pixel pointer argument for data offset bytes into a staging in use
+inline const void *stagingPixels(const Staging &staging, size_t offset)
+{
+    return (const void *)(uintptr_t)(staging.offset + offset);
+}
+
+// Fence the staging once its uploads are issued and unbind the ring
+void endStaging(const Staging &staging);
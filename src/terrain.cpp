@@ -8,6 +8,7 @@
 
 #include "engine.h"
 #include "shader.h"
+#include "glresource.h"
 
 #define NUM_PATCH_PTS 4
 
@@ -16,10 +17,10 @@ void Terrain::render(Shader *shader) const
     shader->setMatrix4("uModel", _model);
     shader->setMatrix3("uNormalMatrix", _normalMatrix);
 
-    if (_hasHeightMap)
+    if (_slots)
     {
-        shader->setTexture("uHeightmap", _heightMap, 30);
-        shader->setTexture("uNormalmap", _normalMap, 31);
+        _slots->bind(shader);
+        shader->setInt("uChunkSlot", _slot);
     }
 
     if (_useMaterials)
@@ -55,8 +56,6 @@ void Terrain::update()
 
 void Terrain::load(float width, float height, uint32_t resolution)
 {
-    _hasHeightMap = false;
-
     /* Generate vertices */
 
     _nVertices = resolution * resolution * NUM_PATCH_PTS;
@@ -103,9 +102,20 @@ void Terrain::load(float width, float height, uint32_t resolution)
     glGenVertexArrays(1, &_vao);
     glBindVertexArray(_vao);
 
-    glGenBuffers(1, &_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(TerrainVertex) * _nVertices, vertices, GL_STATIC_DRAW);
+    /* Chunks of the same resolution share the buffer size */
+    const GLsizeiptr vboSize = sizeof(TerrainVertex) * _nVertices;
+    _vbo = acquireGLBuffer(vboSize, GL_STATIC_DRAW);
+    if (_vbo)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, vboSize, vertices);
+    }
+    else
+    {
+        glGenBuffers(1, &_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+        glBufferData(GL_ARRAY_BUFFER, vboSize, vertices, GL_STATIC_DRAW);
+    }
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(TerrainVertex), (void *)offsetof(TerrainVertex, position));
     glEnableVertexAttribArray(0);
@@ -176,60 +186,32 @@ void Terrain::load(const char *folder, uint32_t resolution)
 
     fclose(file);
 
-    /* Load */
-    load(hmWidth, hmHeight, heightData, normalData, resolution);
+    /* Load into a slot of our own */
+    load((float)hmWidth, (float)hmHeight, resolution);
+
+    _ownSlots = new ChunkSlots();
+    _ownSlots->load(hmWidth, hmHeight, 1, 1);
+
+    const int32_t slot = _ownSlots->alloc();
+    _ownSlots->upload(slot, heightData, normalData);
+    setSlot(_ownSlots, slot);
 
     /* Cleanup */
     free(normalData);
     free(heightData);
 }
 
-void Terrain::load(int width, int height, const half_float::half *heights, const half_float::half *normals, uint32_t resolution)
-{
-    /* Setup main terrain */
-    load((float)width, (float)height, resolution);
-
-    /* Create heightmap texture */
-    glGenTextures(1, &_heightMap);
-    glBindTexture(GL_TEXTURE_2D, _heightMap);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, width, height, 0, GL_RED, GL_HALF_FLOAT, heights);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    /* Create normalmap texture */
-    glGenTextures(1, &_normalMap);
-    glBindTexture(GL_TEXTURE_2D, _normalMap);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_HALF_FLOAT, normals);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    _hasHeightMap = true;
-}
-
-void Terrain::retain()
+void Terrain::setSlot(const ChunkSlots *slots, int32_t slot)
 {
-    _refs++;
-}
-
-void Terrain::release()
-{
-    if (--_refs == 0)
-        delete this;
+    _slots = slots;
+    _slot = slot;
 }
 
 Terrain::Terrain() : _vao(0), _vbo(0),
                      _nVertices(0),
                      _width(0.0f), _height(0.0f),
-                     _refs(1),
                      _enabled(true),
-                     _hasHeightMap(false),
-                     _heightMap(0), _normalMap(0),
+                     _slots(nullptr), _slot(-1), _ownSlots(nullptr),
                      _useMaterials(true),
                      _dirty(true)
 {
@@ -238,15 +220,12 @@ Terrain::Terrain() : _vao(0), _vbo(0),
 
 Terrain::~Terrain()
 {
-    if (_normalMap)
-        glDeleteTextures(1, &_normalMap);
-
-    if (_heightMap)
-        glDeleteTextures(1, &_heightMap);
+    delete _ownSlots;
 
+    /* Streamed chunks come and go with the same size, keep their storage */
     if (_vbo)
-        glDeleteBuffers(1, &_vbo);
+        recycleGLBuffer(_vbo, sizeof(TerrainVertex) * _nVertices, GL_STATIC_DRAW);
 
     if (_vao)
-        glDeleteVertexArrays(1, &_vao);
+        releaseGLVertexArrays(1, &_vao);
 }
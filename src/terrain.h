@@ -6,6 +6,8 @@
 #include <mutil/mutil.h>
 #include <half.hpp>
 
+#include "mem.h"
+#include "chunkslots.h"
 #include "material.h"
 
 #define NUM_TERRAIN_MATERIALS 5
@@ -27,7 +29,7 @@ struct TerrainVertex
 
 using TerrainMaterials = MaterialArray<NUM_TERRAIN_MATERIALS>;
 
-class Terrain
+class Terrain final : public Object
 {
 public:
     void render(Shader *shader) const;
@@ -35,10 +37,9 @@ public:
 
     void load(float width, float height, uint32_t resolution);
     void load(const char *folder, uint32_t resolution);
-    void load(int width, int height, const half_float::half *heights, const half_float::half *normals, uint32_t resolution);
 
-    void retain();
-    void release();
+    // Sample heights and normals from a slot, the slots outlive the terrain
+    void setSlot(const ChunkSlots *slots, int32_t slot);
 
     constexpr float width() const { return _width; }
     constexpr float height() const { return _height; }
@@ -49,7 +50,7 @@ public:
     constexpr TerrainMaterials &getMaterials() { return _materials; }
     constexpr AutoRelease<Material> &getMaterial() { return _materials[0]; }
 
-    constexpr void setMaterials(const TerrainMaterials &materials) { _materials = materials; }
+    inline void setMaterials(const TerrainMaterials &materials) { _materials = materials; }
 
     constexpr bool usesMaterials() const { return _useMaterials; }
     constexpr void setUseMaterials(bool use) { _useMaterials = use; }
@@ -82,7 +83,7 @@ public:
     constexpr const Matrix4 &invModel() const { return _invModel; }
 
     Terrain();
-    ~Terrain();
+    virtual ~Terrain();
 
 private:
     GLuint _vao, _vbo;
@@ -90,12 +91,11 @@ private:
 
     float _width, _height;
 
-    size_t _refs;
-
     bool _enabled;
 
-    bool _hasHeightMap;
-    GLuint _heightMap, _normalMap;
+    const ChunkSlots *_slots;
+    int32_t _slot;
+    ChunkSlots *_ownSlots; // Slots of a heightmap loaded from a folder
 
     TerrainMaterials _materials;
     bool _useMaterials;
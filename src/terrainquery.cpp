@@ -0,0 +1,739 @@
+#include "terrainquery.h"
+
+#include <cmath>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+#include <emmintrin.h>
+
+#include "threadpool.h"
+
+// Heightmap samples per world unit
+#define QUERY_SAMPLE_SCALE ((float)CHUNK_SIZE / (float)CHUNK_WORLD_SIZE)
+
+/* Chunk (x, y) is centered on (x, y) * CHUNK_WORLD_SIZE and texel centers are
+ * half a texel in, so sample coordinates continue across chunks */
+#define QUERY_SAMPLE_OFFSET ((float)CHUNK_SIZE * 0.5f - 0.5f)
+
+// Points per batch when computing normals
+#define QUERY_NORMAL_BATCH 64
+
+// Rays per task when tracing on a pool
+#define QUERY_RAY_GRAIN 256
+
+// Smallest direction component, keeps inverse directions finite
+#define QUERY_RAY_EPSILON 1e-20f
+
+static inline uint64_t chunkKey(int32_t x, int32_t y)
+{
+	return ((uint64_t)(uint32_t)x << 32) | (uint32_t)y;
+}
+
+static inline int32_t floorDiv(int32_t a, int32_t b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+void TerrainQuery::insert(int32_t x, int32_t y, const half_float::half *heights, const HeightBounds *bounds)
+{
+	/* Quantize outside the lock, the root of the tree bounds every sample */
+	Chunk *chunk = new Chunk;
+	chunk->x = x;
+	chunk->y = y;
+
+	const HeightBounds &root = bounds[CHUNK_BOUNDS_COUNT - 1];
+	chunk->base = root.min;
+	chunk->step = (root.max - root.min) / 65535.0f;
+
+	const float scale = chunk->step > 0.0f ? 1.0f / chunk->step : 0.0f;
+	for (size_t i = 0; i < CHUNK_SIZE_SQ; i++)
+	{
+		const float q = ((float)heights[i] - chunk->base) * scale + 0.5f;
+		chunk->samples[i] = (uint16_t)clamp(q, 0.0f, 65535.0f);
+	}
+
+	/* Quantized samples round by up to half a step */
+	chunk->root.min = root.min - chunk->step;
+	chunk->root.max = root.max + chunk->step;
+
+	ChildBounds *children = chunk->children;
+	for (int level = 1; level < CHUNK_BOUNDS_LEVELS; level++)
+	{
+		const int32_t size = CHUNK_BOUNDS_SIZE >> level;
+		const HeightBounds *below = bounds + mipOffset(CHUNK_BOUNDS_SIZE, level - 1);
+
+		for (int32_t j = 0; j < size; j++)
+		{
+			for (int32_t i = 0; i < size; i++, children++)
+			{
+				for (int k = 0; k < 4; k++)
+				{
+					const HeightBounds &child = below[(2 * j + (k >> 1)) * (2 * size) + 2 * i + (k & 1)];
+					children->min[k] = child.min - chunk->step;
+					children->max[k] = child.max + chunk->step;
+				}
+			}
+		}
+	}
+
+	Chunk *old = nullptr;
+	{
+		std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+
+		Chunk *&slot = _chunks[chunkKey(x, y)];
+		old = slot;
+		slot = chunk;
+
+		updateExtent();
+	}
+
+	delete old;
+}
+
+void TerrainQuery::remove(int32_t x, int32_t y)
+{
+	Chunk *old = nullptr;
+	{
+		std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+
+		auto it = _chunks.find(chunkKey(x, y));
+		if (it == _chunks.end())
+			return;
+
+		old = it->second;
+		_chunks.erase(it);
+
+		updateExtent();
+	}
+
+	delete old;
+}
+
+bool TerrainQuery::resident(int32_t x, int32_t y) const
+{
+	std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+	return find(x, y) != nullptr;
+}
+
+const TerrainQuery::Chunk *TerrainQuery::find(int32_t x, int32_t y) const
+{
+	auto it = _chunks.find(chunkKey(x, y));
+	return it != _chunks.end() ? it->second : nullptr;
+}
+
+float TerrainQuery::sample(int32_t x, int32_t y) const
+{
+	const int32_t cx = floorDiv(x, CHUNK_SIZE);
+	const int32_t cy = floorDiv(y, CHUNK_SIZE);
+
+	const Chunk *chunk = find(cx, cy);
+	if (chunk)
+		return chunk->base + chunk->samples[(y - cy * CHUNK_SIZE) * CHUNK_SIZE + (x - cx * CHUNK_SIZE)] * chunk->step;
+
+	/* Sample (x, y) of the world is noise position (x, y), see generateHeights */
+	return _compute ? computeHeight(Vector2((float)x, (float)y)) : NAN;
+}
+
+void TerrainQuery::heightsLocked(const Vector2 *points, size_t count, float *out) const
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(QUERY_SAMPLE_SCALE);
+	const __m128 offset = _mm_set1_ps(QUERY_SAMPLE_OFFSET);
+
+	/* Chunk of the previous lane, points in a batch are usually close */
+	int32_t lastX = INT32_MIN, lastY = INT32_MIN;
+	const Chunk *last = nullptr;
+
+	for (size_t i = 0; i < count; i += 4)
+	{
+		const size_t n = min(count - i, (size_t)4);
+
+		alignas(16) float px[4] = {}, py[4] = {};
+		for (size_t k = 0; k < n; k++)
+		{
+			px[k] = points[i + k].x;
+			py[k] = points[i + k].y;
+		}
+
+		/* Sample coordinates and their floor */
+		__m128 x = _mm_add_ps(_mm_mul_ps(_mm_load_ps(px), scale), offset);
+		__m128 y = _mm_add_ps(_mm_mul_ps(_mm_load_ps(py), scale), offset);
+
+		__m128 x0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+		__m128 y0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(y));
+		x0 = _mm_sub_ps(x0, _mm_and_ps(_mm_cmpgt_ps(x0, x), one));
+		y0 = _mm_sub_ps(y0, _mm_and_ps(_mm_cmpgt_ps(y0, y), one));
+
+		const __m128 fx = _mm_sub_ps(x, x0);
+		const __m128 fy = _mm_sub_ps(y, y0);
+
+		alignas(16) int32_t ix[4], iy[4];
+		_mm_store_si128((__m128i *)ix, _mm_cvttps_epi32(x0));
+		_mm_store_si128((__m128i *)iy, _mm_cvttps_epi32(y0));
+
+		/* Gather the corners, lanes whose cell straddles a seam or lies in a
+		 * missing chunk take the slow path */
+		alignas(16) float h00[4] = {}, h10[4] = {}, h01[4] = {}, h11[4] = {};
+		for (size_t k = 0; k < n; k++)
+		{
+			const int32_t cx = floorDiv(ix[k], CHUNK_SIZE);
+			const int32_t cy = floorDiv(iy[k], CHUNK_SIZE);
+			const int32_t lx = ix[k] - cx * CHUNK_SIZE;
+			const int32_t ly = iy[k] - cy * CHUNK_SIZE;
+
+			if (cx != lastX || cy != lastY)
+			{
+				last = find(cx, cy);
+				lastX = cx, lastY = cy;
+			}
+
+			if (last && lx < CHUNK_SIZE - 1 && ly < CHUNK_SIZE - 1)
+			{
+				const uint16_t *p = last->samples + ly * CHUNK_SIZE + lx;
+				h00[k] = last->base + p[0] * last->step;
+				h10[k] = last->base + p[1] * last->step;
+				h01[k] = last->base + p[CHUNK_SIZE] * last->step;
+				h11[k] = last->base + p[CHUNK_SIZE + 1] * last->step;
+			}
+			else
+			{
+				h00[k] = sample(ix[k], iy[k]);
+				h10[k] = sample(ix[k] + 1, iy[k]);
+				h01[k] = sample(ix[k], iy[k] + 1);
+				h11[k] = sample(ix[k] + 1, iy[k] + 1);
+			}
+		}
+
+		__m128 a = _mm_load_ps(h00);
+		__m128 b = _mm_load_ps(h01);
+		a = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(h10), a), fx));
+		b = _mm_add_ps(b, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(h11), b), fx));
+
+		alignas(16) float h[4];
+		_mm_store_ps(h, _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), fy)));
+
+		for (size_t k = 0; k < n; k++)
+			out[i + k] = h[k];
+	}
+}
+
+float TerrainQuery::height(const Vector2 &p) const
+{
+	float h;
+	heights(&p, 1, &h);
+	return h;
+}
+
+Vector3 TerrainQuery::normal(const Vector2 &p) const
+{
+	Vector3 n;
+	normals(&p, 1, &n);
+	return n;
+}
+
+void TerrainQuery::heights(const Vector2 *points, size_t count, float *out) const
+{
+	std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+	heightsLocked(points, count, out);
+}
+
+void TerrainQuery::normals(const Vector2 *points, size_t count, Vector3 *out) const
+{
+	/* Central differences one sample apart, in world units */
+	const float d = 1.0f / QUERY_SAMPLE_SCALE;
+
+	Vector2 taps[QUERY_NORMAL_BATCH * 4];
+	float h[QUERY_NORMAL_BATCH * 4];
+
+	std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+
+	for (size_t i = 0; i < count; i += QUERY_NORMAL_BATCH)
+	{
+		const size_t n = min(count - i, (size_t)QUERY_NORMAL_BATCH);
+
+		for (size_t k = 0; k < n; k++)
+		{
+			const Vector2 &p = points[i + k];
+			taps[k * 4 + 0] = Vector2(p.x - d, p.y);
+			taps[k * 4 + 1] = Vector2(p.x + d, p.y);
+			taps[k * 4 + 2] = Vector2(p.x, p.y - d);
+			taps[k * 4 + 3] = Vector2(p.x, p.y + d);
+		}
+
+		heightsLocked(taps, n * 4, h);
+
+		for (size_t k = 0; k < n; k++)
+		{
+			const float gx = (h[k * 4 + 1] - h[k * 4 + 0]) / (2.0f * d);
+			const float gz = (h[k * 4 + 3] - h[k * 4 + 2]) / (2.0f * d);
+			out[i + k] = normalize(Vector3(-gx, 1.0f, -gz));
+		}
+	}
+}
+
+/* A ray in sample space, x and z in global heightmap samples and y in height
+ * units. t is the same as in world space */
+struct TerrainQuery::Trace
+{
+	float o[3], d[3], inv[3];
+	__m128 o4[3], inv4[3];
+	float best; // Closest hit so far, starts at the end of the ray
+};
+
+static inline float rayDirection(float d)
+{
+	return mutil::abs(d) < QUERY_RAY_EPSILON ? (d < 0.0f ? -QUERY_RAY_EPSILON : QUERY_RAY_EPSILON) : d;
+}
+
+/* Entry and exit of a ray through a box, t0 > t1 on a miss */
+static inline void rayBox(const float *o, const float *inv, const float *lo, const float *hi, float *t0, float *t1)
+{
+	float tnear = 0.0f, tfar = INFINITY;
+	for (int c = 0; c < 3; c++)
+	{
+		const float ta = (lo[c] - o[c]) * inv[c];
+		const float tb = (hi[c] - o[c]) * inv[c];
+		tnear = max(tnear, min(ta, tb));
+		tfar = min(tfar, max(ta, tb));
+	}
+
+	*t0 = tnear;
+	*t1 = tfar;
+}
+
+/* The four children of a node against one ray, lane k is child (k & 1, k >> 1).
+ * Returns the mask of children entered before the closest hit */
+static inline int childBoxes(const __m128 *o, const __m128 *inv, float best, float x0, float y0, float side,
+	const float *min, const float *max, __m128 *tnear, __m128 *tfar)
+{
+	const __m128 s = _mm_set1_ps(side);
+	const __m128 x = _mm_add_ps(_mm_set1_ps(x0), _mm_set_ps(side, 0.0f, side, 0.0f));
+	const __m128 z = _mm_add_ps(_mm_set1_ps(y0), _mm_set_ps(side, side, 0.0f, 0.0f));
+	const __m128 ylo = _mm_load_ps(min);
+	const __m128 yhi = _mm_load_ps(max);
+
+	__m128 ta = _mm_mul_ps(_mm_sub_ps(x, o[0]), inv[0]);
+	__m128 tb = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(x, s), o[0]), inv[0]);
+	__m128 lo = _mm_min_ps(ta, tb);
+	__m128 hi = _mm_max_ps(ta, tb);
+
+	ta = _mm_mul_ps(_mm_sub_ps(ylo, o[1]), inv[1]);
+	tb = _mm_mul_ps(_mm_sub_ps(yhi, o[1]), inv[1]);
+	lo = _mm_max_ps(lo, _mm_min_ps(ta, tb));
+	hi = _mm_min_ps(hi, _mm_max_ps(ta, tb));
+
+	ta = _mm_mul_ps(_mm_sub_ps(z, o[2]), inv[2]);
+	tb = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(z, s), o[2]), inv[2]);
+	lo = _mm_max_ps(_mm_max_ps(lo, _mm_min_ps(ta, tb)), _mm_setzero_ps());
+	hi = _mm_min_ps(hi, _mm_max_ps(ta, tb));
+
+	*tnear = lo;
+	*tfar = hi;
+
+	const __m128 hit = _mm_and_ps(_mm_cmple_ps(lo, hi), _mm_cmplt_ps(lo, _mm_set1_ps(best)));
+	return _mm_movemask_ps(hit);
+}
+
+/* Smallest s in [0, length] with a s^2 + b s + c <= 0, given c > 0 */
+static inline bool firstRoot(float a, float b, float c, float length, float *s)
+{
+	if (mutil::abs(a) < 1e-12f)
+	{
+		if (b >= 0.0f)
+			return false;
+
+		*s = -c / b;
+		return *s <= length;
+	}
+
+	const float disc = b * b - 4.0f * a * c;
+	if (disc < 0.0f)
+		return false;
+
+	/* Stable form of the two roots */
+	const float q = -0.5f * (b + (b < 0.0f ? -sqrtf(disc) : sqrtf(disc)));
+	float r0 = q / a, r1 = q != 0.0f ? c / q : r0;
+	if (r0 > r1)
+		std::swap(r0, r1);
+
+	*s = r0 >= 0.0f ? r0 : r1;
+	return *s >= 0.0f && *s <= length;
+}
+
+void TerrainQuery::traceLeaf(const Chunk *chunk, int32_t x0, int32_t y0, Trace &ray, float tnear, float tfar) const
+{
+	const float *o = ray.o;
+	const float *d = ray.d;
+
+	const int32_t chunkX = chunk->x * CHUNK_SIZE;
+	const int32_t chunkY = chunk->y * CHUNK_SIZE;
+
+	/* Cell the ray enters the leaf in */
+	float ta = tnear;
+	int32_t cx = clamp((int32_t)floorf(o[0] + d[0] * ta - (float)x0), 0, CHUNK_BOUNDS_LEAF - 1);
+	int32_t cy = clamp((int32_t)floorf(o[2] + d[2] * ta - (float)y0), 0, CHUNK_BOUNDS_LEAF - 1);
+
+	const int32_t stepX = d[0] > 0.0f ? 1 : -1;
+	const int32_t stepY = d[2] > 0.0f ? 1 : -1;
+	const float deltaX = mutil::abs(ray.inv[0]);
+	const float deltaY = mutil::abs(ray.inv[2]);
+	float nextX = ((float)(x0 + cx + (stepX > 0)) - o[0]) * ray.inv[0];
+	float nextY = ((float)(y0 + cy + (stepY > 0)) - o[2]) * ray.inv[2];
+
+	for (;;)
+	{
+		const float tb = min(min(nextX, nextY), min(tfar, ray.best));
+
+		const int32_t gx = x0 + cx, gy = y0 + cy;
+		const int32_t lx = gx - chunkX, ly = gy - chunkY;
+
+		float h00, h10, h01, h11;
+		if (lx < CHUNK_SIZE - 1 && ly < CHUNK_SIZE - 1)
+		{
+			const uint16_t *p = chunk->samples + ly * CHUNK_SIZE + lx;
+			h00 = chunk->base + p[0] * chunk->step;
+			h10 = chunk->base + p[1] * chunk->step;
+			h01 = chunk->base + p[CHUNK_SIZE] * chunk->step;
+			h11 = chunk->base + p[CHUNK_SIZE + 1] * chunk->step;
+		}
+		else
+		{
+			h00 = sample(gx, gy);
+			h10 = sample(gx + 1, gy);
+			h01 = sample(gx, gy + 1);
+			h11 = sample(gx + 1, gy + 1);
+		}
+
+		/* The bilinear surface stays under its highest corner */
+		const float ya = o[1] + d[1] * ta;
+		const float yb = o[1] + d[1] * tb;
+		if (min(ya, yb) <= max(max(h00, h10), max(h01, h11)))
+		{
+			/* Height above the surface along the ray is quadratic in t */
+			const float u = o[0] + d[0] * ta - (float)gx;
+			const float v = o[2] + d[2] * ta - (float)gy;
+
+			const float a = h10 - h00, b = h01 - h00, k = h00 - h10 - h01 + h11;
+
+			const float qa = -k * d[0] * d[2];
+			const float qb = d[1] - a * d[0] - b * d[2] - k * (u * d[2] + v * d[0]);
+			const float qc = ya - h00 - a * u - b * v - k * u * v;
+
+			float s;
+			if (qc <= 0.0f)
+			{
+				ray.best = ta;
+				return;
+			}
+
+			if (firstRoot(qa, qb, qc, tb - ta, &s))
+			{
+				ray.best = ta + s;
+				return;
+			}
+		}
+
+		if (tb >= tfar || tb >= ray.best)
+			return;
+
+		/* Next cell */
+		if (nextX < nextY)
+		{
+			cx += stepX;
+			ta = nextX;
+			nextX += deltaX;
+		}
+		else
+		{
+			cy += stepY;
+			ta = nextY;
+			nextY += deltaY;
+		}
+
+		if (cx < 0 || cx >= CHUNK_BOUNDS_LEAF || cy < 0 || cy >= CHUNK_BOUNDS_LEAF)
+			return;
+	}
+}
+
+void TerrainQuery::traceChunk(const Chunk *chunk, Trace &ray, float tnear, float tfar) const
+{
+	struct Node
+	{
+		int level;
+		int32_t i, j;
+		float tnear;
+	};
+
+	/* Offset of the parents of each level in Chunk::children */
+	static const size_t kLevelOffset[CHUNK_BOUNDS_LEVELS] = {
+		0, 0,
+		mipOffset(CHUNK_BOUNDS_SIZE, 2) - mipOffset(CHUNK_BOUNDS_SIZE, 1),
+		mipOffset(CHUNK_BOUNDS_SIZE, 3) - mipOffset(CHUNK_BOUNDS_SIZE, 1),
+		mipOffset(CHUNK_BOUNDS_SIZE, 4) - mipOffset(CHUNK_BOUNDS_SIZE, 1),
+		mipOffset(CHUNK_BOUNDS_SIZE, 5) - mipOffset(CHUNK_BOUNDS_SIZE, 1),
+		mipOffset(CHUNK_BOUNDS_SIZE, 6) - mipOffset(CHUNK_BOUNDS_SIZE, 1)
+	};
+
+	const int32_t chunkX = chunk->x * CHUNK_SIZE;
+	const int32_t chunkY = chunk->y * CHUNK_SIZE;
+
+	/* Start from the smallest node holding the part of the ray inside the
+	 * chunk's bounds, steep rays skip most of the tree */
+	tfar = min(tfar, ray.best);
+	const int32_t ax = clamp((int32_t)floorf(ray.o[0] + ray.d[0] * tnear) - chunkX, 0, CHUNK_SIZE - 1);
+	const int32_t ay = clamp((int32_t)floorf(ray.o[2] + ray.d[2] * tnear) - chunkY, 0, CHUNK_SIZE - 1);
+	const int32_t bx = clamp((int32_t)floorf(ray.o[0] + ray.d[0] * tfar) - chunkX, 0, CHUNK_SIZE - 1);
+	const int32_t by = clamp((int32_t)floorf(ray.o[2] + ray.d[2] * tfar) - chunkY, 0, CHUNK_SIZE - 1);
+
+	int start = 1;
+	for (uint32_t spread = (uint32_t)((ax ^ bx) | (ay ^ by)) / (CHUNK_BOUNDS_LEAF * 2); spread; spread >>= 1)
+		start++;
+
+	/* Front to back, the children of a node are tested together. The nearest
+	 * is visited next and the rest wait on the stack */
+	Node stack[3 * CHUNK_BOUNDS_LEVELS];
+	int top = 0;
+
+	const int32_t startSide = CHUNK_BOUNDS_LEAF << start;
+	Node node = { start, ax / startSide, ay / startSide, tnear };
+	for (;;)
+	{
+		if (node.tnear < ray.best)
+		{
+			const int level = node.level - 1;
+			const int32_t side = CHUNK_BOUNDS_LEAF << level;
+			const int32_t x0 = chunkX + node.i * 2 * side;
+			const int32_t y0 = chunkY + node.j * 2 * side;
+
+			const ChildBounds &bounds = chunk->children[kLevelOffset[node.level] + node.j * (CHUNK_BOUNDS_SIZE >> node.level) + node.i];
+
+			__m128 near4, far4;
+			const int mask = childBoxes(ray.o4, ray.inv4, ray.best, (float)x0, (float)y0, (float)side, bounds.min, bounds.max, &near4, &far4);
+			if (mask)
+			{
+				alignas(16) float near[4], far[4];
+				_mm_store_ps(near, near4);
+				_mm_store_ps(far, far4);
+
+				int order[4], count = 0;
+				for (int k = 0; k < 4; k++)
+				{
+					if (!(mask & (1 << k)))
+						continue;
+
+					int n = count++;
+					for (; n > 0 && near[order[n - 1]] > near[k]; n--)
+						order[n] = order[n - 1];
+					order[n] = k;
+				}
+
+				if (level == 0)
+				{
+					for (int n = 0; n < count && near[order[n]] < ray.best; n++)
+					{
+						const int k = order[n];
+						traceLeaf(chunk, x0 + (k & 1) * side, y0 + (k >> 1) * side, ray, near[k], far[k]);
+					}
+				}
+				else
+				{
+					for (int n = count - 1; n > 0; n--)
+					{
+						const int k = order[n];
+						stack[top++] = Node{ level, node.i * 2 + (k & 1), node.j * 2 + (k >> 1), near[k] };
+					}
+
+					const int k = order[0];
+					node = Node{ level, node.i * 2 + (k & 1), node.j * 2 + (k >> 1), near[k] };
+					continue;
+				}
+			}
+		}
+
+		if (top == 0)
+			return;
+
+		node = stack[--top];
+	}
+}
+
+void TerrainQuery::traceRay(Trace &ray) const
+{
+	/* Clip to the resident chunks */
+	const float lo[3] = { (float)(_extent.minX * CHUNK_SIZE), _extent.minHeight, (float)(_extent.minY * CHUNK_SIZE) };
+	const float hi[3] = { (float)((_extent.maxX + 1) * CHUNK_SIZE), _extent.maxHeight, (float)((_extent.maxY + 1) * CHUNK_SIZE) };
+
+	float t, end;
+	rayBox(ray.o, ray.inv, lo, hi, &t, &end);
+	end = min(end, ray.best);
+	if (t > end)
+		return;
+
+	/* Walk the chunks the ray passes over, in order */
+	int32_t cx = clamp((int32_t)floorf((ray.o[0] + ray.d[0] * t) / CHUNK_SIZE), _extent.minX, _extent.maxX);
+	int32_t cy = clamp((int32_t)floorf((ray.o[2] + ray.d[2] * t) / CHUNK_SIZE), _extent.minY, _extent.maxY);
+
+	const int32_t stepX = ray.d[0] > 0.0f ? 1 : -1;
+	const int32_t stepY = ray.d[2] > 0.0f ? 1 : -1;
+	const float deltaX = mutil::abs(ray.inv[0]) * CHUNK_SIZE;
+	const float deltaY = mutil::abs(ray.inv[2]) * CHUNK_SIZE;
+	float nextX = ((float)((cx + (stepX > 0)) * CHUNK_SIZE) - ray.o[0]) * ray.inv[0];
+	float nextY = ((float)((cy + (stepY > 0)) * CHUNK_SIZE) - ray.o[2]) * ray.inv[2];
+
+	while (t <= end && t < ray.best)
+	{
+		const Chunk *chunk = find(cx, cy);
+		if (chunk)
+		{
+			const HeightBounds &root = chunk->root;
+			const float clo[3] = { (float)(cx * CHUNK_SIZE), root.min, (float)(cy * CHUNK_SIZE) };
+			const float chi[3] = { (float)((cx + 1) * CHUNK_SIZE), root.max, (float)((cy + 1) * CHUNK_SIZE) };
+
+			float t0, t1;
+			rayBox(ray.o, ray.inv, clo, chi, &t0, &t1);
+			if (t0 <= t1 && t0 < ray.best)
+				traceChunk(chunk, ray, t0, t1);
+		}
+
+		/* Hits are inside their chunk, later chunks are further away */
+		if (nextX < nextY)
+		{
+			if (ray.best <= nextX)
+				return;
+
+			cx += stepX;
+			t = nextX;
+			nextX += deltaX;
+		}
+		else
+		{
+			if (ray.best <= nextY)
+				return;
+
+			cy += stepY;
+			t = nextY;
+			nextY += deltaY;
+		}
+	}
+}
+
+bool TerrainQuery::raycast(const TerrainRay &ray, TerrainHit *hit) const
+{
+	raycast(&ray, 1, hit);
+	return hit->t != INFINITY;
+}
+
+void TerrainQuery::raycastLocked(const TerrainRay *rays, size_t count, TerrainHit *hits) const
+{
+	for (size_t i = 0; i < count; i += 4)
+	{
+		const size_t n = min(count - i, (size_t)4);
+
+		/* Rays starting under the ground hit at their origin, only origins
+		 * below the highest chunk need a look */
+		Vector2 ground[4];
+		float height[4] = { -INFINITY, -INFINITY, -INFINITY, -INFINITY };
+		size_t low[4], lows = 0;
+		for (size_t k = 0; k < n; k++)
+		{
+			if (rays[i + k].origin.y <= _extent.maxHeight)
+			{
+				ground[lows] = Vector2(rays[i + k].origin.x, rays[i + k].origin.z);
+				low[lows++] = k;
+			}
+		}
+
+		if (lows)
+		{
+			float below[4];
+			heightsLocked(ground, lows, below);
+			for (size_t k = 0; k < lows; k++)
+				height[low[k]] = below[k];
+		}
+
+		for (size_t k = 0; k < n; k++)
+		{
+			const TerrainRay &in = rays[i + k];
+			TerrainHit &hit = hits[i + k];
+
+			Trace ray;
+			ray.o[0] = in.origin.x * QUERY_SAMPLE_SCALE + QUERY_SAMPLE_OFFSET;
+			ray.o[1] = in.origin.y;
+			ray.o[2] = in.origin.z * QUERY_SAMPLE_SCALE + QUERY_SAMPLE_OFFSET;
+			ray.d[0] = rayDirection(in.direction.x * QUERY_SAMPLE_SCALE);
+			ray.d[1] = rayDirection(in.direction.y);
+			ray.d[2] = rayDirection(in.direction.z * QUERY_SAMPLE_SCALE);
+			ray.best = in.maxT;
+
+			for (int c = 0; c < 3; c++)
+			{
+				ray.inv[c] = 1.0f / ray.d[c];
+				ray.o4[c] = _mm_set1_ps(ray.o[c]);
+				ray.inv4[c] = _mm_set1_ps(ray.inv[c]);
+			}
+
+			if (in.origin.y <= height[k] && in.maxT > 0.0f)
+				ray.best = 0.0f;
+			else if (!_chunks.empty())
+				traceRay(ray);
+
+			if (ray.best < in.maxT)
+			{
+				hit.t = ray.best;
+				hit.position = in.origin + in.direction * hit.t;
+			}
+			else
+			{
+				hit.t = INFINITY;
+				hit.position = in.origin;
+			}
+		}
+	}
+}
+
+void TerrainQuery::raycast(const TerrainRay *rays, size_t count, TerrainHit *hits, ThreadPool *pool) const
+{
+	std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+
+	if (!pool || count <= QUERY_RAY_GRAIN)
+	{
+		raycastLocked(rays, count, hits);
+		return;
+	}
+
+	/* Workers read under the caller's lock */
+	pool->parallelFor(count, QUERY_RAY_GRAIN, [&](size_t begin, size_t end)
+	{
+		raycastLocked(rays + begin, end - begin, hits + begin);
+	});
+}
+
+void TerrainQuery::updateExtent()
+{
+	_extent = Extent{ INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN, INFINITY, -INFINITY };
+
+	for (const auto &entry : _chunks)
+	{
+		const Chunk *chunk = entry.second;
+		const HeightBounds &root = chunk->root;
+
+		_extent.minX = min(_extent.minX, chunk->x);
+		_extent.minY = min(_extent.minY, chunk->y);
+		_extent.maxX = max(_extent.maxX, chunk->x);
+		_extent.maxY = max(_extent.maxY, chunk->y);
+		_extent.minHeight = min(_extent.minHeight, root.min);
+		_extent.maxHeight = max(_extent.maxHeight, root.max);
+	}
+}
+
+TerrainQuery::TerrainQuery(bool compute) : _compute(compute)
+{
+	updateExtent();
+}
+
+TerrainQuery::~TerrainQuery()
+{
+	for (auto &entry : _chunks)
+		delete entry.second;
+}
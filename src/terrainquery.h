@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <shared_mutex>
+
+#include <half.hpp>
+#include <mutil/mutil.h>
+
+#include "worldgen.h"
+
+using namespace mutil;
+
+class ThreadPool;
+
+// Ray in world space, direction need not be normalized
+struct TerrainRay
+{
+	Vector3 origin;
+	Vector3 direction;
+	float maxT; // Rays end at origin + direction * maxT
+};
+
+struct TerrainHit
+{
+	float t; // INFINITY on a miss
+	Vector3 position;
+};
+
+/* Ground heights and normals for gameplay, without the GPU.
+ *
+ * Positions are world (x, z). Heights are sampled bilinearly from the
+ * heightmap texels the renderer displaces with, continuing into the
+ * neighbouring chunk across seams. Resident chunks are kept as 16 bit heights
+ * quantized over the chunk's bounds, other chunks are computed from the world
+ * graph if enabled.
+ *
+ * Rays are traced against the bilinear surface through each chunk's min/max
+ * tree, only resident chunks are hit.
+ *
+ * Queries may run on any number of threads while chunks are inserted and
+ * removed.
+ */
+class TerrainQuery final
+{
+public:
+	/* Copy chunk (x, y), heights is its CHUNK_SIZE_SQ finest level and bounds
+	 * its min/max tree. Replaces an older copy */
+	void insert(int32_t x, int32_t y, const half_float::half *heights, const HeightBounds *bounds);
+
+	void remove(int32_t x, int32_t y);
+
+	bool resident(int32_t x, int32_t y) const;
+
+	// NAN outside resident chunks unless compute is enabled
+	float height(const Vector2 &p) const;
+	Vector3 normal(const Vector2 &p) const;
+
+	/* Batched, points are processed four at a time under one lock */
+	void heights(const Vector2 *points, size_t count, float *out) const;
+	void normals(const Vector2 *points, size_t count, Vector3 *out) const;
+
+	bool raycast(const TerrainRay &ray, TerrainHit *hit) const;
+
+	/* Rays are traced in groups of four, a pool splits large batches across
+	 * its threads */
+	void raycast(const TerrainRay *rays, size_t count, TerrainHit *hits, ThreadPool *pool = nullptr) const;
+
+	/* Compute heights outside resident chunks through computeHeight(), slow
+	 * but exact. Not safe while querying */
+	constexpr bool computes() const { return _compute; }
+	constexpr void setCompute(bool compute) { _compute = compute; }
+
+	TerrainQuery(bool compute = true);
+	~TerrainQuery();
+
+	TerrainQuery(const TerrainQuery &) = delete;
+	TerrainQuery &operator=(const TerrainQuery &) = delete;
+
+private:
+	// Bounds of the four children of a node, child k is (k & 1, k >> 1)
+	struct alignas(16) ChildBounds
+	{
+		float min[4], max[4];
+	};
+
+	struct Chunk
+	{
+		int32_t x, y;
+		float base, step; // height = base + sample * step
+		uint16_t samples[CHUNK_SIZE_SQ];
+
+		/* Min/max tree widened to cover the quantized samples, stored by
+		 * parent from level 1 up */
+		HeightBounds root;
+		ChildBounds children[CHUNK_BOUNDS_COUNT - CHUNK_BOUNDS_SIZE * CHUNK_BOUNDS_SIZE];
+	};
+
+	// Chunk coordinates and heights covered by the resident chunks
+	struct Extent
+	{
+		int32_t minX, minY, maxX, maxY;
+		float minHeight, maxHeight;
+	};
+
+	struct Trace;
+
+	mutable std::shared_timed_mutex _mutex;
+	std::unordered_map<uint64_t, Chunk *> _chunks;
+	Extent _extent;
+	bool _compute;
+
+	// The exclusive lock must be held
+	void updateExtent();
+
+	const Chunk *find(int32_t x, int32_t y) const;
+
+	// Height of global sample (x, y), the lock must be held
+	float sample(int32_t x, int32_t y) const;
+
+	void heightsLocked(const Vector2 *points, size_t count, float *out) const;
+
+	void raycastLocked(const TerrainRay *rays, size_t count, TerrainHit *hits) const;
+	void traceRay(Trace &ray) const;
+	void traceChunk(const Chunk *chunk, Trace &ray, float tnear, float tfar) const;
+	void traceLeaf(const Chunk *chunk, int32_t x0, int32_t y0, Trace &ray, float tnear, float tfar) const;
+};
@@ -3,19 +3,81 @@
 #include <cstdio>
 #include <cstdint>
 #include <cmath>
+#include <cstring>
 #include <unordered_map>
 #include <string>
 
 #include <stb_image.h>
 
+#include "glresource.h"
+#include "staging.h"
+
 static std::unordered_map<std::string, AutoRelease<Texture2D>> _textures;
 
+// Bytes in a tightly packed image, 0 for layouts staging does not handle
+static size_t imageSize(GLsizei width, GLsizei height, GLenum format, GLenum type)
+{
+    size_t components;
+    switch (format)
+    {
+    case GL_RED:
+        components = 1;
+        break;
+    case GL_RG:
+        components = 2;
+        break;
+    case GL_RGB:
+        components = 3;
+        break;
+    case GL_RGBA:
+        components = 4;
+        break;
+    default:
+        return 0;
+    }
+
+    size_t componentSize;
+    switch (type)
+    {
+    case GL_UNSIGNED_BYTE:
+        componentSize = 1;
+        break;
+    case GL_HALF_FLOAT:
+        componentSize = 2;
+        break;
+    case GL_FLOAT:
+        componentSize = 4;
+        break;
+    default:
+        return 0;
+    }
+
+    /* Rows are read with the default unpack alignment of 4 */
+    const size_t rowSize = (size_t)width * components * componentSize;
+    if (rowSize % 4 != 0)
+        return 0;
+
+    return rowSize * height;
+}
+
 void Texture2D::load(GLenum internalformat, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels)
 {
     glGenTextures(1, &_texture);
 
     glBindTexture(GL_TEXTURE_2D, _texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, internalformat, width, height, 0, format, type, pixels);
+
+    /* Upload through the staging ring so the copy does not stall the driver */
+    Staging staging;
+    const size_t size = pixels ? imageSize(width, height, format, type) : 0;
+    if (size && beginStaging(size, &staging))
+    {
+        memcpy(staging.data, pixels, size);
+        useStaging(staging);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalformat, width, height, 0, format, type, stagingPixels(staging, 0));
+        endStaging(staging);
+    }
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, internalformat, width, height, 0, format, type, pixels);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -113,7 +175,7 @@ Texture2D::Texture2D() : _texture(0), _width(0), _height(0)
 Texture2D::~Texture2D()
 {
     if (_texture)
-        glDeleteTextures(1, &_texture);
+        releaseGLTextures(1, &_texture);
 }
 
 AutoRelease<Texture2D> &loadTexture2D(const char *filename, ColorSpace colorSpace)
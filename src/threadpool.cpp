@@ -0,0 +1,107 @@
+#include "threadpool.h"
+
+void ThreadPool::parallelFor(size_t count, size_t grain, const RangeFunction &fn)
+{
+    if (count == 0)
+        return;
+
+    if (grain == 0)
+        grain = 1;
+
+    /* Not worth waking anyone */
+    if (_workers.empty() || count <= grain)
+    {
+        fn(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> job(_jobMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _fn = &fn;
+        _count = count;
+        _grain = grain;
+        _next.store(0, std::memory_order_relaxed);
+        _active = (int)_workers.size();
+        _generation++;
+    }
+    _wake.notify_all();
+
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this]() { return _active == 0; });
+    _fn = nullptr;
+}
+
+ThreadPool::ThreadPool(int threads) :
+    _fn(nullptr), _count(0), _grain(1), _next(0),
+    _active(0), _generation(0), _quit(false)
+{
+    if (threads <= 0)
+        threads = (int)std::thread::hardware_concurrency();
+
+    for (int i = 1; i < threads; i++)
+        _workers.emplace_back(&ThreadPool::workerMain, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _wake.notify_all();
+
+    for (std::thread &worker : _workers)
+        worker.join();
+}
+
+void ThreadPool::workerMain()
+{
+    uint64_t seen = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this, seen]() { return _quit || _generation != seen; });
+
+            if (_quit)
+                return;
+
+            seen = _generation;
+        }
+
+        runChunks();
+
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            last = --_active == 0;
+        }
+
+        if (last)
+            _done.notify_one();
+    }
+}
+
+void ThreadPool::runChunks()
+{
+    for (;;)
+    {
+        size_t begin = _next.fetch_add(_grain, std::memory_order_relaxed);
+        if (begin >= _count)
+            break;
+
+        size_t end = begin + _grain < _count ? begin + _grain : _count;
+        (*_fn)(begin, end);
+    }
+}
+
+ThreadPool *getThreadPool()
+{
+    static ThreadPool pool;
+    return &pool;
+}
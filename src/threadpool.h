@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/* Fixed set of worker threads for data parallel loops.
+ *
+ * The calling thread takes part in the work. Only one loop runs at a time,
+ * parallelFor must not be called from inside a loop body.
+ */
+class ThreadPool final
+{
+public:
+    typedef std::function<void(size_t begin, size_t end)> RangeFunction;
+
+    // Run fn over [0, count) in chunks of at most grain, blocks until done
+    void parallelFor(size_t count, size_t grain, const RangeFunction &fn);
+
+    // Number of threads working on a loop, including the caller
+    inline int threadCount() const { return (int)_workers.size() + 1; }
+
+    // threads = 0 uses one thread per hardware thread
+    ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+private:
+    std::vector<std::thread> _workers;
+
+    std::mutex _jobMutex; // Serializes callers
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+
+    /* Current loop */
+    const RangeFunction *_fn;
+    size_t _count;
+    size_t _grain;
+    std::atomic<size_t> _next;
+    int _active; // Workers still in the loop
+    uint64_t _generation;
+
+    bool _quit;
+
+    void workerMain();
+    void runChunks();
+};
+
+// Shared pool, created on first use
+ThreadPool *getThreadPool();
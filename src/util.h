@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 #include <mutil/mutil.h>
 
 using namespace mutil;
@@ -20,6 +23,20 @@ constexpr Vector3 kDefaultNormal = {0.5f, 1.0f, 0.5f};
 
 void checkGLErrors(const char *where);
 
+#define HASH_SEED 0xcbf29ce484222325ull
+
+// FNV-1a hash of a block of memory, chain calls by passing the previous hash
+inline uint64_t hashBytes(const void *data, size_t size, uint64_t hash = HASH_SEED)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
 constexpr Vector4 nvec4(const Vector3 &v)
 {
 	return Vector4(v, 1.0f);
@@ -0,0 +1,777 @@
+#include "worldgen.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <lysys/lysys.hpp>
+
+#include "util.h"
+#include "arena.h"
+#include "heightpreset.h"
+#include "scatter.h"
+
+#define CHUNK_CACHE_MAGIC 0x4b484354 // 'TCHK'
+#define CHUNK_CACHE_VERSION 6
+
+// Version of caches without normals, the heights are followed by the bounds
+#define CHUNK_CACHE_VERSION_HEIGHTS 7
+
+// Bump when the generator output changes to invalidate existing caches
+#define WORLDGEN_VERSION 2
+
+struct ChunkHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t signature;
+	int32_t size;
+	int32_t x, y;
+	int32_t _pad0;
+};
+
+static NoiseProgram _worldGraph;
+
+static void graphRows(const Vector2 &start, int count, const Vector2 *seedOffsets, float *out)
+{
+	for (int i = 0; i < count; i++)
+		out[i] = _worldGraph.evaluate(Vector2(start.x + (float)i, start.y));
+}
+
+static HeightRowFunction _heightRows = graphRows;
+static const char *_heightKernel = "graph";
+static Vector2 _seedOffsets[PRESET_NOISE_COUNT];
+
+/* Use a compiled preset if one is equivalent to the world graph */
+static void selectHeightKernel()
+{
+	_heightRows = graphRows;
+	_heightKernel = "graph";
+
+	char source[4096];
+	for (int i = 0; i < HEIGHT_PRESET_COUNT; i++)
+	{
+		const HeightPreset &preset = kHeightPresets[i];
+		preset.describe(source, sizeof(source), _worldGraph.seed());
+
+		NoiseProgram program;
+		if (!program.compile(source, preset.name) || program.signature() != _worldGraph.signature())
+			continue;
+
+		for (int j = 0; j < PRESET_NOISE_COUNT; j++)
+			_seedOffsets[j] = noiseSeedOffset(_worldGraph.seed(), kPresetNoiseNames[j]);
+
+		_heightRows = preset.rows;
+		_heightKernel = preset.name;
+		return;
+	}
+}
+
+bool loadWorldGraph(const char *path)
+{
+	NoiseProgram program;
+	if (!program.load(path))
+		return false;
+
+	_worldGraph = program;
+	selectHeightKernel();
+	return true;
+}
+
+const char *getHeightKernel()
+{
+	return _heightKernel;
+}
+
+const NoiseProgram &getWorldGraph()
+{
+	return _worldGraph;
+}
+
+float computeHeight(const Vector2 &p)
+{
+	float h;
+	_heightRows(p, 1, _seedOffsets, &h);
+	return h;
+}
+
+static float _adaptiveTolerance = ADAPTIVE_TOLERANCE;
+
+void setAdaptiveTolerance(float tolerance)
+{
+	_adaptiveTolerance = max(tolerance, 0.0f);
+}
+
+float getAdaptiveTolerance()
+{
+	return _adaptiveTolerance;
+}
+
+static ErosionSettings _erosion = defaultErosion(EROSION_ITERATIONS);
+
+void setErosion(const ErosionSettings &settings)
+{
+	_erosion = settings;
+}
+
+const ErosionSettings &getErosion()
+{
+	return _erosion;
+}
+
+static_assert(CHUNK_SIZE % ADAPTIVE_TILE == 0, "Tiles must align with chunks");
+
+/* Rows of each tile checked exactly against the interpolation, every other
+ * one from the top edge. The left edge is checked on the rows between */
+#define ADAPTIVE_PROBE_STEP 2
+
+enum TileFill : uint8_t
+{
+	TILE_EVALUATE,
+	TILE_CONSTANT,
+	TILE_CUBIC
+};
+
+static inline int32_t floorDiv(int32_t a, int32_t b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/* Catmull-Rom weights of the four nodes around t in [0, 1) */
+static inline void cubicWeights(float t, float *w)
+{
+	const float t2 = t * t;
+	const float t3 = t2 * t;
+
+	w[0] = 0.5f * (-t3 + 2.0f * t2 - t);
+	w[1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+	w[2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+	w[3] = 0.5f * (t3 - t2);
+}
+
+static inline float cubic(const float *p, const float *w)
+{
+	return p[0] * w[0] + p[1] * w[1] + p[2] * w[2] + p[3] * w[3];
+}
+
+// Samples probed at the start of tile row v
+static inline int probeCount(int v)
+{
+	return v % ADAPTIVE_PROBE_STEP == 0 ? ADAPTIVE_TILE : 1;
+}
+
+/* Fill a size x size image starting at sample (x0, y0). Tiles are aligned to
+ * the world, not the chunk, so neighbouring chunks agree where they overlap */
+static void adaptiveHeights(int32_t x0, int32_t y0, int32_t size, float *out)
+{
+	const float tolerance = _adaptiveTolerance;
+
+	const int32_t tileX = floorDiv(x0, ADAPTIVE_TILE);
+	const int32_t tileY = floorDiv(y0, ADAPTIVE_TILE);
+
+	// Tiles overlapping the image along one axis, and the coarse grid with a ring for the cubic
+	const int32_t tiles = max(floorDiv(x0 + size - 1, ADAPTIVE_TILE) - tileX, floorDiv(y0 + size - 1, ADAPTIVE_TILE) - tileY) + 1;
+	const int32_t side = tiles + 3;
+
+	float weights[ADAPTIVE_TILE][4];
+	for (int i = 0; i < ADAPTIVE_TILE; i++)
+		cubicWeights((float)i / ADAPTIVE_TILE, weights[i]);
+
+	ScratchScope scope;
+
+	/* Coarse pass, node (i, j) is at tile corner (tileX + i - 1, tileY + j - 1) */
+	float *nodes = scope.arena().alloc<float>(side * side);
+	for (int j = 0; j < side; j++)
+	{
+		for (int i = 0; i < side; i++)
+		{
+			const Vector2 p((float)((tileX + i - 1) * ADAPTIVE_TILE), (float)((tileY + j - 1) * ADAPTIVE_TILE));
+			_heightRows(p, 1, _seedOffsets, &nodes[j * side + i]);
+		}
+	}
+
+	/* Classify tiles. The error of the cubic is estimated from the third
+	 * differences of the nodes and checked against exact rows of the tile.
+	 * Probes inside the image are kept, the fill only computes the rest */
+	uint8_t *fill = scope.arena().alloc<uint8_t>(tiles * tiles);
+	uint8_t *probed = scope.arena().alloc<uint8_t>(tiles * tiles); // Tile rows probed before the verdict
+	for (int tj = 0; tj < tiles; tj++)
+	{
+		for (int ti = 0; ti < tiles; ti++)
+		{
+			const float *n = nodes + tj * side + ti; // Top left of the 4x4 patch
+
+			bool constant = true;
+			float curvature = 0.0f;
+
+			for (int k = 0; k < 4; k++)
+			{
+				const float *row = n + k * side;
+				const float column[4] = { n[k], n[side + k], n[2 * side + k], n[3 * side + k] };
+
+				for (int l = 0; l < 4; l++)
+					constant = constant && row[l] == n[0];
+
+				curvature = max(curvature, mutil::abs(row[3] - 3.0f * row[2] + 3.0f * row[1] - row[0]));
+				curvature = max(curvature, mutil::abs(column[3] - 3.0f * column[2] + 3.0f * column[1] - column[0]));
+			}
+
+			/* Probes see half the tile, samples between them were measured to
+			 * stray up to about twice as far, so hold the probes to half */
+			const float probeTolerance = 0.5f * tolerance;
+
+			/* On a cubic the interpolation is off by at most about a sixtieth
+			 * of the third difference, allow that along both axes */
+			uint8_t &mode = fill[tj * tiles + ti];
+			uint8_t &rows = probed[tj * tiles + ti];
+			rows = 0;
+
+			if (curvature / 32.0f > probeTolerance)
+			{
+				mode = TILE_EVALUATE;
+				continue;
+			}
+
+			/* Top edge and every other row in full, the left edge in between */
+			const int32_t tx = (tileX + ti) * ADAPTIVE_TILE;
+			const int32_t ty = (tileY + tj) * ADAPTIVE_TILE;
+
+			bool exact = constant;
+			bool smooth = true;
+
+			for (int v = 0; v < ADAPTIVE_TILE && smooth; v++)
+			{
+				const int count = probeCount(v);
+
+				float probes[ADAPTIVE_TILE];
+				_heightRows(Vector2((float)tx, (float)(ty + v)), count, _seedOffsets, probes);
+				rows = (uint8_t)(v + 1);
+
+				/* Keep the exact samples that fall in the image */
+				const int32_t j = ty + v - y0;
+				if (j >= 0 && j < size)
+				{
+					for (int u = max(x0 - tx, 0); u < count && tx + u - x0 < size; u++)
+						out[j * size + tx + u - x0] = probes[u];
+				}
+
+				float columns[4];
+				for (int c = 0; c < 4; c++)
+				{
+					const float column[4] = { n[c], n[side + c], n[2 * side + c], n[3 * side + c] };
+					columns[c] = cubic(column, weights[v]);
+				}
+
+				for (int u = 0; u < count && smooth; u++)
+				{
+					exact = exact && probes[u] == n[0];
+					smooth = mutil::abs(probes[u] - cubic(columns, weights[u])) <= probeTolerance;
+				}
+			}
+
+			if (!smooth)
+				mode = TILE_EVALUATE;
+			else
+				mode = exact ? TILE_CONSTANT : TILE_CUBIC; // Constant is usually the sea floor, kept exact
+		}
+	}
+
+	/* Fill row by row around the probes, runs of evaluated samples are passed
+	 * to the kernel at once */
+	for (int32_t j = 0; j < size; j++)
+	{
+		float *row = out + j * size;
+
+		const int32_t y = y0 + j;
+		const int tj = floorDiv(y, ADAPTIVE_TILE) - tileY;
+		const int v = y - (tileY + tj) * ADAPTIVE_TILE;
+		const float *wy = weights[v];
+
+		int32_t run = -1; // Start of the pending run of evaluated samples
+
+		for (int32_t i = 0; i < size;)
+		{
+			const int32_t x = x0 + i;
+			const int ti = floorDiv(x, ADAPTIVE_TILE) - tileX;
+			const int32_t start = (tileX + ti) * ADAPTIVE_TILE - x0;
+			const int32_t end = min(start + ADAPTIVE_TILE, size);
+
+			/* Samples probed at the start of this tile row are done */
+			const int32_t known = v < probed[tj * tiles + ti] ? min(start + probeCount(v), end) : start;
+			if (known > i)
+			{
+				if (run >= 0)
+				{
+					_heightRows(Vector2((float)(x0 + run), (float)y), i - run, _seedOffsets, row + run);
+					run = -1;
+				}
+				i = known;
+				if (i == end)
+					continue;
+			}
+
+			const uint8_t mode = fill[tj * tiles + ti];
+			if (mode == TILE_EVALUATE)
+			{
+				if (run < 0)
+					run = i;
+				i = end;
+				continue;
+			}
+
+			if (run >= 0)
+			{
+				_heightRows(Vector2((float)(x0 + run), (float)y), i - run, _seedOffsets, row + run);
+				run = -1;
+			}
+
+			const float *n = nodes + tj * side + ti;
+			if (mode == TILE_CONSTANT)
+			{
+				for (; i < end; i++)
+					row[i] = n[0];
+				continue;
+			}
+
+			float columns[4];
+			for (int k = 0; k < 4; k++)
+			{
+				const float column[4] = { n[k], n[side + k], n[2 * side + k], n[3 * side + k] };
+				columns[k] = cubic(column, wy);
+			}
+
+			for (; i < end; i++)
+				row[i] = cubic(columns, weights[i - start]);
+		}
+
+		if (run >= 0)
+			_heightRows(Vector2((float)(x0 + run), (float)y), size - run, _seedOffsets, row + run);
+	}
+}
+
+/* Clamp to edge fetch from a padded chunk image */
+static inline float fetchPadded(const float *image, int32_t x, int32_t y)
+{
+	x = clamp(x, 0, CHUNK_PADDED_SIZE - 1);
+	y = clamp(y, 0, CHUNK_PADDED_SIZE - 1);
+	return image[y * CHUNK_PADDED_SIZE + x];
+}
+
+/* Heights of a size x size image starting at sample (x0, y0) */
+static void regionHeights(int32_t x0, int32_t y0, int32_t size, float *out)
+{
+	if (_adaptiveTolerance > 0.0f)
+		adaptiveHeights(x0, y0, size, out);
+	else
+	{
+		/* Kernel is picked once per row, not per sample */
+		for (int32_t j = 0; j < size; j++)
+			_heightRows(Vector2((float)x0, (float)(y0 + j)), size, _seedOffsets, out + j * size);
+	}
+}
+
+void generateHeights(int32_t x, int32_t y, float *paddedOut, half_float::half *heightmapOut, ThreadPool *pool)
+{
+	/* Padded image starts one sample before the chunk */
+	const int32_t x0 = x * CHUNK_SIZE - 1;
+	const int32_t y0 = y * CHUNK_SIZE - 1;
+
+	if (_erosion.iterations > 0)
+	{
+		/* Erode with the margin the padded image depends on, neighbouring
+		 * chunks then erode their shared border the same way */
+		const int32_t margin = erosionMargin(_erosion.iterations);
+		const int32_t size = CHUNK_PADDED_SIZE + 2 * margin;
+
+		ScratchScope scope;
+		float *region = scope.arena().alloc<float>((size_t)size * size);
+		regionHeights(x0 - margin, y0 - margin, size, region);
+		erodeHeights(region, size, _erosion, pool);
+
+		for (int32_t j = 0; j < CHUNK_PADDED_SIZE; j++)
+			memcpy(paddedOut + j * CHUNK_PADDED_SIZE, region + (j + margin) * size + margin, CHUNK_PADDED_SIZE * sizeof(float));
+	}
+	else
+		regionHeights(x0, y0, CHUNK_PADDED_SIZE, paddedOut);
+
+	for (int32_t j = 0; j < CHUNK_SIZE; j++)
+	{
+		const float *row = paddedOut + (j + 1) * CHUNK_PADDED_SIZE + 1;
+		half_float::half *out = heightmapOut + j * CHUNK_SIZE;
+		for (int32_t i = 0; i < CHUNK_SIZE; i++)
+			out[i] = row[i];
+	}
+}
+
+void blurHeights(const float *padded, float *blurredOut)
+{
+	for (int32_t j = 0; j < CHUNK_PADDED_SIZE; j++)
+	{
+		for (int32_t i = 0; i < CHUNK_PADDED_SIZE; i++)
+		{
+			float a = fetchPadded(padded, i - 1, j - 1);
+			float b = fetchPadded(padded, i, j - 1);
+			float c = fetchPadded(padded, i + 1, j - 1);
+
+			float d = fetchPadded(padded, i - 1, j);
+			float e = fetchPadded(padded, i, j);
+			float f = fetchPadded(padded, i + 1, j);
+
+			float g = fetchPadded(padded, i - 1, j + 1);
+			float h = fetchPadded(padded, i, j + 1);
+			float k = fetchPadded(padded, i + 1, j + 1);
+
+			float value = (a + c + g + k) + (b + d + f + h) * 2.0f + e * 4.0f;
+			value /= 16.0f;
+
+			blurredOut[j * CHUNK_PADDED_SIZE + i] = value;
+		}
+	}
+}
+
+void generateNormals(const float *blurred, half_float::half *normalmapOut)
+{
+	/* Only the interior is stored, the border is there for the gradient */
+	for (int32_t j = 1; j < CHUNK_PADDED_SIZE - 1; j++)
+	{
+		const int32_t joff = (j - 1) * CHUNK_SIZE;
+		for (int32_t i = 1; i < CHUNK_PADDED_SIZE - 1; i++)
+		{
+			/* Compute image gradient */
+			float gradx = (fetchPadded(blurred, i + 1, j) - fetchPadded(blurred, i - 1, j)) / 2.0f;
+			float grady = (fetchPadded(blurred, i, j + 1) - fetchPadded(blurred, i, j - 1)) / 2.0f;
+
+			/* Compute normal */
+			Vector3 normal = normalize(Vector3(-gradx, 1.0f, -grady));
+
+			/* Store normal */
+			int32_t offset = (joff + i - 1) * 3; // Offset into normalmap
+			normalmapOut[offset + 0] = normal.x;
+			normalmapOut[offset + 1] = normal.y;
+			normalmapOut[offset + 2] = normal.z;
+		}
+	}
+}
+
+/* Normal of a level from its heights, gradients are per full resolution sample
+ * like generateNormals(). Edges are clamped, levels have no border */
+static void levelNormals(const float *heights, int32_t size, float spacing, half_float::half *normalmapOut)
+{
+	for (int32_t j = 0; j < size; j++)
+	{
+		const float *row = heights + j * size;
+		const float *up = heights + max(j - 1, 0) * size;
+		const float *down = heights + min(j + 1, size - 1) * size;
+
+		for (int32_t i = 0; i < size; i++)
+		{
+			const int32_t left = max(i - 1, 0);
+			const int32_t right = min(i + 1, size - 1);
+
+			float gradx = (row[right] - row[left]) / (2.0f * spacing);
+			float grady = (down[i] - up[i]) / (2.0f * spacing);
+
+			Vector3 normal = normalize(Vector3(-gradx, 1.0f, -grady));
+
+			half_float::half *out = normalmapOut + (j * size + i) * 3;
+			out[0] = normal.x;
+			out[1] = normal.y;
+			out[2] = normal.z;
+		}
+	}
+}
+
+void generateLevels(const float *padded, half_float::half *heightmapOut, half_float::half *normalmapOut)
+{
+	/* Each level is filtered from the previous one in place, level 1 reads
+	 * the interior of the padded image */
+	ScratchScope scope;
+	float *level = scope.arena().alloc<float>((CHUNK_SIZE / 2) * (CHUNK_SIZE / 2));
+
+	const float *src = padded + CHUNK_PADDED_SIZE + 1;
+	int32_t stride = CHUNK_PADDED_SIZE;
+
+	for (int l = 1; l < CHUNK_LEVELS; l++)
+	{
+		const int32_t size = CHUNK_SIZE >> l;
+
+		half_float::half *heights = heightmapOut + mipOffset(CHUNK_SIZE, l);
+		for (int32_t j = 0; j < size; j++)
+		{
+			const float *a = src + 2 * j * stride;
+			const float *b = a + stride;
+
+			for (int32_t i = 0; i < size; i++)
+			{
+				const float value = (a[2 * i] + a[2 * i + 1] + b[2 * i] + b[2 * i + 1]) * 0.25f;
+				level[j * size + i] = value;
+				heights[j * size + i] = value;
+			}
+		}
+
+		if (normalmapOut)
+			levelNormals(level, size, (float)(1 << l), normalmapOut + mipOffset(CHUNK_SIZE, l) * 3);
+
+		src = level;
+		stride = size;
+	}
+}
+
+void generateBounds(const float *padded, HeightBounds *boundsOut)
+{
+	/* Leaves, bounds are widened by the rounding of the half heightmap */
+	const float rounding = 1.0f / 1024.0f;
+
+	for (int32_t j = 0; j < CHUNK_BOUNDS_SIZE; j++)
+	{
+		for (int32_t i = 0; i < CHUNK_BOUNDS_SIZE; i++)
+		{
+			float lo = INFINITY, hi = -INFINITY;
+			for (int32_t y = j * CHUNK_BOUNDS_LEAF; y <= (j + 1) * CHUNK_BOUNDS_LEAF; y++)
+			{
+				const float *row = padded + (y + 1) * CHUNK_PADDED_SIZE + 1;
+				for (int32_t x = i * CHUNK_BOUNDS_LEAF; x <= (i + 1) * CHUNK_BOUNDS_LEAF; x++)
+				{
+					lo = min(lo, row[x]);
+					hi = max(hi, row[x]);
+				}
+			}
+
+			HeightBounds &leaf = boundsOut[j * CHUNK_BOUNDS_SIZE + i];
+			leaf.min = lo - mutil::abs(lo) * rounding;
+			leaf.max = hi + mutil::abs(hi) * rounding;
+		}
+	}
+
+	/* Parents */
+	for (int l = 1; l < CHUNK_BOUNDS_LEVELS; l++)
+	{
+		const int32_t size = CHUNK_BOUNDS_SIZE >> l;
+		const HeightBounds *children = boundsOut + mipOffset(CHUNK_BOUNDS_SIZE, l - 1);
+		HeightBounds *nodes = boundsOut + mipOffset(CHUNK_BOUNDS_SIZE, l);
+
+		for (int32_t j = 0; j < size; j++)
+		{
+			for (int32_t i = 0; i < size; i++)
+			{
+				const HeightBounds &a = children[(2 * j) * (2 * size) + 2 * i];
+				const HeightBounds &b = children[(2 * j) * (2 * size) + 2 * i + 1];
+				const HeightBounds &c = children[(2 * j + 1) * (2 * size) + 2 * i];
+				const HeightBounds &d = children[(2 * j + 1) * (2 * size) + 2 * i + 1];
+
+				nodes[j * size + i].min = min(min(a.min, b.min), min(c.min, d.min));
+				nodes[j * size + i].max = max(max(a.max, b.max), max(c.max, d.max));
+			}
+		}
+	}
+}
+
+static_assert((CHUNK_BOUNDS_SIZE >> CHUNK_PATCH_BOUNDS_LEVEL) == CHUNK_PATCHES, "Patches must match a level of the min/max tree");
+
+void generatePatchErrors(const float *padded, float *patchErrorsOut)
+{
+	/* Patches include the samples on their far edges like the tree leaves */
+	const float *interior = padded + CHUNK_PADDED_SIZE + 1;
+	const float scale = 1.0f / CHUNK_PATCH_SIZE;
+
+	for (int32_t pj = 0; pj < CHUNK_PATCHES; pj++)
+	{
+		for (int32_t pi = 0; pi < CHUNK_PATCHES; pi++)
+		{
+			const float *corner = interior + pj * CHUNK_PATCH_SIZE * CHUNK_PADDED_SIZE + pi * CHUNK_PATCH_SIZE;
+			const float h00 = corner[0];
+			const float h10 = corner[CHUNK_PATCH_SIZE];
+			const float h01 = corner[CHUNK_PATCH_SIZE * CHUNK_PADDED_SIZE];
+			const float h11 = corner[CHUNK_PATCH_SIZE * CHUNK_PADDED_SIZE + CHUNK_PATCH_SIZE];
+
+			float error = 0.0f;
+			for (int32_t y = 0; y <= CHUNK_PATCH_SIZE; y++)
+			{
+				const float *row = corner + y * CHUNK_PADDED_SIZE;
+				const float fy = y * scale;
+				const float left = h00 + (h01 - h00) * fy;
+				const float right = h10 + (h11 - h10) * fy;
+
+				for (int32_t x = 0; x <= CHUNK_PATCH_SIZE; x++)
+				{
+					const float surface = left + (right - left) * (x * scale);
+					error = max(error, mutil::abs(row[x] - surface));
+				}
+			}
+
+			patchErrorsOut[pj * CHUNK_PATCHES + pi] = error;
+		}
+	}
+}
+
+void generateArea(int32_t x, int32_t y, half_float::half *heightmapOut, half_float::half *normalmapOut, HeightBounds *boundsOut,
+	float *patchErrorsOut, ChunkScatter *scatterOut, ThreadPool *pool)
+{
+	/* Scratch is reused by the next chunk this thread generates */
+	ScratchScope scope;
+	float *heights = scope.arena().alloc<float>(CHUNK_PADDED_SIZE_SQ);
+
+	generateHeights(x, y, heights, heightmapOut, pool);
+
+	/* Derived data is built while the heights are still in cache */
+	generateBounds(heights, boundsOut);
+	generatePatchErrors(heights, patchErrorsOut);
+	if (scatterOut)
+		generateScatter(x, y, heights, scatterOut);
+	generateLevels(heights, heightmapOut, normalmapOut);
+
+	if (normalmapOut)
+	{
+		float *blurred = scope.arena().alloc<float>(CHUNK_PADDED_SIZE_SQ);
+		blurHeights(heights, blurred);
+		generateNormals(blurred, normalmapOut);
+	}
+}
+
+// Chunk maps per pool arena, about 12 MB
+#define CHUNK_MAPS_PER_ARENA (16 / CHUNK_MAP_CHANNELS)
+
+// Bounds per pool arena, fills about 2 MB
+#define CHUNK_BOUNDS_PER_ARENA 46
+
+/* Pools are never destroyed, threads hand their cached blocks back on exit */
+
+static BlockPool *mapsPool()
+{
+	static BlockPool *pool = new BlockPool(CHUNK_MIP_SIZE * CHUNK_MAP_CHANNELS * sizeof(half_float::half), CHUNK_MAPS_PER_ARENA);
+	return pool;
+}
+
+static BlockPool *boundsPool()
+{
+	static BlockPool *pool = new BlockPool(CHUNK_BOUNDS_COUNT * sizeof(HeightBounds) + CHUNK_PATCH_COUNT * sizeof(float), CHUNK_BOUNDS_PER_ARENA);
+	return pool;
+}
+
+half_float::half *allocChunkMaps()
+{
+	return (half_float::half *)mapsPool()->alloc();
+}
+
+void freeChunkMaps(half_float::half *maps)
+{
+	mapsPool()->free(maps);
+}
+
+HeightBounds *allocChunkBounds()
+{
+	return (HeightBounds *)boundsPool()->alloc();
+}
+
+void freeChunkBounds(HeightBounds *bounds)
+{
+	boundsPool()->free(bounds);
+}
+
+uint64_t worldSignature()
+{
+	const int32_t values[] = { WORLDGEN_VERSION, CHUNK_SIZE };
+	const uint64_t graph = _worldGraph.signature();
+
+	uint64_t hash = hashBytes(&graph, sizeof(graph), hashBytes(values, sizeof(values)));
+
+	/* Props are cached with the chunk, retuning them invalidates it */
+	const int32_t scatter[] = { SCATTER_VERSION, CHUNK_SCATTER_MAX, SCATTER_KIND_COUNT };
+	hash = hashBytes(scatter, sizeof(scatter), hash);
+	for (int kind = 0; kind < SCATTER_KIND_COUNT; kind++)
+		hash = hashBytes(&getScatterLayer((ScatterKind)kind), sizeof(ScatterLayer), hash);
+
+	if (_adaptiveTolerance > 0.0f)
+	{
+		/* Exact chunks keep their signature */
+		const float adaptive[] = { _adaptiveTolerance, (float)ADAPTIVE_TILE };
+		hash = hashBytes(adaptive, sizeof(adaptive), hash);
+	}
+	if (_erosion.iterations > 0)
+	{
+		const float erosion[] = { (float)_erosion.iterations, _erosion.rain, _erosion.evaporation, _erosion.capacity,
+			_erosion.erosion, _erosion.deposition, _erosion.talus, _erosion.thermal };
+		hash = hashBytes(erosion, sizeof(erosion), hash);
+	}
+	return hash;
+}
+
+void pathForChunk(char *path, size_t size, const char *dir, int32_t x, int32_t y)
+{
+	snprintf(path, size, "%s/%d_%d", dir, x, y);
+}
+
+/* Props are stored up to their count, the ranges must be ordered and in it */
+static bool readScatter(ls_handle file, ChunkScatter *scatter)
+{
+	const size_t header = scatterBytes(0);
+	if ((size_t)ls_read(file, scatter, header) != header || scatter->count > CHUNK_SCATTER_MAX)
+		return false;
+
+	for (int kind = 0; kind < SCATTER_KIND_COUNT; kind++)
+	{
+		if (scatter->first[kind] > scatter->first[kind + 1])
+			return false;
+	}
+	if (scatter->first[0] != 0 || scatter->first[SCATTER_KIND_COUNT] != scatter->count)
+		return false;
+
+	const size_t size = scatterBytes(scatter->count) - header;
+	return (size_t)ls_read(file, scatter->instances, size) == size;
+}
+
+bool readChunk(const char *path, int32_t x, int32_t y, half_float::half *heights, half_float::half *normals, HeightBounds *bounds,
+	float *patchErrors, ChunkScatter *scatter)
+{
+	ls_handle file = ls_open(path, LS_FILE_READ, LS_SHARE_READ, LS_OPEN_EXISTING);
+	if (!file)
+		return false;
+
+	/* Reject caches from other generator versions or chunks */
+	ChunkHeader header;
+	bool ok = (size_t)ls_read(file, &header, sizeof(header)) == sizeof(header) &&
+		header.magic == CHUNK_CACHE_MAGIC &&
+		header.version == (normals ? CHUNK_CACHE_VERSION : CHUNK_CACHE_VERSION_HEIGHTS) &&
+		header.signature == worldSignature() &&
+		header.size == CHUNK_SIZE &&
+		header.x == x && header.y == y;
+
+	ok = ok && (size_t)ls_read(file, heights, CHUNK_MIP_SIZE * sizeof(half_float::half)) == CHUNK_MIP_SIZE * sizeof(half_float::half);
+	if (normals)
+		ok = ok && (size_t)ls_read(file, normals, CHUNK_MIP_SIZE * 3 * sizeof(half_float::half)) == CHUNK_MIP_SIZE * 3 * sizeof(half_float::half);
+	ok = ok && (size_t)ls_read(file, bounds, CHUNK_BOUNDS_COUNT * sizeof(HeightBounds)) == CHUNK_BOUNDS_COUNT * sizeof(HeightBounds);
+	ok = ok && (size_t)ls_read(file, patchErrors, CHUNK_PATCH_COUNT * sizeof(float)) == CHUNK_PATCH_COUNT * sizeof(float);
+	if (scatter)
+		ok = ok && readScatter(file, scatter);
+
+	ls_close(file);
+	return ok;
+}
+
+bool writeChunk(const char *path, int32_t x, int32_t y, const half_float::half *heights, const half_float::half *normals,
+	const HeightBounds *bounds, const float *patchErrors, const ChunkScatter *scatter)
+{
+	ls_handle file = ls_open(path, LS_FILE_WRITE, LS_SHARE_NONE, LS_CREATE_ALWAYS);
+	if (!file)
+		return false;
+
+	ChunkHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = CHUNK_CACHE_MAGIC;
+	header.version = normals ? CHUNK_CACHE_VERSION : CHUNK_CACHE_VERSION_HEIGHTS;
+	header.signature = worldSignature();
+	header.size = CHUNK_SIZE;
+	header.x = x;
+	header.y = y;
+
+	bool ok = (size_t)ls_write(file, &header, sizeof(header)) == sizeof(header);
+	ok = ok && (size_t)ls_write(file, heights, CHUNK_MIP_SIZE * sizeof(half_float::half)) == CHUNK_MIP_SIZE * sizeof(half_float::half);
+	if (normals)
+		ok = ok && (size_t)ls_write(file, normals, CHUNK_MIP_SIZE * 3 * sizeof(half_float::half)) == CHUNK_MIP_SIZE * 3 * sizeof(half_float::half);
+	ok = ok && (size_t)ls_write(file, bounds, CHUNK_BOUNDS_COUNT * sizeof(HeightBounds)) == CHUNK_BOUNDS_COUNT * sizeof(HeightBounds);
+	ok = ok && (size_t)ls_write(file, patchErrors, CHUNK_PATCH_COUNT * sizeof(float)) == CHUNK_PATCH_COUNT * sizeof(float);
+	if (scatter)
+		ok = ok && (size_t)ls_write(file, scatter, scatterBytes(scatter->count)) == scatterBytes(scatter->count);
+
+	ls_close(file);
+	return ok;
+}
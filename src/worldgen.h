@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <half.hpp>
+#include <mutil/mutil.h>
+
+#include "noisegraph.h"
+#include "erosion.h"
+
+using namespace mutil;
+
+struct ChunkScatter;
+
+/* Terrain generation core, no windowing or GL dependencies */
+
+// Chunk size
+#define CHUNK_SIZE 512
+#define CHUNK_SIZE_SQ (CHUNK_SIZE * CHUNK_SIZE)
+
+// Chunk size including the one sample border used by the blur and normals
+#define CHUNK_PADDED_SIZE (CHUNK_SIZE + 2)
+#define CHUNK_PADDED_SIZE_SQ (CHUNK_PADDED_SIZE * CHUNK_PADDED_SIZE)
+
+// Chunk size in world units
+#define CHUNK_WORLD_SIZE 2048
+
+// Mip levels of a chunk, level i is CHUNK_SIZE >> i samples on a side
+#define CHUNK_LEVELS 10
+
+// Samples in all levels of a chunk
+#define CHUNK_MIP_SIZE mipOffset(CHUNK_SIZE, CHUNK_LEVELS)
+
+// Side in samples of the leaves of the min/max tree
+#define CHUNK_BOUNDS_LEAF 8
+#define CHUNK_BOUNDS_SIZE (CHUNK_SIZE / CHUNK_BOUNDS_LEAF)
+
+// Levels of the min/max tree, the last is the whole chunk
+#define CHUNK_BOUNDS_LEVELS 7
+
+// Nodes in all levels of the min/max tree
+#define CHUNK_BOUNDS_COUNT mipOffset(CHUNK_BOUNDS_SIZE, CHUNK_BOUNDS_LEVELS)
+
+// Tessellation patches on a side of a chunk
+#define CHUNK_PATCHES 16
+#define CHUNK_PATCH_SIZE (CHUNK_SIZE / CHUNK_PATCHES)
+#define CHUNK_PATCH_COUNT (CHUNK_PATCHES * CHUNK_PATCHES)
+
+// Level of the min/max tree with a node per patch
+#define CHUNK_PATCH_BOUNDS_LEVEL 2
+
+#define TERRAIN_CACHE_DIR ".tcache"
+
+// Noise graph the world is generated from
+#define WORLD_GRAPH_FILE "assets/worlds/default.graph"
+
+// Side of the tiles adaptive generation interpolates, divides CHUNK_SIZE
+#define ADAPTIVE_TILE 8
+
+/* Default interpolation error adaptive generation accepts, in height units.
+ * Off, the error is only bounded empirically and per graph, so lossy chunks
+ * are opt in through bake and bench -e */
+#define ADAPTIVE_TOLERANCE 0.0f
+
+// Default erosion iterations per chunk, off
+#define EROSION_ITERATIONS 0
+
+/* Derive terrain normals from the heights in the terrain shader. Chunks then
+ * have no normalmap to generate, keep or cache */
+#ifndef TERRAIN_DERIVED_NORMALS
+#define TERRAIN_DERIVED_NORMALS 0
+#endif
+
+// Halfs per sample in a chunk maps block, the height and maybe a normal
+#define CHUNK_MAP_CHANNELS (TERRAIN_DERIVED_NORMALS ? 1 : 4)
+
+// Offset of a level in a buffer holding every level of a square image
+constexpr size_t mipOffset(size_t size, int level)
+{
+	return level <= 0 ? 0 : mipOffset(size, level - 1) + (size >> (level - 1)) * (size >> (level - 1));
+}
+
+/* Heights a min/max tree node covers. A leaf includes the samples on its
+ * far edges, so it bounds every bilinear cell inside it */
+struct HeightBounds
+{
+	float min, max;
+};
+
+// Compile the noise graph used by computeHeight, not safe while generating
+bool loadWorldGraph(const char *path);
+
+const NoiseProgram &getWorldGraph();
+
+// Name of the compiled preset computeHeight runs, "graph" if interpreted
+const char *getHeightKernel();
+
+// Height at a position in heightmap samples
+float computeHeight(const Vector2 &p);
+
+/* Smooth tiles of a chunk are interpolated from a coarse grid as long as the
+ * estimated error stays within tolerance, 0 evaluates every sample. Not safe
+ * while generating */
+void setAdaptiveTolerance(float tolerance);
+float getAdaptiveTolerance();
+
+/* Erode the heights of every chunk, 0 iterations disables it. Chunks generate
+ * and erode erosionMargin(iterations) more samples around them so seams match.
+ * Not safe while generating */
+void setErosion(const ErosionSettings &settings);
+const ErosionSettings &getErosion();
+
+/* Generate chunk (x, y). The heightmap and normalmap hold CHUNK_LEVELS levels,
+ * CHUNK_MIP_SIZE samples, the tree CHUNK_BOUNDS_COUNT nodes, finest first,
+ * the patch errors CHUNK_PATCH_COUNT. A null normalmap skips the normals, a
+ * null scatter the props. A pool splits erosion across its threads */
+void generateArea(int32_t x, int32_t y, half_float::half *heightmapOut, half_float::half *normalmapOut, HeightBounds *boundsOut,
+	float *patchErrorsOut, ChunkScatter *scatterOut, ThreadPool *pool = nullptr);
+
+/* Passes of generateArea, padded images are CHUNK_PADDED_SIZE_SQ floats */
+
+void generateHeights(int32_t x, int32_t y, float *paddedOut, half_float::half *heightmapOut, ThreadPool *pool = nullptr);
+void blurHeights(const float *padded, float *blurredOut);
+void generateNormals(const float *blurred, half_float::half *normalmapOut);
+
+// Levels 1 and up of the heightmap and normalmap if any, box filtered from the heights
+void generateLevels(const float *padded, half_float::half *heightmapOut, half_float::half *normalmapOut);
+
+void generateBounds(const float *padded, HeightBounds *boundsOut);
+
+/* Largest distance of the samples of each patch from the bilinear surface
+ * through its corners, how far the untessellated patch is off. Row major */
+void generatePatchErrors(const float *padded, float *patchErrorsOut);
+
+/* Chunk buffers from shared block pools, nullptr when out of memory. A maps
+ * block holds the CHUNK_MIP_SIZE heightmap followed by the normalmap, unless
+ * normals are derived. Bounds have their own blocks, they outlive the maps.
+ * A bounds block holds the tree followed by the patch errors */
+half_float::half *allocChunkMaps();
+void freeChunkMaps(half_float::half *maps);
+
+HeightBounds *allocChunkBounds();
+void freeChunkBounds(HeightBounds *bounds);
+
+// Identifies the generator output, cached chunks with another signature are stale
+uint64_t worldSignature();
+
+void pathForChunk(char *path, size_t size, const char *dir, int32_t x, int32_t y);
+
+/* Read a cached chunk, fails if missing, truncated or stale. Chunks cached
+ * without normals are read and written with null normals. A null scatter
+ * skips the props, which come last, so a chunk written without them fails
+ * to read with them */
+bool readChunk(const char *path, int32_t x, int32_t y, half_float::half *heights, half_float::half *normals, HeightBounds *bounds,
+	float *patchErrors, ChunkScatter *scatter);
+
+bool writeChunk(const char *path, int32_t x, int32_t y, const half_float::half *heights, const half_float::half *normals,
+	const HeightBounds *bounds, const float *patchErrors, const ChunkScatter *scatter);